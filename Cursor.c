@@ -7,9 +7,17 @@
 //
 
 #include "Cursor.h"
+#include "Doc.h"
+#include "Marks.h"
+#include "Utf8.h"
 
-void cursorCopy(cursor_t *dst, cursor_t *src) {
+// copies the position only; dst keeps its own mark
+void cursorCopy(cursor_t *dst, cursor_t *src, doc_t *doc) {
+  int mark = dst->mark;
   myMemcpy(dst, src, sizeof(cursor_t));
+  dst->mark = mark;
+  if (mark)
+    markSet(&doc->marks, mark, dst->offset);
 }
 
 void cursorInit(cursor_t *c) { myMemset(c, 0, sizeof(cursor_t)); }
@@ -33,14 +41,31 @@ void cursorSetOffsetString(cursor_t *cursor, int offset, char *s0, int len) {
 
   cursor->offset = offset;
   cursor->row = row;
-  int col = (int)(s - nl);
+  int col = (int)utf8Columns(nl, s - nl);
   cursor->column = col;
   cursor->preferredColumn = col;
 }
 
-void cursorSetOffset(cursor_t *cursor, int offset, doc_t *doc) {
-  cursorSetOffsetString(cursor, offset, doc->contents.start,
-                        doc->contents.numElems);
+void cursorSetOffset(cursor_t *cursor, int64_t offset, doc_t *doc) {
+  offset = clamp(0, offset, docLength(doc));
+  int64_t row = docRowOf(doc, offset);
+
+  cursor->offset = offset;
+  cursor->row = row;
+  int64_t sol = docLineStart(doc, row);
+  cursor->column = docColumns(doc, sol, offset - sol);
+  cursor->preferredColumn = cursor->column;
+  if (cursor->mark)
+    markSet(&doc->marks, cursor->mark, offset);
+}
+
+// follows the cursor's mark after an edit
+void cursorSync(cursor_t *cursor, doc_t *doc) {
+  if (!cursor->mark)
+    return;
+  int64_t offset = markOffset(&doc->marks, cursor->mark);
+  if (offset != cursor->offset)
+    cursorSetOffset(cursor, offset, doc);
 }
 
 void cursorSetRowColString(cursor_t *cursor, int row0, int col0, char *s0,
@@ -59,25 +84,38 @@ void cursorSetRowColString(cursor_t *cursor, int row0, int col0, char *s0,
     s++;
   }
   s = min(eof, lastEOL + 1);
-  char *done = min(eof, s + col0);
-  while (s < done && *s != '\n') {
-    s++;
+  char *eol = s;
+  while (eol < eof && *eol != '\n') {
+    eol++;
   }
+  int64_t col = max(0, col0);
+  s += utf8ColumnOffset(s, eol - s, &col);
 
   cursor->offset = (int)(s - s0);
   cursor->row = row;
-  int col = (int)(s - lastEOL - 1);
   cursor->column = col;
   cursor->preferredColumn = col;
 }
 
-void cursorSetRowCol(cursor_t *cursor, int row, int col, doc_t *doc) {
-  cursorSetRowColString(cursor, row, col, doc->contents.start,
-                        doc->contents.numElems);
+void cursorSetRowCol(cursor_t *cursor, int64_t row, int64_t col, doc_t *doc) {
+  row = clamp(0, row, docNumLines(doc));
+  int64_t sol = docLineStart(doc, row);
+  col = max(0, col);
+  int64_t offset = docColumnOffset(doc, sol, docLineEnd(doc, row), &col);
+
+  cursor->offset = offset;
+  cursor->row = row;
+  cursor->column = col;
+  cursor->preferredColumn = cursor->column;
+  if (cursor->mark)
+    markSet(&doc->marks, cursor->mark, offset);
 }
 
 void cursorTest() {
   cursor_t cursor;
+  cursorInit(&cursor);
+  doc_t doc;
+  docInit(&doc, "", false, false);
 
   typedef struct {
     int offset;
@@ -102,6 +140,11 @@ void cursorTest() {
       {99, "kdkd\n\nkdkd\ndd", 13, 3, 2},
       {5, "kdkd\n\nkdkd\ndd", 5, 1, 0},
       {10, "kdkd\n\nkdkd\ndd", 10, 2, 4},
+
+      // columns count characters, not bytes
+      {3, "\xc3\xa9t\xc3\xa9", 3, 0, 2},
+      {9, "a\n\xe2\x82\xac\xf0\x9f\x98\x80" "b", 9, 1, 2},
+      {3, "\xff\xc3x", 3, 0, 3},
   };
 
   for (int i = 0; i < sizeof(test) / sizeof(ctTest_t); ++i) {
@@ -116,6 +159,18 @@ void cursorTest() {
     assert(cursor.offset == test[i].expectedOffset);
     assert(cursor.row == test[i].expectedRow);
     assert(cursor.column == test[i].expectedCol);
+
+    // same again through the document line index
+    docReinit(&doc);
+    docInsert(&doc, 0, test[i].s, (int)strlen(test[i].s));
+    cursorSetOffset(&cursor, test[i].offset, &doc);
+    assert(cursor.offset == test[i].expectedOffset);
+    assert(cursor.row == test[i].expectedRow);
+    assert(cursor.column == test[i].expectedCol);
+    cursorSetRowCol(&cursor, test[i].expectedRow, test[i].expectedCol, &doc);
+    assert(cursor.offset == test[i].expectedOffset);
+    assert(cursor.row == test[i].expectedRow);
+    assert(cursor.column == test[i].expectedCol);
   }
 
   typedef struct {
@@ -132,6 +187,8 @@ void cursorTest() {
       {55, 0, "kdkd\n\nkdkd\ndd", 11, 3, 0},
       {2, 55, "kdkd\n\nkdkd\ndd", 10, 2, 4},
       {3, 55, "kdkd\n\nkdkd\ndd\n", 13, 3, 2},
+      {0, 1, "\xc3\xa9t\xc3\xa9", 2, 0, 1},
+      {1, 9, "a\n\xe2\x82\xac\xf0\x9f\x98\x80" "b\n", 10, 1, 3},
   };
 
   for (int i = 0; i < sizeof(test2) / sizeof(ctTest2_t); ++i) {
@@ -145,5 +202,18 @@ void cursorTest() {
     assert(cursor.offset == test2[i].expectedOffset);
     assert(cursor.row == test2[i].expectedRow);
     assert(cursor.column == test2[i].expectedCol);
+
+    docReinit(&doc);
+    docInsert(&doc, 0, test2[i].s, (int)strlen(test2[i].s));
+    cursorSetRowCol(&cursor, test2[i].row, test2[i].col, &doc);
+    assert(cursor.offset == test2[i].expectedOffset);
+    assert(cursor.row == test2[i].expectedRow);
+    assert(cursor.column == test2[i].expectedCol);
+    cursorSetOffset(&cursor, test2[i].expectedOffset, &doc);
+    assert(cursor.offset == test2[i].expectedOffset);
+    assert(cursor.row == test2[i].expectedRow);
+    assert(cursor.column == test2[i].expectedCol);
   }
+
+  docReinit(&doc);
 }
@@ -10,12 +10,13 @@
 #define Cursor_h
 
 #include "Util.h"
-void cursorCopy(cursor_t *dst, cursor_t *src);
+void cursorCopy(cursor_t *dst, cursor_t *src, doc_t *doc);
 void cursorInit(cursor_t *c);
 void cursorSetOffsetString(cursor_t *cursor, int offset, char *s0, int len);
-void cursorSetOffset(cursor_t *cursor, int offset, doc_t *doc);
+void cursorSetOffset(cursor_t *cursor, int64_t offset, doc_t *doc);
 void cursorSetRowColString(cursor_t *cursor, int row0, int col0, char *s0,
                            int len);
-void cursorSetRowCol(cursor_t *cursor, int row, int col, doc_t *doc);
+void cursorSetRowCol(cursor_t *cursor, int64_t row, int64_t col, doc_t *doc);
+void cursorSync(cursor_t *cursor, doc_t *doc);
 
 #endif /* Cursor_h */
@@ -7,39 +7,259 @@
 //
 
 #include "Doc.h"
+#include "Cursor.h"
 #include "DynamicArray.h"
+#include "Journal.h"
+#include "Marks.h"
+#include "Parse.h"
+#include "PieceTable.h"
+#include "Stats.h"
+#include "Syntax.h"
+#include "Utf8.h"
+#include <unistd.h>
 
-int docDelete(doc_t *doc, int offset, int len) {
-  int n = numLinesString(arrayElemAt(&doc->contents, offset), len);
-  docIncNumLines(doc, -n);
+static int64_t mapDelete(int64_t p, int64_t offset, int64_t len) {
+  return p <= offset ? p : max(offset, p - len);
+}
+
+// keeps the ranges of text that changed since the search results were found
+// in step with an edit, so only they need searching again
+static void searchEditsNote(doc_t *doc, commandTag_t tag, int64_t offset,
+                            int64_t len) {
+  if (!doc->searchString)
+    return;
+  dynamicArray_t *edits = &doc->searchEdits;
+  searchEdit_t edit = {offset, tag == INSERT ? offset + len : offset};
+  int64_t i = 0;
+  while (i < edits->numElems) {
+    searchEdit_t *e = arrayElemAt(edits, i);
+    if (tag == INSERT) {
+      e->start += e->start > offset ? len : 0;
+      e->end += e->end >= offset ? len : 0;
+    } else {
+      e->start = mapDelete(e->start, offset, len);
+      e->end = mapDelete(e->end, offset, len);
+    }
+    if (e->start <= edit.end && e->end >= edit.start) {
+      // take it into the new one
+      edit.start = min(edit.start, e->start);
+      edit.end = max(edit.end, e->end);
+      *e = *(searchEdit_t *)arrayPop(edits);
+      continue;
+    }
+    i++;
+  }
+  if (edits->numElems >= MAX_SEARCH_EDITS) {
+    for (i = 0; i < edits->numElems; ++i) {
+      searchEdit_t *e = arrayElemAt(edits, i);
+      edit.start = min(edit.start, e->start);
+      edit.end = max(edit.end, e->end);
+    }
+    arrayReinit(edits);
+  }
+  arrayPush(edits, &edit);
+}
+
+int64_t docDelete(doc_t *doc, int64_t offset, int64_t len) {
   doc->modified = true;
-  return arrayDelete(&doc->contents, offset, len);
+  int64_t row = docRowOf(doc, offset);
+  int64_t lines = docNumLines(doc);
+  len = pieceTableDelete(&doc->contents, offset, len);
+  syntaxCacheEdit(&doc->syntax, row, docNumLines(doc) - lines);
+  parserEdit(&doc->parser, DELETE, offset, len);
+  marksDelete(&doc->marks, offset, len);
+  searchEditsNote(doc, DELETE, offset, len);
+  journalAppend(&doc->journal, DELETE, offset, NULL, len);
+  return len;
 }
 
-void docInsert(doc_t *doc, int offset, char *s, int len) {
-  int n = numLinesString(s, len);
-  docIncNumLines(doc, n);
+void docInsert(doc_t *doc, int64_t offset, char *s, int64_t len) {
   doc->modified = true;
-  arrayInsert(&doc->contents, offset, s, len);
+  int64_t row = docRowOf(doc, offset);
+  int64_t lines = docNumLines(doc);
+  pieceTableInsert(&doc->contents, offset, s, len);
+  syntaxCacheEdit(&doc->syntax, row, docNumLines(doc) - lines);
+  parserEdit(&doc->parser, INSERT, offset, len);
+  marksInsert(&doc->marks, offset, len);
+  searchEditsNote(doc, INSERT, offset, len);
+  journalAppend(&doc->journal, INSERT, offset, s, len);
+}
+
+// applies a batch of edits in one pass (see pieceTableApply).  Delete
+// lengths must already be in range.
+void docApply(doc_t *doc, command_t *cmds, int64_t n) {
+  doc->modified = true;
+  if (n > 0)
+    syntaxCacheTruncate(&doc->syntax, docRowOf(doc, cmds[0].offset));
+  pieceTableApply(&doc->contents, cmds, n);
+  // the marks and the journal see the edits one at a time, first to last
+  int64_t shift = 0;
+  for (int64_t i = 0; i < n; ++i) {
+    command_t *cmd = &cmds[i];
+    int64_t offset = cmd->offset + shift;
+    if (cmd->tag == INSERT) {
+      marksInsert(&doc->marks, offset, cmd->len);
+      parserEdit(&doc->parser, INSERT, offset, cmd->len);
+      searchEditsNote(doc, INSERT, offset, cmd->len);
+      journalAppend(&doc->journal, INSERT, offset, cmd->start, cmd->len);
+      shift += cmd->len;
+    } else {
+      marksDelete(&doc->marks, offset, cmd->len);
+      parserEdit(&doc->parser, DELETE, offset, cmd->len);
+      searchEditsNote(doc, DELETE, offset, cmd->len);
+      journalAppend(&doc->journal, DELETE, offset, NULL, cmd->len);
+      shift -= cmd->len;
+    }
+  }
+}
+
+int64_t docLength(doc_t *doc) { return pieceTableLength(&doc->contents); }
+
+char *docSpan(doc_t *doc, int64_t offset, int *len) {
+  return pieceTableSpan(&doc->contents, offset, len);
+}
+
+char docCharAt(doc_t *doc, int64_t offset) {
+  int n;
+  if (offset < 0)
+    return '\0';
+  char *s = docSpan(doc, offset, &n);
+  return s ? *s : '\0';
+}
+
+void docCopy(doc_t *doc, int64_t offset, int64_t len, char *dst) {
+  pieceTableCopy(&doc->contents, offset, len, dst);
+}
+
+// bytes of the character at offset, which can straddle two pieces.  A byte
+// that isn't part of a valid UTF-8 character is a character of its own.
+int docCharLen(doc_t *doc, int64_t offset) {
+  int n;
+  char *s = docSpan(doc, offset, &n);
+  if (!s)
+    return 0;
+  if ((uchar)*s < 0x80)
+    return 1;
+  char buf[4];
+  n = min(4, docLength(doc) - offset);
+  docCopy(doc, offset, n, buf);
+  return utf8CharLen(buf, n);
+}
+
+int64_t docNextChar(doc_t *doc, int64_t offset) {
+  return offset + docCharLen(doc, offset);
+}
+
+// start of the character that ends at offset
+int64_t docPrevChar(doc_t *doc, int64_t offset) {
+  if (offset <= 0)
+    return 0;
+  for (int i = min(4, offset); i > 1; --i) {
+    if (docNextChar(doc, offset - i) == offset)
+      return offset - i;
+  }
+  return offset - 1;
+}
+
+// number of characters from offset to offset + len
+int64_t docColumns(doc_t *doc, int64_t offset, int64_t len) {
+  int64_t end = offset + len;
+  int64_t cols = 0;
+  while (offset < end) {
+    int n;
+    char *s = docSpan(doc, offset, &n);
+    if (!s)
+      break;
+    int64_t m = utf8CompleteLen(s, min(n, end - offset));
+    if (m == 0) { // the character continues in the next piece
+      offset += docCharLen(doc, offset);
+      cols++;
+      continue;
+    }
+    cols += utf8Columns(s, m);
+    offset += m;
+  }
+  return cols;
+}
+
+// offset of column *col in the line from sol to eol (or eol if the line is
+// shorter).  *col is set to the column reached.
+int64_t docColumnOffset(doc_t *doc, int64_t sol, int64_t eol, int64_t *col) {
+  int64_t want = *col;
+  int64_t offset = sol;
+  int64_t cols = 0;
+  while (offset < eol && cols < want) {
+    int n;
+    char *s = docSpan(doc, offset, &n);
+    int64_t m = utf8CompleteLen(s, min(n, eol - offset));
+    if (m == 0) {
+      offset += docCharLen(doc, offset);
+      cols++;
+      continue;
+    }
+    int64_t k = want - cols;
+    offset += utf8ColumnOffset(s, m, &k);
+    cols += k;
+  }
+  *col = cols;
+  return offset;
+}
+
+int64_t docCountLines(doc_t *doc, int64_t offset, int64_t len) {
+  return pieceTableNumLines(&doc->contents, offset, len);
+}
+
+int64_t docRowOf(doc_t *doc, int64_t offset) {
+  return pieceTableRowOf(&doc->contents, offset);
+}
+
+int64_t docLineStart(doc_t *doc, int64_t row) {
+  return pieceTableLineStart(&doc->contents, row);
+}
+
+// offset of the newline ending row (or the end of file)
+int64_t docLineEnd(doc_t *doc, int64_t row) {
+  if (row >= docNumLines(doc))
+    return docLength(doc);
+  return docLineStart(doc, row + 1) - 1;
 }
 
+char *docCString(doc_t *doc) { return pieceTableCString(&doc->contents); }
+
+// a consistent read-only view for background work (see pieceTableSnapshot)
+void docSnapshot(doc_t *doc, snapshot_t *snap) {
+  pieceTableSnapshot(&doc->contents, snap);
+}
+
+// changes with every edit so results computed from a snapshot can be checked
+// for staleness
+uint64_t docGeneration(doc_t *doc) { return doc->contents.generation; }
+
 void docWrite(doc_t *doc) {
   if (DEMO_MODE)
     return;
-  if (!doc->modified)
+  if (!doc->modified) {
+    journalReset(&doc->journal, cstringOf(&doc->filepath));
     return;
+  }
   FILE *fp = fopen(cstringOf(&doc->filepath), "w");
   if (!fp)
     die("unable to open file for write");
 
-  if (fwrite(doc->contents.start, sizeof(char), doc->contents.numElems, fp) !=
-      doc->contents.numElems)
-    die("unable to write file");
+  int64_t offset = 0;
+  int len;
+  char *s;
+  while ((s = docSpan(doc, offset, &len))) {
+    if (fwrite(s, sizeof(char), len, fp) != len)
+      die("unable to write file");
+    offset += len;
+  }
 
   if (fclose(fp) != 0)
     die("unable to close file");
 
   doc->modified = false;
+  journalReset(&doc->journal, cstringOf(&doc->filepath));
 }
 
 void docInit(doc_t *doc, char *filepath, bool isUserDoc, bool isReadOnly) {
@@ -47,10 +267,44 @@ void docInit(doc_t *doc, char *filepath, bool isUserDoc, bool isReadOnly) {
   doc->isUserDoc = isUserDoc;
   doc->isReadOnly = isReadOnly;
   arrayInit(&doc->filepath, sizeof(char));
+  arraySetGrowth(&doc->filepath, GROW_EXACT);
   arrayInsert(&doc->filepath, 0, filepath, strlen(filepath));
-  arrayInit(&doc->contents, sizeof(char));
+  pieceTableInit(&doc->contents);
   arrayInit(&doc->undoStack, sizeof(command_t));
-  arrayInit(&doc->searchResults, sizeof(int));
+  arenaInit(&doc->undoArena);
+  doc->undoLimit = UNDO_MEMORY_LIMIT;
+  journalInit(&doc->journal);
+  marksInit(&doc->marks);
+  arrayInit(&doc->searchResults, sizeof(searchResult_t));
+  arrayInit(&doc->searchEdits, sizeof(searchEdit_t));
+  syntaxCacheInit(&doc->syntax, filepath);
+  parserInit(&doc->parser, doc->syntax.language);
+}
+
+// frees what doc holds (but not doc itself)
+void docFree(doc_t *doc) {
+  arrayFree(&doc->filepath);
+  pieceTableFree(&doc->contents);
+  arrayFree(&doc->undoStack);
+  arenaFree(&doc->undoArena);
+  journalFree(&doc->journal);
+  marksFree(&doc->marks);
+  arrayFree(&doc->searchResults);
+  free(doc->searchString);
+  arrayFree(&doc->searchEdits);
+  syntaxCacheFree(&doc->syntax);
+  parserFree(&doc->parser);
+}
+
+void docReinit(doc_t *doc) {
+  marksDelete(&doc->marks, 0, docLength(doc));
+  pieceTableReinit(&doc->contents);
+  syntaxCacheReset(&doc->syntax);
+  parserReset(&doc->parser);
+  // the search results are no longer worth keeping up to date
+  free(doc->searchString);
+  doc->searchString = NULL;
+  arrayReinit(&doc->searchEdits);
 }
 
 void docRead(doc_t *doc) {
@@ -65,25 +319,92 @@ void docRead(doc_t *doc) {
   if (fstat(fileno(fp), &stat) != 0)
     die("unable to get file size");
 
-  doc->contents.numElems = (int)stat.st_size;
-  arrayGrow(&doc->contents,
-            clamp(4096, 2 * doc->contents.numElems, INT_MAX - 1));
+  int64_t len = stat.st_size;
+  char *buf = dieIfNull(malloc(len + 1));
 
-  if (fread(doc->contents.start, sizeof(char), stat.st_size, fp) !=
-      stat.st_size)
+  if (fread(buf, sizeof(char), len, fp) != len)
     die("unable to read in file");
 
   if (fclose(fp) != 0)
     die("unable to close file");
 
-  docIncNumLines(doc,
-                 numLinesString(doc->contents.start, doc->contents.numElems));
+  pieceTableLoad(&doc->contents, buf, len);
+  if (doc->isUserDoc && !DEMO_MODE)
+    doc->modified = journalOpen(&doc->journal, cstringOf(&doc->filepath),
+                                &stat, &doc->contents);
+  // after the journal's edits (if any) are replayed
+  syntaxCacheReset(&doc->syntax);
+  syntaxCacheFill(doc);
+  parserReset(&doc->parser);
 }
-int docNumLines(doc_t *doc) {
-  assert(doc->numLines >= 0);
-  return doc->numLines;
+// line, word and character counts and the longest line, kept up to date by
+// the piece table so they are free to read
+textStats_t *docStats(doc_t *doc) { return pieceTableStats(&doc->contents); }
+
+int64_t docLongestLine(doc_t *doc) { return statsLongestLine(docStats(doc)); }
+
+int64_t docNumLines(doc_t *doc) {
+  return docStats(doc)->numLines;
 }
-void docIncNumLines(doc_t *doc, int n) {
-  doc->numLines += n;
-  assert(doc->numLines >= 0);
+
+// synthesizes a file bigger than 2GB and checks that offsets past INT_MAX
+// load, index and search correctly
+void docTest() {
+  char *filepath = "/tmp/ceditor-docTest.txt";
+  char line[] = "the quick brown fox jumps over the lazy dog 0123456789abcdefg\n";
+  int lineLen = sizeof(line) - 1;
+  char *needle = "needle in a haystack";
+  char buf[65536];
+
+  for (int i = 0; i + lineLen <= sizeof(buf); i += lineLen) {
+    myMemcpy(buf + i, line, lineLen);
+  }
+  int bufLen = sizeof(buf) / lineLen * lineLen;
+
+  FILE *fp = dieIfNull(fopen(filepath, "w"));
+  int64_t numLines = 0;
+  int64_t len = 0;
+  while (len <= (int64_t)INT_MAX + bufLen) {
+    if (fwrite(buf, sizeof(char), bufLen, fp) != bufLen)
+      die("unable to write test file");
+    len += bufLen;
+    numLines += bufLen / lineLen;
+  }
+  fprintf(fp, "%s", needle);
+  if (fclose(fp) != 0)
+    die("unable to close test file");
+  int64_t needleOffset = len;
+  len += strlen(needle);
+
+  doc_t doc;
+  docInit(&doc, filepath, true, false);
+  docRead(&doc);
+  assert(docLength(&doc) == len);
+  assert(docNumLines(&doc) == numLines);
+
+  cursor_t cursor;
+  cursorInit(&cursor);
+  cursorSetOffset(&cursor, needleOffset + 7, &doc);
+  assert(cursor.row == numLines);
+  assert(cursor.column == 7);
+  cursorSetRowCol(&cursor, numLines - 1, 4, &doc);
+  assert(cursor.offset == needleOffset - lineLen + 4);
+  assert(docLineStart(&doc, numLines) == needleOffset);
+
+  char *s = docCString(&doc);
+  char *p = strstr(s + needleOffset - 2 * lineLen, needle);
+  assert(p && p - s == needleOffset);
+
+  docInsert(&doc, needleOffset, "\n", 1);
+  assert(docNumLines(&doc) == numLines + 1);
+  assert(docCharAt(&doc, needleOffset + 1) == needle[0]);
+  assert(docDelete(&doc, needleOffset, 1) == 1);
+  assert(docLength(&doc) == len);
+  uint64_t generation = docGeneration(&doc);
+  s = docCString(&doc); // compacts the edited doc, which isn't an edit
+  assert(docGeneration(&doc) == generation);
+  assert(strcmp(s + needleOffset, needle) == 0);
+
+  docReinit(&doc);
+  unlink(filepath);
 }
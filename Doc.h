@@ -11,16 +11,36 @@
 
 #include "Util.h"
 
-int docDelete(doc_t *doc, int offset, int len); // BAL: update cursors?
-void docInsert(doc_t *doc, int offset, char *s, int len);
+int64_t docDelete(doc_t *doc, int64_t offset, int64_t len);
+void docInsert(doc_t *doc, int64_t offset, char *s, int64_t len);
+void docApply(doc_t *doc, command_t *cmds, int64_t n);
 void docWrite(doc_t *doc);
 void docInit(doc_t *doc, char *filepath, bool isUserDoc, bool isReadOnly);
+void docReinit(doc_t *doc);
+void docFree(doc_t *doc);
 void docRead(doc_t *doc);
 char *docCString(doc_t *doc);
-void docPushInsert(doc_t *doc, int offset, char *s, int len);
-int docPushDelete(doc_t *doc, int offset, int len);
+void docSnapshot(doc_t *doc, snapshot_t *snap);
+uint64_t docGeneration(doc_t *doc);
+int64_t docLength(doc_t *doc);
+char *docSpan(doc_t *doc, int64_t offset, int *len);
+char docCharAt(doc_t *doc, int64_t offset);
+void docCopy(doc_t *doc, int64_t offset, int64_t len, char *dst);
+int docCharLen(doc_t *doc, int64_t offset);
+int64_t docNextChar(doc_t *doc, int64_t offset);
+int64_t docPrevChar(doc_t *doc, int64_t offset);
+int64_t docColumns(doc_t *doc, int64_t offset, int64_t len);
+int64_t docColumnOffset(doc_t *doc, int64_t sol, int64_t eol, int64_t *col);
+int64_t docCountLines(doc_t *doc, int64_t offset, int64_t len);
+int64_t docRowOf(doc_t *doc, int64_t offset);
+int64_t docLineStart(doc_t *doc, int64_t row);
+int64_t docLineEnd(doc_t *doc, int64_t row);
+void docPushInsert(doc_t *doc, int64_t offset, char *s, int64_t len);
+int64_t docPushDelete(doc_t *doc, int64_t offset, int64_t len);
+void docPushBatch(doc_t *doc, command_t *cmds, int64_t n);
 void docMakeAll(void);
-int docNumLines(doc_t *doc);
-void docIncNumLines(doc_t *doc, int n);
+int64_t docNumLines(doc_t *doc);
+textStats_t *docStats(doc_t *doc);
+int64_t docLongestLine(doc_t *doc);
 
 #endif /* Doc_h */
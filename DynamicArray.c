@@ -8,11 +8,15 @@
 
 #include "DynamicArray.h"
 
-int arrayMaxSize(dynamicArray_t *arr) {
+#define MAX_GROW_STEP (64 << 20)
+#define MIN_ARENA_CHUNK_SIZE 1024
+#define MAX_ARENA_CHUNK_SIZE 65536
+
+int64_t arrayMaxSize(dynamicArray_t *arr) {
   return arr->elemSize * arr->maxElems;
 }
 
-void arrayGrow(dynamicArray_t *arr, int maxElems) {
+void arrayGrow(dynamicArray_t *arr, int64_t maxElems) {
   assert(arr);
   assert(maxElems >= 1);
   assert(arr->elemSize > 0);
@@ -22,11 +26,16 @@ void arrayGrow(dynamicArray_t *arr, int maxElems) {
       return;
     }
 
-  int n = max(maxElems, arr->maxElems * 2);
+  int64_t n = maxElems;
+  if (arr->growth == GROW_GEOMETRIC) {
+    // doubling a huge buffer would leave most of it unused
+    int64_t step = min(arr->maxElems, MAX_GROW_STEP / arr->elemSize);
+    n = max(n, arr->maxElems + step);
+  }
 
-  int oldSize = arrayMaxSize(arr);
+  int64_t oldSize = arrayMaxSize(arr);
 
-  int sz = arr->elemSize * n;
+  int64_t sz = arr->elemSize * n;
 
   arr->start = dieIfNull(realloc(arr->start, sz));
   // don't need to zero memory myMemset(arr->start + oldSize, 0, sz - oldSize);
@@ -34,6 +43,25 @@ void arrayGrow(dynamicArray_t *arr, int maxElems) {
   arr->maxElems = n;
 }
 
+void arraySetGrowth(dynamicArray_t *arr, growthPolicy_t growth) {
+  arr->growth = growth;
+}
+
+// give back the unused capacity
+void arrayShrinkToFit(dynamicArray_t *arr) {
+  assert(arr);
+  if (arr->maxElems == arr->numElems)
+    return;
+  if (arr->numElems == 0) {
+    free(arr->start);
+    arr->start = NULL;
+    arr->maxElems = 0;
+    return;
+  }
+  arr->start = dieIfNull(realloc(arr->start, arr->elemSize * arr->numElems));
+  arr->maxElems = arr->numElems;
+}
+
 void arrayReinit(dynamicArray_t *arr) {
   assert(arr);
   arr->offset = 0;
@@ -47,7 +75,7 @@ void arrayInit(dynamicArray_t *arr, int elemSize) {
 
 #define elemAt(arr, i) ((arr)->start + ((i) * (arr)->elemSize))
 
-void *arrayElemAt(dynamicArray_t *arr, int i) {
+void *arrayElemAt(dynamicArray_t *arr, int64_t i) {
   assert(arr);
   assert(arr->start);
   assert(i >= 0);
@@ -69,9 +97,9 @@ bool arrayAtTop(dynamicArray_t *arr) {
   return arr->offset == arr->numElems;
 }
 
-int arrayDelete(dynamicArray_t *arr, int offset, int len0) {
+int64_t arrayDelete(dynamicArray_t *arr, int64_t offset, int64_t len0) {
   assert(arr);
-  int len = min(len0, arr->numElems - offset);
+  int64_t len = min(len0, arr->numElems - offset);
 
   void *p = arrayElemAt(arr, offset);
   void *q = p + len * arr->elemSize;
@@ -82,14 +110,14 @@ int arrayDelete(dynamicArray_t *arr, int offset, int len0) {
   return len;
 }
 
-void arrayInsert(dynamicArray_t *arr, int offset, void *s, int len) {
+void arrayInsert(dynamicArray_t *arr, int64_t offset, void *s, int64_t len) {
   assert(arr);
   if (len <= 0) return;
-  int n = arr->numElems + len;
+  int64_t n = arr->numElems + len;
   if (n > arr->maxElems)
     arrayGrow(arr, n);
 
-  int sz = len * arr->elemSize;
+  int64_t sz = len * arr->elemSize;
   void *top = arrayTop(arr); // needs to be before numElems is changed
 
   arr->numElems = n; // needs to be before call to arrayElemAt
@@ -115,7 +143,7 @@ void *arrayPushUninit(dynamicArray_t *arr) {
 void arrayPush(dynamicArray_t *arr, void *elem) {
   assert(arr);
   assert(elem);
-  myMemcpy(arrayPushUninit(arr), elem, sizeof(arr->elemSize));
+  myMemcpy(arrayPushUninit(arr), elem, arr->elemSize);
 }
 
 void *arrayPop(dynamicArray_t *arr) {
@@ -126,7 +154,7 @@ void *arrayPop(dynamicArray_t *arr) {
   return arrayTop(arr);
 }
 
-void arraySetFocus(dynamicArray_t *arr, int i) {
+void arraySetFocus(dynamicArray_t *arr, int64_t i) {
   assert(arr);
   assert(i >= 0);
   assert(i < arr->numElems);
@@ -144,3 +172,108 @@ char *cstringOf(string_t *s) {
   return s->start;
 }
 
+
+// Bump allocator for lots of small strings.  Chunks start small and double
+// up to MAX_ARENA_CHUNK_SIZE so that a doc that is barely edited stays
+// small.  Anything bigger than that gets a chunk of its own.  Memory is only
+// given back in LIFO order with arenaFreeTo.
+
+void arenaInit(arena_t *arena) {
+  arrayInit(&arena->chunks, sizeof(arenaChunk_t));
+  arena->used = 0;
+  arena->size = 0;
+}
+
+static arenaChunk_t *arenaLastChunk(arena_t *arena) {
+  if (arena->chunks.numElems == 0)
+    return NULL;
+  return arrayElemAt(&arena->chunks, arena->chunks.numElems - 1);
+}
+
+static void arenaNewChunk(arena_t *arena, int64_t len) {
+  arenaChunk_t *last = arenaLastChunk(arena);
+  int64_t size =
+      last ? min(last->size * 2, MAX_ARENA_CHUNK_SIZE) : MIN_ARENA_CHUNK_SIZE;
+  arenaChunk_t *c = arrayPushUninit(&arena->chunks);
+  c->size = max(size, len);
+  c->start = dieIfNull(malloc(c->size));
+  arena->used = 0;
+  arena->size += c->size;
+}
+
+// the rest of the current chunk (starting a new one if it is full).  An
+// arenaAlloc of no more than avail bytes returns the same pointer.
+char *arenaReserve(arena_t *arena, int64_t *avail) {
+  arenaChunk_t *c = arenaLastChunk(arena);
+  if (!c || arena->used == c->size) {
+    arenaNewChunk(arena, 1);
+    c = arenaLastChunk(arena);
+  }
+  *avail = c->size - arena->used;
+  return c->start + arena->used;
+}
+
+void *arenaAlloc(arena_t *arena, int64_t len) {
+  assert(len > 0);
+  arenaChunk_t *c = arenaLastChunk(arena);
+  if (!c || c->size - arena->used < len) {
+    arenaNewChunk(arena, len);
+    c = arenaLastChunk(arena);
+  }
+  char *p = c->start + arena->used;
+  arena->used += len;
+  return p;
+}
+
+// grows p, the last thing allocated, from oldLen to newLen bytes.  If it
+// can't grow in place it moves to a new chunk with as much room again to
+// spare, so growing a byte at a time is amortized O(1).
+void *arenaGrowLast(arena_t *arena, void *p, int64_t oldLen, int64_t newLen) {
+  assert(newLen >= oldLen);
+  arenaChunk_t *c = arenaLastChunk(arena);
+  char *end = (char *)p + oldLen;
+  if (c && end == c->start + arena->used &&
+      c->size - arena->used >= newLen - oldLen) {
+    arena->used += newLen - oldLen;
+    return p;
+  }
+  arenaNewChunk(arena, 2 * newLen);
+  char *q = arenaAlloc(arena, newLen);
+  myMemcpy(q, p, oldLen);
+  return q;
+}
+
+// start of the chunk that arenaReserve/arenaAlloc currently hand out from
+char *arenaChunkStart(arena_t *arena) {
+  arenaChunk_t *c = arenaLastChunk(arena);
+  return c ? c->start : NULL;
+}
+
+// frees p, which must come from arena, and everything allocated after it
+void arenaFreeTo(arena_t *arena, void *p) {
+  arenaChunk_t *c;
+  while ((c = arenaLastChunk(arena))) {
+    if ((char *)p >= c->start && (char *)p < c->start + c->size) {
+      arena->used = (char *)p - c->start;
+      return;
+    }
+    arena->size -= c->size;
+    free(c->start);
+    arrayPop(&arena->chunks);
+  }
+  assert(false);
+}
+
+void arenaFree(arena_t *arena) {
+  for (int64_t i = 0; i < arena->chunks.numElems; ++i) {
+    arenaChunk_t *c = arrayElemAt(&arena->chunks, i);
+    free(c->start);
+  }
+  arrayFree(&arena->chunks);
+  arenaInit(arena);
+}
+
+// bytes held by the arena
+int64_t arenaSize(arena_t *arena) {
+  return arrayMaxSize(&arena->chunks) + arena->size;
+}
@@ -11,22 +11,32 @@
 
 #include "Util.h"
 
-void arrayGrow(dynamicArray_t *arr, int maxElems);
+void arrayGrow(dynamicArray_t *arr, int64_t maxElems);
 void arrayReinit(dynamicArray_t *arr);
 void arrayInit(dynamicArray_t *arr, int elemSize);
 void *arrayPushUninit(dynamicArray_t *arr);
 void arrayPush(dynamicArray_t *arr, void *elem);
 void *arrayPop(dynamicArray_t *arr);
-void *arrayElemAt(dynamicArray_t *arr, int i);
+void *arrayElemAt(dynamicArray_t *arr, int64_t i);
 void *arrayFocus(dynamicArray_t *arr);
-void arraySetFocus(dynamicArray_t *arr, int i);
+void arraySetFocus(dynamicArray_t *arr, int64_t i);
 void *arrayBoundary(dynamicArray_t *arr);
-void arrayInsert(dynamicArray_t *arr, int offset, void *s, int len);
-int arrayDelete(dynamicArray_t *arr, int offset, int len);
+void arrayInsert(dynamicArray_t *arr, int64_t offset, void *s, int64_t len);
+int64_t arrayDelete(dynamicArray_t *arr, int64_t offset, int64_t len);
 void *arrayTop(dynamicArray_t *arr);
 void arrayFree(dynamicArray_t *arr);
 bool arrayAtTop(dynamicArray_t *arr);
-int arrayMaxSize(dynamicArray_t *arr);
+int64_t arrayMaxSize(dynamicArray_t *arr);
 char *cstringOf(string_t *s);
+void arraySetGrowth(dynamicArray_t *arr, growthPolicy_t growth);
+void arrayShrinkToFit(dynamicArray_t *arr);
+void arenaInit(arena_t *arena);
+char *arenaReserve(arena_t *arena, int64_t *avail);
+void *arenaAlloc(arena_t *arena, int64_t len);
+void *arenaGrowLast(arena_t *arena, void *p, int64_t oldLen, int64_t newLen);
+char *arenaChunkStart(arena_t *arena);
+void arenaFreeTo(arena_t *arena, void *p);
+void arenaFree(arena_t *arena);
+int64_t arenaSize(arena_t *arena);
 
 #endif /* DynamicArray_h */
@@ -7,6 +7,7 @@
 //
 
 #include "Font.h"
+#include "Utf8.h"
 
 SDL_Color white = {255, 255, 255};
 uint16_t unicode[256];
@@ -27,6 +28,51 @@ static inline void initCharTexture(font_t *font, TTF_Font *ttfFont, uchar c) {
   SDL_FreeSurface(srfc);
 }
 
+static SDL_Texture *glyphTexture(font_t *font, uint32_t cp) {
+  char s[5];
+  s[utf8Encode(cp, s)] = '\0';
+
+  SDL_Surface *srfc = TTF_RenderUTF8_Blended(font->ttfFont, s, white);
+  if (!srfc)
+    srfc = TTF_RenderUTF8_Blended(font->ttfFont, "\xef\xbf\xbd", white);
+  if (!srfc)
+    die(TTF_GetError());
+  SDL_Texture *txtr = SDL_CreateTextureFromSurface(renderer, srfc);
+  if (!txtr)
+    die(TTF_GetError());
+
+  SDL_FreeSurface(srfc);
+  return txtr;
+}
+
+// texture for a code point past ASCII.  Text can use any of them, so they're
+// rendered the first time they're drawn rather than up front.
+SDL_Texture *fontGlyph(font_t *font, uint32_t cp) {
+  assert(cp < 0x110000);
+  SDL_Texture **page = font->glyphs[cp >> 8];
+  if (!page) {
+    page = dieIfNull(calloc(256, sizeof(SDL_Texture *)));
+    font->glyphs[cp >> 8] = page;
+  }
+  if (!page[cp & 0xff])
+    page[cp & 0xff] = glyphTexture(font, cp);
+  return page[cp & 0xff];
+}
+
+static void freeGlyphs(font_t *font) {
+  for (int i = 0; i < GLYPH_PAGES; ++i) {
+    SDL_Texture **page = font->glyphs[i];
+    if (!page)
+      continue;
+    for (int c = 0; c < 256; ++c) {
+      if (page[c])
+        SDL_DestroyTexture(page[c]);
+    }
+    free(page);
+    font->glyphs[i] = NULL;
+  }
+}
+
 static inline void initFontData(font_t *font) {
   TTF_Font *ttfFont = TTF_OpenFont(font->filepath, font->size);
 
@@ -41,7 +87,7 @@ static inline void initFontData(font_t *font) {
   }
 
   font->lineSkip = TTF_FontLineSkip(ttfFont);
-  TTF_CloseFont(ttfFont);
+  font->ttfFont = ttfFont; // kept open for fontGlyph
 
   SDL_QueryTexture(font->charTexture['!'], NULL, NULL, &font->charSkip,
                    &font->charRect.h);
@@ -59,6 +105,8 @@ void reinitFont(font_t *font) {
   for (uint16_t c = 0; c <= 255; c++) {
     SDL_DestroyTexture(font->charTexture[c]);
   }
+  freeGlyphs(font);
+  TTF_CloseFont(font->ttfFont);
 
   initFontData(font);
 }
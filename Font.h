@@ -17,5 +17,6 @@ void resetCharRect(font_t *font, int scrollX, int scrollY);
 void renderEOF(font_t *font);
 void renderBox(font_t *font, char *p, unsigned int len);
 void renderAndAdvChar(font_t *font, char c);
+SDL_Texture *fontGlyph(font_t *font, uint32_t cp);
 
 #endif /* Font_h */
@@ -0,0 +1,807 @@
+//
+//  Index.c
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#include "Index.h"
+#include "Doc.h"
+#include "DynamicArray.h"
+#include "Search.h"
+#include <dirent.h>
+#include <unistd.h>
+
+// Trigram index of the files under a directory, for finding the few files a
+// search can match without reading the rest.  Every trigram (folded, like
+// the searches) maps to the ascending ids of the files that have it.  A file
+// that changes or goes away stays in the table but is no longer alive, and
+// its new contents get a new id at the end so the lists stay sorted; saving
+// renumbers.  The index is kept in ".ceditor-index" in the directory and
+// brought up to date from the mtimes and sizes of the files, on a thread of
+// its own.  That thread holds the lock while it changes the index, so it can
+// be queried as it stands at any time.
+//
+// The file is "CEI2", the number of files, then for each its mtime, size,
+// flags (INDEX_INDEXED, INDEX_SCAN) and path; then the number of trigrams, and
+// for each in ascending order the trigram, the number of ids and the ids as
+// varint differences.
+
+#define INDEX_MAGIC "CEI2"
+#define INDEX_NAME ".ceditor-index"
+#define INDEX_MAX_FILE_SIZE (16 << 20) // bigger ones are always candidates
+#define INDEX_SNIFF_SIZE (64 << 10)    // of those, read to rule out binaries
+#define INDEX_INDEXED 1
+#define INDEX_SCAN 2
+#define INDEX_MAX_FILES (1 << 20)
+#define INDEX_INIT_TABLE_SIZE 1024
+
+static inline uchar indexFold(char c) {
+  return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static indexFile_t *fileAt(index_t *index, int64_t id) {
+  return arrayElemAt(&index->files, id);
+}
+
+static uint32_t *idsOf(indexPosting_t *p) { return p->ids.start; }
+
+static indexPosting_t *slotOf(indexPosting_t *table, int64_t size,
+                              uint32_t trigram) {
+  uint64_t i = (trigram * 0x9e3779b97f4a7c15ull) >> 32;
+  for (;; ++i) {
+    indexPosting_t *p = &table[i & (size - 1)];
+    if (p->trigram == 0 || p->trigram == trigram)
+      return p;
+  }
+}
+
+// moves the postings to a new table, dropping the empty ones
+static void indexRehash(index_t *index, int64_t size) {
+  indexPosting_t *table = dieIfNull(calloc(size, sizeof(indexPosting_t)));
+  index->numTrigrams = 0;
+  for (int64_t i = 0; i < index->tableSize; ++i) {
+    indexPosting_t *p = &index->table[i];
+    if (p->trigram == 0)
+      continue;
+    if (p->ids.numElems == 0) {
+      arrayFree(&p->ids);
+      continue;
+    }
+    *slotOf(table, size, p->trigram) = *p;
+    index->numTrigrams++;
+  }
+  free(index->table);
+  index->table = table;
+  index->tableSize = size;
+}
+
+static indexPosting_t *postingOf(index_t *index, uint32_t trigram,
+                                 bool create) {
+  indexPosting_t *p = slotOf(index->table, index->tableSize, trigram);
+  if (p->trigram || !create)
+    return p->trigram ? p : NULL;
+  if (2 * (index->numTrigrams + 1) > index->tableSize) {
+    indexRehash(index, 2 * index->tableSize);
+    p = slotOf(index->table, index->tableSize, trigram);
+  }
+  p->trigram = trigram;
+  arrayInit(&p->ids, sizeof(uint32_t));
+  index->numTrigrams++;
+  return p;
+}
+
+static void indexEmpty(index_t *index) {
+  arrayInit(&index->files, sizeof(indexFile_t));
+  index->tableSize = INDEX_INIT_TABLE_SIZE;
+  index->table = dieIfNull(calloc(index->tableSize, sizeof(indexPosting_t)));
+  index->numTrigrams = 0;
+  index->numDead = 0;
+}
+
+void indexInit(index_t *index, char *root) {
+  myMemset(index, 0, sizeof(index_t));
+  index->root = dieIfNull(strdup(root));
+  index->lock = dieIfNull(SDL_CreateMutex());
+  indexEmpty(index);
+}
+
+static void indexClear(index_t *index) {
+  for (int64_t i = 0; i < index->files.numElems; ++i) {
+    free(fileAt(index, i)->path);
+  }
+  arrayFree(&index->files);
+  for (int64_t i = 0; i < index->tableSize; ++i) {
+    arrayFree(&index->table[i].ids);
+  }
+  free(index->table);
+}
+
+void indexFree(index_t *index) {
+  SDL_AtomicSet(&index->cancel, 1);
+  indexWait(index);
+  indexClear(index);
+  SDL_DestroyMutex(index->lock);
+  free(index->root);
+  myMemset(index, 0, sizeof(index_t));
+}
+
+static uint32_t indexAddFile(index_t *index, char *path, struct stat *st) {
+  uint32_t id = (uint32_t)index->files.numElems;
+  indexFile_t *f = arrayPushUninit(&index->files);
+  f->path = dieIfNull(strdup(path));
+  f->mtime = st->st_mtime;
+  f->size = st->st_size;
+  f->alive = true;
+  f->indexed = false;
+  f->scan = false;
+  f->seen = true;
+  return id;
+}
+
+// the contents of the file (of len bytes), or NULL if it's not to be indexed.
+// Sets *scan if that's because it's too big, but it looks like text.
+static char *indexRead(char *filepath, struct stat *st, int64_t *len,
+                       bool *scan) {
+  *scan = false;
+  FILE *fp = fopen(filepath, "r");
+  if (!fp)
+    return NULL;
+  bool big = st->st_size > INDEX_MAX_FILE_SIZE;
+  int64_t n = big ? INDEX_SNIFF_SIZE : st->st_size;
+  char *buf = dieIfNull(malloc(max(1, n)));
+  *len = fread(buf, 1, n, fp);
+  fclose(fp);
+  bool binary = memchr(buf, '\0', *len) != NULL;
+  if (big || binary) {
+    *scan = big && !binary;
+    free(buf);
+    return NULL;
+  }
+  return buf;
+}
+
+// adds id to the posting of each trigram in buf
+static void indexContents(index_t *index, uint32_t id, char *buf,
+                          int64_t len) {
+  uint32_t trigram = 0;
+  for (int64_t i = 0; i < len; ++i) {
+    trigram = ((trigram << 8) | indexFold(buf[i])) & 0xffffff;
+    if (i < 2)
+      continue;
+    indexPosting_t *p = postingOf(index, trigram, true);
+    if (p->ids.numElems && idsOf(p)[p->ids.numElems - 1] == id)
+      continue;
+    arrayPush(&p->ids, &id);
+  }
+  fileAt(index, id)->indexed = true;
+}
+
+typedef struct {
+  char *path;
+  uint32_t id;
+} pathId_t;
+
+static int pathIdCmp(const void *a, const void *b) {
+  return strcmp(((pathId_t *)a)->path, ((pathId_t *)b)->path);
+}
+
+typedef struct {
+  index_t *index;
+  pathId_t *known; // the alive files, by path
+  int64_t numKnown;
+  string_t path;   // relative to the root, of the directory being walked
+} walk_t;
+
+static void indexWalkFile(walk_t *w, char *full, struct stat *st) {
+  index_t *index = w->index;
+  char *rel = full + strlen(index->root) + 1;
+  pathId_t key = {rel, 0};
+  pathId_t *k = bsearch(&key, w->known, w->numKnown, sizeof(pathId_t),
+                        pathIdCmp);
+  if (k) {
+    indexFile_t *f = fileAt(index, k->id);
+    f->seen = true;
+    if (f->mtime == st->st_mtime && f->size == st->st_size)
+      return;
+  }
+  int64_t len = 0;
+  bool scan;
+  char *buf = indexRead(full, st, &len, &scan);
+  SDL_LockMutex(index->lock);
+  if (k) {
+    fileAt(index, k->id)->alive = false;
+    index->numDead++;
+  }
+  if (index->files.numElems < INDEX_MAX_FILES) {
+    uint32_t id = indexAddFile(index, rel, st);
+    fileAt(index, id)->scan = scan;
+    if (buf)
+      indexContents(index, id, buf, len);
+  }
+  index->dirty = true;
+  SDL_UnlockMutex(index->lock);
+  free(buf);
+}
+
+// full is the path of a directory, with a trailing '/'
+static void indexWalk(walk_t *w, string_t *full) {
+  DIR *dir = opendir(cstringOf(full));
+  if (!dir)
+    return;
+  int64_t n = full->numElems;
+  struct dirent *e;
+  while ((e = readdir(dir)) && !SDL_AtomicGet(&w->index->cancel)) {
+    if (e->d_name[0] == '.') // also skips the index itself
+      continue;
+    full->numElems = n;
+    arrayInsert(full, n, e->d_name, strlen(e->d_name));
+    struct stat st;
+    if (lstat(cstringOf(full), &st) != 0)
+      continue;
+    if (S_ISDIR(st.st_mode)) {
+      arrayPush(full, "/");
+      indexWalk(w, full);
+    } else if (S_ISREG(st.st_mode)) {
+      indexWalkFile(w, cstringOf(full), &st);
+    }
+  }
+  full->numElems = n;
+  closedir(dir);
+}
+
+// brings the index up to date with the files on disk (unless cancelled)
+static void indexRefresh(index_t *index) {
+  walk_t w;
+  w.index = index;
+  w.known = dieIfNull(malloc(max(1, index->files.numElems) * sizeof(pathId_t)));
+  w.numKnown = 0;
+  for (int64_t i = 0; i < index->files.numElems; ++i) {
+    indexFile_t *f = fileAt(index, i);
+    f->seen = false;
+    if (f->alive)
+      w.known[w.numKnown++] = (pathId_t){f->path, (uint32_t)i};
+  }
+  qsort(w.known, w.numKnown, sizeof(pathId_t), pathIdCmp);
+
+  string_t full;
+  arrayInit(&full, sizeof(char));
+  arrayInsert(&full, 0, index->root, strlen(index->root));
+  arrayPush(&full, "/");
+  indexWalk(&w, &full);
+  arrayFree(&full);
+  free(w.known);
+  if (SDL_AtomicGet(&index->cancel))
+    return;
+
+  SDL_LockMutex(index->lock);
+  for (int64_t i = 0; i < index->files.numElems; ++i) {
+    indexFile_t *f = fileAt(index, i);
+    if (f->alive && !f->seen) { // gone
+      f->alive = false;
+      index->numDead++;
+      index->dirty = true;
+    }
+  }
+  index->complete = true;
+  SDL_UnlockMutex(index->lock);
+}
+
+// drops the files that aren't alive and numbers the rest from 0
+static void indexCompact(index_t *index) {
+  if (index->numDead == 0)
+    return;
+  uint32_t *newId =
+      dieIfNull(malloc(max(1, index->files.numElems) * sizeof(uint32_t)));
+  uint32_t n = 0;
+  for (int64_t i = 0; i < index->files.numElems; ++i) {
+    indexFile_t *f = fileAt(index, i);
+    if (!f->alive) {
+      free(f->path);
+      newId[i] = UINT32_MAX;
+      continue;
+    }
+    newId[i] = n;
+    *fileAt(index, n++) = *f;
+  }
+  index->files.numElems = n;
+  for (int64_t i = 0; i < index->tableSize; ++i) {
+    indexPosting_t *p = &index->table[i];
+    int64_t m = 0;
+    for (int64_t j = 0; j < p->ids.numElems; ++j) {
+      uint32_t id = newId[idsOf(p)[j]];
+      if (id != UINT32_MAX)
+        idsOf(p)[m++] = id;
+    }
+    p->ids.numElems = m;
+  }
+  free(newId);
+  index->numDead = 0;
+  indexRehash(index, index->tableSize);
+}
+
+static void put(string_t *out, void *p, int64_t len) {
+  arrayInsert(out, out->numElems, p, len);
+}
+
+static void putVarint(string_t *out, uint32_t x) {
+  while (x >= 0x80) {
+    uchar b = (x & 0x7f) | 0x80;
+    arrayPush(out, &b);
+    x >>= 7;
+  }
+  uchar b = x;
+  arrayPush(out, &b);
+}
+
+static int postingCmp(const void *a, const void *b) {
+  uint32_t x = (*(indexPosting_t **)a)->trigram;
+  uint32_t y = (*(indexPosting_t **)b)->trigram;
+  return (x > y) - (x < y);
+}
+
+static char *indexFilepath(index_t *index, char *suffix) {
+  int64_t n = strlen(index->root) + strlen(INDEX_NAME) + strlen(suffix) + 2;
+  char *s = dieIfNull(malloc(n));
+  snprintf(s, n, "%s/%s%s", index->root, INDEX_NAME, suffix);
+  return s;
+}
+
+// writes the index if it changed, quietly giving up if it can't
+static void indexSave(index_t *index) {
+  if (!index->dirty || SDL_AtomicGet(&index->cancel))
+    return;
+  SDL_LockMutex(index->lock);
+  indexCompact(index);
+  SDL_UnlockMutex(index->lock);
+  string_t out;
+  arrayInit(&out, sizeof(char));
+  put(&out, INDEX_MAGIC, 4);
+  uint32_t numFiles = (uint32_t)index->files.numElems;
+  put(&out, &numFiles, sizeof(numFiles));
+  for (uint32_t i = 0; i < numFiles; ++i) {
+    indexFile_t *f = fileAt(index, i);
+    uint32_t len = (uint32_t)strlen(f->path);
+    uchar flags = (f->indexed ? INDEX_INDEXED : 0) | (f->scan ? INDEX_SCAN : 0);
+    put(&out, &f->mtime, sizeof(f->mtime));
+    put(&out, &f->size, sizeof(f->size));
+    put(&out, &flags, 1);
+    put(&out, &len, sizeof(len));
+    put(&out, f->path, len);
+  }
+
+  indexPosting_t **sorted =
+      dieIfNull(malloc(max(1, index->numTrigrams) * sizeof(indexPosting_t *)));
+  uint32_t n = 0;
+  for (int64_t i = 0; i < index->tableSize; ++i) {
+    if (index->table[i].trigram)
+      sorted[n++] = &index->table[i];
+  }
+  qsort(sorted, n, sizeof(indexPosting_t *), postingCmp);
+  put(&out, &n, sizeof(n));
+  for (uint32_t i = 0; i < n; ++i) {
+    indexPosting_t *p = sorted[i];
+    uint32_t count = (uint32_t)p->ids.numElems;
+    put(&out, &p->trigram, sizeof(p->trigram));
+    put(&out, &count, sizeof(count));
+    uint32_t last = 0;
+    for (uint32_t j = 0; j < count; ++j) {
+      putVarint(&out, idsOf(p)[j] - last);
+      last = idsOf(p)[j];
+    }
+  }
+  free(sorted);
+
+  // a reader never sees half of one
+  char *tmp = indexFilepath(index, ".tmp");
+  char *path = indexFilepath(index, "");
+  FILE *fp = fopen(tmp, "w");
+  bool ok = fp && fwrite(out.start, 1, out.numElems, fp) == out.numElems;
+  if (fp)
+    ok &= fclose(fp) == 0;
+  if (ok && rename(tmp, path) == 0)
+    index->dirty = false;
+  else
+    unlink(tmp);
+  free(tmp);
+  free(path);
+  arrayFree(&out);
+}
+
+typedef struct {
+  uchar *p;
+  uchar *end;
+  bool ok;
+} reader_t;
+
+static void get(reader_t *r, void *p, int64_t len) {
+  if (!r->ok || r->end - r->p < len) {
+    r->ok = false;
+    myMemset(p, 0, len);
+    return;
+  }
+  memcpy(p, r->p, len);
+  r->p += len;
+}
+
+static uint32_t getVarint(reader_t *r) {
+  uint32_t x = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    uchar b;
+    get(r, &b, 1);
+    x |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return x;
+  }
+  r->ok = false;
+  return 0;
+}
+
+static bool indexParse(index_t *index, reader_t *r) {
+  char magic[4];
+  get(r, magic, 4);
+  if (!r->ok || memcmp(magic, INDEX_MAGIC, 4) != 0)
+    return false;
+  uint32_t numFiles;
+  get(r, &numFiles, sizeof(numFiles));
+  for (uint32_t i = 0; i < numFiles && r->ok; ++i) {
+    indexFile_t f;
+    uint32_t len;
+    uchar flags;
+    get(r, &f.mtime, sizeof(f.mtime));
+    get(r, &f.size, sizeof(f.size));
+    get(r, &flags, 1);
+    get(r, &len, sizeof(len));
+    if (!r->ok || len > PATH_MAX || r->end - r->p < len)
+      return false;
+    f.path = dieIfNull(malloc(len + 1));
+    get(r, f.path, len);
+    f.path[len] = '\0';
+    f.alive = true;
+    f.indexed = flags & INDEX_INDEXED;
+    f.scan = flags & INDEX_SCAN;
+    f.seen = false;
+    arrayPush(&index->files, &f);
+  }
+  uint32_t numTrigrams;
+  get(r, &numTrigrams, sizeof(numTrigrams));
+  for (uint32_t i = 0; i < numTrigrams && r->ok; ++i) {
+    uint32_t trigram;
+    uint32_t count;
+    get(r, &trigram, sizeof(trigram));
+    get(r, &count, sizeof(count));
+    if (!r->ok || trigram == 0 || trigram > 0xffffff || count > numFiles ||
+        postingOf(index, trigram, false))
+      return false;
+    indexPosting_t *p = postingOf(index, trigram, true);
+    arrayGrow(&p->ids, max(1, count));
+    uint32_t id = 0;
+    for (uint32_t j = 0; j < count; ++j) {
+      uint32_t delta = getVarint(r);
+      if (j > 0 && delta == 0)
+        return false;
+      id += delta;
+      if (id >= numFiles)
+        return false;
+      arrayPush(&p->ids, &id);
+    }
+  }
+  return r->ok && r->p == r->end;
+}
+
+// reads the index on disk, if there is a good one
+void indexLoad(index_t *index) {
+  index->loaded = true;
+  char *path = indexFilepath(index, "");
+  FILE *fp = fopen(path, "r");
+  free(path);
+  if (!fp)
+    return;
+  struct stat st;
+  uchar *buf = NULL;
+  bool ok = fstat(fileno(fp), &st) == 0;
+  if (ok) {
+    buf = dieIfNull(malloc(max(1, st.st_size)));
+    ok = fread(buf, 1, st.st_size, fp) == st.st_size;
+  }
+  fclose(fp);
+  reader_t r = {buf, buf + (ok ? st.st_size : 0), ok};
+  SDL_LockMutex(index->lock);
+  if (!ok || !indexParse(index, &r)) { // start over
+    indexClear(index);
+    indexEmpty(index);
+  }
+  SDL_UnlockMutex(index->lock);
+  free(buf);
+}
+
+static int indexRun(void *arg) {
+  index_t *index = arg;
+  if (!index->loaded)
+    indexLoad(index);
+  indexRefresh(index);
+  indexSave(index);
+  SDL_AtomicSet(&index->busy, 0);
+  return 0;
+}
+
+// loads (the first time), refreshes and saves the index on a thread of its
+// own, unless that's already happening.  Until it's done, nothing but
+// indexQuery may touch the index.
+void indexStart(index_t *index) {
+  if (SDL_AtomicGet(&index->busy))
+    return;
+  indexWait(index); // the last run is over
+  SDL_AtomicSet(&index->busy, 1);
+  index->thread = dieIfNull(SDL_CreateThread(indexRun, "index", index));
+}
+
+void indexWait(index_t *index) {
+  if (!index->thread)
+    return;
+  SDL_WaitThread(index->thread, NULL);
+  index->thread = NULL;
+}
+
+// out = the ids in both a and b
+static void intersect(uint32_t *a, int64_t n, dynamicArray_t *b,
+                      dynamicArray_t *out) {
+  arrayReinit(out);
+  uint32_t *ids = b->start;
+  int64_t j = 0;
+  for (int64_t i = 0; i < n && j < b->numElems; ++i) {
+    while (j < b->numElems && ids[j] < a[i])
+      j++;
+    if (j < b->numElems && ids[j] == a[i])
+      arrayPush(out, &a[i]);
+  }
+}
+
+// sets the bits of the files that have every trigram of s
+static void markHaving(index_t *index, char *s, uint64_t *bits) {
+  dynamicArray_t have;
+  dynamicArray_t next;
+  arrayInit(&have, sizeof(uint32_t));
+  arrayInit(&next, sizeof(uint32_t));
+  int64_t len = strlen(s);
+  for (int64_t i = 0; i + 3 <= len; ++i) {
+    uint32_t trigram = ((uint32_t)(uchar)s[i] << 16) |
+                       ((uint32_t)(uchar)s[i + 1] << 8) | (uchar)s[i + 2];
+    indexPosting_t *p = postingOf(index, trigram, false);
+    if (!p) {
+      arrayReinit(&have);
+      break;
+    }
+    if (i == 0) {
+      arrayInsert(&have, 0, p->ids.start, p->ids.numElems);
+      continue;
+    }
+    intersect(have.start, have.numElems, &p->ids, &next);
+    swap(dynamicArray_t, have, next);
+    if (have.numElems == 0)
+      break;
+  }
+  for (int64_t i = 0; i < have.numElems; ++i) {
+    uint32_t id = ((uint32_t *)have.start)[i];
+    bits[id >> 6] |= 1ull << (id & 63);
+  }
+  arrayFree(&have);
+  arrayFree(&next);
+}
+
+// appends to out (char *, relative to the root, to be freed) the files that
+// can have a match of query (see searchQuery), which includes those too big
+// to index.  Returns whether the index has been through all the files yet:
+// until then, there may be others.
+bool indexQuery(index_t *index, char *query, int64_t len, dynamicArray_t *out) {
+  SDL_LockMutex(index->lock);
+  int64_t numWords = (index->files.numElems + 63) / 64;
+  uint64_t *result = dieIfNull(calloc(max(1, numWords), sizeof(uint64_t)));
+  uint64_t *any = dieIfNull(calloc(max(1, numWords), sizeof(uint64_t)));
+  for (int64_t i = 0; i < index->files.numElems; ++i) {
+    indexFile_t *f = fileAt(index, i);
+    if (f->alive && f->indexed)
+      result[i >> 6] |= 1ull << (i & 63);
+  }
+  char *p = query;
+  char *end = query + len;
+  while (p < end) {
+    myMemset(any, 0, max(1, numWords) * sizeof(uint64_t));
+    for (; *p; p += strlen(p) + 1) {
+      markHaving(index, p, any);
+    }
+    p++;
+    for (int64_t i = 0; i < numWords; ++i) {
+      result[i] &= any[i];
+    }
+  }
+  for (int64_t i = 0; i < index->files.numElems; ++i) {
+    indexFile_t *f = fileAt(index, i);
+    if (((result[i >> 6] >> (i & 63)) & 1) || (f->alive && f->scan)) {
+      char *path = dieIfNull(strdup(f->path));
+      arrayPush(out, &path);
+    }
+  }
+  free(result);
+  free(any);
+  bool complete = index->complete;
+  SDL_UnlockMutex(index->lock);
+  return complete;
+}
+
+#define INDEX_TEST_DIR "/tmp/ceditor-indexTest"
+#define INDEX_TEST_FILES 40
+
+static char *indexTestPath(int i) {
+  static char path[64];
+  if (i == INDEX_TEST_FILES)
+    return "big.txt";
+  snprintf(path, sizeof(path), "%sf%d.txt", i % 4 == 0 ? "sub/" : "", i);
+  return path;
+}
+
+static void indexTestWrite(char *path, char *s, int64_t len) {
+  char full[128];
+  snprintf(full, sizeof(full), "%s/%s", INDEX_TEST_DIR, path);
+  FILE *fp = dieIfNull(fopen(full, "w"));
+  if (fwrite(s, 1, len, fp) != len || fclose(fp) != 0)
+    die("unable to write test file");
+}
+
+// random words, some of them capitalized
+static char *indexTestWords() {
+  static char *words[] = {"apple", "banana", "cherry", "kiwi",
+                          "melon", "banjo",  "grape"};
+  int n = rand() % 20;
+  char *s = dieIfNull(malloc(n * 8 + 1));
+  s[0] = '\0';
+  for (int i = 0; i < n; ++i) {
+    char *w = words[rand() % 7];
+    int64_t k = strlen(s);
+    sprintf(s + k, "%s%c", w, " \n"[rand() % 2]);
+    if (rand() % 4 == 0)
+      s[k] = s[k] - 'a' + 'A';
+  }
+  return s;
+}
+
+static void indexTestFound(void *arg, int64_t offset, int64_t len) {
+  *(bool *)arg = true;
+}
+
+// whether the search finds anything in s
+static bool indexTestMatches(char *s, char *needle, bool isRegexp) {
+  doc_t doc;
+  docInit(&doc, "", false, false);
+  docInsert(&doc, 0, s, strlen(s));
+  bool found = false;
+  if (isRegexp) {
+    regexp_t *re = dieIfNull(regexpNew(needle, strlen(needle), NULL));
+    regexpSearchDoc(re, &doc, indexTestFound, &found);
+    regexpFree(re);
+  } else {
+    searcher_t searcher;
+    searcherInit(&searcher, needle, strlen(needle));
+    searchDoc(&searcher, &doc, indexTestFound, &found);
+    searcherFree(&searcher);
+  }
+  docFree(&doc);
+  return found;
+}
+
+// every file that has a match is a candidate, the big one always is and the
+// binary one never is.  Returns the number of candidates, over all searches.
+static int64_t indexTestCheck(index_t *index, char **contents) {
+  // the first 5 are literal
+  static char *searches[] = {"apple",       "BANANA",    "an",
+                             "kiwi\nmelon", "durian",    "ban(ana|jo)",
+                             "ch.rry",      "[a-c]pple", "kiwi|grape",
+                             "^melon",      "o+n\\s",    ".*"};
+  int64_t total = 0;
+  for (int i = 0; i < 12; ++i) {
+    char *needle = searches[i];
+    bool isRegexp = i >= 5;
+    dynamicArray_t query;
+    arrayInit(&query, sizeof(char));
+    assert(searchQuery(needle, strlen(needle), isRegexp, &query));
+    dynamicArray_t paths;
+    arrayInit(&paths, sizeof(char *));
+    indexQuery(index, query.start, query.numElems, &paths);
+    arrayFree(&query);
+    bool *candidate = dieIfNull(calloc(INDEX_TEST_FILES + 2, sizeof(bool)));
+    for (int64_t j = 0; j < paths.numElems; ++j) {
+      char *path = *(char **)arrayElemAt(&paths, j);
+      if (strcmp(path, "binary") == 0)
+        candidate[INDEX_TEST_FILES + 1] = true;
+      for (int k = 0; k <= INDEX_TEST_FILES; ++k) {
+        if (strcmp(path, indexTestPath(k)) == 0)
+          candidate[k] = true;
+      }
+      free(path);
+    }
+    for (int k = 0; k < INDEX_TEST_FILES; ++k) {
+      assert(!contents[k] || candidate[k] ||
+             !indexTestMatches(contents[k], needle, isRegexp));
+    }
+    assert(candidate[INDEX_TEST_FILES] && !candidate[INDEX_TEST_FILES + 1]);
+    total += paths.numElems;
+    arrayFree(&paths);
+    free(candidate);
+  }
+  return total;
+}
+
+static void indexTestRefresh(index_t *index) {
+  indexStart(index);
+  indexWait(index);
+}
+
+// the candidates of literal and regexp searches over random files, after
+// some change or go away, and from the index saved on disk, whole or cut off
+void indexTest() {
+  char *contents[INDEX_TEST_FILES];
+  mkdir(INDEX_TEST_DIR, 0700);
+  mkdir(INDEX_TEST_DIR "/sub", 0700);
+  for (int i = 0; i < INDEX_TEST_FILES; ++i) {
+    contents[i] = indexTestWords();
+    indexTestWrite(indexTestPath(i), contents[i], strlen(contents[i]));
+  }
+  indexTestWrite("binary", "apple\0banana", 12);
+  // too big to index, with a match only far past what's sniffed
+  int64_t bigLen = INDEX_MAX_FILE_SIZE + 1;
+  char *big = dieIfNull(malloc(bigLen));
+  myMemset(big, 'x', bigLen);
+  memcpy(big + bigLen - 6, "apple\n", 6);
+  indexTestWrite(indexTestPath(INDEX_TEST_FILES), big, bigLen);
+  free(big);
+
+  index_t index;
+  indexInit(&index, INDEX_TEST_DIR);
+  indexTestRefresh(&index);
+  assert(index.complete && index.files.numElems == INDEX_TEST_FILES + 2);
+  indexTestCheck(&index, contents);
+
+  // a file changes (in size, as the mtime may not) and another goes away
+  free(contents[1]);
+  contents[1] = dieIfNull(strdup("the kiwi\nmelon and the apple, cherry"));
+  indexTestWrite(indexTestPath(1), contents[1], strlen(contents[1]));
+  assert(unlink(INDEX_TEST_DIR "/f2.txt") == 0);
+  free(contents[2]);
+  contents[2] = NULL;
+  indexTestRefresh(&index);
+  int64_t total = indexTestCheck(&index, contents);
+
+  // the same again from disk
+  index_t loaded;
+  indexInit(&loaded, INDEX_TEST_DIR);
+  indexLoad(&loaded);
+  assert(loaded.files.numElems == INDEX_TEST_FILES + 1 &&
+         loaded.numTrigrams == index.numTrigrams);
+  assert(indexTestCheck(&loaded, contents) == total);
+  indexFree(&loaded);
+
+  // a cut off one is thrown away, and a refresh makes it whole again
+  char *path = indexFilepath(&index, "");
+  struct stat st;
+  assert(stat(path, &st) == 0 && truncate(path, st.st_size / 2) == 0);
+  indexInit(&loaded, INDEX_TEST_DIR);
+  indexLoad(&loaded);
+  assert(loaded.files.numElems == 0);
+  indexTestRefresh(&loaded);
+  assert(indexTestCheck(&loaded, contents) == total);
+  indexFree(&loaded);
+  indexFree(&index);
+
+  assert(unlink(path) == 0);
+  free(path);
+  for (int i = 0; i <= INDEX_TEST_FILES + 1; ++i) {
+    char full[128];
+    snprintf(full, sizeof(full), "%s/%s", INDEX_TEST_DIR,
+             i <= INDEX_TEST_FILES ? indexTestPath(i) : "binary");
+    unlink(full);
+    if (i < INDEX_TEST_FILES)
+      free(contents[i]);
+  }
+  rmdir(INDEX_TEST_DIR "/sub");
+  rmdir(INDEX_TEST_DIR);
+}
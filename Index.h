@@ -0,0 +1,20 @@
+//
+//  Index.h
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#ifndef Index_h
+#define Index_h
+
+#include "Util.h"
+
+void indexInit(index_t *index, char *root);
+void indexFree(index_t *index);
+void indexLoad(index_t *index);
+void indexStart(index_t *index);
+void indexWait(index_t *index);
+bool indexQuery(index_t *index, char *query, int64_t len, dynamicArray_t *out);
+
+#endif /* Index_h */
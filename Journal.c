@@ -0,0 +1,350 @@
+//
+//  Journal.c
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#include "Journal.h"
+#include "DynamicArray.h"
+#include "PieceTable.h"
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+
+// Crash recovery.  Every edit to a user doc is appended to an in memory
+// buffer, and the buffer is written and fsync'd to ".<name>.journal" next
+// to the file every JOURNAL_COMMIT_MS.  The journal starts with the mtime
+// and size of the file the edits apply to, and is replayed on the next load
+// if the file still matches.  Saving the file removes it.
+
+#define JOURNAL_MAGIC "CEJ1"
+
+struct journalHeader_s {
+  char magic[4];
+  int64_t mtime;
+  int64_t size;
+};
+
+typedef struct journalHeader_s journalHeader_t;
+
+struct journalRecord_s {
+  int64_t tag;
+  int64_t offset;
+  int64_t len; // followed by len bytes of text for an INSERT
+};
+
+typedef struct journalRecord_s journalRecord_t;
+
+static SDL_atomic_t pending; // set while any journal has pending records
+
+void journalInit(journal_t *j) {
+  arrayInit(&j->path, sizeof(char));
+  arrayInit(&j->pending, sizeof(char));
+  j->fd = -1;
+  j->started = false;
+}
+
+static void journalSetFile(journal_t *j, struct stat *stat) {
+  j->mtime = stat->st_mtime;
+  j->size = stat->st_size;
+}
+
+// stop journaling rather than take the editor down with it
+static void journalFail(journal_t *j, char *msg) {
+  fprintf(stderr, "%s: %s (journaling disabled)\n", cstringOf(&j->path), msg);
+  if (j->fd >= 0)
+    close(j->fd);
+  j->fd = -1;
+  j->path.numElems = 0;
+  j->pending.numElems = 0;
+}
+
+// replays the records in buf onto t, returning how many bytes were good.  A
+// crash can leave a partial record at the end.
+static int64_t journalReplay(char *buf, int64_t len, pieceTable_t *t) {
+  int64_t i = sizeof(journalHeader_t);
+  while (len - i >= (int64_t)sizeof(journalRecord_t)) {
+    journalRecord_t r;
+    myMemcpy(&r, buf + i, sizeof(r));
+    int64_t n = sizeof(r) + (r.tag == INSERT ? r.len : 0);
+    if (r.offset < 0 || r.len < 0 || r.offset > pieceTableLength(t) ||
+        len - i < n)
+      break;
+    if (r.tag == INSERT) {
+      pieceTableInsert(t, r.offset, buf + i + sizeof(r), r.len);
+    } else if (r.tag == DELETE) {
+      pieceTableDelete(t, r.offset, r.len);
+    } else {
+      break;
+    }
+    i += n;
+  }
+  return i;
+}
+
+static bool journalRead(journal_t *j, pieceTable_t *t) {
+  FILE *fp = fopen(cstringOf(&j->path), "r");
+  if (!fp)
+    return false;
+  struct stat stat;
+  if (fstat(fileno(fp), &stat) != 0)
+    die("unable to get journal size");
+  int64_t len = stat.st_size;
+  char *buf = dieIfNull(malloc(len + 1));
+  bool ok = fread(buf, sizeof(char), len, fp) == len;
+  fclose(fp);
+
+  journalHeader_t h;
+  ok = ok && len >= (int64_t)sizeof(h);
+  if (ok)
+    myMemcpy(&h, buf, sizeof(h));
+  if (!ok || memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) != 0 ||
+      h.mtime != j->mtime || h.size != j->size) {
+    // the file changed since, so the edits no longer apply
+    unlink(cstringOf(&j->path));
+    free(buf);
+    return false;
+  }
+
+  int64_t good = journalReplay(buf, len, t);
+  free(buf);
+  j->fd = open(cstringOf(&j->path), O_WRONLY | O_APPEND);
+  if (j->fd < 0 || ftruncate(j->fd, good) != 0) {
+    journalFail(j, "unable to reopen journal");
+    return good > (int64_t)sizeof(h);
+  }
+  j->started = true;
+  return good > (int64_t)sizeof(h);
+}
+
+// starts journaling the file just loaded into t (described by stat),
+// replaying edits left from a previous session.  Returns whether there were
+// any.
+bool journalOpen(journal_t *j, char *filepath, struct stat *stat,
+                 pieceTable_t *t) {
+  char *dir = dieIfNull(strdup(filepath));
+  char *base = dieIfNull(strdup(filepath));
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/.%s.journal", dirname(dir), basename(base));
+  free(dir);
+  free(base);
+
+  arrayReinit(&j->path);
+  arrayInsert(&j->path, 0, path, strlen(path));
+  journalSetFile(j, stat);
+  return journalRead(j, t);
+}
+
+// called on every edit, so this only buffers
+void journalAppend(journal_t *j, commandTag_t tag, int64_t offset, char *s,
+                   int64_t len) {
+  if (j->path.numElems == 0 || len <= 0)
+    return;
+  if (!j->started) {
+    journalHeader_t h;
+    myMemset(&h, 0, sizeof(h));
+    myMemcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+    h.mtime = j->mtime;
+    h.size = j->size;
+    arrayInsert(&j->pending, j->pending.numElems, &h, sizeof(h));
+    j->started = true;
+  }
+  journalRecord_t r = {tag, offset, len};
+  arrayInsert(&j->pending, j->pending.numElems, &r, sizeof(r));
+  if (tag == INSERT)
+    arrayInsert(&j->pending, j->pending.numElems, s, len);
+  SDL_AtomicSet(&pending, 1);
+}
+
+// writes out the pending records.  One fsync covers all the edits since the
+// last commit.
+void journalCommit(journal_t *j) {
+  if (j->pending.numElems == 0)
+    return;
+  if (j->fd < 0) {
+    j->fd = open(cstringOf(&j->path), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (j->fd < 0) {
+      journalFail(j, "unable to create journal");
+      return;
+    }
+  }
+  char *p = j->pending.start;
+  int64_t n = j->pending.numElems;
+  while (n > 0) {
+    ssize_t k = write(j->fd, p, n);
+    if (k < 0) {
+      journalFail(j, "unable to write journal");
+      return;
+    }
+    p += k;
+    n -= k;
+  }
+  if (fsync(j->fd) != 0)
+    journalFail(j, "unable to sync journal");
+  j->pending.numElems = 0;
+}
+
+// the file was just saved: throw the journal away and start a new one
+// against what is now on disk
+void journalReset(journal_t *j, char *filepath) {
+  if (j->path.numElems == 0)
+    return;
+  if (j->fd >= 0)
+    close(j->fd);
+  if (j->started)
+    unlink(cstringOf(&j->path));
+  j->fd = -1;
+  j->started = false;
+  j->pending.numElems = 0;
+  struct stat info;
+  if (stat(filepath, &info) == 0)
+    journalSetFile(j, &info);
+}
+
+void journalFree(journal_t *j) {
+  if (j->fd >= 0)
+    close(j->fd);
+  arrayFree(&j->path);
+  arrayFree(&j->pending);
+  journalInit(j);
+}
+
+// whether there have been edits since the last call.  Safe to call from the
+// timer thread.
+bool journalTakePending(void) { return SDL_AtomicSet(&pending, 0); }
+
+static void journalTestLoad(pieceTable_t *t, char *filepath, struct stat *st) {
+  FILE *fp = dieIfNull(fopen(filepath, "r"));
+  if (fstat(fileno(fp), st) != 0)
+    die("unable to get test file size");
+  char *buf = dieIfNull(malloc(st->st_size + 1));
+  if (fread(buf, sizeof(char), st->st_size, fp) != st->st_size)
+    die("unable to read test file");
+  fclose(fp);
+  pieceTableReinit(t);
+  pieceTableLoad(t, buf, st->st_size);
+}
+
+// an edit to t that is journaled
+static void journalTestEdit(journal_t *j, pieceTable_t *t, commandTag_t tag,
+                            int64_t offset, char *s, int64_t len) {
+  if (tag == INSERT)
+    pieceTableInsert(t, offset, s, len);
+  else
+    pieceTableDelete(t, offset, len);
+  journalAppend(j, tag, offset, s, len);
+}
+
+static int64_t journalTestSize(char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+// replays a journal, one cut off in the middle of a record and ones for a
+// file that changed since
+void journalTest() {
+  char *filepath = "/tmp/ceditor-journalTest.txt";
+  char *path = "/tmp/.ceditor-journalTest.txt.journal";
+  FILE *fp = dieIfNull(fopen(filepath, "w"));
+  fputs("hello world\n", fp);
+  if (fclose(fp) != 0)
+    die("unable to close test file");
+
+  pieceTable_t t;
+  pieceTableInit(&t);
+  journal_t j;
+  journalInit(&j);
+  struct stat st;
+  journalTestLoad(&t, filepath, &st);
+  assert(!journalOpen(&j, filepath, &st, &t));
+  assert(journalTestSize(path) < 0);
+
+  journalTestEdit(&j, &t, INSERT, 5, ", there", 7);
+  journalTestEdit(&j, &t, DELETE, 0, NULL, 1);
+  journalTestEdit(&j, &t, INSERT, 0, "J", 1);
+  journalCommit(&j);
+  int64_t committed = journalTestSize(path);
+  journalTestEdit(&j, &t, INSERT, 18, "!", 1);
+  journalCommit(&j);
+  assert(strcmp(pieceTableCString(&t), "Jello, there world!\n") == 0);
+  journalFree(&j);
+
+  // after a crash, and the journal carries on where it left off
+  journalInit(&j);
+  journalTestLoad(&t, filepath, &st);
+  assert(journalOpen(&j, filepath, &st, &t));
+  assert(strcmp(pieceTableCString(&t), "Jello, there world!\n") == 0);
+  journalTestEdit(&j, &t, DELETE, 5, NULL, 7);
+  journalCommit(&j);
+  journalFree(&j);
+  journalInit(&j);
+  journalTestLoad(&t, filepath, &st);
+  assert(journalOpen(&j, filepath, &st, &t));
+  assert(strcmp(pieceTableCString(&t), "Jello world!\n") == 0);
+  journalFree(&j);
+
+  // a torn record at the end is dropped, and the journal cut back to what
+  // was good before it carries on
+  int64_t size = journalTestSize(path);
+  if (truncate(path, size - 3) != 0)
+    die("unable to truncate test journal");
+  journalInit(&j);
+  journalTestLoad(&t, filepath, &st);
+  assert(journalOpen(&j, filepath, &st, &t));
+  assert(strcmp(pieceTableCString(&t), "Jello, there world!\n") == 0);
+  journalTestEdit(&j, &t, INSERT, 0, "<", 1);
+  journalCommit(&j);
+  journalFree(&j);
+  journalInit(&j);
+  journalTestLoad(&t, filepath, &st);
+  assert(journalOpen(&j, filepath, &st, &t));
+  assert(strcmp(pieceTableCString(&t), "<Jello, there world!\n") == 0);
+  journalFree(&j);
+
+  // cut inside the text of an insert
+  if (truncate(path, committed + sizeof(journalRecord_t)) != 0)
+    die("unable to truncate test journal");
+  journalInit(&j);
+  journalTestLoad(&t, filepath, &st);
+  assert(journalOpen(&j, filepath, &st, &t));
+  assert(strcmp(pieceTableCString(&t), "Jello, there world\n") == 0);
+  assert(journalTestSize(path) == committed);
+  journalFree(&j);
+
+  // the file's mtime or size no longer matches: the edits are thrown away
+  journalInit(&j);
+  journalTestLoad(&t, filepath, &st);
+  st.st_mtime++;
+  assert(!journalOpen(&j, filepath, &st, &t));
+  assert(strcmp(pieceTableCString(&t), "hello world\n") == 0);
+  assert(journalTestSize(path) < 0);
+  journalTestEdit(&j, &t, INSERT, 0, ">", 1);
+  journalCommit(&j);
+  journalFree(&j);
+  fp = dieIfNull(fopen(filepath, "a"));
+  fputs("more\n", fp);
+  if (fclose(fp) != 0)
+    die("unable to close test file");
+  journalInit(&j);
+  journalTestLoad(&t, filepath, &st);
+  assert(!journalOpen(&j, filepath, &st, &t));
+  assert(strcmp(pieceTableCString(&t), "hello world\nmore\n") == 0);
+  assert(journalTestSize(path) < 0);
+
+  // nothing but part of the header
+  journalTestEdit(&j, &t, INSERT, 0, ">", 1);
+  journalCommit(&j);
+  journalFree(&j);
+  if (truncate(path, sizeof(journalHeader_t) - 1) != 0)
+    die("unable to truncate test journal");
+  journalInit(&j);
+  journalTestLoad(&t, filepath, &st);
+  assert(!journalOpen(&j, filepath, &st, &t));
+  assert(strcmp(pieceTableCString(&t), "hello world\nmore\n") == 0);
+  assert(journalTestSize(path) < 0);
+
+  journalFree(&j);
+  pieceTableFree(&t);
+  unlink(filepath);
+}
@@ -0,0 +1,23 @@
+//
+//  Journal.h
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#ifndef Journal_h
+#define Journal_h
+
+#include "Util.h"
+
+void journalInit(journal_t *j);
+bool journalOpen(journal_t *j, char *filepath, struct stat *stat,
+                 pieceTable_t *t);
+void journalAppend(journal_t *j, commandTag_t tag, int64_t offset, char *s,
+                   int64_t len);
+void journalCommit(journal_t *j);
+void journalReset(journal_t *j, char *filepath);
+void journalFree(journal_t *j);
+bool journalTakePending(void);
+
+#endif /* Journal_h */
@@ -21,7 +21,7 @@ char *macroHelp[256];
 void macrosInit(void) {
   myMemset(macro, 0, sizeof(macro));
   for (int i = 0; i < NUM_BUILTIN_MACROS; ++i) {
-    macro[builtinMacros[i][0]] = &builtinMacros[i][1];
+    macro[(uchar)builtinMacros[i][0]] = &builtinMacros[i][1];
   }
 }
 
@@ -182,6 +182,9 @@ void keysymInit(void) {
   keyHandlerHelp[NAVIGATE_MODE]['v'] = "select characters";
   keyHandler[NAVIGATE_MODE]['V'] = (keyHandler_t)selectLines;
   keyHandlerHelp[NAVIGATE_MODE]['V'] = "select lines";
+  keyHandler[NAVIGATE_MODE]['C'] = (keyHandler_t)addCursors;
+  keyHandlerHelp[NAVIGATE_MODE]['C'] =
+      "add cursors at search results or selected lines";
 
   keyHandler[NAVIGATE_MODE][KEY_LEFT] = (keyHandler_t)backwardChar;
   keyHandlerHelp[NAVIGATE_MODE][KEY_LEFT] = "backward char";
@@ -233,6 +236,12 @@ void keysymInit(void) {
   keyHandlerHelp[NAVIGATE_MODE]['N'] = "search backward";
   keyHandler[NAVIGATE_MODE]['R'] = (keyHandler_t)replace;
   keyHandlerHelp[NAVIGATE_MODE]['R'] = "replace";
+  keyHandler[NAVIGATE_MODE]['F'] = (keyHandler_t)searchAllBuffers;
+  keyHandlerHelp[NAVIGATE_MODE]['F'] = "search all buffers";
+  keyHandler[NAVIGATE_MODE]['Q'] = (keyHandler_t)replaceAllBuffers;
+  keyHandlerHelp[NAVIGATE_MODE]['Q'] = "replace in all buffers";
+  keyHandler[NAVIGATE_MODE]['G'] = (keyHandler_t)grepFiles;
+  keyHandlerHelp[NAVIGATE_MODE]['G'] = "search the files under the directory";
   keyHandler[NAVIGATE_MODE][','] = (keyHandler_t)stopRecordingOrPlayMacro;
   keyHandlerHelp[NAVIGATE_MODE][','] = "play/stop recording macro";
   keyHandler[NAVIGATE_MODE]['m'] = (keyHandler_t)startOrStopRecording;
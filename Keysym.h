@@ -47,12 +47,16 @@ void forwardSearch();
 void backwardSearch();
 void enter();
 void replace();
+void searchAllBuffers();
+void replaceAllBuffers();
+void grepFiles();
 void setInsertMode();
 void setNavigateMode();
 void forwardPage();
 void backwardPage();
 void selectChars();
 void selectLines();
+void addCursors();
 void forwardFrame();
 void backwardFrame();
 void forwardView();
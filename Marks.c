@@ -0,0 +1,309 @@
+//
+//  Marks.c
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#include "Marks.h"
+#include "DynamicArray.h"
+
+// Offsets into a doc that follow the text as it is edited (cursors,
+// selections, search results).  The marks are kept in a treap ordered by
+// offset where each node holds its offset relative to its parent, so an
+// edit moves every mark after it by changing one node: O(log n), plus O(k)
+// for the k marks inside a deleted range.  Nodes live in an array and refer
+// to each other by index so a mark is just a stable int.
+
+static markNode_t *markNode(marks_t *marks, int i) {
+  return arrayElemAt(&marks->nodes, i);
+}
+
+static unsigned int markRandom(void) {
+  static unsigned int x = 2463534242;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+void marksInit(marks_t *marks) {
+  arrayInit(&marks->nodes, sizeof(markNode_t));
+  markNode_t *null = arrayPushUninit(&marks->nodes);
+  myMemset(null, 0, sizeof(markNode_t));
+  marks->root = 0;
+  marks->freeList = 0;
+}
+
+void marksFree(marks_t *marks) { arrayFree(&marks->nodes); }
+
+static void markSetParent(marks_t *marks, int i, int parent) {
+  if (i)
+    markNode(marks, i)->parent = parent;
+}
+
+// splits t (relative to base) into the marks at or before offset and the
+// ones after it, both relative to base
+static void marksSplit(marks_t *marks, int t, int64_t base, int64_t offset,
+                       int *l, int *r) {
+  if (!t) {
+    *l = *r = 0;
+    return;
+  }
+  markNode_t *p = markNode(marks, t);
+  int64_t off = base + p->delta;
+  int a, b;
+  if (off <= offset) {
+    marksSplit(marks, p->right, off, offset, &a, &b);
+    p = markNode(marks, t);
+    p->right = a;
+    markSetParent(marks, a, t);
+    if (b)
+      markNode(marks, b)->delta += p->delta;
+    *l = t;
+    *r = b;
+  } else {
+    marksSplit(marks, p->left, off, offset, &a, &b);
+    p = markNode(marks, t);
+    p->left = b;
+    markSetParent(marks, b, t);
+    if (a)
+      markNode(marks, a)->delta += p->delta;
+    *l = a;
+    *r = t;
+  }
+}
+
+// a and b are relative to the same base and every mark in a comes first
+static int marksMerge(marks_t *marks, int a, int b) {
+  if (!a)
+    return b;
+  if (!b)
+    return a;
+  markNode_t *p = markNode(marks, a);
+  markNode_t *q = markNode(marks, b);
+  if (p->priority > q->priority) {
+    q->delta -= p->delta;
+    p->right = marksMerge(marks, p->right, b);
+    markSetParent(marks, p->right, a);
+    return a;
+  }
+  p->delta -= q->delta;
+  q->left = marksMerge(marks, a, q->left);
+  markSetParent(marks, q->left, b);
+  return b;
+}
+
+static void marksSetRoot(marks_t *marks, int t) {
+  marks->root = t;
+  markSetParent(marks, t, 0);
+}
+
+static void markLink(marks_t *marks, int mark, int64_t offset) {
+  markNode_t *p = markNode(marks, mark);
+  p->left = p->right = 0;
+  p->delta = offset;
+  int l, r;
+  marksSplit(marks, marks->root, 0, offset, &l, &r);
+  marksSetRoot(marks, marksMerge(marks, marksMerge(marks, l, mark), r));
+}
+
+// takes mark out of the tree, putting its children in its place
+static void markUnlink(marks_t *marks, int mark) {
+  markNode_t *p = markNode(marks, mark);
+  int parent = p->parent;
+  if (p->left)
+    markNode(marks, p->left)->delta += p->delta;
+  if (p->right)
+    markNode(marks, p->right)->delta += p->delta;
+  int t = marksMerge(marks, p->left, p->right);
+  if (!parent) {
+    marksSetRoot(marks, t);
+    return;
+  }
+  markNode_t *q = markNode(marks, parent);
+  if (q->left == mark)
+    q->left = t;
+  else
+    q->right = t;
+  markSetParent(marks, t, parent);
+}
+
+int markNew(marks_t *marks, int64_t offset) {
+  int mark = marks->freeList;
+  if (mark) {
+    marks->freeList = markNode(marks, mark)->left;
+  } else {
+    mark = (int)marks->nodes.numElems;
+    arrayPushUninit(&marks->nodes);
+  }
+  markNode(marks, mark)->priority = markRandom();
+  markLink(marks, mark, max(0, offset));
+  return mark;
+}
+
+void markFree(marks_t *marks, int mark) {
+  if (!mark)
+    return;
+  markUnlink(marks, mark);
+  markNode_t *p = markNode(marks, mark);
+  p->parent = -1;
+  p->left = marks->freeList;
+  marks->freeList = mark;
+}
+
+int64_t markOffset(marks_t *marks, int mark) {
+  assert(mark);
+  int64_t offset = 0;
+  for (int i = mark; i; i = markNode(marks, i)->parent) {
+    assert(markNode(marks, i)->parent >= 0);
+    offset += markNode(marks, i)->delta;
+  }
+  return offset;
+}
+
+void markSet(marks_t *marks, int mark, int64_t offset) {
+  if (markOffset(marks, mark) == offset)
+    return;
+  markUnlink(marks, mark);
+  markLink(marks, mark, offset);
+}
+
+// len bytes were inserted at offset.  Marks at offset stay before the new
+// text.
+void marksInsert(marks_t *marks, int64_t offset, int64_t len) {
+  int l, r;
+  marksSplit(marks, marks->root, 0, offset, &l, &r);
+  if (r)
+    markNode(marks, r)->delta += len;
+  marksSetRoot(marks, marksMerge(marks, l, r));
+}
+
+static void marksCollapse(marks_t *marks, int t) {
+  if (!t)
+    return;
+  markNode_t *p = markNode(marks, t);
+  p->delta = 0;
+  marksCollapse(marks, p->left);
+  marksCollapse(marks, p->right);
+}
+
+// len bytes were deleted at offset.  Marks inside the range end up at
+// offset.
+void marksDelete(marks_t *marks, int64_t offset, int64_t len) {
+  if (len <= 0)
+    return;
+  int l, m, r;
+  marksSplit(marks, marks->root, 0, offset, &l, &r);
+  marksSplit(marks, r, 0, offset + len - 1, &m, &r);
+  if (m) {
+    marksCollapse(marks, m);
+    markNode(marks, m)->delta = offset;
+  }
+  if (r)
+    markNode(marks, r)->delta -= len;
+  marksSetRoot(marks, marksMerge(marks, marksMerge(marks, l, m), r));
+}
+
+#define MARKS_TEST_N 200
+
+// where the marks in offsets go on an edit, one at a time
+static void marksTestEdit(int64_t *offsets, bool *live, commandTag_t tag,
+                          int64_t offset, int64_t len) {
+  for (int i = 0; i < MARKS_TEST_N; ++i) {
+    if (!live[i])
+      continue;
+    if (tag == INSERT && offsets[i] > offset)
+      offsets[i] += len;
+    else if (tag == DELETE && offsets[i] >= offset + len)
+      offsets[i] -= len;
+    else if (tag == DELETE && offsets[i] > offset)
+      offsets[i] = offset;
+  }
+}
+
+void marksTest() {
+  marks_t marks;
+  marksInit(&marks);
+  int a = markNew(&marks, 10);
+  int b = markNew(&marks, 20);
+  int c = markNew(&marks, 30);
+
+  marksInsert(&marks, 25, 5); // between
+  assert(markOffset(&marks, a) == 10 && markOffset(&marks, b) == 20 &&
+         markOffset(&marks, c) == 35);
+  marksInsert(&marks, 20, 1); // at b, which stays before the new text
+  assert(markOffset(&marks, b) == 20 && markOffset(&marks, c) == 36);
+  marksInsert(&marks, 0, 4); // before them all
+  assert(markOffset(&marks, a) == 14 && markOffset(&marks, b) == 24 &&
+         markOffset(&marks, c) == 40);
+  marksDelete(&marks, 50, 10); // after them all
+  marksDelete(&marks, 0, 4);   // before them all
+  assert(markOffset(&marks, a) == 10 && markOffset(&marks, b) == 20 &&
+         markOffset(&marks, c) == 36);
+  marksDelete(&marks, 10, 10); // ending at b, starting at a
+  assert(markOffset(&marks, a) == 10 && markOffset(&marks, b) == 10 &&
+         markOffset(&marks, c) == 26);
+  marksDelete(&marks, 5, 30); // spanning them all
+  assert(markOffset(&marks, a) == 5 && markOffset(&marks, b) == 5 &&
+         markOffset(&marks, c) == 5);
+  markSet(&marks, b, 7);
+  markFree(&marks, a);
+  int d = markNew(&marks, 2); // reuses a's node
+  assert(d == a);
+  marksInsert(&marks, 3, 1);
+  assert(markOffset(&marks, d) == 2 && markOffset(&marks, b) == 8 &&
+         markOffset(&marks, c) == 6);
+  marksFree(&marks);
+
+  // against moving each mark by itself
+  marksInit(&marks);
+  int ids[MARKS_TEST_N];
+  int64_t offsets[MARKS_TEST_N];
+  bool live[MARKS_TEST_N];
+  int64_t len = 1000;
+  for (int i = 0; i < MARKS_TEST_N; ++i) {
+    offsets[i] = rand() % (len + 1);
+    ids[i] = markNew(&marks, offsets[i]);
+    live[i] = true;
+  }
+  for (int k = 0; k < 20000; ++k) {
+    int i = rand() % MARKS_TEST_N;
+    int64_t offset = rand() % (len + 1);
+    int64_t n = 1 + rand() % 50;
+    switch (rand() % 5) {
+    case 0:
+      marksInsert(&marks, offset, n);
+      marksTestEdit(offsets, live, INSERT, offset, n);
+      len += n;
+      break;
+    case 1:
+    case 2:
+      n = min(n, len - offset);
+      marksDelete(&marks, offset, n);
+      marksTestEdit(offsets, live, DELETE, offset, n);
+      len -= n;
+      break;
+    case 3:
+      if (live[i]) {
+        markFree(&marks, ids[i]);
+        live[i] = false;
+      } else {
+        ids[i] = markNew(&marks, offset);
+        offsets[i] = offset;
+        live[i] = true;
+      }
+      break;
+    default:
+      if (live[i]) {
+        markSet(&marks, ids[i], offset);
+        offsets[i] = offset;
+      }
+      break;
+    }
+    for (int j = 0; j < MARKS_TEST_N; ++j) {
+      assert(!live[j] || markOffset(&marks, ids[j]) == offsets[j]);
+    }
+  }
+  marksFree(&marks);
+}
@@ -0,0 +1,22 @@
+//
+//  Marks.h
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#ifndef Marks_h
+#define Marks_h
+
+#include "Util.h"
+
+void marksInit(marks_t *marks);
+void marksFree(marks_t *marks);
+int markNew(marks_t *marks, int64_t offset);
+void markFree(marks_t *marks, int mark);
+int64_t markOffset(marks_t *marks, int mark);
+void markSet(marks_t *marks, int mark, int64_t offset);
+void marksInsert(marks_t *marks, int64_t offset, int64_t len);
+void marksDelete(marks_t *marks, int64_t offset, int64_t len);
+
+#endif /* Marks_h */
@@ -0,0 +1,531 @@
+//
+//  Parse.c
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#include "Doc.h"
+#include "DynamicArray.h"
+#include "PieceTable.h"
+#include "Simd.h"
+#include "Syntax.h"
+#include "Parse.h"
+
+// The parser finds what the lexer can't see from one character to the next:
+// the names of functions called or defined, the names after struct, union,
+// enum or class, brackets that close nothing, and the tree of bracketed
+// blocks.  It runs as a job over a snapshot, on its own thread for big docs,
+// and makes the result the drawing doesn't read.  Taking the job flips them.
+//
+// Reparsing starts at the last checkpoint before the edits and stops at the
+// first one after them where the lexer state and the open brackets are what
+// they were: from there on the old result only needs moving.
+
+#define PARSE_CHUNK (64 << 10) // bytes copied out of the snapshot at a time
+
+static void resultInit(parseResult_t *r) {
+  r->generation = 0;
+  arrayInit(&r->spans, sizeof(parseSpan_t));
+  arrayInit(&r->blocks, sizeof(block_t));
+  arrayInit(&r->checkpoints, sizeof(parseCheckpoint_t));
+}
+
+static void resultReinit(parseResult_t *r) {
+  r->generation = 0;
+  arrayReinit(&r->spans);
+  arrayReinit(&r->blocks);
+  arrayReinit(&r->checkpoints);
+}
+
+void parserInit(parser_t *p, language_t *language) {
+  myMemset(p, 0, sizeof(parser_t));
+  p->language = language;
+  resultInit(&p->results[0]);
+  resultInit(&p->results[1]);
+  p->full = true;
+  p->editStart = -1;
+}
+
+static void parserNoEdits(parser_t *p) {
+  p->editStart = -1;
+  p->editEnd = -1;
+  p->editDelta = 0;
+}
+
+// keeps the text changed since the front result in step with an edit
+void parserEdit(parser_t *p, commandTag_t tag, int64_t offset, int64_t len) {
+  if (p->editStart < 0) {
+    p->editStart = offset;
+    p->editEnd = offset;
+  }
+  p->editStart = min(p->editStart, offset);
+  if (tag == INSERT) {
+    p->editEnd = p->editEnd >= offset ? p->editEnd + len : offset + len;
+    p->editDelta += len;
+  } else {
+    int64_t end = p->editEnd <= offset ? p->editEnd : p->editEnd - len;
+    p->editEnd = max(offset, end);
+    p->editDelta -= len;
+  }
+}
+
+typedef struct {
+  language_t *lang;
+  parseResult_t *res;
+  dynamicArray_t stack; // contains int, the blocks open, outermost first
+  tokSt_t acc;
+  bool tag;             // the last word was struct, union, enum or class
+  int64_t checkpoint;   // offset of the last one
+} parseSt_t;
+
+static block_t *blockAt(parseResult_t *r, int i) {
+  return arrayElemAt(&r->blocks, i);
+}
+
+static int stackTop(parseSt_t *ps) {
+  dynamicArray_t *a = &ps->stack;
+  return a->numElems == 0 ? -1 : *(int *)arrayElemAt(a, a->numElems - 1);
+}
+
+static void pushSpan(parseSt_t *ps, int64_t offset, int64_t len, color_t c) {
+  parseSpan_t span = {offset, len, c};
+  arrayPush(&ps->res->spans, &span);
+}
+
+static void pushCheckpoint(parseSt_t *ps, int64_t offset) {
+  parseCheckpoint_t cp = {offset, stackTop(ps), ps->acc};
+  arrayPush(&ps->res->checkpoints, &cp);
+  ps->checkpoint = offset;
+}
+
+static void parseBracket(parseSt_t *ps, char c, int64_t offset) {
+  char kind = c == ')' ? '(' : c == ']' ? '[' : c == '}' ? '{' : '\0';
+  if (!kind) {
+    block_t b = {offset, -1, stackTop(ps), (int)ps->stack.numElems, c};
+    int i = (int)ps->res->blocks.numElems;
+    arrayPush(&ps->res->blocks, &b);
+    arrayPush(&ps->stack, &i);
+    return;
+  }
+  int top = stackTop(ps);
+  if (top < 0 || blockAt(ps->res, top)->kind != kind) {
+    pushSpan(ps, offset, 1, errorColor);
+    return;
+  }
+  blockAt(ps->res, top)->close = offset;
+  arrayPop(&ps->stack);
+}
+
+static bool isTagKeyword(char *s, int n) {
+  char *tags[] = {"struct", "union", "enum", "class"};
+  for (int i = 0; i < 4; ++i) {
+    if (strlen(tags[i]) == n && strncmp(tags[i], s, n) == 0)
+      return true;
+  }
+  return false;
+}
+
+// the token s[i, i + k) that the lexer gave color.  next is the character
+// following s[n - 1], and base is the offset of s.
+static void parseToken(parseSt_t *ps, char *s, int n, char next, int i, int k,
+                       tokSt_t before, color_t color, int64_t base) {
+  if ((color == lidentColor || color == uidentColor) && before != IN_LIDENT &&
+      before != IN_UIDENT && (i + k < n || !isIdentChar(next))) {
+    if (isKeyword(ps->lang, s + i, k)) {
+      ps->tag = isTagKeyword(s + i, k);
+      return;
+    }
+    // the name at the end of a.b or 1.5
+    int j = i + k;
+    while (j > i && s[j - 1] != '.') {
+      j--;
+    }
+    int e = i + k;
+    while (e < n && (s[e] == ' ' || s[e] == '\t')) {
+      e++;
+    }
+    bool name = j < i + k && !(s[j] >= '0' && s[j] <= '9');
+    if (name && ps->tag)
+      pushSpan(ps, base + j, i + k - j, typeColor);
+    else if (name && e < n && s[e] == '(')
+      pushSpan(ps, base + j, i + k - j, functionColor);
+    ps->tag = false;
+    return;
+  }
+  for (int j = i; j < i + k; ++j) {
+    char c = s[j];
+    if (color == specialColor && strchr("()[]{}", c))
+      parseBracket(ps, c, base + j);
+    if (c != ' ' && c != '\t')
+      ps->tag = false;
+  }
+}
+
+// whether the blocks open in ps are the same kinds as the ones open in old
+// from top down
+static bool sameStack(parseSt_t *ps, parseResult_t *old, int top) {
+  for (int64_t s = ps->stack.numElems - 1; s >= 0; --s) {
+    if (top < 0)
+      return false;
+    block_t *b = blockAt(old, top);
+    if (b->kind != blockAt(ps->res, *(int *)arrayElemAt(&ps->stack, s))->kind)
+      return false;
+    top = b->parent;
+  }
+  return top < 0;
+}
+
+// the first element of a (ordered by the int64_t at the start of each) at or
+// after offset
+static int64_t lowerBound(dynamicArray_t *a, int64_t offset) {
+  int64_t lo = 0;
+  int64_t hi = a->numElems;
+  while (lo < hi) {
+    int64_t mid = (lo + hi) / 2;
+    if (*(int64_t *)arrayElemAt(a, mid) < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// the new block in place of the old block i (-1 for none), one of those open
+// where the parses met
+static int stackBlock(parseSt_t *ps, parseResult_t *old, int i) {
+  return i < 0 ? -1
+               : *(int *)arrayElemAt(&ps->stack, blockAt(old, i)->depth);
+}
+
+// the old result from its checkpoint ci on, moved by delta, is the rest of
+// the new one
+static void parseSplice(parseSt_t *ps, parseResult_t *old, int64_t ci,
+                        int64_t delta) {
+  parseCheckpoint_t *cp = arrayElemAt(&old->checkpoints, ci);
+  int64_t q = cp->offset;
+  int top = cp->top;
+  for (int64_t s = ps->stack.numElems - 1; s >= 0; --s) {
+    block_t *b = blockAt(ps->res, *(int *)arrayElemAt(&ps->stack, s));
+    block_t *o = blockAt(old, top);
+    b->close = o->close < 0 ? -1 : o->close + delta;
+    top = o->parent;
+  }
+
+  int64_t first = lowerBound(&old->blocks, q);
+  int64_t numBlocks = ps->res->blocks.numElems;
+  for (int64_t i = first; i < old->blocks.numElems; ++i) {
+    block_t b = *blockAt(old, (int)i);
+    b.open += delta;
+    b.close = b.close < 0 ? -1 : b.close + delta;
+    b.parent = b.parent >= first ? b.parent + (int)(numBlocks - first)
+                                 : stackBlock(ps, old, b.parent);
+    arrayPush(&ps->res->blocks, &b);
+  }
+  for (int64_t i = lowerBound(&old->spans, q); i < old->spans.numElems; ++i) {
+    parseSpan_t span = *(parseSpan_t *)arrayElemAt(&old->spans, i);
+    span.offset += delta;
+    arrayPush(&ps->res->spans, &span);
+  }
+  for (int64_t i = ci; i < old->checkpoints.numElems; ++i) {
+    parseCheckpoint_t c = *(parseCheckpoint_t *)arrayElemAt(&old->checkpoints, i);
+    c.offset += delta;
+    c.top = c.top >= first ? c.top + (int)(numBlocks - first)
+                           : stackBlock(ps, old, c.top);
+    arrayPush(&ps->res->checkpoints, &c);
+  }
+}
+
+// keeps the old result up to its last checkpoint at or before offset, and
+// returns where parsing starts again
+static int64_t parseResume(parseSt_t *ps, parseResult_t *old, int64_t offset,
+                           int64_t *ci) {
+  dynamicArray_t *cps = &old->checkpoints;
+  int64_t i = lowerBound(cps, offset + 1) - 1;
+  assert(i >= 0);
+  parseCheckpoint_t *cp = arrayElemAt(cps, i);
+  int64_t from = cp->offset;
+  arrayInsert(&ps->res->checkpoints, 0, cps->start, i + 1);
+  int64_t numBlocks = lowerBound(&old->blocks, from);
+  arrayInsert(&ps->res->blocks, 0, old->blocks.start, numBlocks);
+  arrayInsert(&ps->res->spans, 0, old->spans.start,
+              lowerBound(&old->spans, from));
+  for (int top = cp->top; top >= 0; top = blockAt(old, top)->parent) {
+    blockAt(ps->res, top)->close = -1;
+    arrayInsert(&ps->stack, 0, &top, 1);
+  }
+  ps->acc = cp->acc;
+  ps->checkpoint = from;
+  *ci = i + 1;
+  return from;
+}
+
+static void parserPost(void) {
+  SDL_Event event;
+  myMemset(&event, 0, sizeof(event));
+  event.type = SDL_USEREVENT;
+  event.user.code = PARSE_EVENT;
+  SDL_PushEvent(&event);
+}
+
+// parses the job's snapshot into the back result
+static int parseRun(void *arg) {
+  parser_t *p = arg;
+  parseResult_t *old = p->jobFull ? NULL : &p->results[p->front];
+  parseResult_t *res = &p->results[!p->front];
+  resultReinit(res);
+  parseSt_t ps;
+  myMemset(&ps, 0, sizeof(ps));
+  ps.lang = p->language;
+  ps.res = res;
+  arrayInit(&ps.stack, sizeof(int));
+
+  int64_t offset = 0;
+  int64_t ci = 0; // the next old checkpoint the parse can meet
+  if (old) {
+    offset = parseResume(&ps, old, p->jobStart, &ci);
+  } else {
+    ps.acc = TOKBEGIN;
+    pushCheckpoint(&ps, 0);
+  }
+
+  snapshot_t *snap = &p->snap;
+  int64_t len = snapshotLength(snap);
+  char *buf = dieIfNull(malloc(PARSE_CHUNK + 1));
+  while (offset < len) {
+    if (SDL_AtomicGet(&p->cancel))
+      goto done;
+    // whole lines unless one is longer than a chunk
+    int n = (int)min(PARSE_CHUNK, len - offset);
+    snapshotCopy(snap, offset, n + (offset + n < len), buf);
+    char next = offset + n < len ? buf[n] : '\0';
+    if (offset + n < len) {
+      int m = n;
+      while (m > 0 && buf[m - 1] != '\n') {
+        m--;
+      }
+      if (m > 0) {
+        n = m;
+        next = buf[n];
+      }
+    }
+    color_t color;
+    for (int i = 0; i < n;) {
+      tokSt_t before = ps.acc;
+      int k = lexRun(ps.lang, buf + i, n - i, next, &ps.acc, &color);
+      parseToken(&ps, buf, n, next, i, k, before, color, offset);
+      i += k;
+      if (buf[i - 1] != '\n')
+        continue;
+      ps.tag = false;
+      int64_t lineStart = offset + i;
+      if (old && lineStart >= p->jobEnd) {
+        dynamicArray_t *cps = &old->checkpoints;
+        int64_t q = lineStart - p->jobDelta;
+        while (ci < cps->numElems &&
+               ((parseCheckpoint_t *)arrayElemAt(cps, ci))->offset < q) {
+          ci++;
+        }
+        parseCheckpoint_t *cp = ci < cps->numElems ? arrayElemAt(cps, ci) : NULL;
+        if (cp && cp->offset == q && cp->acc == ps.acc &&
+            sameStack(&ps, old, cp->top)) {
+          parseSplice(&ps, old, ci, p->jobDelta);
+          res->generation = snap->generation;
+          goto done;
+        }
+      }
+      if (lineStart - ps.checkpoint >= PARSE_CHECKPOINT)
+        pushCheckpoint(&ps, lineStart);
+    }
+    offset += n;
+  }
+  res->generation = snap->generation;
+
+done:
+  free(buf);
+  arrayFree(&ps.stack);
+  SDL_AtomicSet(&p->done, 1);
+  if (p->async)
+    parserPost();
+  return 0;
+}
+
+// flips to the job's result if it's done, or waits for it if wait is set.
+// Returns whether the job was taken.
+bool parserTake(parser_t *p, bool wait) {
+  if (!p->running || (!wait && !SDL_AtomicGet(&p->done)))
+    return false;
+  SDL_WaitThread(p->thread, NULL);
+  p->thread = NULL;
+  snapshotFree(&p->snap);
+  p->running = false;
+  if (p->results[!p->front].generation != 0) {
+    p->front = !p->front;
+    p->full = false;
+  }
+  return true;
+}
+
+// starts parsing doc if there are edits the front result doesn't have and
+// no job yet.  Docs no bigger than PARSE_SYNC_LENGTH are parsed before this
+// returns.
+void parserStart(parser_t *p, doc_t *doc) {
+  if (!p->language || p->running ||
+      p->results[p->front].generation == docGeneration(doc))
+    return;
+  docSnapshot(doc, &p->snap);
+  p->jobFull = p->full || p->editStart < 0;
+  p->jobStart = p->editStart;
+  p->jobEnd = p->editEnd;
+  p->jobDelta = p->editDelta;
+  parserNoEdits(p);
+  p->running = true;
+  SDL_AtomicSet(&p->cancel, 0);
+  SDL_AtomicSet(&p->done, 0);
+  p->async = snapshotLength(&p->snap) > PARSE_SYNC_LENGTH;
+  if (p->async) {
+    simdLevel(); // detected before the thread looks
+    p->thread = dieIfNull(SDL_CreateThread(parseRun, "parse", p));
+  } else {
+    parseRun(p);
+    parserTake(p, true);
+  }
+}
+
+// forgets the result, for when the doc's text is replaced
+void parserReset(parser_t *p) {
+  if (p->running) {
+    SDL_AtomicSet(&p->cancel, 1);
+    parserTake(p, true);
+  }
+  p->full = true;
+  parserNoEdits(p);
+}
+
+void parserFree(parser_t *p) {
+  parserReset(p);
+  for (int i = 0; i < 2; ++i) {
+    arrayFree(&p->results[i].spans);
+    arrayFree(&p->results[i].blocks);
+    arrayFree(&p->results[i].checkpoints);
+  }
+}
+
+// the result of the doc's text as it is, or NULL if there's none yet
+parseResult_t *parserResult(parser_t *p, doc_t *doc) {
+  parseResult_t *r = &p->results[p->front];
+  return r->generation == docGeneration(doc) ? r : NULL;
+}
+
+// the innermost block with offset in it (or at its opening bracket), or NULL
+block_t *parseBlockAt(parseResult_t *r, int64_t offset) {
+  int64_t i = lowerBound(&r->blocks, offset + 1) - 1;
+  while (i >= 0) {
+    block_t *b = blockAt(r, (int)i);
+    if (b->close < 0 || b->close >= offset)
+      return b;
+    i = b->parent;
+  }
+  return NULL;
+}
+
+// the first span that ends after offset
+parseSpan_t *parseSpanAt(parseResult_t *r, int64_t offset) {
+  int64_t lo = 0;
+  int64_t hi = r->spans.numElems;
+  while (lo < hi) {
+    int64_t mid = (lo + hi) / 2;
+    parseSpan_t *s = arrayElemAt(&r->spans, mid);
+    if (s->offset + s->len <= offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (parseSpan_t *)r->spans.start + lo;
+}
+
+static void parseCompare(parseResult_t *a, parseResult_t *b) {
+  assert(a->spans.numElems == b->spans.numElems);
+  for (int64_t i = 0; i < a->spans.numElems; ++i) {
+    parseSpan_t *s = arrayElemAt(&a->spans, i);
+    parseSpan_t *t = arrayElemAt(&b->spans, i);
+    assert(s->offset == t->offset && s->len == t->len && s->color == t->color);
+  }
+  assert(a->blocks.numElems == b->blocks.numElems);
+  for (int i = 0; i < a->blocks.numElems; ++i) {
+    block_t *s = blockAt(a, i);
+    block_t *t = blockAt(b, i);
+    assert(s->open == t->open && s->close == t->close);
+    assert(s->parent == t->parent && s->depth == t->depth && s->kind == t->kind);
+  }
+}
+
+// the doc's result against parsing it all again
+static void parseCheck(doc_t *doc) {
+  parser_t q;
+  parserInit(&q, doc->parser.language);
+  parserStart(&q, doc);
+  parserTake(&q, true);
+  parseCompare(parserResult(&doc->parser, doc), parserResult(&q, doc));
+  for (int i = 0; i < 2; ++i) {
+    parseResult_t *r = &q.results[i];
+    arrayFree(&r->spans);
+    arrayFree(&r->blocks);
+    arrayFree(&r->checkpoints);
+  }
+}
+
+static void parseTestInsert(doc_t *doc, int64_t offset, int n) {
+  char *words[] = {"f", "(", ")", "{", "}", "[", "]", " ", "\n", "\n",
+                   "struct ", "if", "/*", "*/", "\"", "x.y", "#", "2.f"};
+  for (int i = 0; i < n; ++i) {
+    char *w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+    docInsert(doc, offset, w, strlen(w));
+    offset += strlen(w);
+  }
+}
+
+// the results reparsed after random edits against parsing everything again,
+// in a doc parsed as it's drawn and in one big enough to be parsed on a thread
+void parseTest() {
+  doc_t doc;
+  docInit(&doc, "parseTest.c", false, false);
+  srand(1);
+  parseTestInsert(&doc, 0, 16000);
+  Uint64 incremental = 0;
+  Uint64 full = 0;
+  for (int i = 0; i < 2000; ++i) {
+    for (int k = rand() % 3; k >= 0; --k) {
+      int64_t len = docLength(&doc);
+      int64_t offset = rand() % (len + 1);
+      if (rand() % 2) {
+        parseTestInsert(&doc, offset, 1 + rand() % 4);
+      } else {
+        docDelete(&doc, offset, min(len - offset, rand() % 8));
+      }
+    }
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    parserStart(&doc.parser, &doc);
+    Uint64 t1 = SDL_GetPerformanceCounter();
+    parseCheck(&doc);
+    Uint64 t2 = SDL_GetPerformanceCounter();
+    incremental += t1 - t0;
+    full += t2 - t1;
+  }
+  double freq = SDL_GetPerformanceFrequency();
+  printf("parseTest: %lld blocks, reparsed in %.3f ms (%.3f ms all of it)\n",
+         (long long)parserResult(&doc.parser, &doc)->blocks.numElems,
+         incremental / freq * 1000 / 2000, full / freq * 1000 / 2000);
+
+  docReinit(&doc);
+  parseTestInsert(&doc, 0, 1 << 20);
+  assert(docLength(&doc) > PARSE_SYNC_LENGTH);
+  for (int i = 0; i < 4; ++i) {
+    parserStart(&doc.parser, &doc);
+    assert(doc.parser.async);
+    parserTake(&doc.parser, true);
+    parseCheck(&doc);
+    parseTestInsert(&doc, rand() % docLength(&doc), 4);
+    assert(!parserResult(&doc.parser, &doc));
+  }
+}
@@ -0,0 +1,23 @@
+//
+//  Parse.h
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#ifndef Parse_h
+#define Parse_h
+
+#include "Util.h"
+
+void parserInit(parser_t *p, language_t *language);
+void parserEdit(parser_t *p, commandTag_t tag, int64_t offset, int64_t len);
+void parserStart(parser_t *p, doc_t *doc);
+bool parserTake(parser_t *p, bool wait);
+void parserReset(parser_t *p);
+void parserFree(parser_t *p);
+parseResult_t *parserResult(parser_t *p, doc_t *doc);
+block_t *parseBlockAt(parseResult_t *r, int64_t offset);
+parseSpan_t *parseSpanAt(parseResult_t *r, int64_t offset);
+
+#endif /* Parse_h */
@@ -0,0 +1,570 @@
+//
+//  PieceTable.c
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#include "PieceTable.h"
+#include "DynamicArray.h"
+#include "Simd.h"
+#include "Stats.h"
+
+// The document is the in-order concatenation of the pieces in a treap keyed
+// by (implicit) offset.  Pieces point either into the original file buffer
+// or into the add buffer.  Neither buffer is ever moved or modified once
+// written so edits only touch O(log n) tree nodes.
+//
+// Each subtree also keeps the textStats_t of its text.  The newline counts
+// make it the line index: offset <-> row lookups descend the tree and then
+// scan at most one piece.  Pieces are kept to MAX_PIECE_SIZE bytes to bound
+// that scan (and the rescans when a piece is split).
+//
+// Snapshots share the tree.  Pieces are reference counted and an edit copies
+// any shared piece on its path before changing it, so a snapshot costs
+// O(1) to take and O(log n) per edit while it is alive.  The buffers are
+// reference counted too and are only freed when the last user lets go.
+
+#define MAX_PIECE_SIZE 16384
+#define PARALLEL_STATS_SIZE (64 << 20)
+#define MAX_STATS_THREADS 16
+
+static unsigned int pieceRandom(void) {
+  static unsigned int x = 2463534242;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+static textStats_t noStats;
+
+static textStats_t *pieceStats(piece_t *p) { return p ? &p->stats : &noStats; }
+
+static int64_t pieceSize(piece_t *p) { return pieceStats(p)->size; }
+
+static int64_t pieceNumLines(piece_t *p) { return pieceStats(p)->numLines; }
+
+static void pieceUpdate(piece_t *p) {
+  statsJoin(&p->stats, pieceStats(p->left), &p->pieceStats);
+  statsJoin(&p->stats, &p->stats, pieceStats(p->right));
+}
+
+// the caller is responsible for filling in pieceStats
+static piece_t *pieceAlloc(char *start, int len, unsigned int priority) {
+  piece_t *p = dieIfNull(malloc(sizeof(piece_t)));
+  p->left = NULL;
+  p->right = NULL;
+  p->priority = priority;
+  p->start = start;
+  p->len = len;
+  SDL_AtomicSet(&p->refCount, 1);
+  return p;
+}
+
+static piece_t *pieceNew(char *start, int len, unsigned int priority) {
+  piece_t *p = pieceAlloc(start, len, priority);
+  statsOf(&p->pieceStats, start, len);
+  pieceUpdate(p);
+  return p;
+}
+
+static piece_t *pieceRetain(piece_t *p) {
+  if (p)
+    SDL_AtomicIncRef(&p->refCount);
+  return p;
+}
+
+// may be called from any thread
+static void pieceRelease(piece_t *p) {
+  if (!p || !SDL_AtomicDecRef(&p->refCount))
+    return;
+  pieceRelease(p->left);
+  pieceRelease(p->right);
+  free(p);
+}
+
+// p if nothing else refers to it, otherwise a copy that can be modified.
+// Takes over the caller's reference to p.
+static piece_t *pieceOwn(piece_t *p) {
+  if (SDL_AtomicGet(&p->refCount) == 1)
+    return p;
+  piece_t *q = pieceAlloc(p->start, p->len, p->priority);
+  q->left = pieceRetain(p->left);
+  q->right = pieceRetain(p->right);
+  q->pieceStats = p->pieceStats;
+  pieceUpdate(q);
+  pieceRelease(p);
+  return q;
+}
+
+// l gets the first k bytes of p, r gets the rest
+static void pieceSplit(piece_t *p, int64_t k, piece_t **l, piece_t **r) {
+  if (!p) {
+    *l = NULL;
+    *r = NULL;
+    return;
+  }
+
+  p = pieceOwn(p);
+  int64_t ls = pieceSize(p->left);
+
+  if (k <= ls) {
+    pieceSplit(p->left, k, l, &p->left);
+    pieceUpdate(p);
+    *r = p;
+    return;
+  }
+
+  if (k >= ls + p->len) {
+    pieceSplit(p->right, k - ls - p->len, &p->right, r);
+    pieceUpdate(p);
+    *l = p;
+    return;
+  }
+
+  // split inside of this piece.  The new piece inherits the priority so that
+  // the heap property still holds for its right subtree.
+  int m = (int)(k - ls);
+  piece_t *q = pieceNew(p->start + m, p->len - m, p->priority);
+  q->right = p->right;
+  pieceUpdate(q);
+  statsOf(&p->pieceStats, p->start, m);
+  p->len = m;
+  p->right = NULL;
+  pieceUpdate(p);
+  *l = p;
+  *r = q;
+}
+
+static piece_t *pieceMerge(piece_t *a, piece_t *b) {
+  if (!a)
+    return b;
+  if (!b)
+    return a;
+  if (a->priority >= b->priority) {
+    a = pieceOwn(a);
+    a->right = pieceMerge(a->right, b);
+    pieceUpdate(a);
+    return a;
+  }
+  b = pieceOwn(b);
+  b->left = pieceMerge(a, b->left);
+  pieceUpdate(b);
+  return b;
+}
+
+static piece_t *pieceLast(piece_t *p) {
+  while (p && p->right)
+    p = p->right;
+  return p;
+}
+
+// typing appends to the add buffer right after the previous keystroke so
+// usually the last piece can just be extended
+static bool pieceCanExtend(piece_t *p, char *chunk, char *s, int len) {
+  return p && p->start >= chunk && p->start + p->len == s &&
+         p->len + len <= MAX_PIECE_SIZE;
+}
+
+static piece_t *pieceExtendLast(piece_t *p, char *s, int len) {
+  p = pieceOwn(p);
+  if (p->right) {
+    p->right = pieceExtendLast(p->right, s, len);
+  } else {
+    textStats_t st;
+    statsOf(&st, s, len);
+    statsJoin(&p->pieceStats, &p->pieceStats, &st);
+    p->len += len;
+  }
+  pieceUpdate(p);
+  return p;
+}
+
+static pieceStorage_t *storageNew(void) {
+  pieceStorage_t *storage = dieIfNull(malloc(sizeof(pieceStorage_t)));
+  SDL_AtomicSet(&storage->refCount, 1);
+  storage->original = NULL;
+  arenaInit(&storage->add);
+  return storage;
+}
+
+static pieceStorage_t *storageRetain(pieceStorage_t *storage) {
+  SDL_AtomicIncRef(&storage->refCount);
+  return storage;
+}
+
+// may be called from any thread
+static void storageRelease(pieceStorage_t *storage) {
+  if (!storage || !SDL_AtomicDecRef(&storage->refCount))
+    return;
+  arenaFree(&storage->add);
+  free(storage->original);
+  free(storage);
+}
+
+// unique across all tables (only changed by the UI thread)
+static uint64_t lastGeneration = 0;
+
+static void pieceTableTouch(pieceTable_t *t) {
+  t->isOriginal = false;
+  t->generation = ++lastGeneration;
+}
+
+void pieceTableInit(pieceTable_t *t) {
+  myMemset(t, 0, sizeof(pieceTable_t));
+  t->storage = storageNew();
+  t->generation = ++lastGeneration;
+}
+
+void pieceTableFree(pieceTable_t *t) {
+  pieceRelease(t->root);
+  t->root = NULL;
+  storageRelease(t->storage);
+  t->storage = NULL;
+}
+
+void pieceTableReinit(pieceTable_t *t) {
+  pieceTableFree(t);
+  pieceTableInit(t);
+}
+
+typedef struct {
+  piece_t **pieces;
+  int64_t numPieces;
+} pieceStatsJob_t;
+
+static int pieceComputeStats(void *data) {
+  pieceStatsJob_t *job = data;
+  for (int64_t i = 0; i < job->numPieces; ++i) {
+    piece_t *p = job->pieces[i];
+    statsOf(&p->pieceStats, p->start, p->len);
+    pieceUpdate(p);
+  }
+  return 0;
+}
+
+// scanning the text dominates loading so big files split it across threads
+static void pieceComputeAllStats(piece_t **pieces, int64_t numPieces,
+                                 int64_t len) {
+  int numThreads = (int)clamp(1, len / PARALLEL_STATS_SIZE,
+                              min(SDL_GetCPUCount(), MAX_STATS_THREADS));
+  SDL_Thread *threads[MAX_STATS_THREADS];
+  pieceStatsJob_t jobs[MAX_STATS_THREADS];
+  int64_t perThread = (numPieces + numThreads - 1) / numThreads;
+
+  simdLevel(); // detect before the workers race to do it
+
+  for (int i = 0; i < numThreads; ++i) {
+    int64_t first = min(i * perThread, numPieces);
+    jobs[i].pieces = pieces + first;
+    jobs[i].numPieces = min(perThread, numPieces - first);
+    threads[i] =
+        i == 0 ? NULL : SDL_CreateThread(pieceComputeStats, "stats", &jobs[i]);
+    if (!threads[i])
+      pieceComputeStats(&jobs[i]);
+  }
+
+  for (int i = 1; i < numThreads; ++i) {
+    if (threads[i])
+      SDL_WaitThread(threads[i], NULL);
+  }
+}
+
+// takes ownership of buf which must hold len + 1 bytes (room for a '\0')
+void pieceTableLoad(pieceTable_t *t, char *buf, int64_t len) {
+  pieceTableReinit(t);
+  t->storage->original = buf;
+  buf[len] = '\0';
+
+  int64_t numPieces = (len + MAX_PIECE_SIZE - 1) / MAX_PIECE_SIZE;
+  piece_t **pieces = dieIfNull(malloc(max(1, numPieces) * sizeof(piece_t *)));
+
+  for (int64_t i = 0; i < numPieces; ++i) {
+    int64_t off = i * MAX_PIECE_SIZE;
+    pieces[i] =
+        pieceAlloc(buf + off, (int)min(MAX_PIECE_SIZE, len - off), pieceRandom());
+  }
+
+  pieceComputeAllStats(pieces, numPieces, len);
+
+  for (int64_t i = 0; i < numPieces; ++i) {
+    t->root = pieceMerge(t->root, pieces[i]);
+  }
+
+  free(pieces);
+  t->isOriginal = true;
+}
+
+int64_t pieceTableLength(pieceTable_t *t) { return pieceSize(t->root); }
+
+void pieceTableInsert(pieceTable_t *t, int64_t offset, char *s, int64_t len) {
+  assert(offset >= 0);
+  assert(offset <= pieceTableLength(t));
+  if (len <= 0)
+    return;
+
+  pieceTableTouch(t);
+
+  piece_t *l;
+  piece_t *r;
+  pieceSplit(t->root, offset, &l, &r);
+
+  while (len > 0) {
+    int64_t avail;
+    arena_t *add = &t->storage->add;
+    char *p = arenaReserve(add, &avail);
+    int n = (int)min(len, min(avail, MAX_PIECE_SIZE));
+    arenaAlloc(add, n);
+    myMemcpy(p, s, n);
+    if (pieceCanExtend(pieceLast(l), arenaChunkStart(add), p, n))
+      l = pieceExtendLast(l, p, n);
+    else
+      l = pieceMerge(l, pieceNew(p, n, pieceRandom()));
+    s += n;
+    len -= n;
+  }
+
+  t->root = pieceMerge(l, r);
+}
+
+int64_t pieceTableDelete(pieceTable_t *t, int64_t offset, int64_t len0) {
+  assert(offset >= 0);
+  int64_t len = min(len0, pieceTableLength(t) - offset);
+  if (len <= 0)
+    return 0;
+
+  pieceTableTouch(t);
+
+  piece_t *l;
+  piece_t *m;
+  piece_t *r;
+  pieceSplit(t->root, offset, &l, &r);
+  pieceSplit(r, len, &m, &r);
+  pieceRelease(m);
+  t->root = pieceMerge(l, r);
+  return len;
+}
+
+// contiguous bytes starting at offset (up to the end of its piece)
+static char *pieceSpan(piece_t *p, int64_t offset, int *len) {
+  while (p) {
+    int64_t ls = pieceSize(p->left);
+    if (offset < ls) {
+      p = p->left;
+      continue;
+    }
+    offset -= ls;
+    if (offset < p->len) {
+      *len = (int)(p->len - offset);
+      return p->start + offset;
+    }
+    offset -= p->len;
+    p = p->right;
+  }
+
+  *len = 0;
+  return NULL;
+}
+
+static void pieceCopy(piece_t *p, int64_t offset, int64_t len, char *dst) {
+  while (len > 0) {
+    int n;
+    char *s = pieceSpan(p, offset, &n);
+    assert(s);
+    n = (int)min(n, len);
+    myMemcpy(dst, s, n);
+    dst += n;
+    offset += n;
+    len -= n;
+  }
+}
+
+// number of newlines before offset
+static int64_t pieceRowOf(piece_t *p, int64_t offset) {
+  int64_t r = 0;
+
+  while (p) {
+    int64_t ls = pieceSize(p->left);
+    if (offset < ls) {
+      p = p->left;
+      continue;
+    }
+    r += pieceNumLines(p->left);
+    offset -= ls;
+    if (offset < p->len)
+      return r + numLinesString(p->start, offset);
+    r += p->pieceStats.numLines;
+    offset -= p->len;
+    p = p->right;
+  }
+
+  return r;
+}
+
+
+// offset of the first character of row (clamped to the last row)
+static int64_t pieceLineStart(piece_t *p, int64_t row) {
+  int64_t offset = 0;
+
+  if (row <= 0 || !p)
+    return 0;
+  if (row > p->stats.numLines)
+    row = p->stats.numLines;
+
+  // find the piece containing the row'th newline
+  while (p) {
+    int64_t ll = pieceNumLines(p->left);
+    if (row <= ll) {
+      p = p->left;
+      continue;
+    }
+    row -= ll;
+    offset += pieceSize(p->left);
+    if (row <= p->pieceStats.numLines)
+      break;
+    row -= p->pieceStats.numLines;
+    offset += p->len;
+    p = p->right;
+  }
+
+  assert(p);
+  char *s = p->start;
+  char *end = p->start + p->len;
+  while (true) {
+    s = memchr(s, '\n', end - s);
+    assert(s);
+    s++;
+    row--;
+    if (row == 0)
+      return offset + (s - p->start);
+  }
+}
+
+static char *pieceFlatten(piece_t *p, char *dst) {
+  if (!p)
+    return dst;
+  dst = pieceFlatten(p->left, dst);
+  myMemcpy(dst, p->start, p->len);
+  return pieceFlatten(p->right, dst + p->len);
+}
+
+// applies n edits at once.  The offsets are into the text before any of
+// them, in ascending order, and the edits don't overlap.  Lots of edits to a
+// table that isn't much bigger than them are cheaper as one rebuild (one
+// copy and one pass over the stats) than one at a time.
+void pieceTableApply(pieceTable_t *t, command_t *cmds, int64_t n) {
+  int64_t len = pieceTableLength(t);
+  if (n == 1 || len > n * MAX_PIECE_SIZE) {
+    // last first so that the offsets stay good
+    for (int64_t i = n - 1; i >= 0; --i) {
+      command_t *cmd = &cmds[i];
+      if (cmd->tag == INSERT)
+        pieceTableInsert(t, cmd->offset, cmd->start, cmd->len);
+      else
+        pieceTableDelete(t, cmd->offset, cmd->len);
+    }
+    return;
+  }
+
+  int64_t newLen = len;
+  for (int64_t i = 0; i < n; ++i) {
+    newLen += cmds[i].tag == INSERT ? cmds[i].len : -cmds[i].len;
+  }
+  char *buf = dieIfNull(malloc(newLen + 1));
+  char *p = buf;
+  int64_t offset = 0;
+  for (int64_t i = 0; i < n; ++i) {
+    command_t *cmd = &cmds[i];
+    assert(cmd->offset >= offset);
+    pieceTableCopy(t, offset, cmd->offset - offset, p);
+    p += cmd->offset - offset;
+    offset = cmd->offset;
+    if (cmd->tag == INSERT) {
+      myMemcpy(p, cmd->start, cmd->len);
+      p += cmd->len;
+    } else {
+      offset += cmd->len;
+    }
+  }
+  pieceTableCopy(t, offset, len - offset, p);
+  pieceTableLoad(t, buf, newLen);
+}
+
+char *pieceTableSpan(pieceTable_t *t, int64_t offset, int *len) {
+  return pieceSpan(t->root, offset, len);
+}
+
+void pieceTableCopy(pieceTable_t *t, int64_t offset, int64_t len, char *dst) {
+  pieceCopy(t->root, offset, len, dst);
+}
+
+int64_t pieceTableRowOf(pieceTable_t *t, int64_t offset) {
+  return pieceRowOf(t->root, offset);
+}
+
+int64_t pieceTableNumLines(pieceTable_t *t, int64_t offset, int64_t len) {
+  if (len <= 0)
+    return 0;
+  return pieceTableRowOf(t, offset + len) - pieceTableRowOf(t, offset);
+}
+
+int64_t pieceTableLineStart(pieceTable_t *t, int64_t row) {
+  return pieceLineStart(t->root, row);
+}
+
+textStats_t *pieceTableStats(pieceTable_t *t) { return pieceStats(t->root); }
+
+// '\0' terminated contents of the whole document.  An unedited file is
+// already contiguous (and terminated) so it is returned as is.  Otherwise the
+// document is compacted: the flattened copy becomes the new original and the
+// old buffers and pieces are freed, so the copy costs no extra memory.  The
+// text is the same, so the generation is too.  The result is valid until the
+// next edit.
+char *pieceTableCString(pieceTable_t *t) {
+  if (!t->isOriginal) {
+    int64_t n = pieceTableLength(t);
+    char *buf = dieIfNull(malloc(n + 1));
+    pieceFlatten(t->root, buf);
+    uint64_t generation = t->generation;
+    pieceTableLoad(t, buf, n);
+    t->generation = generation;
+  }
+
+  assert(t->isOriginal);
+  return t->storage->original;
+}
+
+// Read-only view of the table as it is now.  It stays valid (and unchanged)
+// while the table is edited, until snapshotFree.  Snapshots can be read and
+// freed from any thread but must be taken on the UI thread.
+void pieceTableSnapshot(pieceTable_t *t, snapshot_t *snap) {
+  snap->root = pieceRetain(t->root);
+  snap->storage = storageRetain(t->storage);
+  snap->generation = t->generation;
+}
+
+void snapshotFree(snapshot_t *snap) {
+  pieceRelease(snap->root);
+  storageRelease(snap->storage);
+  snap->root = NULL;
+  snap->storage = NULL;
+}
+
+int64_t snapshotLength(snapshot_t *snap) { return pieceSize(snap->root); }
+
+char *snapshotSpan(snapshot_t *snap, int64_t offset, int *len) {
+  return pieceSpan(snap->root, offset, len);
+}
+
+void snapshotCopy(snapshot_t *snap, int64_t offset, int64_t len, char *dst) {
+  pieceCopy(snap->root, offset, len, dst);
+}
+
+int64_t snapshotRowOf(snapshot_t *snap, int64_t offset) {
+  return pieceRowOf(snap->root, offset);
+}
+
+int64_t snapshotLineStart(snapshot_t *snap, int64_t row) {
+  return pieceLineStart(snap->root, row);
+}
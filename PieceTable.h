@@ -0,0 +1,36 @@
+//
+//  PieceTable.h
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#ifndef PieceTable_h
+#define PieceTable_h
+
+#include "Util.h"
+
+void pieceTableInit(pieceTable_t *t);
+void pieceTableReinit(pieceTable_t *t);
+void pieceTableFree(pieceTable_t *t);
+void pieceTableLoad(pieceTable_t *t, char *buf, int64_t len);
+int64_t pieceTableLength(pieceTable_t *t);
+void pieceTableInsert(pieceTable_t *t, int64_t offset, char *s, int64_t len);
+int64_t pieceTableDelete(pieceTable_t *t, int64_t offset, int64_t len);
+void pieceTableApply(pieceTable_t *t, command_t *cmds, int64_t n);
+char *pieceTableSpan(pieceTable_t *t, int64_t offset, int *len);
+void pieceTableCopy(pieceTable_t *t, int64_t offset, int64_t len, char *dst);
+int64_t pieceTableNumLines(pieceTable_t *t, int64_t offset, int64_t len);
+int64_t pieceTableRowOf(pieceTable_t *t, int64_t offset);
+int64_t pieceTableLineStart(pieceTable_t *t, int64_t row);
+textStats_t *pieceTableStats(pieceTable_t *t);
+char *pieceTableCString(pieceTable_t *t);
+void pieceTableSnapshot(pieceTable_t *t, snapshot_t *snap);
+void snapshotFree(snapshot_t *snap);
+int64_t snapshotLength(snapshot_t *snap);
+char *snapshotSpan(snapshot_t *snap, int64_t offset, int *len);
+void snapshotCopy(snapshot_t *snap, int64_t offset, int64_t len, char *dst);
+int64_t snapshotRowOf(snapshot_t *snap, int64_t offset);
+int64_t snapshotLineStart(snapshot_t *snap, int64_t row);
+
+#endif /* PieceTable_h */
@@ -7,3 +7,2540 @@
 //
 
 #include "Search.h"
+#include "Doc.h"
+#include "DynamicArray.h"
+#include "PieceTable.h"
+#include "Simd.h"
+
+// Case-insensitive substring search (ASCII letters only, like strcasestr)
+// over length-delimited buffers.  The vector kernels look for places where
+// both the first and the last byte of the needle match and only compare the
+// rest of the needle there.  When that turns up too many false candidates, and
+// on machines without the kernels, the two-way algorithm takes over, which is
+// linear in the worst case.
+
+#if defined(__x86_64__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+static uchar foldTable[256];
+
+static void foldInit(void) {
+  if (foldTable['A'] == 'a')
+    return;
+  for (int c = 0; c < 256; ++c) {
+    foldTable[c] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+  }
+}
+
+static inline char fold(char c) { return foldTable[(uchar)c]; }
+
+static char upper(char c) {
+  return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+// needle is already folded
+static bool equalFolded(char *needle, char *s, int64_t len) {
+  for (int64_t i = 0; i < len; ++i) {
+    if (needle[i] != fold(s[i]))
+      return false;
+  }
+  return true;
+}
+
+// Crochemore and Perrin's critical factorization: the needle splits at the
+// returned position into two parts and *period is the period of the right
+// one.  Both maximal suffixes are computed, under each ordering of the
+// alphabet, and the later one is used.
+static int64_t criticalFactorization(char *n, int64_t len, int64_t *period) {
+  if (len < 3) {
+    *period = 1;
+    return len - 1;
+  }
+
+  int64_t suffix = -1;
+  int64_t j = 0;
+  int64_t k = 1;
+  int64_t p = 1;
+  while (j + k < len) {
+    uchar a = n[j + k];
+    uchar b = n[suffix + k];
+    if (a < b) {
+      j += k;
+      k = 1;
+      p = j - suffix;
+    } else if (a == b) {
+      if (k != p) {
+        k++;
+      } else {
+        j += p;
+        k = 1;
+      }
+    } else {
+      suffix = j++;
+      k = p = 1;
+    }
+  }
+  *period = p;
+
+  int64_t suffixRev = -1;
+  j = 0;
+  k = p = 1;
+  while (j + k < len) {
+    uchar a = n[j + k];
+    uchar b = n[suffixRev + k];
+    if (b < a) {
+      j += k;
+      k = 1;
+      p = j - suffixRev;
+    } else if (a == b) {
+      if (k != p) {
+        k++;
+      } else {
+        j += p;
+        k = 1;
+      }
+    } else {
+      suffixRev = j++;
+      k = p = 1;
+    }
+  }
+
+  if (suffixRev < suffix)
+    return suffix + 1;
+  *period = p;
+  return suffixRev + 1;
+}
+
+void searcherInit(searcher_t *s, char *needle, int64_t len) {
+  foldInit();
+  s->len = len;
+  s->needle = dieIfNull(malloc(max(len, 1)));
+  for (int64_t i = 0; i < len; ++i) {
+    s->needle[i] = fold(needle[i]);
+  }
+  s->suffix = criticalFactorization(s->needle, len, &s->period);
+  // the part left of the factorization repeats with the same period
+  s->periodic = s->suffix + s->period <= len &&
+                memcmp(s->needle, s->needle + s->period, s->suffix) == 0;
+}
+
+void searcherFree(searcher_t *s) {
+  free(s->needle);
+  s->needle = NULL;
+}
+
+// first match in hay or -1.  The right part of the needle is compared left
+// to right, then the left part right to left.  In a periodic needle a match
+// of the right part lets the search shift by the period and remember how much
+// of the needle is already known to match.
+static int64_t twoWay(searcher_t *s, char *hay, int64_t len) {
+  char *n = s->needle;
+  int64_t m = s->len;
+  int64_t suffix = s->suffix;
+  int64_t j = 0;
+
+  if (s->periodic) {
+    int64_t period = s->period;
+    int64_t memory = 0;
+    while (j <= len - m) {
+      int64_t i = max(suffix, memory);
+      while (i < m && n[i] == fold(hay[i + j]))
+        i++;
+      if (i < m) {
+        j += i - suffix + 1;
+        memory = 0;
+        continue;
+      }
+      i = suffix - 1;
+      while (memory <= i && n[i] == fold(hay[i + j]))
+        i--;
+      if (i < memory)
+        return j;
+      j += period;
+      memory = m - period;
+    }
+    return -1;
+  }
+
+  int64_t period = max(suffix, m - suffix) + 1;
+  while (j <= len - m) {
+    int64_t i = suffix;
+    while (i < m && n[i] == fold(hay[i + j]))
+      i++;
+    if (i < m) {
+      j += i - suffix + 1;
+      continue;
+    }
+    i = suffix - 1;
+    while (i >= 0 && n[i] == fold(hay[i + j]))
+      i--;
+    if (i < 0)
+      return j;
+    j += period;
+  }
+  return -1;
+}
+
+// the vector kernels hand over to twoWay once the bytes spent on false
+// candidates outgrow the bytes scanned
+#define FILTER_GIVES_UP(wasted, scanned) ((wasted) > 4096 + 4 * (scanned))
+
+#ifdef SIMD_X86
+// true if a match was found at *pos.  Otherwise the search continues from
+// *pos with twoWay.
+static bool filterSSE2(searcher_t *s, char *hay, int64_t len, int64_t *pos) {
+  char *n = s->needle;
+  int64_t m = s->len;
+  __m128i first = _mm_set1_epi8(n[0]);
+  __m128i firstUp = _mm_set1_epi8(upper(n[0]));
+  __m128i last = _mm_set1_epi8(n[m - 1]);
+  __m128i lastUp = _mm_set1_epi8(upper(n[m - 1]));
+  int64_t i = *pos;
+  int64_t start = i;
+  int64_t wasted = 0;
+
+  while (i + m - 1 + 16 <= len) {
+    __m128i a = _mm_loadu_si128((__m128i *)(hay + i));
+    __m128i b = _mm_loadu_si128((__m128i *)(hay + i + m - 1));
+    __m128i eqFirst =
+        _mm_or_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(a, firstUp));
+    __m128i eqLast =
+        _mm_or_si128(_mm_cmpeq_epi8(b, last), _mm_cmpeq_epi8(b, lastUp));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(eqFirst, eqLast));
+    while (mask) {
+      int64_t k = i + __builtin_ctz(mask);
+      if (equalFolded(n + 1, hay + k + 1, m - 2)) {
+        *pos = k;
+        return true;
+      }
+      wasted += m;
+      mask &= mask - 1;
+    }
+    i += 16;
+    if (FILTER_GIVES_UP(wasted, i - start))
+      break;
+  }
+
+  *pos = i;
+  return false;
+}
+
+__attribute__((target("avx2"))) static bool
+filterAVX2(searcher_t *s, char *hay, int64_t len, int64_t *pos) {
+  char *n = s->needle;
+  int64_t m = s->len;
+  __m256i first = _mm256_set1_epi8(n[0]);
+  __m256i firstUp = _mm256_set1_epi8(upper(n[0]));
+  __m256i last = _mm256_set1_epi8(n[m - 1]);
+  __m256i lastUp = _mm256_set1_epi8(upper(n[m - 1]));
+  int64_t i = *pos;
+  int64_t start = i;
+  int64_t wasted = 0;
+
+  while (i + m - 1 + 32 <= len) {
+    __m256i a = _mm256_loadu_si256((__m256i *)(hay + i));
+    __m256i b = _mm256_loadu_si256((__m256i *)(hay + i + m - 1));
+    __m256i eqFirst = _mm256_or_si256(_mm256_cmpeq_epi8(a, first),
+                                      _mm256_cmpeq_epi8(a, firstUp));
+    __m256i eqLast = _mm256_or_si256(_mm256_cmpeq_epi8(b, last),
+                                     _mm256_cmpeq_epi8(b, lastUp));
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(eqFirst, eqLast));
+    while (mask) {
+      int64_t k = i + __builtin_ctz(mask);
+      if (equalFolded(n + 1, hay + k + 1, m - 2)) {
+        *pos = k;
+        return true;
+      }
+      wasted += m;
+      mask &= mask - 1;
+    }
+    i += 32;
+    if (FILTER_GIVES_UP(wasted, i - start))
+      break;
+  }
+
+  *pos = i;
+  return false;
+}
+#endif
+
+// offset of the first match in hay or -1
+int64_t searcherFind(searcher_t *s, char *hay, int64_t len) {
+  if (s->len == 0)
+    return 0;
+  if (s->len > len)
+    return -1;
+
+  int64_t pos = 0;
+  switch (simdLevel()) {
+#ifdef SIMD_X86
+  case SIMD_AVX2:
+    if (filterAVX2(s, hay, len, &pos))
+      return pos;
+    break;
+  case SIMD_SSE2:
+    if (filterSSE2(s, hay, len, &pos))
+      return pos;
+    break;
+#endif
+  default:
+    break;
+  }
+
+  int64_t k = twoWay(s, hay + pos, len - pos);
+  return k < 0 ? -1 : pos + k;
+}
+
+// what a search reads.  A snapshot can be searched from any thread, and the
+// search stops early once cancel is set.
+typedef struct {
+  snapshot_t *snap;
+  SDL_atomic_t *cancel; // or NULL
+} text_t;
+
+static bool textCancelled(text_t *t) {
+  return t->cancel && SDL_AtomicGet(t->cancel);
+}
+
+static int64_t textLength(text_t *t) { return snapshotLength(t->snap); }
+
+static char textCharAt(text_t *t, int64_t offset) {
+  char c = '\0';
+  if (offset >= 0 && offset < textLength(t))
+    snapshotCopy(t->snap, offset, 1, &c);
+  return c;
+}
+
+// up to SEARCH_CHUNK bytes, so a search can check whether to stop
+static char *textSpan(text_t *t, int64_t offset, int *len) {
+  char *s = snapshotSpan(t->snap, offset, len);
+  *len = min(*len, SEARCH_CHUNK);
+  return s;
+}
+
+// calls found with the offset of every match in t, in order and including
+// overlapping ones.  Each piece is searched where it lies.  Only the bytes
+// around the boundaries between pieces are copied, to find the matches that
+// straddle them.
+static void searchText(searcher_t *s, text_t *t, searchFound_t found,
+                       void *arg) {
+  int64_t m = s->len;
+  if (m == 0)
+    return;
+
+  char *buf = dieIfNull(malloc(2 * m));
+  int64_t docLen = textLength(t);
+  int64_t offset = 0;
+  int n;
+  char *span;
+  while (!textCancelled(t) && (span = textSpan(t, offset, &n))) {
+    int64_t i = 0;
+    int64_t k;
+    while ((k = searcherFind(s, span + i, n - i)) >= 0) {
+      found(arg, offset + i + k, m);
+      i += k + 1;
+    }
+
+    // matches that start in this piece and end in a later one
+    int64_t a = max(offset, offset + n - (m - 1));
+    int64_t b = min(docLen, offset + n + (m - 1));
+    offset += n;
+    if (m == 1 || b - offset < 1)
+      continue;
+    snapshotCopy(t->snap, a, b - a, buf);
+    i = 0;
+    while ((k = searcherFind(s, buf + i, b - a - i)) >= 0 &&
+           a + i + k < offset) {
+      found(arg, a + i + k, m);
+      i += k + 1;
+    }
+  }
+  free(buf);
+}
+
+void searchDoc(searcher_t *s, doc_t *doc, searchFound_t found, void *arg) {
+  snapshot_t snap;
+  docSnapshot(doc, &snap);
+  text_t t = {&snap, NULL};
+  searchText(s, &t, found, arg);
+  snapshotFree(&snap);
+}
+
+// Regular expressions.  A pattern compiles to a Thompson NFA: a program in
+// which SPLIT prefers its first branch, so the threads of a search are
+// ordered by priority.  The search runs that program as a lazy DFA whose
+// states are ordered lists of threads, built the first time they're needed.
+// This finds the leftmost-first (Perl) match in one pass with constant work
+// per byte however the pattern is written.  The forward DFA finds where the
+// match ends and a DFA of the reversed pattern, run backwards from there,
+// where it starts.  Capture groups need the NFA itself (a Pike VM), which
+// only ever runs over the text of one match.
+//
+// Searches are case-insensitive like the literal ones.  '.' and negated
+// classes match any character but a newline, including a whole UTF-8
+// sequence.  Empty matches are never reported.
+
+#define RE_MAX_INSTS 10000
+#define RE_MAX_GROUPS 32
+#define RE_MAX_REPEAT 1000
+#define DFA_MAX_STATES 2048 // the cache starts over when it fills up
+#define DFA_DEAD 0
+
+enum { RE_SET, RE_SPLIT, RE_JMP, RE_SAVE, RE_BOL, RE_EOL, RE_MATCH };
+
+typedef struct {
+  int op;
+  int x; // the set of RE_SET, the first branch of RE_SPLIT, the slot of RE_SAVE
+  int y; // the second branch of RE_SPLIT
+} reInst_t;
+
+typedef struct {
+  uint32_t bits[8];
+} reSet_t;
+
+static void setAdd(reSet_t *set, uchar c) {
+  set->bits[c >> 5] |= 1u << (c & 31);
+}
+
+static bool setHas(reSet_t *set, uchar c) {
+  return (set->bits[c >> 5] >> (c & 31)) & 1;
+}
+
+static void setAddRange(reSet_t *set, int lo, int hi) {
+  for (int c = lo; c <= hi; ++c) {
+    setAdd(set, c);
+  }
+}
+
+static void setFold(reSet_t *set) {
+  for (int c = 'a'; c <= 'z'; ++c) {
+    if (setHas(set, c) || setHas(set, upper(c))) {
+      setAdd(set, c);
+      setAdd(set, upper(c));
+    }
+  }
+}
+
+enum { N_EMPTY, N_SET, N_CAT, N_ALT, N_REPEAT, N_GROUP, N_BOL, N_EOL };
+
+typedef struct {
+  int type;
+  int a;
+  int b;
+  int x; // the set of N_SET, the number of N_GROUP
+  int min;
+  int max; // -1 if unbounded
+  bool greedy;
+} reNode_t;
+
+typedef struct {
+  char *p;
+  char *end;
+  dynamicArray_t nodes; // contains reNode_t
+  dynamicArray_t *sets;
+  int numGroups;
+  char *err;
+} reParser_t;
+
+static reNode_t *nodeAt(reParser_t *ps, int i) {
+  return arrayElemAt(&ps->nodes, i);
+}
+
+static int newNode(reParser_t *ps, int type, int a, int b) {
+  reNode_t *n = arrayPushUninit(&ps->nodes);
+  myMemset(n, 0, sizeof(reNode_t));
+  n->type = type;
+  n->a = a;
+  n->b = b;
+  return (int)ps->nodes.numElems - 1;
+}
+
+static int setNode(reParser_t *ps, reSet_t *set) {
+  setFold(set);
+  arrayPush(ps->sets, set);
+  int n = newNode(ps, N_SET, 0, 0);
+  nodeAt(ps, n)->x = (int)ps->sets->numElems - 1;
+  return n;
+}
+
+static int rangeNode(reParser_t *ps, int lo, int hi) {
+  reSet_t set;
+  myMemset(&set, 0, sizeof(set));
+  setAddRange(&set, lo, hi);
+  return setNode(ps, &set);
+}
+
+static int catNode(reParser_t *ps, int a, int b) {
+  return newNode(ps, N_CAT, a, b);
+}
+
+// one character that isn't a newline: an ASCII byte in ascii, a UTF-8
+// sequence or, failing that, any other byte
+static int anyCharNode(reParser_t *ps, reSet_t *ascii) {
+  for (int c = 0x80; c < 0x100; ++c) {
+    ascii->bits[c >> 5] &= ~(1u << (c & 31));
+  }
+  ascii->bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+  int two = catNode(ps, rangeNode(ps, 0xc2, 0xdf), rangeNode(ps, 0x80, 0xbf));
+  int three = catNode(ps, rangeNode(ps, 0xe0, 0xef),
+                      catNode(ps, rangeNode(ps, 0x80, 0xbf),
+                              rangeNode(ps, 0x80, 0xbf)));
+  int four = catNode(
+      ps, rangeNode(ps, 0xf0, 0xf4),
+      catNode(ps, rangeNode(ps, 0x80, 0xbf),
+              catNode(ps, rangeNode(ps, 0x80, 0xbf), rangeNode(ps, 0x80, 0xbf))));
+  int other = rangeNode(ps, 0x80, 0xff);
+  int multi = newNode(ps, N_ALT, two,
+                      newNode(ps, N_ALT, three, newNode(ps, N_ALT, four, other)));
+  return newNode(ps, N_ALT, setNode(ps, ascii), multi);
+}
+
+static void setComplement(reSet_t *set) {
+  for (int i = 0; i < 8; ++i) {
+    set->bits[i] = ~set->bits[i];
+  }
+}
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = fold(c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+// the byte after a backslash, or -1 if the escape is a class (\d, \w, \s and
+// their complements), which is added to set
+static int parseEscape(reParser_t *ps, reSet_t *set, bool *negated) {
+  if (ps->p >= ps->end) {
+    ps->err = "trailing backslash";
+    return 0;
+  }
+  char c = *ps->p++;
+  *negated = c >= 'A' && c <= 'Z';
+  switch (fold(c)) {
+  case 'd':
+    setAddRange(set, '0', '9');
+    return -1;
+  case 'w':
+    setAddRange(set, 'a', 'z');
+    setAddRange(set, 'A', 'Z');
+    setAddRange(set, '0', '9');
+    setAdd(set, '_');
+    return -1;
+  case 's':
+    setAdd(set, ' ');
+    setAddRange(set, '\t', '\r');
+    return -1;
+  }
+  *negated = false;
+  switch (c) {
+  case 'n':
+    return '\n';
+  case 't':
+    return '\t';
+  case 'r':
+    return '\r';
+  case 'f':
+    return '\f';
+  case 'v':
+    return '\v';
+  case 'x':
+    if (ps->end - ps->p >= 2 && hexDigit(ps->p[0]) >= 0 &&
+        hexDigit(ps->p[1]) >= 0) {
+      int b = hexDigit(ps->p[0]) * 16 + hexDigit(ps->p[1]);
+      ps->p += 2;
+      return b;
+    }
+    return 'x';
+  default:
+    return (uchar)c;
+  }
+}
+
+static int parseClass(reParser_t *ps) {
+  reSet_t set;
+  myMemset(&set, 0, sizeof(set));
+  bool negated = ps->p < ps->end && *ps->p == '^';
+  if (negated)
+    ps->p++;
+
+  char *start = ps->p;
+  while (ps->p < ps->end && (*ps->p != ']' || ps->p == start)) {
+    int lo = (uchar)*ps->p++;
+    if (lo == '\\') {
+      reSet_t esc;
+      myMemset(&esc, 0, sizeof(esc));
+      bool escNegated;
+      lo = parseEscape(ps, &esc, &escNegated);
+      if (lo < 0) {
+        if (escNegated)
+          setComplement(&esc);
+        for (int i = 0; i < 8; ++i) {
+          set.bits[i] |= esc.bits[i];
+        }
+        continue;
+      }
+    }
+    int hi = lo;
+    if (ps->end - ps->p >= 2 && ps->p[0] == '-' && ps->p[1] != ']') {
+      ps->p++;
+      hi = (uchar)*ps->p++;
+      if (hi == '\\') {
+        reSet_t esc;
+        myMemset(&esc, 0, sizeof(esc));
+        bool escNegated;
+        hi = parseEscape(ps, &esc, &escNegated);
+      }
+      if (hi < lo) {
+        ps->err = "bad class range";
+        return 0;
+      }
+    }
+    setAddRange(&set, lo, hi);
+  }
+  if (ps->p >= ps->end) {
+    ps->err = "missing ]";
+    return 0;
+  }
+  ps->p++;
+
+  if (!negated)
+    return setNode(ps, &set);
+  setFold(&set);
+  setComplement(&set);
+  return anyCharNode(ps, &set);
+}
+
+static int parseAlt(reParser_t *ps);
+
+static int parseAtom(reParser_t *ps) {
+  char c = *ps->p++;
+  reSet_t set;
+  myMemset(&set, 0, sizeof(set));
+  switch (c) {
+  case '(': {
+    bool capture = !(ps->end - ps->p >= 2 && ps->p[0] == '?' && ps->p[1] == ':');
+    int group = 0;
+    if (capture) {
+      group = ++ps->numGroups;
+      if (group > RE_MAX_GROUPS)
+        ps->err = "too many groups";
+    } else {
+      ps->p += 2;
+    }
+    int a = parseAlt(ps);
+    if (ps->p >= ps->end || *ps->p != ')') {
+      ps->err = "missing )";
+      return a;
+    }
+    ps->p++;
+    if (!capture)
+      return a;
+    int n = newNode(ps, N_GROUP, a, 0);
+    nodeAt(ps, n)->x = group;
+    return n;
+  }
+  case '.':
+    setComplement(&set);
+    return anyCharNode(ps, &set);
+  case '^':
+    return newNode(ps, N_BOL, 0, 0);
+  case '$':
+    return newNode(ps, N_EOL, 0, 0);
+  case '[':
+    return parseClass(ps);
+  case '*':
+  case '+':
+  case '?':
+    ps->err = "nothing to repeat";
+    return 0;
+  case '\\': {
+    bool negated;
+    int b = parseEscape(ps, &set, &negated);
+    if (b >= 0) {
+      setAdd(&set, b);
+    } else if (negated) {
+      setFold(&set);
+      setComplement(&set);
+      return anyCharNode(ps, &set);
+    }
+    return setNode(ps, &set);
+  }
+  default:
+    setAdd(&set, c);
+    return setNode(ps, &set);
+  }
+}
+
+static bool parseNumber(reParser_t *ps, int *n) {
+  if (ps->p >= ps->end || *ps->p < '0' || *ps->p > '9')
+    return false;
+  *n = 0;
+  while (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9') {
+    int digit = *ps->p++ - '0';
+    *n = min(*n * 10 + digit, RE_MAX_REPEAT + 1);
+  }
+  return true;
+}
+
+// {m}, {m,} or {m,n}.  Anything else leaves the '{' to be a literal.
+static bool parseCount(reParser_t *ps, int *min, int *max) {
+  char *start = ps->p;
+  ps->p++;
+  if (!parseNumber(ps, min))
+    goto literal;
+  *max = *min;
+  if (ps->p < ps->end && *ps->p == ',') {
+    ps->p++;
+    if (!parseNumber(ps, max))
+      *max = -1;
+  }
+  if (ps->p >= ps->end || *ps->p != '}')
+    goto literal;
+  ps->p++;
+  if (*min > RE_MAX_REPEAT || *max > RE_MAX_REPEAT)
+    ps->err = "repeat count too big";
+  else if (*max >= 0 && *max < *min)
+    ps->err = "bad repeat count";
+  return true;
+
+literal:
+  ps->p = start;
+  return false;
+}
+
+static int parseRepeat(reParser_t *ps) {
+  int a = parseAtom(ps);
+  while (!ps->err && ps->p < ps->end) {
+    int min;
+    int max;
+    switch (*ps->p) {
+    case '*':
+      min = 0;
+      max = -1;
+      ps->p++;
+      break;
+    case '+':
+      min = 1;
+      max = -1;
+      ps->p++;
+      break;
+    case '?':
+      min = 0;
+      max = 1;
+      ps->p++;
+      break;
+    case '{':
+      if (parseCount(ps, &min, &max))
+        break;
+      return a;
+    default:
+      return a;
+    }
+    bool greedy = !(ps->p < ps->end && *ps->p == '?');
+    if (!greedy)
+      ps->p++;
+    a = newNode(ps, N_REPEAT, a, 0);
+    reNode_t *n = nodeAt(ps, a);
+    n->min = min;
+    n->max = max;
+    n->greedy = greedy;
+  }
+  return a;
+}
+
+static int parseCat(reParser_t *ps) {
+  int a = -1;
+  while (!ps->err && ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+    int b = parseRepeat(ps);
+    a = a < 0 ? b : catNode(ps, a, b);
+  }
+  return a < 0 ? newNode(ps, N_EMPTY, 0, 0) : a;
+}
+
+static int parseAlt(reParser_t *ps) {
+  int a = parseCat(ps);
+  while (!ps->err && ps->p < ps->end && *ps->p == '|') {
+    ps->p++;
+    a = newNode(ps, N_ALT, a, parseCat(ps));
+  }
+  return a;
+}
+
+static int emitInst(dynamicArray_t *prog, int op, int x, int y) {
+  reInst_t *inst = arrayPushUninit(prog);
+  inst->op = op;
+  inst->x = x;
+  inst->y = y;
+  return (int)prog->numElems - 1;
+}
+
+static reInst_t *instAt(dynamicArray_t *prog, int pc) {
+  return arrayElemAt(prog, pc);
+}
+
+static void patchSplit(dynamicArray_t *prog, int pc, int a, int b,
+                       bool greedy) {
+  instAt(prog, pc)->x = greedy ? a : b;
+  instAt(prog, pc)->y = greedy ? b : a;
+}
+
+// reversed, the program matches the reversed text: concatenations run
+// backwards and the anchors trade places
+static void emitNode(reParser_t *ps, dynamicArray_t *prog, int i, bool rev) {
+  if (ps->err)
+    return;
+  if (prog->numElems > RE_MAX_INSTS) {
+    ps->err = "pattern too big";
+    return;
+  }
+  reNode_t n = *nodeAt(ps, i);
+  switch (n.type) {
+  case N_EMPTY:
+    return;
+  case N_SET:
+    emitInst(prog, RE_SET, n.x, 0);
+    return;
+  case N_BOL:
+    emitInst(prog, rev ? RE_EOL : RE_BOL, 0, 0);
+    return;
+  case N_EOL:
+    emitInst(prog, rev ? RE_BOL : RE_EOL, 0, 0);
+    return;
+  case N_CAT:
+    emitNode(ps, prog, rev ? n.b : n.a, rev);
+    emitNode(ps, prog, rev ? n.a : n.b, rev);
+    return;
+  case N_ALT: {
+    int split = emitInst(prog, RE_SPLIT, 0, 0);
+    emitNode(ps, prog, n.a, rev);
+    int jmp = emitInst(prog, RE_JMP, 0, 0);
+    patchSplit(prog, split, split + 1, jmp + 1, true);
+    emitNode(ps, prog, n.b, rev);
+    instAt(prog, jmp)->x = (int)prog->numElems;
+    return;
+  }
+  case N_GROUP:
+    if (!rev)
+      emitInst(prog, RE_SAVE, 2 * n.x, 0);
+    emitNode(ps, prog, n.a, rev);
+    if (!rev)
+      emitInst(prog, RE_SAVE, 2 * n.x + 1, 0);
+    return;
+  case N_REPEAT: {
+    // a{2,} is a a*, written a a+ so the last copy loops on itself
+    int copies = n.max < 0 ? max(n.min - 1, 0) : n.min;
+    for (int k = 0; k < copies; ++k) {
+      emitNode(ps, prog, n.a, rev);
+    }
+    if (n.max < 0 && n.min == 0) {
+      int split = emitInst(prog, RE_SPLIT, 0, 0);
+      emitNode(ps, prog, n.a, rev);
+      int jmp = emitInst(prog, RE_JMP, split, 0);
+      patchSplit(prog, split, split + 1, jmp + 1, n.greedy);
+      return;
+    }
+    if (n.max < 0) {
+      int loop = (int)prog->numElems;
+      emitNode(ps, prog, n.a, rev);
+      int split = emitInst(prog, RE_SPLIT, 0, 0);
+      patchSplit(prog, split, loop, split + 1, n.greedy);
+      return;
+    }
+    // a{0,3} is (a(a(a)?)?)?
+    dynamicArray_t splits;
+    arrayInit(&splits, sizeof(int));
+    for (int k = n.min; k < n.max && !ps->err; ++k) {
+      int split = emitInst(prog, RE_SPLIT, 0, 0);
+      arrayPush(&splits, &split);
+      emitNode(ps, prog, n.a, rev);
+    }
+    for (int64_t k = 0; k < splits.numElems; ++k) {
+      int split = *(int *)arrayElemAt(&splits, k);
+      patchSplit(prog, split, split + 1, (int)prog->numElems, n.greedy);
+    }
+    arrayFree(&splits);
+    return;
+  }
+  }
+}
+
+typedef struct {
+  int list;  // index of its first thread in dfa->lists
+  int len;
+  int flags;
+  int next[256]; // next state << 1 | a match ended before the byte, -1 if unknown
+} dfaState_t;
+
+#define DFA_BOL 1     // at the start of a line
+#define DFA_NOSTART 2 // a match was seen so no new threads start
+
+static void dfaFlush(dfa_t *d) {
+  d->flushes++;
+  arrayReinit(&d->states);
+  arrayReinit(&d->lists);
+  myMemset(d->table, 0, 2 * DFA_MAX_STATES * sizeof(int));
+  d->start[0] = -1;
+  d->start[1] = -1;
+  dfaState_t *dead = arrayPushUninit(&d->states);
+  dead->list = 0;
+  dead->len = 0;
+  dead->flags = DFA_NOSTART;
+  for (int b = 0; b < 256; ++b) {
+    dead->next[b] = DFA_DEAD << 1;
+  }
+}
+
+static void dfaInit(dfa_t *d, dynamicArray_t *sets, bool anchored,
+                    bool longest) {
+  arrayInit(&d->prog, sizeof(reInst_t));
+  d->sets = sets;
+  d->anchored = anchored;
+  d->longest = longest;
+  arrayInit(&d->states, sizeof(dfaState_t));
+  arrayInit(&d->lists, sizeof(int));
+  d->table = dieIfNull(malloc(2 * DFA_MAX_STATES * sizeof(int)));
+  d->flushes = 0;
+  d->seen = NULL;
+  d->stack = NULL;
+  d->list = NULL;
+  d->list2 = NULL;
+  d->stamp = 0;
+  dfaFlush(d);
+}
+
+// once the program is complete
+static void dfaAllocScratch(dfa_t *d) {
+  // a thread is an instruction and whether it has matched any bytes yet
+  int64_t n = 2 * d->prog.numElems + 2;
+  d->seen = dieIfNull(calloc(n, sizeof(int)));
+  d->stack = dieIfNull(malloc(2 * n * sizeof(int)));
+  d->list = dieIfNull(malloc(n * sizeof(int)));
+  d->list2 = dieIfNull(malloc(n * sizeof(int)));
+}
+
+static void dfaFree(dfa_t *d) {
+  arrayFree(&d->prog);
+  arrayFree(&d->states);
+  arrayFree(&d->lists);
+  free(d->table);
+  free(d->seen);
+  free(d->stack);
+  free(d->list);
+  free(d->list2);
+}
+
+static reInst_t *dfaInst(dfa_t *d, int thread) {
+  return instAt(&d->prog, thread >> 1);
+}
+
+// appends the threads reachable from thread to out in priority order.
+// Unless eol is known to hold, RE_EOL is left for the transition, which knows
+// the next byte.
+static void dfaClosure(dfa_t *d, int thread, bool bol, bool eol, int *out,
+                       int *n) {
+  int sp = 0;
+  d->stack[sp++] = thread;
+  while (sp > 0) {
+    thread = d->stack[--sp];
+    if (d->seen[thread] == d->stamp)
+      continue;
+    d->seen[thread] = d->stamp;
+    reInst_t *inst = dfaInst(d, thread);
+    int moved = thread & 1;
+    switch (inst->op) {
+    case RE_JMP:
+      d->stack[sp++] = inst->x << 1 | moved;
+      break;
+    case RE_SPLIT:
+      d->stack[sp++] = inst->y << 1 | moved;
+      d->stack[sp++] = inst->x << 1 | moved;
+      break;
+    case RE_SAVE:
+      d->stack[sp++] = thread + 2;
+      break;
+    case RE_BOL:
+      if (bol)
+        d->stack[sp++] = thread + 2;
+      break;
+    case RE_EOL:
+      if (eol)
+        d->stack[sp++] = thread + 2;
+      else
+        out[(*n)++] = thread;
+      break;
+    default:
+      out[(*n)++] = thread;
+    }
+  }
+}
+
+// may be empty, so not arrayElemAt
+static int *dfaList(dfa_t *d, dfaState_t *st) {
+  return (int *)d->lists.start + st->list;
+}
+
+static uint64_t dfaHash(int *list, int n, int flags) {
+  uint64_t h = 14695981039346656037ull ^ flags;
+  for (int i = 0; i < n; ++i) {
+    h = (h ^ list[i]) * 1099511628211ull;
+  }
+  return h;
+}
+
+static int dfaState(dfa_t *d, int *list, int n, int flags) {
+  if (n == 0 && (flags & DFA_NOSTART))
+    return DFA_DEAD;
+  int mask = 2 * DFA_MAX_STATES - 1;
+  int h = dfaHash(list, n, flags) & mask;
+  for (;; h = (h + 1) & mask) {
+    int s = d->table[h] - 1;
+    if (s < 0)
+      break;
+    dfaState_t *st = arrayElemAt(&d->states, s);
+    if (st->len == n && st->flags == flags &&
+        memcmp(dfaList(d, st), list, n * sizeof(int)) == 0)
+      return s;
+  }
+
+  if (d->states.numElems >= DFA_MAX_STATES) {
+    dfaFlush(d);
+    return dfaState(d, list, n, flags);
+  }
+  int s = (int)d->states.numElems;
+  dfaState_t *st = arrayPushUninit(&d->states);
+  st->list = (int)d->lists.numElems;
+  st->len = n;
+  st->flags = flags;
+  for (int b = 0; b < 256; ++b) {
+    st->next[b] = -1;
+  }
+  arrayInsert(&d->lists, d->lists.numElems, list, n);
+  d->table[h] = s + 1;
+  return s;
+}
+
+static int dfaStart(dfa_t *d, bool bol) {
+  if (d->start[bol] < 0) {
+    int n = 0;
+    d->stamp++;
+    dfaClosure(d, 0, bol, false, d->list, &n);
+    d->start[bol] =
+        dfaState(d, d->list, n, (bol ? DFA_BOL : 0) |
+                                    (d->anchored ? DFA_NOSTART : 0));
+  }
+  return d->start[bol];
+}
+
+// the threads of state s with its RE_EOLs followed if eol holds.  Returns
+// whether a thread that has matched some bytes reaches RE_MATCH.  Unless
+// looking for the longest match the threads after it are dropped.
+static bool dfaExpand(dfa_t *d, int s, bool eol, int *out, int *n) {
+  dfaState_t *st = arrayElemAt(&d->states, s);
+  int *list = dfaList(d, st);
+  int len = st->len;
+  bool bol = st->flags & DFA_BOL;
+  *n = 0;
+  d->stamp++;
+  for (int i = 0; i < len; ++i) {
+    int thread = list[i];
+    if (dfaInst(d, thread)->op == RE_EOL) {
+      if (eol)
+        dfaClosure(d, thread + 2, bol, true, out, n);
+    } else if (d->seen[thread] != d->stamp) {
+      d->seen[thread] = d->stamp;
+      out[(*n)++] = thread;
+    }
+  }
+  for (int i = 0; i < *n; ++i) {
+    if (dfaInst(d, out[i])->op == RE_MATCH && (out[i] & 1)) {
+      if (!d->longest)
+        *n = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static int dfaStep(dfa_t *d, int s, uchar b) {
+  int n;
+  bool eol = b == '\n';
+  bool matched = dfaExpand(d, s, eol, d->list2, &n);
+  int flags = ((dfaState_t *)arrayElemAt(&d->states, s))->flags;
+  if (matched && !d->longest)
+    flags |= DFA_NOSTART;
+
+  int m = 0;
+  d->stamp++;
+  for (int i = 0; i < n; ++i) {
+    reInst_t *inst = dfaInst(d, d->list2[i]);
+    if (inst->op == RE_SET &&
+        setHas(arrayElemAt(d->sets, inst->x), b))
+      dfaClosure(d, (d->list2[i] | 1) + 2, eol, false, d->list, &m);
+  }
+  if (!(flags & DFA_NOSTART))
+    dfaClosure(d, 0, eol, false, d->list, &m);
+
+  int64_t numStates = d->states.numElems;
+  int next = dfaState(d, d->list, m, (flags & DFA_NOSTART) | (eol ? DFA_BOL : 0));
+  int t = next << 1 | matched;
+  // unless the cache was flushed and s is gone
+  if (d->states.numElems >= numStates)
+    ((dfaState_t *)arrayElemAt(&d->states, s))->next[b] = t;
+  return t;
+}
+
+static bool dfaMatchAtEnd(dfa_t *d, int s, bool eol) {
+  int n;
+  return dfaExpand(d, s, eol, d->list2, &n);
+}
+
+static dfaState_t *dfaStates(dfa_t *d) { return arrayElemAt(&d->states, 0); }
+
+// Finding every match searches for the end of each from the end of the one
+// before.  That search only stops once the DFA dies, which can be far past
+// the match, so for a pattern like a*b|a a run of a's would be scanned again
+// for every one of its matches.  But the DFA is deterministic: a search that
+// gets to an offset in the state an earlier one was in there goes on the same
+// way and ends the same way.  So once they have found a match, which is when
+// they go past where the next search starts, searches leave visits for the
+// ones after, at every offset near where they started leaving them and at
+// every RE_MEMO_STRIDE bytes beyond.  A search that falls in with an earlier
+// one stops within a stride of there, so a run like that is scanned about
+// once however many matches it has.
+
+#define RE_MEMO_RECENT (1 << 16) // a power of 2
+#define RE_MEMO_STRIDE 1024
+
+static void memoInit(reMemo_t *memo) {
+  memo->generation = 0;
+  memo->to = 0;
+  memo->flushes = 0;
+  memo->search = -1;
+  memo->firstSearch = 0;
+  arrayInit(&memo->searches, sizeof(reSearch_t));
+  memo->recent = NULL;
+  arrayInit(&memo->sparse, sizeof(reVisit_t));
+  memo->sparseBase = 0;
+}
+
+static void memoFree(reMemo_t *memo) {
+  arrayFree(&memo->searches);
+  free(memo->recent);
+  arrayFree(&memo->sparse);
+}
+
+// forgets the searches so far.  Their numbers aren't used again, so the
+// visits they left need no clearing.
+static void memoReset(reMemo_t *memo, dfa_t *d, uint64_t generation,
+                      int64_t to) {
+  memo->generation = generation;
+  memo->to = to;
+  memo->flushes = d->flushes;
+  memo->search = -1;
+  memo->firstSearch += memo->searches.numElems;
+  arrayReinit(&memo->searches);
+  arrayReinit(&memo->sparse);
+}
+
+// the finished search numbered search, or NULL
+static reSearch_t *memoSearch(reMemo_t *memo, int64_t search) {
+  int64_t i = search - memo->firstSearch;
+  if (i < 0 || i >= memo->searches.numElems)
+    return NULL;
+  reSearch_t *r = arrayElemAt(&memo->searches, i);
+  return r->stop < 0 ? NULL : r;
+}
+
+// a search of the text of generation for the end of a match, from from to to
+static void memoBegin(reMemo_t *memo, dfa_t *d, uint64_t generation,
+                      int64_t from, int64_t to) {
+  if (memo->generation != generation || memo->to != to ||
+      memo->flushes != d->flushes)
+    memoReset(memo, d, generation, to);
+  memo->search = -1;
+  // searches only go forward
+  dynamicArray_t *sparse = &memo->sparse;
+  int64_t n = min(from / RE_MEMO_STRIDE - memo->sparseBase, sparse->numElems);
+  if (n > 0 && 2 * n >= sparse->numElems) {
+    arrayDelete(sparse, 0, n);
+    memo->sparseBase += n;
+  }
+}
+
+// an earlier search that was at offset in state s, or NULL after leaving a
+// visit there
+static reSearch_t *memoVisit(reMemo_t *memo, dfa_t *d, int64_t offset, int s) {
+  if (memo->flushes != d->flushes) {
+    // the states were numbered again
+    memoReset(memo, d, memo->generation, memo->to);
+    return NULL;
+  }
+  reVisit_t *recent = NULL;
+  if (memo->recent) {
+    recent = memo->recent + (offset & (RE_MEMO_RECENT - 1));
+    reSearch_t *r = memoSearch(memo, recent->search);
+    // it only left the one visit there within its RE_MEMO_RECENT
+    if (r && recent->state == s && offset >= r->first &&
+        offset - r->first < RE_MEMO_RECENT)
+      return r;
+  }
+  dynamicArray_t *sparse = &memo->sparse;
+  reVisit_t *stride = NULL;
+  if (offset % RE_MEMO_STRIDE == 0) {
+    if (sparse->numElems == 0)
+      memo->sparseBase = offset / RE_MEMO_STRIDE;
+    int64_t i = offset / RE_MEMO_STRIDE - memo->sparseBase;
+    if (i >= 0 && i < sparse->numElems) {
+      stride = arrayElemAt(sparse, i);
+      reSearch_t *r = memoSearch(memo, stride->search);
+      if (r && stride->state == s)
+        return r;
+    } else if (i >= sparse->numElems) {
+      while (sparse->numElems <= i) {
+        reVisit_t *v = arrayPushUninit(sparse);
+        v->search = -1;
+      }
+      stride = arrayElemAt(sparse, i);
+    }
+  }
+
+  if (memo->search < 0) {
+    reSearch_t *r = arrayPushUninit(&memo->searches);
+    r->first = offset;
+    r->end = -1;
+    r->stop = -1;
+    memo->search = memo->firstSearch + memo->searches.numElems - 1;
+  }
+  reSearch_t *r = arrayElemAt(&memo->searches,
+                              memo->search - memo->firstSearch);
+  if (offset - r->first < RE_MEMO_RECENT) {
+    if (!recent) {
+      memo->recent = dieIfNull(malloc(RE_MEMO_RECENT * sizeof(reVisit_t)));
+      for (int i = 0; i < RE_MEMO_RECENT; ++i) {
+        memo->recent[i].search = -1;
+      }
+      recent = memo->recent + (offset & (RE_MEMO_RECENT - 1));
+    }
+    recent->search = memo->search;
+    recent->state = s;
+  }
+  if (stride) {
+    stride->search = memo->search;
+    stride->state = s;
+  }
+  return NULL;
+}
+
+static void memoEnd(reMemo_t *memo, int64_t end, int64_t stop) {
+  if (memo->search >= 0) {
+    reSearch_t *r = arrayElemAt(&memo->searches,
+                                memo->search - memo->firstSearch);
+    r->end = end;
+    r->stop = stop;
+  }
+  memo->search = -1;
+}
+
+regexp_t *regexpNew(char *pattern, int64_t len, char **err) {
+  foldInit();
+  regexp_t *re = dieIfNull(malloc(sizeof(regexp_t)));
+  memoInit(&re->memo);
+  arrayInit(&re->sets, sizeof(reSet_t));
+  dfaInit(&re->forward, &re->sets, false, false);
+  dfaInit(&re->reverse, &re->sets, true, true);
+
+  reParser_t ps;
+  ps.p = pattern;
+  ps.end = pattern + len;
+  arrayInit(&ps.nodes, sizeof(reNode_t));
+  ps.sets = &re->sets;
+  ps.numGroups = 0;
+  ps.err = NULL;
+
+  int root = parseAlt(&ps);
+  if (!ps.err && ps.p < ps.end)
+    ps.err = "unmatched )";
+  re->numGroups = ps.numGroups;
+
+  dynamicArray_t *prog = &re->forward.prog;
+  emitInst(prog, RE_SAVE, 0, 0);
+  emitNode(&ps, prog, root, false);
+  emitInst(prog, RE_SAVE, 1, 0);
+  emitInst(prog, RE_MATCH, 0, 0);
+  emitNode(&ps, &re->reverse.prog, root, true);
+  emitInst(&re->reverse.prog, RE_MATCH, 0, 0);
+  arrayFree(&ps.nodes);
+
+  if (ps.err) {
+    if (err)
+      *err = ps.err;
+    regexpFree(re);
+    return NULL;
+  }
+  dfaAllocScratch(&re->forward);
+  dfaAllocScratch(&re->reverse);
+  re->multiline = false;
+  for (int64_t i = 0; i < re->sets.numElems; ++i) {
+    re->multiline |= setHas(arrayElemAt(&re->sets, i), '\n');
+  }
+  return re;
+}
+
+void regexpFree(regexp_t *re) {
+  if (!re)
+    return;
+  dfaFree(&re->forward);
+  dfaFree(&re->reverse);
+  arrayFree(&re->sets);
+  memoFree(&re->memo);
+  free(re);
+}
+
+// Trigram queries.  What a pattern needs a file to contain, for an index of
+// the trigrams of files to rule out the ones it can't match.  A query is a
+// list of clauses and a file can match only if it has every clause; a
+// clause is a list of strings and a file has it if it has every trigram of
+// one of them.  Strings are folded and NUL terminated, and an empty one ends
+// each clause.  Every node of the pattern gets the strings a match of it
+// starts with and ends with, and the only strings it matches if there are few
+// enough of them (Cox, "Regular Expression Matching with a Trigram Index").
+
+#define RE_INFO_MAX_STRS 16
+#define RE_INFO_MAX_LEN 16
+
+typedef struct {
+  char s[2 * RE_INFO_MAX_LEN + 1];
+  int len;
+} reStr_t;
+
+typedef struct {
+  bool exact;            // strs is everything the node matches
+  dynamicArray_t strs;   // contains reStr_t
+  dynamicArray_t prefix; // contains reStr_t, a match starts with one
+  dynamicArray_t suffix; // contains reStr_t, a match ends with one
+  dynamicArray_t query;  // contains char, clauses as above
+} reInfo_t;
+
+static reStr_t *strAt(dynamicArray_t *set, int64_t i) {
+  return arrayElemAt(set, i);
+}
+
+static void strSetAdd(dynamicArray_t *set, char *s, int len) {
+  assert(len <= 2 * RE_INFO_MAX_LEN);
+  for (int64_t i = 0; i < set->numElems; ++i) {
+    reStr_t *t = strAt(set, i);
+    if (t->len == len && memcmp(t->s, s, len) == 0)
+      return;
+  }
+  reStr_t *t = arrayPushUninit(set);
+  memcpy(t->s, s, len);
+  t->s[len] = '\0';
+  t->len = len;
+}
+
+static void strSetCopy(dynamicArray_t *dst, dynamicArray_t *src) {
+  arrayReinit(dst);
+  for (int64_t i = 0; i < src->numElems; ++i) {
+    strSetAdd(dst, strAt(src, i)->s, strAt(src, i)->len);
+  }
+}
+
+// false, leaving out unchanged, if there would be too many or too long
+static bool strSetCross(dynamicArray_t *a, dynamicArray_t *b,
+                        dynamicArray_t *out) {
+  if (a->numElems * b->numElems > RE_INFO_MAX_STRS)
+    return false;
+  dynamicArray_t set;
+  arrayInit(&set, sizeof(reStr_t));
+  for (int64_t i = 0; i < a->numElems; ++i) {
+    for (int64_t j = 0; j < b->numElems; ++j) {
+      reStr_t *x = strAt(a, i);
+      reStr_t *y = strAt(b, j);
+      if (x->len + y->len > 2 * RE_INFO_MAX_LEN) {
+        arrayFree(&set);
+        return false;
+      }
+      char s[2 * RE_INFO_MAX_LEN];
+      memcpy(s, x->s, x->len);
+      memcpy(s + x->len, y->s, y->len);
+      strSetAdd(&set, s, x->len + y->len);
+    }
+  }
+  arrayFree(out);
+  *out = set;
+  return true;
+}
+
+static void strSetUnion(dynamicArray_t *dst, dynamicArray_t *src) {
+  for (int64_t i = 0; i < src->numElems; ++i) {
+    strSetAdd(dst, strAt(src, i)->s, strAt(src, i)->len);
+  }
+}
+
+// a clause with a string of less than a trigram says nothing
+static void addClause(dynamicArray_t *query, dynamicArray_t *set) {
+  if (set->numElems == 0)
+    return;
+  for (int64_t i = 0; i < set->numElems; ++i) {
+    if (strAt(set, i)->len < 3)
+      return;
+  }
+  for (int64_t i = 0; i < set->numElems; ++i) {
+    arrayInsert(query, query->numElems, strAt(set, i)->s,
+                strAt(set, i)->len + 1);
+  }
+  arrayPush(query, "");
+}
+
+// keeps a set small by adding it to the query and cutting its strings down
+// to their first (or last) two bytes, which can still make trigrams with
+// what comes next to them
+static void strSetTrim(dynamicArray_t *set, bool suffix,
+                       dynamicArray_t *query) {
+  bool trim = set->numElems > RE_INFO_MAX_STRS;
+  for (int64_t i = 0; i < set->numElems; ++i) {
+    trim |= strAt(set, i)->len > RE_INFO_MAX_LEN;
+  }
+  if (!trim)
+    return;
+  addClause(query, set);
+  dynamicArray_t old = *set;
+  arrayInit(set, sizeof(reStr_t));
+  for (int64_t i = 0; i < old.numElems; ++i) {
+    reStr_t *t = strAt(&old, i);
+    int n = min(t->len, 2);
+    strSetAdd(set, suffix ? t->s + t->len - n : t->s, n);
+  }
+  arrayFree(&old);
+  if (set->numElems > RE_INFO_MAX_STRS) {
+    arrayReinit(set);
+    strSetAdd(set, "", 0);
+  }
+}
+
+static void infoInit(reInfo_t *info, bool exact) {
+  info->exact = exact;
+  arrayInit(&info->strs, sizeof(reStr_t));
+  arrayInit(&info->prefix, sizeof(reStr_t));
+  arrayInit(&info->suffix, sizeof(reStr_t));
+  arrayInit(&info->query, sizeof(char));
+  if (!exact) {
+    strSetAdd(&info->prefix, "", 0);
+    strSetAdd(&info->suffix, "", 0);
+  }
+}
+
+static void infoFree(reInfo_t *info) {
+  arrayFree(&info->strs);
+  arrayFree(&info->prefix);
+  arrayFree(&info->suffix);
+  arrayFree(&info->query);
+}
+
+// what is known about the node once everything it matches isn't
+static void infoInexact(reInfo_t *info) {
+  if (!info->exact)
+    return;
+  info->exact = false;
+  addClause(&info->query, &info->strs);
+  arrayReinit(&info->strs);
+}
+
+static void infoSimplify(reInfo_t *info) {
+  if (info->exact) {
+    strSetCopy(&info->prefix, &info->strs);
+    strSetCopy(&info->suffix, &info->strs);
+    bool big = info->strs.numElems > RE_INFO_MAX_STRS;
+    for (int64_t i = 0; i < info->strs.numElems; ++i) {
+      big |= strAt(&info->strs, i)->len > RE_INFO_MAX_LEN;
+    }
+    if (big)
+      infoInexact(info);
+  }
+  strSetTrim(&info->prefix, false, &info->query);
+  strSetTrim(&info->suffix, true, &info->query);
+}
+
+// the clause of q (as above) with the fewest strings
+static char *bestClause(dynamicArray_t *q, int64_t *len) {
+  char *best = NULL;
+  int bestN = 0;
+  char *p = q->start;
+  char *end = p + q->numElems;
+  while (p < end) {
+    char *c = p;
+    int n = 0;
+    while (*p) {
+      p += strlen(p) + 1;
+      n++;
+    }
+    p++;
+    if (!best || n < bestN) {
+      best = c;
+      bestN = n;
+      *len = p - c;
+    }
+  }
+  return best;
+}
+
+// one clause that holds if either query does
+static void orQuery(dynamicArray_t *a, dynamicArray_t *b,
+                    dynamicArray_t *out) {
+  int64_t lenA;
+  int64_t lenB;
+  char *ca = bestClause(a, &lenA);
+  char *cb = bestClause(b, &lenB);
+  if (!ca || !cb)
+    return;
+  arrayInsert(out, out->numElems, ca, lenA - 1);
+  arrayInsert(out, out->numElems, cb, lenB);
+}
+
+static void setInfo(reSet_t *set, reInfo_t *info) {
+  char chars[4];
+  int n = 0;
+  for (int c = 0; c < 256; ++c) {
+    if (!setHas(set, c) || foldTable[c] != c)
+      continue;
+    if (c == '\0' || n == sizeof(chars)) {
+      infoInit(info, false);
+      return;
+    }
+    chars[n++] = c;
+  }
+  infoInit(info, true);
+  for (int i = 0; i < n; ++i) {
+    strSetAdd(&info->strs, &chars[i], 1);
+  }
+}
+
+static void catInfo(reInfo_t *a, reInfo_t *b, reInfo_t *info) {
+  infoInit(info, false);
+  arrayInsert(&info->query, 0, a->query.start, a->query.numElems);
+  arrayInsert(&info->query, info->query.numElems, b->query.start,
+              b->query.numElems);
+  if (a->exact && b->exact && strSetCross(&a->strs, &b->strs, &info->strs)) {
+    info->exact = true;
+    return;
+  }
+  if (!a->exact || !strSetCross(&a->strs, &b->prefix, &info->prefix))
+    strSetCopy(&info->prefix, &a->prefix);
+  if (!b->exact || !strSetCross(&a->suffix, &b->strs, &info->suffix))
+    strSetCopy(&info->suffix, &b->suffix);
+  // across the join
+  dynamicArray_t join;
+  arrayInit(&join, sizeof(reStr_t));
+  if (strSetCross(&a->suffix, &b->prefix, &join))
+    addClause(&info->query, &join);
+  arrayFree(&join);
+  if (a->exact)
+    addClause(&info->query, &a->strs);
+  if (b->exact)
+    addClause(&info->query, &b->strs);
+}
+
+static void altInfo(reInfo_t *a, reInfo_t *b, reInfo_t *info) {
+  if (a->exact && b->exact) {
+    infoInit(info, true);
+    strSetCopy(&info->strs, &a->strs);
+    strSetUnion(&info->strs, &b->strs);
+    return;
+  }
+  infoInexact(a);
+  infoInexact(b);
+  infoInit(info, false);
+  strSetCopy(&info->prefix, &a->prefix);
+  strSetUnion(&info->prefix, &b->prefix);
+  strSetCopy(&info->suffix, &a->suffix);
+  strSetUnion(&info->suffix, &b->suffix);
+  orQuery(&a->query, &b->query, &info->query);
+}
+
+static void nodeInfo(reParser_t *ps, int i, reInfo_t *info) {
+  reNode_t *n = nodeAt(ps, i);
+  reInfo_t a;
+  reInfo_t b;
+  switch (n->type) {
+  case N_SET:
+    setInfo(arrayElemAt(ps->sets, n->x), info);
+    break;
+  case N_CAT:
+  case N_ALT:
+    nodeInfo(ps, n->a, &a);
+    nodeInfo(ps, n->b, &b);
+    if (n->type == N_CAT)
+      catInfo(&a, &b, info);
+    else
+      altInfo(&a, &b, info);
+    infoFree(&a);
+    infoFree(&b);
+    break;
+  case N_REPEAT:
+    nodeInfo(ps, n->a, &a);
+    if (n->min == 1 && n->max == 1) {
+      *info = a;
+      break;
+    }
+    if (n->min == 0 && n->max == 1 && a.exact) {
+      *info = a;
+      strSetAdd(&info->strs, "", 0);
+      break;
+    }
+    if (n->min == 0) {
+      infoFree(&a);
+      infoInit(info, false);
+      break;
+    }
+    infoInexact(&a);
+    *info = a;
+    break;
+  case N_GROUP:
+    nodeInfo(ps, n->a, info);
+    return;
+  default: // the empty string or an anchor
+    infoInit(info, true);
+    strSetAdd(&info->strs, "", 0);
+    break;
+  }
+  infoSimplify(info);
+}
+
+// appends what a file needs to have for the search to find something in it,
+// or returns false if a regexp doesn't compile
+bool searchQuery(char *needle, int64_t len, bool isRegexp,
+                 dynamicArray_t *query) {
+  foldInit();
+  if (!isRegexp) {
+    // a NUL can't go in a clause but every part between them has to be there
+    for (int64_t i = 0; i < len;) {
+      int64_t n = strnlen(needle + i, len - i);
+      if (n >= 3) {
+        for (int64_t j = 0; j < n; ++j) {
+          arrayPush(query, &foldTable[(uchar)needle[i + j]]);
+        }
+        arrayPush(query, "");
+        arrayPush(query, "");
+      }
+      i += n + 1;
+    }
+    return true;
+  }
+  dynamicArray_t sets;
+  arrayInit(&sets, sizeof(reSet_t));
+  reParser_t ps;
+  ps.p = needle;
+  ps.end = needle + len;
+  arrayInit(&ps.nodes, sizeof(reNode_t));
+  ps.sets = &sets;
+  ps.numGroups = 0;
+  ps.err = NULL;
+  int root = parseAlt(&ps);
+  bool ok = !ps.err && ps.p == ps.end;
+  if (ok) {
+    reInfo_t info;
+    nodeInfo(&ps, root, &info);
+    if (info.exact) {
+      infoInexact(&info);
+    } else {
+      addClause(&info.query, &info.prefix);
+      addClause(&info.query, &info.suffix);
+    }
+    arrayInsert(query, query->numElems, info.query.start,
+                info.query.numElems);
+    infoFree(&info);
+  }
+  arrayFree(&ps.nodes);
+  arrayFree(&sets);
+  return ok;
+}
+
+static bool isBol(text_t *t, int64_t offset) {
+  return offset == 0 || textCharAt(t, offset - 1) == '\n';
+}
+
+static bool isEol(text_t *t, int64_t offset) {
+  return offset == textLength(t) || textCharAt(t, offset) == '\n';
+}
+
+// end of the leftmost-first match between from and to, or -1.  Sets *stop to
+// one past the last byte it looked at, to + 1 if it got to the end.
+static int64_t regexpEnd(regexp_t *re, text_t *t, int64_t from, int64_t to,
+                         int64_t *stop) {
+  dfa_t *d = &re->forward;
+  reMemo_t *memo = &re->memo;
+  memoBegin(memo, d, t->snap->generation, from, to);
+  int s = dfaStart(d, isBol(t, from));
+  dfaState_t *states = dfaStates(d);
+  int64_t end = -1;
+  int64_t offset = from;
+  int n;
+  char *span;
+  while (offset < to && (span = textSpan(t, offset, &n))) {
+    if (textCancelled(t)) {
+      memo->generation = 0;
+      break;
+    }
+    n = min(n, to - offset);
+    for (int i = 0; i < n; ++i) {
+      uchar b = span[i];
+      int t = states[s].next[b];
+      if (t < 0) {
+        t = dfaStep(d, s, b);
+        states = dfaStates(d);
+      }
+      if (t & 1)
+        end = offset + i;
+      s = t >> 1;
+      if (s == DFA_DEAD) {
+        *stop = offset + i + 1;
+        memoEnd(memo, end, *stop);
+        return end;
+      }
+      if (end >= 0) {
+        // past the match, where the next search will look again
+        reSearch_t *r = memoVisit(memo, d, offset + i + 1, s);
+        if (r) {
+          end = r->end > offset + i ? r->end : end;
+          *stop = r->stop;
+          memoEnd(memo, end, *stop);
+          return end;
+        }
+      }
+    }
+    offset += n;
+  }
+  *stop = to + 1;
+  end = dfaMatchAtEnd(d, s, isEol(t, to)) ? to : end;
+  memoEnd(memo, end, *stop);
+  return end;
+}
+
+// start of the longest match that ends at end and starts at or after from.
+// That's where the leftmost-first match ending there starts too, or a match
+// would start further left.
+static int64_t regexpStart(regexp_t *re, text_t *t, int64_t from,
+                           int64_t end) {
+  dfa_t *d = &re->reverse;
+  int s = dfaStart(d, isEol(t, end));
+  dfaState_t *states = dfaStates(d);
+  int64_t start = -1;
+  char buf[4096];
+  int64_t offset = end;
+  while (offset > from && !textCancelled(t)) {
+    int64_t n = min(offset - from, (int64_t)sizeof(buf));
+    snapshotCopy(t->snap, offset - n, n, buf);
+    for (int64_t i = n - 1; i >= 0; --i) {
+      uchar b = buf[i];
+      int t = states[s].next[b];
+      if (t < 0) {
+        t = dfaStep(d, s, b);
+        states = dfaStates(d);
+      }
+      if (t & 1)
+        start = offset - n + i + 1;
+      s = t >> 1;
+      if (s == DFA_DEAD)
+        return start;
+    }
+    offset -= n;
+  }
+  return dfaMatchAtEnd(d, s, isBol(t, from)) ? from : start;
+}
+
+// start of the first match that lies between from and to, or -1.  Sets *len
+// to its length and *stop to one past the last byte the search depended on
+// (to + 1 if it got to the end), so edits from there on can't change it.
+static int64_t regexpFindText(regexp_t *re, text_t *t, int64_t from,
+                              int64_t to, int64_t *len, int64_t *stop) {
+  int64_t end = regexpEnd(re, t, from, to, stop);
+  if (end < 0)
+    return -1;
+  int64_t start = regexpStart(re, t, from, end);
+  if (textCancelled(t))
+    return -1;
+  assert(start >= from && start < end);
+  *len = end - start;
+  return start;
+}
+
+int64_t regexpFind(regexp_t *re, doc_t *doc, int64_t from, int64_t to,
+                   int64_t *len, int64_t *stop) {
+  snapshot_t snap;
+  docSnapshot(doc, &snap);
+  text_t t = {&snap, NULL};
+  int64_t start = regexpFindText(re, &t, from, to, len, stop);
+  snapshotFree(&snap);
+  return start;
+}
+
+// calls found with every match in doc, in order and not overlapping
+void regexpSearchDoc(regexp_t *re, doc_t *doc, searchFound_t found,
+                     void *arg) {
+  snapshot_t snap;
+  docSnapshot(doc, &snap);
+  text_t t = {&snap, NULL};
+  int64_t from = 0;
+  int64_t start;
+  int64_t len;
+  int64_t stop;
+  int64_t to = textLength(&t);
+  while ((start = regexpFindText(re, &t, from, to, &len, &stop)) >= 0) {
+    found(arg, start, len);
+    from = start + len;
+  }
+  snapshotFree(&snap);
+}
+
+typedef struct {
+  int n;
+  int *threads;
+  int64_t *caps;
+} pikeList_t;
+
+typedef struct {
+  dynamicArray_t *prog;
+  dynamicArray_t *sets;
+  int ncap;
+  int *seen;
+  int stamp;
+  int64_t *caps; // scratch for the thread being added
+} pike_t;
+
+static void pikeAdd(pike_t *pk, pikeList_t *l, int pc, int64_t pos, bool bol,
+                    bool eol) {
+  if (pk->seen[pc] == pk->stamp)
+    return;
+  pk->seen[pc] = pk->stamp;
+  reInst_t *inst = instAt(pk->prog, pc);
+  switch (inst->op) {
+  case RE_JMP:
+    pikeAdd(pk, l, inst->x, pos, bol, eol);
+    return;
+  case RE_SPLIT:
+    pikeAdd(pk, l, inst->x, pos, bol, eol);
+    pikeAdd(pk, l, inst->y, pos, bol, eol);
+    return;
+  case RE_SAVE: {
+    int64_t old = pk->caps[inst->x];
+    pk->caps[inst->x] = pos;
+    pikeAdd(pk, l, pc + 1, pos, bol, eol);
+    pk->caps[inst->x] = old;
+    return;
+  }
+  case RE_BOL:
+    if (bol)
+      pikeAdd(pk, l, pc + 1, pos, bol, eol);
+    return;
+  case RE_EOL:
+    if (eol)
+      pikeAdd(pk, l, pc + 1, pos, bol, eol);
+    return;
+  default:
+    l->threads[l->n] = pc;
+    myMemcpy(l->caps + l->n * pk->ncap, pk->caps, pk->ncap * sizeof(int64_t));
+    l->n++;
+  }
+}
+
+// fills groups (a start and an end for each, -1 if it didn't take part) for
+// the match found by regexpSearchDoc from start to end.  Group 0 is the
+// whole match.
+void regexpGroups(regexp_t *re, doc_t *doc, int64_t start, int64_t end,
+                  int64_t *groups) {
+  int64_t len = end - start;
+  char *s = dieIfNull(malloc(max(len, 1)));
+  docCopy(doc, start, len, s);
+  snapshot_t snap;
+  docSnapshot(doc, &snap);
+  text_t t = {&snap, NULL};
+  bool bolFirst = isBol(&t, start);
+  bool eolLast = isEol(&t, end);
+  snapshotFree(&snap);
+
+  pike_t pk;
+  pk.prog = &re->forward.prog;
+  pk.sets = &re->sets;
+  pk.ncap = 2 * (re->numGroups + 1);
+  int64_t numInsts = pk.prog->numElems;
+  pk.seen = dieIfNull(calloc(numInsts, sizeof(int)));
+  pk.stamp = 0;
+  pk.caps = dieIfNull(malloc(pk.ncap * sizeof(int64_t)));
+  pikeList_t lists[2];
+  for (int i = 0; i < 2; ++i) {
+    lists[i].threads = dieIfNull(malloc(numInsts * sizeof(int)));
+    lists[i].caps = dieIfNull(malloc(numInsts * pk.ncap * sizeof(int64_t)));
+    lists[i].n = 0;
+  }
+  for (int i = 0; i < pk.ncap; ++i) {
+    groups[i] = -1;
+    pk.caps[i] = -1;
+  }
+
+  pikeList_t *cur = &lists[0];
+  pikeList_t *next = &lists[1];
+  pk.stamp++;
+  pikeAdd(&pk, cur, 0, 0, bolFirst, len == 0 ? eolLast : s[0] == '\n');
+  for (int64_t pos = 0; pos <= len && cur->n > 0; ++pos) {
+    next->n = 0;
+    pk.stamp++;
+    for (int i = 0; i < cur->n; ++i) {
+      reInst_t *inst = instAt(pk.prog, cur->threads[i]);
+      int64_t *caps = cur->caps + i * pk.ncap;
+      if (inst->op == RE_MATCH) {
+        if (pos == 0) // empty matches don't count
+          continue;
+        myMemcpy(groups, caps, pk.ncap * sizeof(int64_t));
+        break; // the threads after it have lower priority
+      }
+      if (pos < len && setHas(arrayElemAt(pk.sets, inst->x), s[pos])) {
+        myMemcpy(pk.caps, caps, pk.ncap * sizeof(int64_t));
+        bool eol = pos + 1 == len ? eolLast : s[pos + 1] == '\n';
+        pikeAdd(&pk, next, cur->threads[i] + 1, pos + 1, s[pos] == '\n', eol);
+      }
+    }
+    swap(pikeList_t *, cur, next);
+  }
+
+  for (int i = 0; i < pk.ncap; ++i) {
+    if (groups[i] >= 0)
+      groups[i] += start;
+  }
+  for (int i = 0; i < 2; ++i) {
+    free(lists[i].threads);
+    free(lists[i].caps);
+  }
+  free(pk.caps);
+  free(pk.seen);
+  free(s);
+}
+
+// appends repl to out with \0 to \9 replaced by the text of that group of the
+// match from start to end.  \n and \t are a newline and a tab, a backslash
+// before anything else quotes it.
+void regexpExpand(regexp_t *re, doc_t *doc, int64_t start, int64_t end,
+                  char *repl, int64_t len, dynamicArray_t *out) {
+  int64_t *groups =
+      dieIfNull(malloc(2 * (re->numGroups + 1) * sizeof(int64_t)));
+  regexpGroups(re, doc, start, end, groups);
+  char *p = repl;
+  char *q = repl + len;
+  while (p < q) {
+    char c = *p++;
+    if (c != '\\' || p == q) {
+      arrayPush(out, &c);
+      continue;
+    }
+    c = *p++;
+    if (c >= '0' && c <= '9') {
+      int g = c - '0';
+      if (g > re->numGroups || groups[2 * g] < 0)
+        continue;
+      int64_t n = groups[2 * g + 1] - groups[2 * g];
+      arrayGrow(out, out->numElems + n);
+      docCopy(doc, groups[2 * g], n, (char *)out->start + out->numElems);
+      out->numElems += n;
+      continue;
+    }
+    c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+    arrayPush(out, &c);
+  }
+  free(groups);
+}
+
+// Search jobs.  A search of a big doc runs on its own thread, over a
+// snapshot so the doc can change meanwhile.  The matches are handed over as
+// they are found: the first one that the editor hasn't taken posts a
+// SEARCH_EVENT, and it takes all there are by then.  Setting cancel stops the
+// search within SEARCH_CHUNK bytes.
+
+void searchJobInit(searchJob_t *job) {
+  myMemset(job, 0, sizeof(searchJob_t));
+  job->lock = dieIfNull(SDL_CreateMutex());
+  arrayInit(&job->found, sizeof(searchMatch_t));
+}
+
+static void searchJobPost(void) {
+  SDL_Event event;
+  myMemset(&event, 0, sizeof(event));
+  event.type = SDL_USEREVENT;
+  event.user.code = SEARCH_EVENT;
+  SDL_PushEvent(&event);
+}
+
+typedef void (*searchMatchFound_t)(void *arg, searchMatch_t *m);
+
+typedef struct {
+  searchMatchFound_t found;
+  void *arg;
+} literalSt_t;
+
+static void literalFound(void *arg, int64_t offset, int64_t len) {
+  literalSt_t *ls = arg;
+  searchMatch_t m = {offset, len, offset + len};
+  ls->found(ls->arg, &m);
+}
+
+// calls found with every match in t of the regexp re, or if it's NULL of s
+static void searchMatches(searcher_t *s, regexp_t *re, text_t *t,
+                          searchMatchFound_t found, void *arg) {
+  if (!re) {
+    literalSt_t ls = {found, arg};
+    searchText(s, t, literalFound, &ls);
+    return;
+  }
+  // a match depends on the text up to where the search stopped looking
+  searchMatch_t m;
+  int64_t from = 0;
+  int64_t reach = 0;
+  int64_t stop;
+  int64_t to = textLength(t);
+  while ((m.offset = regexpFindText(re, t, from, to, &m.len, &stop)) >= 0) {
+    reach = max(reach, stop);
+    m.reach = reach;
+    found(arg, &m);
+    from = m.offset + m.len;
+  }
+}
+
+static void searchJobFound(void *arg, searchMatch_t *m) {
+  searchJob_t *job = arg;
+  SDL_LockMutex(job->lock);
+  if (job->async && job->found.numElems == 0)
+    searchJobPost();
+  arrayPush(&job->found, m);
+  SDL_UnlockMutex(job->lock);
+}
+
+static int searchJobRun(void *arg) {
+  searchJob_t *job = arg;
+  text_t t = {&job->snap, &job->cancel};
+  searchMatches(&job->searcher, job->regexp, &t, searchJobFound, job);
+  SDL_LockMutex(job->lock);
+  job->done = true;
+  if (job->async)
+    searchJobPost();
+  SDL_UnlockMutex(job->lock);
+  return 0;
+}
+
+// starts searching doc for needle.  Docs no bigger than SEARCH_CHUNK are
+// searched before this returns.
+void searchJobStart(searchJob_t *job, doc_t *doc, char *needle, int64_t len,
+                    bool isRegexp) {
+  searchJobCancel(job);
+  simdLevel(); // detected before the thread looks
+  docSnapshot(doc, &job->snap);
+  if (isRegexp) {
+    job->regexp = dieIfNull(regexpNew(needle, len, NULL));
+  } else {
+    searcherInit(&job->searcher, needle, len);
+  }
+  job->running = true;
+  job->done = false;
+  job->async = snapshotLength(&job->snap) > SEARCH_CHUNK;
+  SDL_AtomicSet(&job->cancel, 0);
+  if (job->async) {
+    job->thread = dieIfNull(SDL_CreateThread(searchJobRun, "search", job));
+  } else {
+    searchJobRun(job);
+  }
+}
+
+static void searchJobEnd(searchJob_t *job) {
+  SDL_WaitThread(job->thread, NULL);
+  job->thread = NULL;
+  snapshotFree(&job->snap);
+  if (job->regexp) {
+    regexpFree(job->regexp);
+    job->regexp = NULL;
+  } else {
+    searcherFree(&job->searcher);
+  }
+  job->found.numElems = 0;
+  job->running = false;
+}
+
+// moves the matches found since the last call to out, which must be empty.
+// Waits for the rest if wait is set.  Returns whether that was all of them.
+bool searchJobTake(searchJob_t *job, dynamicArray_t *out, bool wait) {
+  assert(job->running && out->numElems == 0);
+  if (wait) {
+    SDL_WaitThread(job->thread, NULL);
+    job->thread = NULL;
+  }
+  SDL_LockMutex(job->lock);
+  swap(dynamicArray_t, *out, job->found);
+  bool done = job->done;
+  SDL_UnlockMutex(job->lock);
+  if (done)
+    searchJobEnd(job);
+  return done;
+}
+
+void searchJobCancel(searchJob_t *job) {
+  if (!job->running)
+    return;
+  SDL_AtomicSet(&job->cancel, 1);
+  searchJobEnd(job);
+}
+
+// Searching many docs at once.  Each thread takes the next snapshot that no
+// other has yet, and has its own copy of the search.
+
+typedef struct {
+  snapshot_t *snaps;
+  int n;
+  SDL_atomic_t next;
+  char *needle;
+  int64_t len;
+  bool isRegexp;
+  dynamicArray_t *found;
+} searchAllSt_t;
+
+static void searchAllFound(void *arg, searchMatch_t *m) { arrayPush(arg, m); }
+
+static int searchAllRun(void *arg) {
+  searchAllSt_t *sa = arg;
+  searcher_t s;
+  regexp_t *re = NULL;
+  if (sa->isRegexp) {
+    re = dieIfNull(regexpNew(sa->needle, sa->len, NULL));
+  } else {
+    searcherInit(&s, sa->needle, sa->len);
+  }
+  int i;
+  while ((i = SDL_AtomicAdd(&sa->next, 1)) < sa->n) {
+    text_t t = {&sa->snaps[i], NULL};
+    searchMatches(&s, re, &t, searchAllFound, &sa->found[i]);
+  }
+  if (re)
+    regexpFree(re);
+  else
+    searcherFree(&s);
+  return 0;
+}
+
+// appends the matches (searchMatch_t) of needle in snaps[i] to found[i], for
+// all n of them, using all the cores.  A regexp needle must compile.
+void searchSnapshots(snapshot_t *snaps, int n, char *needle, int64_t len,
+                     bool isRegexp, dynamicArray_t *found) {
+  // set up before the threads look
+  foldInit();
+  simdLevel();
+  searchAllSt_t sa = {snaps, n, {0}, needle, len, isRegexp, found};
+  int numThreads = clamp(1, SDL_GetCPUCount(), n);
+  SDL_Thread **threads = dieIfNull(malloc(numThreads * sizeof(SDL_Thread *)));
+  for (int i = 1; i < numThreads; ++i) {
+    threads[i] = dieIfNull(SDL_CreateThread(searchAllRun, "search", &sa));
+  }
+  searchAllRun(&sa);
+  for (int i = 1; i < numThreads; ++i) {
+    SDL_WaitThread(threads[i], NULL);
+  }
+  free(threads);
+}
+
+static int64_t findNaive(char *needle, int64_t m, char *hay, int64_t len) {
+  for (int64_t j = 0; j + m <= len; ++j) {
+    int64_t i = 0;
+    while (i < m && fold(needle[i]) == fold(hay[j + i]))
+      i++;
+    if (i == m)
+      return j;
+  }
+  return -1;
+}
+
+static void countFound(void *arg, int64_t offset, int64_t len) {
+  (*(int64_t *)arg)++;
+}
+
+// checks every level against a naive search, including needles that defeat
+// the first/last byte filter, and prints the search throughput
+void searchTest() {
+  foldInit();
+  int size = 1 << 14;
+  char *buf = dieIfNull(malloc(size));
+  char needle[64];
+  simdLevel_t best = simdLevel();
+
+  for (int i = 0; i < 20000; ++i) {
+    char *alphabet = i % 3 == 0 ? "aA" : i % 3 == 1 ? "abAB" : "abcxyzABC \n";
+    int na = strlen(alphabet);
+    int len = rand() % 2000;
+    for (int j = 0; j < len; ++j) {
+      buf[j] = alphabet[rand() % na];
+    }
+    int m = 1 + rand() % (i % 10 == 0 ? 60 : 8);
+    for (int j = 0; j < m; ++j) {
+      needle[j] = alphabet[rand() % na];
+    }
+    int64_t want = findNaive(needle, m, buf, len);
+    searcher_t s;
+    searcherInit(&s, needle, m);
+    for (simdLevel_t l = SIMD_SCALAR; l <= best; ++l) {
+      simdSetLevel(l);
+      assert(searcherFind(&s, buf, len) == want);
+    }
+    searcherFree(&s);
+  }
+  simdSetLevel(best);
+
+  // matches across piece boundaries
+  doc_t doc;
+  docInit(&doc, "", false, false);
+  for (int i = 0; i < 3000; ++i) {
+    docInsert(&doc, rand() % (docLength(&doc) + 1), "abAB\nabAB\n" + rand() % 5,
+              1 + rand() % 3);
+  }
+  char *s0 = docCString(&doc);
+  int64_t len = docLength(&doc);
+  searcher_t s;
+  searcherInit(&s, "BaB", 3);
+  int64_t want = 0;
+  for (int64_t j = 0; j < len; ++j) {
+    want += findNaive("bab", 3, s0 + j, min(3, len - j)) == 0;
+  }
+  int64_t got = 0;
+  searchDoc(&s, &doc, countFound, &got);
+  assert(got == want);
+  searcherFree(&s);
+  docFree(&doc);
+
+  // a needle with no match in text like the editor's own
+  int64_t bigSize = 256 << 20;
+  char *big = dieIfNull(malloc(bigSize));
+  char *text = "static int64_t twoWay(searcher_t *s, char *hay) {\n";
+  int64_t textLen = strlen(text);
+  for (int64_t i = 0; i < bigSize; ++i) {
+    big[i] = text[i % textLen];
+  }
+  searcherInit(&s, "SearcherFind(", 13);
+  for (simdLevel_t l = SIMD_SCALAR; l <= best; ++l) {
+    simdSetLevel(l);
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    int64_t k = searcherFind(&s, big, bigSize);
+    double secs =
+        (double)(SDL_GetPerformanceCounter() - t0) / SDL_GetPerformanceFrequency();
+    assert(k == -1);
+    printf("search level %d: %.2f GB/s\n", l, bigSize / secs / 1e9);
+  }
+  searcherFree(&s);
+
+  simdSetLevel(best);
+  free(big);
+  free(buf);
+}
+
+typedef struct {
+  dynamicArray_t *prog;
+  dynamicArray_t *sets;
+  char *s;
+  int64_t len;
+  int64_t start;
+  bool *visited; // by instruction and position
+  int64_t *caps;
+} backtrack_t;
+
+// the slow and obvious way to find the leftmost-first match, to check the
+// DFAs and the Pike VM against
+static bool backtrack(backtrack_t *bt, int pc, int64_t pos) {
+  bool *v = &bt->visited[pc * (bt->len + 1) + pos];
+  if (*v)
+    return false;
+  *v = true;
+  reInst_t *inst = instAt(bt->prog, pc);
+  switch (inst->op) {
+  case RE_SET:
+    return pos < bt->len &&
+           setHas(arrayElemAt(bt->sets, inst->x), bt->s[pos]) &&
+           backtrack(bt, pc + 1, pos + 1);
+  case RE_JMP:
+    return backtrack(bt, inst->x, pos);
+  case RE_SPLIT:
+    return backtrack(bt, inst->x, pos) || backtrack(bt, inst->y, pos);
+  case RE_SAVE: {
+    int64_t old = bt->caps[inst->x];
+    bt->caps[inst->x] = pos;
+    if (backtrack(bt, pc + 1, pos))
+      return true;
+    bt->caps[inst->x] = old;
+    return false;
+  }
+  case RE_BOL:
+    return (pos == 0 || bt->s[pos - 1] == '\n') && backtrack(bt, pc + 1, pos);
+  case RE_EOL:
+    return (pos == bt->len || bt->s[pos] == '\n') &&
+           backtrack(bt, pc + 1, pos);
+  default:
+    return pos > bt->start;
+  }
+}
+
+static int64_t backtrackFind(regexp_t *re, char *s, int64_t len, int64_t from,
+                             int64_t *caps) {
+  backtrack_t bt;
+  bt.prog = &re->forward.prog;
+  bt.sets = &re->sets;
+  bt.s = s;
+  bt.len = len;
+  bt.caps = caps;
+  int64_t n = bt.prog->numElems * (len + 1);
+  bt.visited = dieIfNull(malloc(n));
+  int64_t found = -1;
+  for (bt.start = from; bt.start < len && found < 0; ++bt.start) {
+    myMemset(bt.visited, 0, n);
+    for (int i = 0; i < 2 * (re->numGroups + 1); ++i) {
+      caps[i] = -1;
+    }
+    if (backtrack(&bt, 0, bt.start))
+      found = bt.start;
+  }
+  free(bt.visited);
+  return found;
+}
+
+typedef struct {
+  int64_t matches[64];
+  int n;
+} foundList_t;
+
+static void listFound(void *arg, int64_t offset, int64_t len) {
+  foundList_t *l = arg;
+  if (l->n < 32) {
+    l->matches[2 * l->n] = offset;
+    l->matches[2 * l->n + 1] = offset + len;
+  }
+  l->n++;
+}
+
+// the matches of pattern in text, written as start-end pairs
+static void checkRegexp(char *pattern, char *text, char *want) {
+  char *err = NULL;
+  regexp_t *re = regexpNew(pattern, strlen(pattern), &err);
+  if (!re) {
+    assert(strcmp(want, "error") == 0);
+    return;
+  }
+  doc_t doc;
+  docInit(&doc, "", false, false);
+  docInsert(&doc, 0, text, strlen(text));
+  foundList_t l;
+  l.n = 0;
+  regexpSearchDoc(re, &doc, listFound, &l);
+  char got[256] = "";
+  for (int i = 0; i < l.n; ++i) {
+    sprintf(got + strlen(got), "%s%lld-%lld", i ? " " : "",
+            (long long)l.matches[2 * i], (long long)l.matches[2 * i + 1]);
+  }
+  if (strcmp(got, want) != 0) {
+    printf("/%s/ on \"%s\": got \"%s\", want \"%s\"\n", pattern, text, got,
+           want);
+    assert(false);
+  }
+  docFree(&doc);
+  regexpFree(re);
+}
+
+static void checkReplace(char *pattern, char *text, char *repl, char *want) {
+  regexp_t *re = regexpNew(pattern, strlen(pattern), NULL);
+  doc_t doc;
+  docInit(&doc, "", false, false);
+  docInsert(&doc, 0, text, strlen(text));
+  foundList_t l;
+  l.n = 0;
+  regexpSearchDoc(re, &doc, listFound, &l);
+  assert(l.n == 1);
+  dynamicArray_t out;
+  arrayInit(&out, sizeof(char));
+  regexpExpand(re, &doc, l.matches[0], l.matches[1], repl, strlen(repl), &out);
+  assert(out.numElems == (int64_t)strlen(want) &&
+         memcmp(out.start, want, out.numElems) == 0);
+  arrayFree(&out);
+  docFree(&doc);
+  regexpFree(re);
+}
+
+static char *randomRegexp(char *p, int depth) {
+  char *atoms[] = {"a", "b", "A", ".", "[ab]", "[^a]", "\\n", "^", "$", "\\w"};
+  int k = depth > 2 ? rand() % 10 : rand() % 16;
+  if (k < 10)
+    return p + sprintf(p, "%s", atoms[k]);
+  char *ops[] = {"*", "+", "?", "*?", "{2}", "{1,2}"};
+  switch (k) {
+  case 10:
+  case 11:
+    p = randomRegexp(p, depth + 1);
+    return randomRegexp(p, depth + 1);
+  case 12:
+    *p++ = '(';
+    p = randomRegexp(p, depth + 1);
+    *p++ = '|';
+    p = randomRegexp(p, depth + 1);
+    *p++ = ')';
+    return p;
+  case 13:
+    *p++ = '(';
+    p = randomRegexp(p, depth + 1);
+    *p++ = ')';
+    return p + sprintf(p, "%s", ops[rand() % 6]);
+  default:
+    p = randomRegexp(p, depth + 1);
+    return p + sprintf(p, "%s", ops[rand() % 6]);
+  }
+}
+
+// checks matches and groups against a backtracker, then times patterns that
+// take a backtracking matcher exponential time
+void regexpTest() {
+  checkRegexp("ab", "xabyAB", "1-3 4-6");
+  checkRegexp("a|ab", "ab", "0-1");
+  checkRegexp("ab|a", "ab", "0-2");
+  checkRegexp("a*", "baaa", "1-4");
+  checkRegexp("a*?b", "aab", "0-3");
+  checkRegexp("a+?", "aa", "0-1 1-2");
+  checkRegexp("a{2,3}", "aaaaaaa", "0-3 3-6");
+  checkRegexp("a{2}", "aaaaa", "0-2 2-4");
+  checkRegexp("x{,2}", "x{,2}", "0-5");
+  checkRegexp("^a", "aa\naa", "0-1 3-4");
+  checkRegexp("a$", "aa\naa", "1-2 4-5");
+  checkRegexp("^$", "a\n\nb", "");
+  checkRegexp("^\\n", "a\n\nb", "2-3");
+  checkRegexp(".+", "ab\ncd", "0-2 3-5");
+  checkRegexp("[^x]+", "ab\ncd", "0-2 3-5");
+  checkRegexp(".", "\xc3\xa9\xff", "0-2 2-3");
+  checkRegexp("[a-c]+\\d", "xBCa9", "1-5");
+  checkRegexp("\\w+\\s\\S", "foo_1 +", "0-7");
+  checkRegexp("[]a]+", "a]b", "0-2");
+  checkRegexp("\\/\\x41", "/a", "0-2");
+  checkRegexp("(a", "", "error");
+  checkRegexp("a)", "", "error");
+  checkRegexp("*a", "", "error");
+  checkRegexp("a{3,2}", "", "error");
+  checkRegexp("[b-a]", "", "error");
+  checkRegexp("(a{1000}){1000}", "", "error");
+
+  checkReplace("(\\w+)=(\\w+)", "x = a=b;", "\\2=\\1", "b=a");
+  checkReplace("(a)|(b)", "b", "[\\1][\\2][\\0]", "[][b][b]");
+  checkReplace("(a)", "a", "\\\\1\\t\\n", "\\1\t\n");
+
+  // against the backtracker
+  char pattern[512];
+  char text[64];
+  int64_t caps[2 * (RE_MAX_GROUPS + 1)];
+  int64_t groups[2 * (RE_MAX_GROUPS + 1)];
+  char *alphabet = "aabAB\n\xc3\xa9";
+  for (int i = 0; i < 20000; ++i) {
+    *randomRegexp(pattern, 0) = '\0';
+    int len = rand() % 24;
+    for (int j = 0; j < len; ++j) {
+      text[j] = alphabet[rand() % 8];
+    }
+    regexp_t *re = regexpNew(pattern, strlen(pattern), NULL);
+    assert(re);
+    doc_t doc;
+    docInit(&doc, "", false, false);
+    for (int j = 0; j < len; ++j) { // one piece per byte
+      docInsert(&doc, j, text + j, 1);
+    }
+    foundList_t l;
+    l.n = 0;
+    regexpSearchDoc(re, &doc, listFound, &l);
+    int64_t from = 0;
+    for (int k = 0; k <= l.n; ++k) {
+      int64_t start = backtrackFind(re, text, len, from, caps);
+      if (k == l.n) {
+        assert(start < 0);
+        break;
+      }
+      assert(start == l.matches[2 * k] && caps[1] == l.matches[2 * k + 1]);
+      regexpGroups(re, &doc, start, caps[1], groups);
+      assert(memcmp(groups, caps, 2 * (re->numGroups + 1) * sizeof(int64_t)) ==
+             0);
+      from = caps[1];
+    }
+    docFree(&doc);
+    regexpFree(re);
+  }
+
+  // more states than the cache holds
+  regexp_t *re = regexpNew("a[ab]{11}b", 10, NULL);
+  doc_t doc;
+  docInit(&doc, "", false, false);
+  int64_t textLen = 20000;
+  char *s = dieIfNull(malloc(textLen));
+  for (int64_t i = 0; i < textLen; ++i) {
+    s[i] = "ab"[rand() % 2];
+  }
+  docInsert(&doc, 0, s, textLen);
+  foundList_t l;
+  l.n = 0;
+  regexpSearchDoc(re, &doc, listFound, &l);
+  int64_t want = 0;
+  for (int64_t i = 0; i + 13 <= textLen; ++i) {
+    if (s[i] == 'a' && s[i + 12] == 'b') {
+      want++;
+      i += 12;
+    }
+  }
+  assert(l.n == want);
+  docReinit(&doc);
+  regexpFree(re);
+  free(s);
+
+  // linear however the pattern is written
+  int64_t bigSize = 64 << 20;
+  char *line = dieIfNull(malloc(bigSize));
+  for (int64_t i = 0; i < bigSize; ++i) {
+    line[i] = i % 1000 == 999 ? '\n' : 'a';
+  }
+  docInsert(&doc, 0, line, bigSize);
+  char *slow[] = {"(a|a)*b", "(a*)*b", "(a|aa)+$", "(\\w+\\s?)*x",
+                  "a{20}.{20}b"};
+  for (int i = 0; i < 5; ++i) {
+    regexp_t *re = regexpNew(slow[i], strlen(slow[i]), NULL);
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    int64_t n = 0;
+    regexpSearchDoc(re, &doc, countFound, &n);
+    double secs =
+        (double)(SDL_GetPerformanceCounter() - t0) / SDL_GetPerformanceFrequency();
+    printf("regexp /%s/: %lld matches, %.2f GB/s\n", slow[i], (long long)n,
+           bigSize / secs / 1e9);
+    regexpFree(re);
+  }
+
+  // every match of these depends on the rest of the run it's in, which would
+  // be scanned again for each one
+  docReinit(&doc);
+  int64_t runSize = 4 << 20;
+  int64_t numA = 0;
+  int64_t numB = 0; // each after an a
+  for (int64_t i = 0; i < runSize; ++i) {
+    line[i] = i % 1000 == 999 ? '\n' : "ab"[i % 2];
+    numA += line[i] == 'a';
+    numB += line[i] == 'b';
+  }
+  docInsert(&doc, 0, line, runSize);
+  char *runs[] = {"[ab]*c|a", "(ab)*c|ab", "(.|\\n)*c|b"};
+  int64_t runMatches[] = {numA, numB, numB};
+  for (int i = 0; i < 3; ++i) {
+    regexp_t *re = regexpNew(runs[i], strlen(runs[i]), NULL);
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    int64_t n = 0;
+    regexpSearchDoc(re, &doc, countFound, &n);
+    double secs =
+        (double)(SDL_GetPerformanceCounter() - t0) / SDL_GetPerformanceFrequency();
+    printf("regexp /%s/: %lld matches, %.2f GB/s\n", runs[i], (long long)n,
+           runSize / secs / 1e9);
+    assert(n == runMatches[i]);
+    regexpFree(re);
+  }
+  docFree(&doc);
+  free(line);
+}
@@ -11,4 +11,29 @@
 
 #include "Util.h"
 
+typedef void (*searchFound_t)(void *arg, int64_t offset, int64_t len);
+
+void searcherInit(searcher_t *s, char *needle, int64_t len);
+void searcherFree(searcher_t *s);
+int64_t searcherFind(searcher_t *s, char *hay, int64_t len);
+void searchDoc(searcher_t *s, doc_t *doc, searchFound_t found, void *arg);
+regexp_t *regexpNew(char *pattern, int64_t len, char **err);
+void regexpFree(regexp_t *re);
+int64_t regexpFind(regexp_t *re, doc_t *doc, int64_t from, int64_t to,
+                   int64_t *len, int64_t *stop);
+void regexpSearchDoc(regexp_t *re, doc_t *doc, searchFound_t found, void *arg);
+void regexpGroups(regexp_t *re, doc_t *doc, int64_t start, int64_t end,
+                  int64_t *groups);
+void regexpExpand(regexp_t *re, doc_t *doc, int64_t start, int64_t end,
+                  char *repl, int64_t len, dynamicArray_t *out);
+void searchJobInit(searchJob_t *job);
+void searchJobStart(searchJob_t *job, doc_t *doc, char *needle, int64_t len,
+                    bool isRegexp);
+bool searchJobTake(searchJob_t *job, dynamicArray_t *out, bool wait);
+void searchJobCancel(searchJob_t *job);
+void searchSnapshots(snapshot_t *snaps, int n, char *needle, int64_t len,
+                     bool isRegexp, dynamicArray_t *found);
+bool searchQuery(char *needle, int64_t len, bool isRegexp,
+                 dynamicArray_t *query);
+
 #endif /* Search_h */
@@ -0,0 +1,625 @@
+//
+//  Simd.c
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#include "Simd.h"
+#include "Utf8.h"
+
+// Byte scanning kernels.  Every kernel has a scalar version and, on x86-64,
+// SSE2 (always available) and AVX2 versions picked at runtime.
+
+#if defined(__x86_64__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+static simdLevel_t level = NUM_SIMD_LEVELS; // not detected yet
+
+static simdLevel_t simdDetect(void) {
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SIMD_AVX2;
+  return SIMD_SSE2;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+simdLevel_t simdLevel(void) {
+  if (level == NUM_SIMD_LEVELS)
+    level = simdDetect();
+  return level;
+}
+
+// used to test and time the narrower kernels
+void simdSetLevel(simdLevel_t l) { level = min(l, simdDetect()); }
+
+static int64_t countCharScalar(char *s, char *end, char c) {
+  int64_t n = 0;
+  while (s < end) {
+    if (*s == c)
+      n++;
+    s++;
+  }
+  return n;
+}
+
+static char *findAnyScalar(char *s, char *end, char a, char b, char c) {
+  while (s < end && *s != a && *s != b && *s != c)
+    s++;
+  return s;
+}
+
+// length of the longest line (counting its newline) given the start of the
+// current line and the longest line so far
+static int64_t maxLineLengthScalar(char *s, char *end, char *sol,
+                                   int64_t rmax) {
+  while (s < end) {
+    if (*s == '\n') {
+      rmax = max(rmax, s - sol + 1);
+      sol = s + 1;
+    }
+    s++;
+  }
+  return max(rmax, end - sol);
+}
+
+// UTF-8 continuation bytes are 10xxxxxx
+static int64_t countCodepointsScalar(char *s, char *end) {
+  int64_t n = 0;
+  while (s < end) {
+    if ((*s & 0xc0) != 0x80)
+      n++;
+    s++;
+  }
+  return n;
+}
+
+// checks the characters that start before stop, returning where the last one
+// ends or NULL
+static char *validUtf8Scalar(char *s, char *stop, char *end) {
+  while (s < stop) {
+    if ((uchar)*s < 0x80) {
+      s++;
+      continue;
+    }
+    uint32_t cp;
+    int n = utf8Decode(s, end - s, &cp);
+    if (!n)
+      return NULL;
+    s += n;
+  }
+  return s;
+}
+
+static bool isSpaceChar(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+// words are runs of non-space characters.  *inWord says whether the byte
+// before s was part of a word and is updated to say the same about end[-1].
+static int64_t countWordStartsScalar(char *s, char *end, bool *inWord) {
+  int64_t n = 0;
+  bool w = *inWord;
+  while (s < end) {
+    bool w1 = !isSpaceChar(*s);
+    if (w1 && !w)
+      n++;
+    w = w1;
+    s++;
+  }
+  *inWord = w;
+  return n;
+}
+
+#ifdef SIMD_X86
+static int64_t countCharSSE2(char *s, char *end, char c) {
+  __m128i needle = _mm_set1_epi8(c);
+  __m128i zero = _mm_setzero_si128();
+  int64_t n = 0;
+
+  while (end - s >= 16) {
+    // the byte counters would overflow after 255 blocks
+    int64_t blocks = min((end - s) / 16, 255);
+    __m128i acc = zero;
+    for (int64_t i = 0; i < blocks; ++i) {
+      __m128i v = _mm_loadu_si128((__m128i *)s);
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+      s += 16;
+    }
+    __m128i sums = _mm_sad_epu8(acc, zero);
+    n += _mm_extract_epi16(sums, 0) + _mm_extract_epi16(sums, 4);
+  }
+
+  return n + countCharScalar(s, end, c);
+}
+
+__attribute__((target("avx2"))) static int64_t countCharAVX2(char *s,
+                                                             char *end,
+                                                             char c) {
+  __m256i needle = _mm256_set1_epi8(c);
+  __m256i zero = _mm256_setzero_si256();
+  int64_t n = 0;
+
+  while (end - s >= 32) {
+    int64_t blocks = min((end - s) / 32, 255);
+    __m256i acc = zero;
+    for (int64_t i = 0; i < blocks; ++i) {
+      __m256i v = _mm256_loadu_si256((__m256i *)s);
+      acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, needle));
+      s += 32;
+    }
+    int64_t sums[4];
+    _mm256_storeu_si256((__m256i *)sums, _mm256_sad_epu8(acc, zero));
+    n += sums[0] + sums[1] + sums[2] + sums[3];
+  }
+
+  return n + countCharSSE2(s, end, c);
+}
+
+static char *findAnySSE2(char *s, char *end, char a, char b, char c) {
+  __m128i va = _mm_set1_epi8(a);
+  __m128i vb = _mm_set1_epi8(b);
+  __m128i vc = _mm_set1_epi8(c);
+  while (end - s >= 16) {
+    __m128i v = _mm_loadu_si128((__m128i *)s);
+    __m128i eq = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+        _mm_cmpeq_epi8(v, vc));
+    int mask = _mm_movemask_epi8(eq);
+    if (mask)
+      return s + __builtin_ctz(mask);
+    s += 16;
+  }
+  return findAnyScalar(s, end, a, b, c);
+}
+
+__attribute__((target("avx2"))) static char *
+findAnyAVX2(char *s, char *end, char a, char b, char c) {
+  __m256i va = _mm256_set1_epi8(a);
+  __m256i vb = _mm256_set1_epi8(b);
+  __m256i vc = _mm256_set1_epi8(c);
+  while (end - s >= 32) {
+    __m256i v = _mm256_loadu_si256((__m256i *)s);
+    __m256i eq = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),
+        _mm256_cmpeq_epi8(v, vc));
+    uint32_t mask = _mm256_movemask_epi8(eq);
+    if (mask)
+      return s + __builtin_ctz(mask);
+    s += 32;
+  }
+  return findAnySSE2(s, end, a, b, c);
+}
+
+static int64_t countCodepointsSSE2(char *s, char *end) {
+  __m128i lastCont = _mm_set1_epi8((char)0xbf);
+  __m128i zero = _mm_setzero_si128();
+  int64_t n = 0;
+
+  while (end - s >= 16) {
+    int64_t blocks = min((end - s) / 16, 255);
+    __m128i acc = zero;
+    for (int64_t i = 0; i < blocks; ++i) {
+      __m128i v = _mm_loadu_si128((__m128i *)s);
+      // signed compare: continuation bytes are -128..-65
+      acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, lastCont));
+      s += 16;
+    }
+    __m128i sums = _mm_sad_epu8(acc, zero);
+    n += _mm_extract_epi16(sums, 0) + _mm_extract_epi16(sums, 4);
+  }
+
+  return n + countCodepointsScalar(s, end);
+}
+
+__attribute__((target("avx2"))) static int64_t countCodepointsAVX2(char *s,
+                                                                   char *end) {
+  __m256i lastCont = _mm256_set1_epi8((char)0xbf);
+  __m256i zero = _mm256_setzero_si256();
+  int64_t n = 0;
+
+  while (end - s >= 32) {
+    int64_t blocks = min((end - s) / 32, 255);
+    __m256i acc = zero;
+    for (int64_t i = 0; i < blocks; ++i) {
+      __m256i v = _mm256_loadu_si256((__m256i *)s);
+      acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(v, lastCont));
+      s += 32;
+    }
+    int64_t sums[4];
+    _mm256_storeu_si256((__m256i *)sums, _mm256_sad_epu8(acc, zero));
+    n += sums[0] + sums[1] + sums[2] + sums[3];
+  }
+
+  return n + countCodepointsSSE2(s, end);
+}
+
+static int64_t countWordStartsSSE2(char *s, char *end, bool *inWord) {
+  __m128i sp = _mm_set1_epi8(' ');
+  __m128i nl = _mm_set1_epi8('\n');
+  __m128i tab = _mm_set1_epi8('\t');
+  __m128i cr = _mm_set1_epi8('\r');
+  unsigned prevSpace = !*inWord;
+  int64_t n = 0;
+
+  while (end - s >= 16) {
+    __m128i v = _mm_loadu_si128((__m128i *)s);
+    __m128i ws =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, nl)),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, cr)));
+    unsigned space = _mm_movemask_epi8(ws);
+    // a word starts at a non-space that follows a space
+    n += __builtin_popcount(~space & ((space << 1) | prevSpace) & 0xffff);
+    prevSpace = space >> 15;
+    s += 16;
+  }
+
+  *inWord = !prevSpace;
+  return n + countWordStartsScalar(s, end, inWord);
+}
+
+__attribute__((target("avx2"))) static int64_t
+countWordStartsAVX2(char *s, char *end, bool *inWord) {
+  __m256i sp = _mm256_set1_epi8(' ');
+  __m256i nl = _mm256_set1_epi8('\n');
+  __m256i tab = _mm256_set1_epi8('\t');
+  __m256i cr = _mm256_set1_epi8('\r');
+  unsigned prevSpace = !*inWord;
+  int64_t n = 0;
+
+  while (end - s >= 32) {
+    __m256i v = _mm256_loadu_si256((__m256i *)s);
+    __m256i ws = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, nl)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, cr)));
+    unsigned space = _mm256_movemask_epi8(ws);
+    n += __builtin_popcount(~space & ((space << 1) | prevSpace));
+    prevSpace = space >> 31;
+    s += 32;
+  }
+
+  *inWord = !prevSpace;
+  return n + countWordStartsScalar(s, end, inWord);
+}
+
+// all-ASCII blocks are skipped 16 bytes at a time, the rest is decoded
+static bool validUtf8SSE2(char *s, char *end) {
+  while (end - s >= 16) {
+    __m128i v = _mm_loadu_si128((__m128i *)s);
+    if (!_mm_movemask_epi8(v)) {
+      s += 16;
+      continue;
+    }
+    // finish the characters that start in this block
+    s = validUtf8Scalar(s, s + 16, end);
+    if (!s)
+      return false;
+  }
+  return validUtf8Scalar(s, end, end) != NULL;
+}
+
+// Keiser and Lemire's lookup validator: three table lookups, on the high and
+// low nibble of the previous byte and the high nibble of the current one,
+// classify every two byte pair, and the positions that must be the third or
+// fourth byte of a character come from the bytes two and three back.
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define LANES(...) __VA_ARGS__, __VA_ARGS__
+
+typedef struct {
+  __m256i prev;
+  __m256i error;
+  __m256i incomplete;
+} utf8State_t;
+
+// the 32 bytes that end n bytes before the end of v
+#define PREV_BYTES(v, prev, n)                                                 \
+  _mm256_alignr_epi8(v, _mm256_permute2x128_si256(prev, v, 0x21), 16 - (n))
+
+__attribute__((target("avx2"))) static __m256i highNibbles(__m256i v) {
+  return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+}
+
+__attribute__((target("avx2"))) static void validUtf8Block(utf8State_t *st,
+                                                           __m256i v) {
+  if (!_mm256_movemask_epi8(v)) {
+    // an ASCII block can't finish a character left open by the last one
+    st->error = _mm256_or_si256(st->error, st->incomplete);
+    st->prev = v;
+    return;
+  }
+
+  const __m256i byte1High = _mm256_setr_epi8(LANES(
+      TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+      TOO_LONG, TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+      TOO_SHORT | OVERLONG_2, TOO_SHORT,
+      TOO_SHORT | OVERLONG_3 | SURROGATE,
+      TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4));
+  const __m256i byte1Low = _mm256_setr_epi8(LANES(
+      CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY,
+      CARRY, CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+      CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000));
+  const __m256i byte2High = _mm256_setr_epi8(LANES(
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+      TOO_SHORT, TOO_SHORT,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+          OVERLONG_4,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, TOO_SHORT,
+      TOO_SHORT, TOO_SHORT, TOO_SHORT));
+
+  __m256i prev1 = PREV_BYTES(v, st->prev, 1);
+  __m256i special = _mm256_and_si256(
+      _mm256_and_si256(_mm256_shuffle_epi8(byte1High, highNibbles(prev1)),
+                       _mm256_shuffle_epi8(byte1Low, _mm256_and_si256(
+                                                   prev1, _mm256_set1_epi8(0x0f)))),
+      _mm256_shuffle_epi8(byte2High, highNibbles(v)));
+
+  // bytes two after an 0xe0.. lead or three after an 0xf0.. lead must be
+  // continuations, which the tables flag as TWO_CONTS
+  __m256i third = _mm256_subs_epu8(PREV_BYTES(v, st->prev, 2),
+                                   _mm256_set1_epi8((char)(0xe0 - 0x80)));
+  __m256i fourth = _mm256_subs_epu8(PREV_BYTES(v, st->prev, 3),
+                                    _mm256_set1_epi8((char)(0xf0 - 0x80)));
+  __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                    _mm256_set1_epi8((char)0x80));
+  st->error =
+      _mm256_or_si256(st->error, _mm256_xor_si256(must23, special));
+
+  // a lead byte in the last three places needs bytes from the next block
+  const __m256i maxTail = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)(0xf0 - 1),
+      (char)(0xe0 - 1), (char)(0xc0 - 1));
+  st->incomplete = _mm256_subs_epu8(v, maxTail);
+  st->prev = v;
+}
+
+__attribute__((target("avx2"))) static bool validUtf8AVX2(char *s,
+                                                          char *end) {
+  utf8State_t st;
+  st.prev = _mm256_setzero_si256();
+  st.error = st.prev;
+  st.incomplete = st.prev;
+
+  while (end - s >= 32) {
+    validUtf8Block(&st, _mm256_loadu_si256((__m256i *)s));
+    s += 32;
+  }
+  if (s < end) { // zero padding is ASCII, which ends any open character
+    char tail[32];
+    myMemset(tail, 0, sizeof(tail));
+    memcpy(tail, s, end - s);
+    validUtf8Block(&st, _mm256_loadu_si256((__m256i *)tail));
+  }
+  st.error = _mm256_or_si256(st.error, st.incomplete);
+  return _mm256_testz_si256(st.error, st.error);
+}
+
+static int64_t maxLineLengthSSE2(char *s, char *end) {
+  __m128i nl = _mm_set1_epi8('\n');
+  char *sol = s;
+  int64_t rmax = 0;
+
+  while (end - s >= 16) {
+    __m128i v = _mm_loadu_si128((__m128i *)s);
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    while (mask) {
+      char *p = s + __builtin_ctz(mask);
+      rmax = max(rmax, p - sol + 1);
+      sol = p + 1;
+      mask &= mask - 1;
+    }
+    s += 16;
+  }
+
+  return maxLineLengthScalar(s, end, sol, rmax);
+}
+
+__attribute__((target("avx2"))) static int64_t
+maxLineLengthAVX2(char *s, char *end) {
+  __m256i nl = _mm256_set1_epi8('\n');
+  char *sol = s;
+  int64_t rmax = 0;
+
+  while (end - s >= 32) {
+    __m256i v = _mm256_loadu_si256((__m256i *)s);
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    while (mask) {
+      char *p = s + __builtin_ctz(mask);
+      rmax = max(rmax, p - sol + 1);
+      sol = p + 1;
+      mask &= mask - 1;
+    }
+    s += 32;
+  }
+
+  return maxLineLengthScalar(s, end, sol, rmax);
+}
+#endif
+
+int64_t simdCountChar(char *s, int64_t len, char c) {
+  char *end = s + len;
+  switch (simdLevel()) {
+#ifdef SIMD_X86
+  case SIMD_AVX2:
+    return countCharAVX2(s, end, c);
+  case SIMD_SSE2:
+    return countCharSSE2(s, end, c);
+#endif
+  default:
+    return countCharScalar(s, end, c);
+  }
+}
+
+// offset of the first of a, b or c in s, or len if there is none
+int64_t simdFindAny(char *s, int64_t len, char a, char b, char c) {
+  char *end = s + len;
+  switch (simdLevel()) {
+#ifdef SIMD_X86
+  case SIMD_AVX2:
+    return findAnyAVX2(s, end, a, b, c) - s;
+  case SIMD_SSE2:
+    return findAnySSE2(s, end, a, b, c) - s;
+#endif
+  default:
+    return findAnyScalar(s, end, a, b, c) - s;
+  }
+}
+
+int64_t simdCountCodepoints(char *s, int64_t len) {
+  char *end = s + len;
+  switch (simdLevel()) {
+#ifdef SIMD_X86
+  case SIMD_AVX2:
+    return countCodepointsAVX2(s, end);
+  case SIMD_SSE2:
+    return countCodepointsSSE2(s, end);
+#endif
+  default:
+    return countCodepointsScalar(s, end);
+  }
+}
+
+// number of words that start in s (a word at the very start counts)
+int64_t simdCountWordStarts(char *s, int64_t len) {
+  char *end = s + len;
+  bool inWord = false;
+  switch (simdLevel()) {
+#ifdef SIMD_X86
+  case SIMD_AVX2:
+    return countWordStartsAVX2(s, end, &inWord);
+  case SIMD_SSE2:
+    return countWordStartsSSE2(s, end, &inWord);
+#endif
+  default:
+    return countWordStartsScalar(s, end, &inWord);
+  }
+}
+
+bool simdUtf8Valid(char *s, int64_t len) {
+  char *end = s + len;
+  switch (simdLevel()) {
+#ifdef SIMD_X86
+  case SIMD_AVX2:
+    return validUtf8AVX2(s, end);
+  case SIMD_SSE2:
+    return validUtf8SSE2(s, end);
+#endif
+  default:
+    return validUtf8Scalar(s, end, end) != NULL;
+  }
+}
+
+int64_t simdMaxLineLength(char *s, int64_t len) {
+  char *end = s + len;
+  switch (simdLevel()) {
+#ifdef SIMD_X86
+  case SIMD_AVX2:
+    return maxLineLengthAVX2(s, end);
+  case SIMD_SSE2:
+    return maxLineLengthSSE2(s, end);
+#endif
+  default:
+    return maxLineLengthScalar(s, end, s, 0);
+  }
+}
+
+// checks every kernel against the scalar one at all alignments and prints
+// the newline counting throughput
+void simdTest() {
+  int size = 1 << 16;
+  char *buf = dieIfNull(malloc(size));
+  for (int i = 0; i < size; ++i) {
+    buf[i] = rand() % 7 == 0 ? '\n' : "ab \t\xc3\xa9"[rand() % 6];
+  }
+  myMemset(buf + 1000, 'x', 5000); // a long line
+
+  simdLevel_t best = simdDetect();
+  for (int i = 0; i < 2000; ++i) {
+    int off = rand() % size;
+    int len = rand() % (size - off);
+    simdSetLevel(SIMD_SCALAR);
+    int64_t n = simdCountChar(buf + off, len, '\n');
+    int64_t m = simdMaxLineLength(buf + off, len);
+    int64_t c = simdCountCodepoints(buf + off, len);
+    int64_t w = simdCountWordStarts(buf + off, len);
+    bool u = simdUtf8Valid(buf + off, len);
+    int64_t f = simdFindAny(buf + off, len, '\n', 'b', '\t');
+    for (simdLevel_t l = SIMD_SCALAR; l <= best; ++l) {
+      simdSetLevel(l);
+      assert(simdCountChar(buf + off, len, '\n') == n);
+      assert(simdFindAny(buf + off, len, '\n', 'b', '\t') == f);
+      assert(simdMaxLineLength(buf + off, len) == m);
+      assert(simdCountCodepoints(buf + off, len) == c);
+      assert(simdCountWordStarts(buf + off, len) == w);
+      assert(simdUtf8Valid(buf + off, len) == u);
+    }
+  }
+
+  // valid text with the odd bad byte, short enough to be valid at times
+  char *utf8 = dieIfNull(malloc(size));
+  char *chars[] = {"a", "\n", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80",
+                   "\xed\x9f\xbf", "\xf4\x8f\xbf\xbf"};
+  char *bad[] = {"\x80", "\xc0\xaf", "\xe0\x80\xaf", "\xed\xa0\x80",
+                 "\xf4\x90\x80\x80", "\xf8", "\xe2\x82", "\xff"};
+  int nValid = 0;
+  for (int i = 0; i < 20000; ++i) {
+    int n = 0;
+    int len = rand() % 200;
+    while (n < len) {
+      char *c = rand() % 500 == 0 ? bad[rand() % 8] : chars[rand() % 7];
+      int k = strlen(c);
+      memcpy(utf8 + n, c, k);
+      n += k;
+    }
+    simdSetLevel(SIMD_SCALAR);
+    bool u = simdUtf8Valid(utf8, n);
+    nValid += u;
+    for (simdLevel_t l = SIMD_SCALAR; l <= best; ++l) {
+      simdSetLevel(l);
+      assert(simdUtf8Valid(utf8, n) == u);
+    }
+  }
+  assert(nValid > 0 && nValid < 20000);
+  free(utf8);
+
+  int64_t bigSize = 256 << 20;
+  char *big = dieIfNull(malloc(bigSize));
+  for (int64_t i = 0; i < bigSize; ++i) {
+    big[i] = buf[i % size];
+  }
+  for (simdLevel_t l = SIMD_SCALAR; l <= best; ++l) {
+    simdSetLevel(l);
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    int64_t n = simdCountChar(big, bigSize, '\n');
+    double secs =
+        (double)(SDL_GetPerformanceCounter() - t0) / SDL_GetPerformanceFrequency();
+    printf("simd level %d: %lld newlines, %.2f GB/s\n", l, (long long)n,
+           bigSize / secs / 1e9);
+  }
+
+  simdSetLevel(best);
+  free(big);
+  free(buf);
+}
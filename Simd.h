@@ -0,0 +1,24 @@
+//
+//  Simd.h
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#ifndef Simd_h
+#define Simd_h
+
+#include "Util.h"
+
+typedef enum { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, NUM_SIMD_LEVELS } simdLevel_t;
+
+simdLevel_t simdLevel(void);
+void simdSetLevel(simdLevel_t level);
+int64_t simdCountChar(char *s, int64_t len, char c);
+int64_t simdFindAny(char *s, int64_t len, char a, char b, char c);
+int64_t simdCountCodepoints(char *s, int64_t len);
+int64_t simdCountWordStarts(char *s, int64_t len);
+bool simdUtf8Valid(char *s, int64_t len);
+int64_t simdMaxLineLength(char *s, int64_t len);
+
+#endif /* Simd_h */
@@ -0,0 +1,93 @@
+//
+//  Stats.c
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#include "Stats.h"
+#include "Simd.h"
+
+// Statistics of a run of text that can be computed for the concatenation of
+// two runs from the statistics of each.  The piece table keeps them for
+// every subtree so the totals for a document are always at hand.
+
+static bool isSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+void statsOf(textStats_t *st, char *s, int64_t len) {
+  myMemset(st, 0, sizeof(textStats_t));
+  st->size = len;
+  if (len == 0)
+    return;
+
+  st->numLines = simdCountChar(s, len, '\n');
+  st->numChars = simdCountCodepoints(s, len);
+  st->numWords = simdCountWordStarts(s, len);
+  st->startsInWord = !isSpace(s[0]);
+  st->endsInWord = !isSpace(s[len - 1]);
+
+  if (st->numLines == 0) {
+    st->lead = len;
+    st->trail = len;
+    return;
+  }
+
+  char *first = memchr(s, '\n', len);
+  char *last = s + len - 1;
+  while (*last != '\n')
+    last--;
+  st->lead = first - s + 1;
+  st->trail = s + len - last - 1;
+  // the lines after the first newline up to the last one are complete
+  st->longest = simdMaxLineLength(first + 1, last - first);
+}
+
+// r may be a or b
+void statsJoin(textStats_t *r, textStats_t *a, textStats_t *b) {
+  if (a->size == 0) {
+    *r = *b;
+    return;
+  }
+  if (b->size == 0) {
+    *r = *a;
+    return;
+  }
+
+  textStats_t st;
+  st.size = a->size + b->size;
+  st.numLines = a->numLines + b->numLines;
+  st.numChars = a->numChars + b->numChars;
+  st.numWords =
+      a->numWords + b->numWords - (a->endsInWord && b->startsInWord ? 1 : 0);
+  st.startsInWord = a->startsInWord;
+  st.endsInWord = b->endsInWord;
+
+  if (a->numLines == 0 && b->numLines == 0) {
+    st.lead = st.size;
+    st.trail = st.size;
+    st.longest = 0;
+  } else if (a->numLines == 0) {
+    st.lead = a->size + b->lead;
+    st.trail = b->trail;
+    st.longest = b->longest;
+  } else if (b->numLines == 0) {
+    st.lead = a->lead;
+    st.trail = a->trail + b->size;
+    st.longest = a->longest;
+  } else {
+    st.lead = a->lead;
+    st.trail = b->trail;
+    st.longest = max(max(a->longest, b->longest), a->trail + b->lead);
+  }
+
+  *r = st;
+}
+
+// in bytes, counting the newline (like simdMaxLineLength)
+int64_t statsLongestLine(textStats_t *st) {
+  if (st->numLines == 0)
+    return st->size;
+  return max(st->longest, max(st->lead, st->trail));
+}
@@ -0,0 +1,17 @@
+//
+//  Stats.h
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#ifndef Stats_h
+#define Stats_h
+
+#include "Util.h"
+
+void statsOf(textStats_t *st, char *s, int64_t len);
+void statsJoin(textStats_t *r, textStats_t *a, textStats_t *b);
+int64_t statsLongestLine(textStats_t *st);
+
+#endif /* Stats_h */
@@ -6,7 +6,13 @@
 //  Copyright (c) 2021 Brett Letner. All rights reserved.
 //
 
+#include "Doc.h"
 #include "DynamicArray.h"
+#include "Font.h"
+#include "Parse.h"
+#include "PieceTable.h"
+#include "Simd.h"
+#include "Utf8.h"
 #include "Widget.h"
 #include "Syntax.h"
 
@@ -20,178 +26,960 @@ bool isSpecialChar(char c) {
   return (c == '{' || c == '}' || c == '(' || c == ')' || c == '[' ||
           c == ']' || c == ';' || c == ':' || c == ',');
 }
-char peekChar(char *p, char *q) {
-  if (p < q)
-    return *p;
-  return '\0';
+// The lexer is a pair of tables indexed by state and character class: the
+// next state and the color of the character.  Only a '-' or a '/' where a
+// token can begin needs to look at the character after it.  Inside comments
+// and strings, the characters up to the next one that can end the run are
+// skipped a vector at a time.
+//
+// Each language compiles its grammar into its own pair of tables, and its
+// keywords into a perfect hash table, so that an identifier is a keyword if
+// the one entry it hashes to is the same.  Files of no known language aren't
+// lexed at all.
+
+enum {
+  CC_LIDENT,
+  CC_UIDENT,
+  CC_NUM,
+  CC_SPECIAL,
+  CC_SYMBOL, // any other printable character
+  CC_QUOTE,
+  CC_APOSTROPHE,
+  CC_BACKSLASH,
+  CC_SLASH,
+  CC_STAR,
+  CC_MINUS,
+  CC_HASH,
+  CC_NEWLINE,
+  CC_UNKNOWN,
+  NUM_CHAR_CLASSES
+};
+
+#define NUM_TOK_STATES (IN_CHAR_ESC + 1)
+#define TOK_LOOKAHEAD 0xff // the next state depends on the next character
+
+typedef struct {
+  char *name;
+  char *fileNames;   // extensions (".c") and whole names ("Makefile")
+  bool cComments;    // "//" and "/* */"
+  bool hashComments; // '#' to the end of the line
+  bool preprocessor; // '#' to the end of the line is a directive
+  char *keywords;
+} grammar_t;
+
+static const grammar_t grammars[] = {
+    {"C", ".c .h .cc .cpp .cxx .hh .hpp .hxx .m .mm", true, false, true,
+     "auto break case char const continue default do double else enum extern "
+     "float for goto if inline int long register restrict return short signed "
+     "sizeof static struct switch typedef union unsigned void volatile while "
+     "bool true false NULL _Bool _Static_assert class namespace template "
+     "typename public private protected virtual override new delete this "
+     "using nullptr operator try catch throw friend constexpr"},
+    {"Makefile", "Makefile makefile GNUmakefile .mk", false, true, false,
+     "ifeq ifneq ifdef ifndef else endif include define endef export "
+     "unexport override vpath"},
+    {"shell", ".sh .bash .zsh", false, true, false,
+     "if then else elif fi case esac for while until do done in function "
+     "select return local export readonly break continue"},
+    {"Python", ".py", false, true, false,
+     "False None True and as assert async await break class continue def del "
+     "elif else except finally for from global if import in is lambda "
+     "nonlocal not or pass raise return try while with yield"},
+};
+
+#define NUM_LANGUAGES ((int)(sizeof(grammars) / sizeof(grammars[0])))
+
+struct language_s {
+  const grammar_t *grammar;
+  uchar next[NUM_TOK_STATES][NUM_CHAR_CLASSES];
+  color_t color[NUM_TOK_STATES][NUM_CHAR_CLASSES];
+  char **keywords; // the perfect hash table, NULL where empty
+  uint32_t seed;
+  uint32_t mask;
+  int maxKeywordLen;
+};
+
+static uchar charClass[256];
+static language_t languages[NUM_LANGUAGES];
+
+static void tokBegin(const grammar_t *g, int cc, uchar *next, color_t *color) {
+  static const struct {
+    uchar next;
+    color_t color;
+  } begin[NUM_CHAR_CLASSES] = {
+      [CC_LIDENT] = {IN_LIDENT, lidentColor},
+      [CC_UIDENT] = {IN_UIDENT, uidentColor},
+      [CC_NUM] = {IN_NUMBER, literalColor},
+      [CC_SPECIAL] = {TOKBEGIN, specialColor},
+      [CC_SYMBOL] = {TOKBEGIN, symbolColor},
+      [CC_QUOTE] = {IN_STRING, literalColor},
+      [CC_APOSTROPHE] = {IN_CHAR, literalColor},
+      [CC_BACKSLASH] = {TOKBEGIN, symbolColor},
+      [CC_SLASH] = {TOKBEGIN, symbolColor},
+      [CC_STAR] = {TOKBEGIN, symbolColor},
+      [CC_MINUS] = {TOK_LOOKAHEAD, symbolColor},
+      [CC_HASH] = {TOKBEGIN, symbolColor},
+      [CC_NEWLINE] = {TOKBEGIN, unknownColor},
+      [CC_UNKNOWN] = {TOKBEGIN, unknownColor},
+  };
+  *next = begin[cc].next;
+  *color = begin[cc].color;
+  if (cc == CC_SLASH && g->cComments) {
+    *next = TOK_LOOKAHEAD;
+  } else if (cc == CC_HASH && g->preprocessor) {
+    *next = IN_PREPROC;
+    *color = preprocColor;
+  } else if (cc == CC_HASH && g->hashComments) {
+    *next = IN_SLCOMMENT;
+    *color = commentColor;
+  }
 }
-// BAL: handle reserved words (requires lookahead)
-// BAL: enable other font characteristics bold, italic, underline
-color_t getCharColor(char c, tokSt_t *accp, char *p, char *q) {
-  tokSt_t acc = *accp;
 
-  switch (acc) {
-  case IN_STRING:
-    if (c == '"')
-      *accp = TOKBEGIN;
-    else if (c == '\\')
-      *accp = IN_STRING_ESC;
-    return literalColor;
-  case IN_STRING_ESC:
-    *accp = IN_STRING;
-    return literalColor;
-  case IN_CHAR:
-    if (c == '\'')
-      *accp = TOKBEGIN;
-    else if (c == '\\')
-      *accp = IN_CHAR_ESC;
-    return literalColor;
-  case IN_CHAR_ESC:
-    *accp = IN_CHAR;
-    return literalColor;
-  case IN_SLCOMMENT:
-    if (c == '\n')
-      *accp = TOKBEGIN;
-    return commentColor;
-  case IN_MLCOMMENT:
-    if (c == '*')
-      *accp = IN_MLCOMMENT_END;
-    return commentColor;
-  case IN_MLCOMMENT_END:
-    if (c == '/')
-      *accp = TOKBEGIN;
-    else
-      *accp = IN_MLCOMMENT;
-    return commentColor;
-  case IN_LIDENT:
-    if (isIdentChar(c))
-      return lidentColor;
-    goto tok_begin;
-  case IN_UIDENT:
-    if (isIdentChar(c))
-      return uidentColor;
-    goto tok_begin;
-  case IN_PREPROC:
-    if (isIdentChar(c))
-      return preprocColor;
-    goto tok_begin;
-  case IN_NUMBER:
-    if (isIdentChar(c))
-      return literalColor;
-    goto tok_begin;
-  default:
-    goto tok_begin;
-  }
-
-tok_begin:
-  switch (c) {
-  case '\'':
-    *accp = IN_CHAR;
-    return literalColor;
-  case '"':
-    *accp = IN_STRING;
-    return literalColor;
-  case '-': {
-    char c1 = peekChar(p, q);
-    if (isNumChar(c1)) {
-      *accp = IN_NUMBER;
-      return literalColor;
+static void compileTables(language_t *lang) {
+  for (int st = 0; st < NUM_TOK_STATES; ++st) {
+    for (int cc = 0; cc < NUM_CHAR_CLASSES; ++cc) {
+      uchar *next = &lang->next[st][cc];
+      color_t *color = &lang->color[st][cc];
+      bool ident = cc == CC_LIDENT || cc == CC_UIDENT || cc == CC_NUM;
+      *next = st;
+      switch (st) {
+      case IN_STRING:
+        *next = cc == CC_QUOTE       ? TOKBEGIN
+                : cc == CC_BACKSLASH ? IN_STRING_ESC
+                                     : IN_STRING;
+        *color = literalColor;
+        break;
+      case IN_CHAR:
+        *next = cc == CC_APOSTROPHE  ? TOKBEGIN
+                : cc == CC_BACKSLASH ? IN_CHAR_ESC
+                                     : IN_CHAR;
+        *color = literalColor;
+        break;
+      case IN_STRING_ESC:
+      case IN_CHAR_ESC:
+        *next = st == IN_STRING_ESC ? IN_STRING : IN_CHAR;
+        *color = literalColor;
+        break;
+      case IN_SLCOMMENT:
+        *next = cc == CC_NEWLINE ? TOKBEGIN : IN_SLCOMMENT;
+        *color = commentColor;
+        break;
+      case IN_MLCOMMENT:
+        *next = cc == CC_STAR ? IN_MLCOMMENT_END : IN_MLCOMMENT;
+        *color = commentColor;
+        break;
+      case IN_MLCOMMENT_END:
+        *next = cc == CC_SLASH ? TOKBEGIN : IN_MLCOMMENT;
+        *color = commentColor;
+        break;
+      case IN_LIDENT:
+      case IN_UIDENT:
+      case IN_PREPROC:
+      case IN_NUMBER:
+        if (ident) {
+          *color = st == IN_LIDENT   ? lidentColor
+                   : st == IN_UIDENT ? uidentColor
+                   : st == IN_PREPROC ? preprocColor
+                                      : literalColor;
+          break;
+        }
+        tokBegin(lang->grammar, cc, next, color);
+        break;
+      default:
+        tokBegin(lang->grammar, cc, next, color);
+        break;
+      }
     }
-    *accp = TOKBEGIN;
-    return symbolColor;
   }
-  case '/': {
-    char c1 = peekChar(p, q);
-    switch (c1) {
+}
+
+static uint32_t keywordHash(uint32_t seed, char *s, int n) {
+  uint32_t h = seed;
+  for (int i = 0; i < n; ++i) {
+    h = (h ^ (uchar)s[i]) * 16777619;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  return h;
+}
+
+// finds a seed that hashes every keyword to a slot of its own, in a table
+// made bigger each time too many seeds have been tried
+static void compileKeywords(language_t *lang) {
+  char *words = dieIfNull(strdup(lang->grammar->keywords));
+  dynamicArray_t list;
+  arrayInit(&list, sizeof(char *));
+  for (char *w = strtok(words, " "); w; w = strtok(NULL, " ")) {
+    arrayPush(&list, &w);
+    lang->maxKeywordLen = max(lang->maxKeywordLen, (int)strlen(w));
+  }
+  char **ws = (char **)list.start;
+  uint32_t size = 1;
+  while (size < 2 * list.numElems) {
+    size *= 2;
+  }
+  for (;; size *= 2) {
+    if (size > 1 << 16)
+      die("unable to hash the keywords");
+    lang->keywords = dieIfNull(realloc(lang->keywords, size * sizeof(char *)));
+    lang->mask = size - 1;
+    for (lang->seed = 1; lang->seed <= 1024; ++lang->seed) {
+      myMemset(lang->keywords, 0, size * sizeof(char *));
+      int64_t i = 0;
+      for (; i < list.numElems; ++i) {
+        char **slot = &lang->keywords[keywordHash(lang->seed, ws[i],
+                                                  (int)strlen(ws[i])) &
+                                      lang->mask];
+        if (*slot)
+          break;
+        *slot = ws[i];
+      }
+      if (i == list.numElems) {
+        arrayFree(&list);
+        return;
+      }
+    }
+  }
+}
+
+bool isKeyword(language_t *lang, char *s, int n) {
+  if (n > lang->maxKeywordLen)
+    return false;
+  char *k = lang->keywords[keywordHash(lang->seed, s, n) & lang->mask];
+  return k && strncmp(k, s, n) == 0 && k[n] == '\0';
+}
+
+static void lexInit(void) {
+  static bool done = false;
+  if (done)
+    return;
+  done = true;
+  for (int c = 0; c < 256; ++c) {
+    uchar cc = CC_UNKNOWN;
+    if (isLidentChar(c))
+      cc = CC_LIDENT;
+    else if (isUidentChar(c))
+      cc = CC_UIDENT;
+    else if (isNumChar(c))
+      cc = CC_NUM;
+    else if (isSpecialChar(c))
+      cc = CC_SPECIAL;
+    else if (c >= ' ' && c <= '~')
+      cc = CC_SYMBOL;
+    switch (c) {
+    case '"':
+      cc = CC_QUOTE;
+      break;
+    case '\'':
+      cc = CC_APOSTROPHE;
+      break;
+    case '\\':
+      cc = CC_BACKSLASH;
+      break;
     case '/':
-      *accp = IN_SLCOMMENT;
-      return commentColor;
+      cc = CC_SLASH;
+      break;
     case '*':
-      *accp = IN_MLCOMMENT;
-      return commentColor;
-    default:
-      *accp = TOKBEGIN;
-      return symbolColor;
+      cc = CC_STAR;
+      break;
+    case '-':
+      cc = CC_MINUS;
+      break;
+    case '#':
+      cc = CC_HASH;
+      break;
+    case '\n':
+      cc = CC_NEWLINE;
+      break;
     }
+    charClass[c] = cc;
+  }
+
+  for (int i = 0; i < NUM_LANGUAGES; ++i) {
+    languages[i].grammar = &grammars[i];
+    compileTables(&languages[i]);
+    compileKeywords(&languages[i]);
   }
-  case '#':
-    *accp = IN_PREPROC;
-    return preprocColor;
+}
+
+// the language of the file's name, or NULL for plain text
+language_t *languageOf(char *filepath) {
+  lexInit();
+  char *name = strrchr(filepath, '/');
+  name = name ? name + 1 : filepath;
+  size_t len = strlen(name);
+  for (int i = 0; i < NUM_LANGUAGES; ++i) {
+    char *p = grammars[i].fileNames;
+    while (*p) {
+      size_t n = strcspn(p, " ");
+      if (*p == '.' ? len > n && memcmp(name + len - n, p, n) == 0
+                    : len == n && memcmp(name, p, n) == 0)
+        return &languages[i];
+      p += n + (p[n] == ' ');
+    }
+  }
+  return NULL;
+}
+
+// c1 is the character following c ('\0' if none)
+color_t getCharColor(language_t *lang, char c, char c1, tokSt_t *accp) {
+  int cc = charClass[(uchar)c];
+  uchar next = lang->next[*accp][cc];
+  if (next != TOK_LOOKAHEAD) {
+    color_t color = lang->color[*accp][cc];
+    *accp = next;
+    return color;
+  }
+  if (cc == CC_MINUS) {
+    bool num = isNumChar(c1);
+    *accp = num ? IN_NUMBER : TOKBEGIN;
+    return num ? literalColor : symbolColor;
+  }
+  switch (c1) {
+  case '/':
+    *accp = IN_SLCOMMENT;
+    return commentColor;
+  case '*':
+    *accp = IN_MLCOMMENT;
+    return commentColor;
   default:
-    if (isLidentChar(c)) {
-      *accp = IN_LIDENT;
-      return lidentColor;
+    *accp = TOKBEGIN;
+    return symbolColor;
+  }
+}
+
+// the bytes from the start of s that, in state acc, stay in it and have its
+// color.  Only comments and strings have them, and the callers check for
+// those first because most runs are short.
+static inline int lexSkip(char *s, int n, tokSt_t acc) {
+  switch (acc) {
+  case IN_SLCOMMENT:
+    return (int)simdFindAny(s, n, '\n', '\n', '\n');
+  case IN_MLCOMMENT:
+    return (int)simdFindAny(s, n, '*', '\n', '\n');
+  case IN_STRING:
+    return (int)simdFindAny(s, n, '"', '\\', '\n');
+  default:
+    return 0;
+  }
+}
+
+// lexes the run of characters at the start of s that have the same color,
+// ending it after a newline, and returns its length.  next is the character
+// following s[n - 1] ('\0' if none).
+int lexRun(language_t *lang, char *s, int n, char next, tokSt_t *acc,
+           color_t *color) {
+  assert(n > 0);
+  tokSt_t st = *acc;
+  *color = getCharColor(lang, s[0], n > 1 ? s[1] : next, &st);
+  int i = 1;
+  while (i < n && s[i - 1] != '\n') {
+    if (st == IN_SLCOMMENT || st == IN_MLCOMMENT || st == IN_STRING) {
+      i += lexSkip(s + i, n - i, st);
+      if (i == n)
+        break;
     }
-    if (isUidentChar(c)) {
-      *accp = IN_UIDENT;
-      return uidentColor;
+    int cc = charClass[(uchar)s[i]];
+    uchar t = lang->next[st][cc];
+    if (t == TOK_LOOKAHEAD) {
+      tokSt_t u = st;
+      if (getCharColor(lang, s[i], i + 1 < n ? s[i + 1] : next, &u) != *color)
+        break;
+      t = u;
+    } else if (lang->color[st][cc] != *color) {
+      break;
     }
-    if (isNumChar(c)) {
-      *accp = IN_NUMBER;
-      return literalColor;
+    st = t;
+    i++;
+  }
+  *acc = st;
+  return i;
+}
+
+// The lexer state at the start of every line is cached so drawing only lexes
+// the lines in view.  An edit makes the states after its line stale, but they
+// are kept (moved with the lines) because lexing usually gets back in step
+// with them soon after the edit, and then the rest are right again.
+
+void syntaxCacheInit(syntaxCache_t *c, char *filepath) {
+  c->language = languageOf(filepath);
+  arrayInit(&c->states, sizeof(uchar));
+  c->valid = 0;
+  c->convergeFrom = 0;
+}
+
+void syntaxCacheReset(syntaxCache_t *c) {
+  arrayReinit(&c->states);
+  c->valid = 0;
+  c->convergeFrom = 0;
+}
+
+void syntaxCacheFree(syntaxCache_t *c) { arrayFree(&c->states); }
+
+// forgets the states after row
+void syntaxCacheTruncate(syntaxCache_t *c, int64_t row) {
+  c->states.numElems = min(c->states.numElems, row + 1);
+  c->valid = min(c->valid, row + 1);
+}
+
+// the text of row changed, and lines were added after it (removed if
+// negative).  Only the states that were right can become stale: the ones
+// already stale may be out of step with any number of edits.
+void syntaxCacheEdit(syntaxCache_t *c, int64_t row, int64_t lines) {
+  dynamicArray_t *a = &c->states;
+  if (row + 1 >= c->valid) {
+    a->numElems = min(a->numElems, row + 1);
+    return;
+  }
+  a->numElems = c->valid;
+  if (lines > 0) {
+    arrayGrow(a, a->numElems + lines);
+    uchar *p = (uchar *)a->start + row + 1;
+    memmove(p + lines, p, a->numElems - row - 1);
+    a->numElems += lines;
+  } else if (lines < 0) {
+    arrayDelete(a, row + 1, min(-lines, a->numElems - row - 1));
+  }
+  c->valid = row + 1;
+  c->convergeFrom = row + 1 + max(lines, 0);
+}
+
+static uchar *stateAt(syntaxCache_t *c, int64_t row) {
+  return arrayElemAt(&c->states, row);
+}
+
+// lexes from the last line known until row is, or the stale states are right
+// again
+static void syntaxLex(doc_t *doc, int64_t row) {
+  syntaxCache_t *c = &doc->syntax;
+  int64_t line = c->valid - 1;
+  tokSt_t acc = *stateAt(c, line);
+  int64_t offset = docLineStart(doc, line);
+  int len;
+  char *s;
+  while ((s = docSpan(doc, offset, &len))) {
+    offset += len;
+    char next = docCharAt(doc, offset);
+    color_t color;
+    for (int i = 0; i < len;) {
+      i += lexRun(c->language, s + i, len - i, next, &acc, &color);
+      if (s[i - 1] != '\n')
+        continue;
+      line++;
+      if (line < c->states.numElems) {
+        if (line >= c->convergeFrom && *stateAt(c, line) == acc) {
+          c->valid = c->states.numElems;
+          return;
+        }
+        *stateAt(c, line) = acc;
+      } else {
+        uchar b = acc;
+        arrayPush(&c->states, &b);
+      }
+      c->valid = line + 1;
+      if (line == row)
+        return;
     }
-    if (isSpecialChar(c)) {
-      *accp = TOKBEGIN;
-      return specialColor;
+  }
+}
+
+// the lexer state at the start of row
+static tokSt_t syntaxStateAt(doc_t *doc, int64_t row) {
+  syntaxCache_t *c = &doc->syntax;
+  assert(c->language);
+  if (c->valid == 0) {
+    uchar b = TOKBEGIN;
+    arrayReinit(&c->states);
+    arrayPush(&c->states, &b);
+    c->valid = 1;
+  }
+  while (row >= c->valid) {
+    syntaxLex(doc, row);
+  }
+  return *stateAt(c, row);
+}
+
+// Filling the whole cache when a big doc is loaded.  The lexer state at the
+// start of a chunk depends on everything before it, so each thread lexes its
+// chunk as if it began in TOKBEGIN.  Then in order, a chunk that didn't is
+// lexed again from the state the one before it ended in, until its states
+// agree with the guessed ones (usually by the end of a comment or string).
+
+#define PARALLEL_LEX_SIZE (16 << 20)
+#define MAX_LEX_THREADS 16
+
+typedef struct {
+  language_t *lang;
+  snapshot_t *snap;
+  int64_t start; // a line start
+  int64_t end;   // the next chunk's start
+  int64_t row;   // of start
+  uchar *states; // at the start of every line
+} lexChunk_t;
+
+// lexes the chunk from acc, setting the states of the lines after its start.
+// If converge is set, stops at the first one that is already right.
+static void lexChunk(lexChunk_t *c, tokSt_t acc, bool converge) {
+  int64_t row = c->row;
+  int64_t offset = c->start;
+  int64_t length = snapshotLength(c->snap);
+  while (offset < c->end) {
+    int len;
+    char *s = snapshotSpan(c->snap, offset, &len);
+    len = (int)min(len, c->end - offset);
+    offset += len;
+    char next = '\0';
+    if (offset < length)
+      snapshotCopy(c->snap, offset, 1, &next);
+    color_t color;
+    for (int i = 0; i < len;) {
+      i += lexRun(c->lang, s + i, len - i, next, &acc, &color);
+      if (s[i - 1] != '\n')
+        continue;
+      row++;
+      if (converge && c->states[row] == acc)
+        return;
+      c->states[row] = acc;
     }
-    if (c >= ' ' && c <= '~') {
-      *accp = TOKBEGIN;
-      return symbolColor;
+  }
+}
+
+static int lexChunkRun(void *data) {
+  lexChunk(data, TOKBEGIN, false);
+  return 0;
+}
+
+static void syntaxCacheFillWith(doc_t *doc, int numThreads) {
+  syntaxCache_t *c = &doc->syntax;
+  snapshot_t snap;
+  docSnapshot(doc, &snap);
+  int64_t len = snapshotLength(&snap);
+  int64_t numLines = snapshotRowOf(&snap, len) + 1;
+  arrayReinit(&c->states);
+  arrayGrow(&c->states, numLines);
+  c->states.numElems = numLines;
+  uchar *states = c->states.start;
+  states[0] = TOKBEGIN;
+
+  SDL_Thread *threads[MAX_LEX_THREADS];
+  lexChunk_t chunks[MAX_LEX_THREADS];
+  simdLevel(); // detect before the workers race to do it
+  for (int i = 0; i < numThreads; ++i) {
+    lexChunk_t *k = &chunks[i];
+    k->lang = c->language;
+    k->snap = &snap;
+    k->states = states;
+    k->start = 0;
+    k->row = 0;
+    if (i > 0) {
+      k->row = min(snapshotRowOf(&snap, len * i / numThreads) + 1, numLines - 1);
+      k->start = snapshotLineStart(&snap, k->row);
+      chunks[i - 1].end = k->start;
     }
+    k->end = len;
+  }
+  for (int i = 0; i < numThreads; ++i) {
+    threads[i] =
+        i == 0 ? NULL : SDL_CreateThread(lexChunkRun, "lex", &chunks[i]);
+    if (!threads[i])
+      lexChunkRun(&chunks[i]);
+  }
+  for (int i = 1; i < numThreads; ++i) {
+    if (threads[i])
+      SDL_WaitThread(threads[i], NULL);
+  }
+
+  for (int i = 1; i < numThreads; ++i) {
+    tokSt_t acc = states[chunks[i].row];
+    if (acc != TOKBEGIN)
+      lexChunk(&chunks[i], acc, true);
   }
-  assert(c < ' ' || c > '~');
-  *accp = TOKBEGIN;
-  return unknownColor;
+  c->valid = numLines;
+  c->convergeFrom = 0;
+  snapshotFree(&snap);
 }
 
-void drawCString(char *s, int n)
-{
+// lexes all of a doc that was just loaded, if it's big enough to be worth
+// splitting across cores (otherwise the lines are lexed as they are drawn)
+void syntaxCacheFill(doc_t *doc) {
+  int numThreads =
+      (int)clamp(1, docLength(doc) / PARALLEL_LEX_SIZE,
+                 min(SDL_GetCPUCount(), MAX_LEX_THREADS));
+  if (doc->syntax.language && numThreads > 1)
+    syntaxCacheFillWith(doc, numThreads);
+}
+
+typedef struct {
+  SDL_Rect rect;
+  int64_t y; // may be far outside of rect's (int) range in large documents
+  language_t *lang; // NULL for plain text
+  tokSt_t acc;
+  int64_t offset;        // of the next character
+  parseSpan_t *span;     // the parser's colors from the next character on
+  parseSpan_t *spansEnd;
+  int64_t match[2];      // brackets of the block the cursor is in, or -1
+  int64_t row;           // of the next character
+  bool cull;             // stop at the right edge of the context
+  bool culled;           // stopped there
+} drawSt_t;
+
+static void drawStSetY(drawSt_t *d, int64_t y) {
+  d->y = y;
+  d->rect.y = clamp(-d->rect.h, y, context.h);
+}
+
+static void drawStInit(drawSt_t *d, language_t *lang) {
+  d->rect.x = 0; // context.dx;
+  d->rect.w = context.font->charSkip;
+  d->rect.h = context.font->lineSkip;
+  drawStSetY(d, context.dy);
+  d->lang = lang;
+  d->acc = TOKBEGIN;
+  d->offset = 0;
+  d->span = d->spansEnd = NULL;
+  d->match[0] = d->match[1] = -1;
+  d->row = 0;
+  d->cull = false;
+  d->culled = false;
+}
+
+// next is the character following s[n - 1] ('\0' if none).  Each UTF-8
+// character takes one cell.  Bytes that aren't part of one (including the
+// keysyms in the macros buffer) are drawn with their own glyphs.  Keywords
+// are found when the run of an identifier is all of it, and the parser's
+// colors go over the lexer's.  Returns false once past the bottom of the
+// context (or the right edge, if culling).
+static bool drawChars(drawSt_t *d, char *s, int n, char next) {
   assert(s);
   assert(n >= 0);
 
   uchar c;
+  uint32_t cp;
   SDL_Texture *txtr;
-  SDL_Rect rect;
-  rect.x = 0; // context.dx;
-  rect.y = context.dy;
-  rect.w = context.font->charSkip;
-  rect.h = context.font->lineSkip;
+  SDL_Rect *rect = &d->rect;
 
   char *p = s;
   char *q = s + n;
-  tokSt_t acc = TOKBEGIN;
+  char *runEnd = d->lang ? s : q;
+  color_t color = plainColor;
 
   while (p < q) {
+    // a character can't start a run in the middle: its other bytes have the
+    // color of the first and leave the state as it is
+    if (p >= runEnd) {
+      tokSt_t acc = d->acc;
+      runEnd = p + lexRun(d->lang, p, q - p, next, &d->acc, &color);
+      if ((color == lidentColor || color == uidentColor) &&
+          acc != IN_LIDENT && acc != IN_UIDENT &&
+          (runEnd < q || !isIdentChar(next)) &&
+          isKeyword(d->lang, p, (int)(runEnd - p)))
+        color = keywordColor;
+    }
     c = *p;
-    p++;
-    color_t color = getCharColor(c, &acc, p, q);
+    int64_t offset = d->offset + (p - s);
+    int k = c < 0x80 ? 1 : utf8Decode(p, q - p, &cp);
+    p += max(k, 1);
     switch (c) {
     case '\n':
-      rect.x = 0; // context.dx;
-      rect.y += rect.h;
+      rect->x = 0; // context.dx;
+      d->row++;
+      drawStSetY(d, d->y + rect->h);
+      if (d->y >= context.h)
+        return false;
       break;
     case ' ':
-      rect.x += rect.w;
+      rect->x += rect->w;
       break;
     default:
-      txtr = context.font->charTexture[c];
+      if (d->cull && rect->x >= context.w) {
+        d->culled = true;
+        return false;
+      }
+      txtr = k > 1 ? fontGlyph(context.font, cp)
+                   : context.font->charTexture[c];
+
+      color_t over = color;
+      while (d->span < d->spansEnd && d->span->offset + d->span->len <= offset) {
+        d->span++;
+      }
+      if (d->span < d->spansEnd && d->span->offset <= offset)
+        over = d->span->color;
+      if (offset == d->match[0] || offset == d->match[1])
+        over = matchColor;
 
       // BAL: could do setTextureColorMod only when the color changes if we used
       // a texture atlas
-      setTextureColorMod(txtr, color);
+      setTextureColorMod(txtr, over);
 
-      SDL_RenderCopy(renderer, txtr, NULL, &rect);
-      rect.x += rect.w;
+      SDL_RenderCopy(renderer, txtr, NULL, rect);
+      rect->x += rect->w;
     }
   }
+  d->offset += n;
+  return true;
+}
 
+void drawCString(char *s, int n)
+{
+  drawSt_t d;
+  lexInit();
+  drawStInit(&d, &languages[0]); // C
+  drawChars(&d, s, n, '\0');
 }
-void drawString(string_t *s) {
-  if (!s)
-    return;
-  assert(s);
-  if (!s->start)
+
+// moves d to the start of row, with the lexer state and parser colors there
+static void drawStSeek(drawSt_t *d, doc_t *doc, parseResult_t *r, int64_t row) {
+  d->row = row;
+  d->offset = docLineStart(doc, row);
+  if (d->lang)
+    d->acc = syntaxStateAt(doc, row);
+  if (r)
+    d->span = parseSpanAt(r, d->offset);
+}
+
+// draws the lines of the document in view a piece at a time (no contiguous
+// copy needed).  Until the parser has caught up with the edits, only the
+// lexer's colors are drawn.  The rest of a line past the right edge is
+// skipped by going to the start of the next one.
+void drawDoc(doc_t *doc, int64_t cursor) {
+  drawSt_t d;
+  drawStInit(&d, doc->syntax.language);
+  d.cull = true;
+  if (d.y >= context.h)
     return;
-  drawCString(s->start, s->numElems);
+
+  int64_t row = d.y < 0 ? min(-d.y / d.rect.h, docNumLines(doc)) : 0;
+  drawStSetY(&d, d.y + row * d.rect.h);
+
+  parserStart(&doc->parser, doc);
+  parseResult_t *r = parserResult(&doc->parser, doc);
+  if (r) {
+    d.spansEnd = (parseSpan_t *)r->spans.start + r->spans.numElems;
+    block_t *b = parseBlockAt(r, cursor);
+    if (b) {
+      d.match[0] = b->open;
+      d.match[1] = b->close;
+    }
+  }
+  drawStSeek(&d, doc, r, row);
+
+  int64_t offset = d.offset;
+  int len;
+  char *s;
+  char buf[32];
+  while ((s = docSpan(doc, offset, &len))) {
+    int m = (int)utf8CompleteLen(s, len);
+    if (m == 0) { // a character split between pieces
+      m = docCharLen(doc, offset);
+      docCopy(doc, offset, m, buf);
+      s = buf;
+    } else if (d.lang && m == len && isIdentChar(s[m - 1]) &&
+               isIdentChar(docCharAt(doc, offset + m))) {
+      // an identifier split between pieces is drawn from a copy (up to the
+      // length of any keyword) so that it can be found to be one
+      while (m > 0 && isIdentChar(s[m - 1])) {
+        m--;
+      }
+      if (m == 0) {
+        while (m < sizeof(buf) && isIdentChar(docCharAt(doc, offset + m))) {
+          m++;
+        }
+        docCopy(doc, offset, m, buf);
+        s = buf;
+      }
+    }
+    offset += m;
+    if (drawChars(&d, s, m, docCharAt(doc, offset)))
+      continue;
+    if (!d.culled || d.row >= docNumLines(doc))
+      return;
+    d.culled = false;
+    d.rect.x = 0; // context.dx;
+    drawStSetY(&d, d.y + d.rect.h);
+    if (d.y >= context.h)
+      return;
+    drawStSeek(&d, doc, r, d.row + 1);
+    offset = d.offset;
+  }
+}
+
+// the runs against lexing a character at a time, at every vector width
+static void lexRunTest(language_t *lang, char *s, int n) {
+  simdLevel_t best = simdLevel();
+  for (simdLevel_t l = SIMD_SCALAR; l <= best; ++l) {
+    simdSetLevel(l);
+    tokSt_t acc = TOKBEGIN;
+    tokSt_t ref = TOKBEGIN;
+    color_t color;
+    for (int i = 0; i < n;) {
+      int k = lexRun(lang, s + i, n - i, '\0', &acc, &color);
+      assert(k > 0);
+      for (int j = i; j < i + k; ++j) {
+        assert(getCharColor(lang, s[j], j + 1 < n ? s[j + 1] : '\0', &ref) ==
+               color);
+        assert(s[j] != '\n' || j == i + k - 1);
+      }
+      assert(acc == ref);
+      i += k;
+      // a run is as long as it can be
+      if (i < n && s[i - 1] != '\n') {
+        tokSt_t t = ref;
+        assert(getCharColor(lang, s[i], i + 1 < n ? s[i + 1] : '\0', &t) !=
+               color);
+      }
+    }
+  }
 }
 
+// prints how fast the document's worth of lines can be lexed, a character at
+// a time and a run at a time
+static void lexBench(language_t *lang, char *s, int n) {
+  tokSt_t acc = TOKBEGIN;
+  int64_t sum = 0;
+  Uint64 t0 = SDL_GetPerformanceCounter();
+  for (int i = 0; i < n; ++i) {
+    sum += getCharColor(lang, s[i], i + 1 < n ? s[i + 1] : '\0', &acc);
+  }
+  Uint64 t1 = SDL_GetPerformanceCounter();
+  color_t color;
+  for (int i = 0; i < n;) {
+    i += lexRun(lang, s + i, n - i, '\0', &acc, &color);
+    sum += color;
+  }
+  Uint64 t2 = SDL_GetPerformanceCounter();
+  double freq = SDL_GetPerformanceFrequency();
+  printf("lexer: %.0f MB/s a character at a time, %.0f MB/s in runs (%lld)\n",
+         n / 1e6 / ((t1 - t0) / freq), n / 1e6 / ((t2 - t1) / freq),
+         (long long)(sum & 1));
+}
+
+// the languages of file names, and their keywords against words that are
+// nearly them
+static void languageTest() {
+  assert(languageOf("/src/ceditor/Syntax.c") == &languages[0]);
+  assert(languageOf("Makefile") == &languages[1]);
+  assert(languageOf("build.sh") == &languages[2]);
+  assert(languageOf("README.md") == NULL);
+  assert(languageOf("notes.txt") == NULL);
+  assert(languageOf(".c") == NULL);
+  assert(languageOf("") == NULL);
+  for (int i = 0; i < NUM_LANGUAGES; ++i) {
+    language_t *lang = &languages[i];
+    char buf[64];
+    char *p = grammars[i].keywords;
+    while (*p) {
+      int n = (int)strcspn(p, " ");
+      memcpy(buf, p, n);
+      assert(isKeyword(lang, buf, n));
+      buf[n] = 'x';
+      assert(!isKeyword(lang, buf, n + 1));
+      buf[n - 1] = 'x';
+      assert(!isKeyword(lang, buf, n));
+      p += n + (p[n] == ' ');
+    }
+  }
+}
+
+// the cache filled a chunk at a time against lexing the lines in order, with
+// comments and strings that go on past the ends of chunks
+static void fillTest(char *s, int n) {
+  doc_t doc;
+  docInit(&doc, "fillTest.c", false, false);
+  docInsert(&doc, 0, s, n);
+  syntaxStateAt(&doc, docNumLines(&doc));
+  dynamicArray_t *a = &doc.syntax.states;
+  int64_t numLines = a->numElems;
+  uchar *ref = dieIfNull(malloc(numLines));
+  memcpy(ref, a->start, numLines);
+  for (int numThreads = 2; numThreads <= MAX_LEX_THREADS; numThreads *= 2) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    syntaxCacheFillWith(&doc, numThreads);
+    Uint64 t1 = SDL_GetPerformanceCounter();
+    assert(a->numElems == numLines && doc.syntax.valid == numLines);
+    assert(memcmp(a->start, ref, numLines) == 0);
+    printf("fillTest: %d threads, %.1f ms\n", numThreads,
+           (t1 - t0) * 1000.0 / SDL_GetPerformanceFrequency());
+  }
+  free(ref);
+}
+
+// the cached states against lexing the whole document, through random edits
+void syntaxTest() {
+  lexInit();
+  languageTest();
+  language_t *cLang = &languages[0];
+  char *code =
+      "// Case-insensitive substring search (ASCII letters only, like\n"
+      "// strcasestr) over length-delimited buffers.  The vector kernels\n"
+      "static int64_t twoWay(searcher_t *s, char *hay, int64_t len) {\n"
+      "  int64_t n = s->len - 1; /* the needle */\n"
+      "  printf(\"%lld \\\"matches\\\"\\n\", (long long)n, '\\'');\n"
+      "#define Y 0x1f\n"
+      "}\n";
+  int size = 16 << 20;
+  char *big = dieIfNull(malloc(size));
+  for (int i = 0; i < size; ++i) {
+    big[i] = code[i % strlen(code)];
+  }
+  lexRunTest(cLang, big, 1 << 16);
+  fillTest(big, size);
+  char *noise = dieIfNull(malloc(1 << 16));
+  char *alphabet = "ab/*\"\\\n\n -#'x\xc3\xa9";
+  int numChars = (int)strlen(alphabet);
+  for (int i = 0; i < 1 << 16; ++i) {
+    noise[i] = alphabet[rand() % numChars];
+  }
+  for (int i = 0; i < NUM_LANGUAGES; ++i) {
+    lexRunTest(&languages[i], noise, 1 << 16);
+  }
+  fillTest(noise, 1 << 16);
+  free(noise);
+  lexBench(cLang, big, size);
+  free(big);
+
+  doc_t doc;
+  docInit(&doc, "syntaxTest.c", false, false);
+  char s[64];
+  srand(1);
+  for (int i = 0; i < 20000; ++i) {
+    int64_t len = docLength(&doc);
+    int op = rand() % 8;
+    if (op < 4 || len == 0) {
+      int n = rand() % (op == 0 ? 64 : 4);
+      for (int j = 0; j < n; ++j) {
+        s[j] = alphabet[rand() % numChars];
+      }
+      docInsert(&doc, rand() % (len + 1), s, n);
+    } else if (op < 7) {
+      int64_t offset = rand() % len;
+      docDelete(&doc, offset, min(len - offset, rand() % (op == 4 ? 64 : 4)));
+    } else {
+      command_t cmds[2] = {{DELETE, rand() % len, NULL, 1},
+                           {INSERT, 0, "/*", 2}};
+      cmds[1].offset = cmds[0].offset + cmds[0].len;
+      docApply(&doc, cmds, 2);
+    }
+
+    // draw as it would, a window somewhere in the document
+    int64_t numLines = docNumLines(&doc);
+    int64_t row = rand() % (numLines + 1);
+    tokSt_t got = syntaxStateAt(&doc, row);
+
+    char *p = docCString(&doc);
+    char *q = p + docLength(&doc);
+    tokSt_t acc = TOKBEGIN;
+    int64_t line = 0;
+    while (p < q && line < row) {
+      uchar c = *p;
+      uint32_t cp;
+      int k = c < 0x80 ? 1 : utf8Decode(p, q - p, &cp);
+      p += max(k, 1);
+      getCharColor(doc.syntax.language, c, p < q ? *p : '\0', &acc);
+      line += c == '\n';
+    }
+    assert(got == acc);
+  }
+  printf("syntaxTest: %lld lines cached\n",
+         (long long)doc.syntax.states.numElems);
+}
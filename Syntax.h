@@ -19,6 +19,12 @@
 #define lidentColor BRCYAN
 #define symbolColor YELLOW
 #define specialColor BLUE
+#define keywordColor GREEN
+#define plainColor BRCYAN
+#define functionColor WHITE
+#define typeColor CYAN
+#define errorColor RED
+#define matchColor BRWHITE
 
 typedef enum {
   TOKBEGIN,
@@ -35,8 +41,19 @@ typedef enum {
   IN_CHAR_ESC
 } tokSt_t;
 
+language_t *languageOf(char *filepath);
+bool isIdentChar(char c);
+bool isKeyword(language_t *lang, char *s, int n);
+int lexRun(language_t *lang, char *s, int n, char next, tokSt_t *acc,
+           color_t *color);
+void syntaxCacheInit(syntaxCache_t *c, char *filepath);
+void syntaxCacheReset(syntaxCache_t *c);
+void syntaxCacheFree(syntaxCache_t *c);
+void syntaxCacheTruncate(syntaxCache_t *c, int64_t row);
+void syntaxCacheEdit(syntaxCache_t *c, int64_t row, int64_t lines);
+void syntaxCacheFill(doc_t *doc);
 void drawCString(char *s, int n);
-void drawString(string_t *s);
+void drawDoc(doc_t *doc, int64_t cursor);
 
 #endif /* Syntax_h */
 
@@ -0,0 +1,300 @@
+//
+//  Undo.c
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#include "Undo.h"
+#include "Doc.h"
+#include "DynamicArray.h"
+
+// Undo history.  Command text lives in the doc's undoArena in the same order
+// as the commands, so dropping the redo history is a single arenaFreeTo.
+// Typing (or deleting) a run of text quickly coalesces into one command
+// whose text is grown in place, so it undoes in one step and one memcpy.
+// When the history gets bigger than doc->undoLimit the oldest commands go.
+// A batch of edits (e.g. from multiple cursors) is a chain of commands that
+// undo and redo as one.
+
+static command_t *undoLast(doc_t *doc) {
+  if (doc->undoStack.numElems == 0)
+    return NULL;
+  return arrayElemAt(&doc->undoStack, doc->undoStack.numElems - 1);
+}
+
+static void undoAppend(doc_t *doc, command_t *cmd, char *s, int64_t len) {
+  cmd->start =
+      arenaGrowLast(&doc->undoArena, cmd->start, cmd->len, cmd->len + len);
+  myMemcpy(cmd->start + cmd->len, s, len);
+  cmd->len += len;
+}
+
+static void undoPrepend(doc_t *doc, command_t *cmd, char *s, int64_t len) {
+  cmd->start =
+      arenaGrowLast(&doc->undoArena, cmd->start, cmd->len, cmd->len + len);
+  memmove(cmd->start + len, cmd->start, cmd->len);
+  myMemcpy(cmd->start, s, len);
+  cmd->len += len;
+  cmd->offset -= len;
+}
+
+// adds the edit to the last command if it continues it: typing forward,
+// deleting forward or backspacing
+static bool undoCoalesce(doc_t *doc, commandTag_t tag, int64_t offset, char *s,
+                         int64_t len, uint32_t now) {
+  command_t *cmd = undoLast(doc);
+  if (!cmd || cmd->chained || cmd->tag != tag ||
+      now - cmd->time > UNDO_COALESCE_MS)
+    return false;
+  if (tag == INSERT && offset == cmd->offset + cmd->len) {
+    undoAppend(doc, cmd, s, len);
+  } else if (tag == DELETE && offset == cmd->offset) {
+    undoAppend(doc, cmd, s, len);
+  } else if (tag == DELETE && offset + len == cmd->offset) {
+    undoPrepend(doc, cmd, s, len);
+  } else {
+    return false;
+  }
+  cmd->time = now;
+  return true;
+}
+
+// index of the first command of the chain that command i is in
+int64_t undoChainStart(doc_t *doc, int64_t i) {
+  while (i > 0 && ((command_t *)arrayElemAt(&doc->undoStack, i))->chained)
+    i--;
+  return i;
+}
+
+// of the commands and their text
+static int64_t undoSize(doc_t *doc, int64_t first, int64_t last) {
+  int64_t n = 0;
+  for (int64_t i = first; i < last; ++i) {
+    command_t *cmd = arrayElemAt(&doc->undoStack, i);
+    n += sizeof(command_t) + cmd->len;
+  }
+  return n;
+}
+
+// the first of the newest commands that take no more than half the limit,
+// but at least the newest chain
+static int64_t undoKeepFrom(doc_t *doc) {
+  undoStack_t *stack = &doc->undoStack;
+  int64_t first = undoChainStart(doc, stack->numElems - 1);
+  int64_t n = undoSize(doc, first, stack->numElems);
+  while (first > 0) {
+    int64_t i = undoChainStart(doc, first - 1);
+    int64_t m = undoSize(doc, i, first);
+    if (n + m > doc->undoLimit / 2)
+      break;
+    n += m;
+    first = i;
+  }
+  return first;
+}
+
+// commands are allocated in order so dropping the redo history frees
+// everything from the first undone command on
+static void undoDropRedo(doc_t *doc) {
+  undoStack_t *stack = &doc->undoStack;
+  if (stack->offset < stack->numElems) {
+    command_t *cmd = arrayElemAt(stack, stack->offset);
+    arenaFreeTo(&doc->undoArena, cmd->start);
+    stack->numElems = stack->offset;
+  }
+}
+
+// drops the oldest commands once the history takes more than the limit and
+// copies the rest into a fresh arena.  What can be redone needs everything
+// undone before it, so if that would go the redo history goes instead.
+static void undoTrim(doc_t *doc) {
+  undoStack_t *stack = &doc->undoStack;
+  if (arenaSize(&doc->undoArena) + arrayMaxSize(stack) <= doc->undoLimit)
+    return;
+  int64_t first = undoKeepFrom(doc);
+  if (first > stack->offset) {
+    undoDropRedo(doc);
+    if (stack->numElems == 0)
+      return;
+    first = undoKeepFrom(doc);
+  }
+
+  arena_t arena;
+  arenaInit(&arena);
+  for (int64_t i = first; i < stack->numElems; ++i) {
+    command_t *cmd = arrayElemAt(stack, i);
+    char *p = arenaAlloc(&arena, cmd->len);
+    myMemcpy(p, cmd->start, cmd->len);
+    cmd->start = p;
+  }
+  arenaFree(&doc->undoArena);
+  doc->undoArena = arena;
+
+  arrayDelete(stack, 0, first);
+  stack->offset -= first;
+  arrayShrinkToFit(stack);
+}
+
+static void undoNew(doc_t *doc, commandTag_t tag, int64_t offset, char *s,
+                    int64_t len, uint32_t now, bool chained) {
+  undoStack_t *stack = &doc->undoStack;
+  command_t *cmd = arrayPushUninit(stack);
+  cmd->tag = tag;
+  cmd->offset = offset;
+  cmd->start = arenaAlloc(&doc->undoArena, len);
+  cmd->len = len;
+  cmd->time = now;
+  cmd->chained = chained;
+  myMemcpy(cmd->start, s, len);
+  stack->offset++;
+}
+
+static void undoPushAt(doc_t *doc, commandTag_t tag, int64_t offset, char *s,
+                       int64_t len, uint32_t now) {
+  undoDropRedo(doc);
+  if (!undoCoalesce(doc, tag, offset, s, len, now))
+    undoNew(doc, tag, offset, s, len, now, false);
+  assert(doc->undoStack.offset == doc->undoStack.numElems);
+  undoTrim(doc);
+}
+
+void undoPush(doc_t *doc, commandTag_t tag, int64_t offset, char *s,
+              int64_t len) {
+  undoPushAt(doc, tag, offset, s, len, SDL_GetTicks());
+}
+
+// pushes the edits of a docApply as one chain (the offsets stay relative to
+// the text before the batch)
+void undoPushBatch(doc_t *doc, command_t *cmds, int64_t n) {
+  undoDropRedo(doc);
+  uint32_t now = SDL_GetTicks();
+  for (int64_t i = 0; i < n; ++i) {
+    undoNew(doc, cmds[i].tag, cmds[i].offset, cmds[i].start, cmds[i].len, now,
+            i > 0);
+  }
+  undoTrim(doc);
+}
+
+void undoSetLimit(doc_t *doc, int64_t limit) {
+  doc->undoLimit = limit;
+  if (doc->undoStack.numElems > 0)
+    undoTrim(doc);
+}
+
+static command_t *undoAt(doc_t *doc, int64_t i) {
+  return arrayElemAt(&doc->undoStack, i);
+}
+
+static bool undoIs(command_t *cmd, commandTag_t tag, int64_t offset, char *s) {
+  return cmd->tag == tag && cmd->offset == offset && cmd->len == strlen(s) &&
+         memcmp(cmd->start, s, cmd->len) == 0;
+}
+
+void undoTest() {
+  doc_t doc;
+  docInit(&doc, "", false, false);
+  undoStack_t *stack = &doc.undoStack;
+
+  // typing a run, then a pause, then typing somewhere else
+  uint32_t t = 1;
+  for (int i = 0; i < 5; ++i) {
+    undoPushAt(&doc, INSERT, 10 + i, "hello" + i, 1, t += 100);
+  }
+  undoPushAt(&doc, INSERT, 15, "!", 1, t += UNDO_COALESCE_MS + 1);
+  undoPushAt(&doc, INSERT, 3, "x", 1, t += 100);
+  assert(stack->numElems == 3 && stack->offset == 3);
+  assert(undoIs(undoAt(&doc, 0), INSERT, 10, "hello"));
+  assert(undoIs(undoAt(&doc, 1), INSERT, 15, "!"));
+  assert(undoIs(undoAt(&doc, 2), INSERT, 3, "x"));
+
+  // backspacing and deleting forward, which don't join typing
+  undoPushAt(&doc, DELETE, 7, "c", 1, t += 100);
+  undoPushAt(&doc, DELETE, 6, "b", 1, t += 100);
+  undoPushAt(&doc, DELETE, 5, "a", 1, t += 100);
+  undoPushAt(&doc, DELETE, 20, "d", 1, t += UNDO_COALESCE_MS + 1);
+  undoPushAt(&doc, DELETE, 20, "ef", 2, t += 100);
+  assert(stack->numElems == 5);
+  assert(undoIs(undoAt(&doc, 3), DELETE, 5, "abc"));
+  assert(undoIs(undoAt(&doc, 4), DELETE, 20, "def"));
+
+  // a batch is a chain of its own, and nothing joins it
+  command_t cmds[2] = {{INSERT, 0, "y", 1}, {INSERT, 30, "z", 1}};
+  undoPushBatch(&doc, cmds, 2);
+  undoPushAt(&doc, INSERT, 32, "w", 1, t);
+  assert(stack->numElems == 8);
+  assert(!undoAt(&doc, 5)->chained && undoAt(&doc, 6)->chained);
+  assert(undoChainStart(&doc, 6) == 5 && undoChainStart(&doc, 7) == 7);
+  assert(undoIs(undoAt(&doc, 7), INSERT, 32, "w"));
+
+  // a new edit after undoing drops what could have been redone, and its text
+  // takes the place of theirs
+  stack->offset = 5;
+  int64_t size = arenaSize(&doc.undoArena);
+  undoPushAt(&doc, INSERT, 0, "new", 3, t += UNDO_COALESCE_MS + 1);
+  assert(stack->numElems == 6 && stack->offset == 6);
+  assert(undoIs(undoAt(&doc, 5), INSERT, 0, "new"));
+  assert(!undoAt(&doc, 5)->chained);
+  assert(arenaSize(&doc.undoArena) <= size);
+  docFree(&doc);
+
+  // the oldest commands go once over the limit, but not the newest chain
+  docInit(&doc, "", false, false);
+  int64_t limit = 1 << 20;
+  undoSetLimit(&doc, limit);
+  char text[1000];
+  int64_t trims = 0;
+  for (int i = 0; i < 4000; ++i) {
+    int n = 1 + rand() % (sizeof(text) - 1);
+    for (int j = 0; j < n; ++j) {
+      text[j] = 'a' + (i + j) % 26;
+    }
+    text[n] = '\0';
+    int64_t before = stack->numElems;
+    undoPushAt(&doc, INSERT, 2 * i, text, n, t += UNDO_COALESCE_MS + 1);
+    trims += stack->numElems <= before;
+    assert(stack->offset == stack->numElems);
+    assert(arenaSize(&doc.undoArena) + arrayMaxSize(stack) <= limit);
+    assert(undoIs(undoAt(&doc, stack->numElems - 1), INSERT, 2 * i, text));
+    for (int64_t k = 0; k < stack->numElems; ++k) { // the newest are kept
+      assert(undoAt(&doc, k)->offset == 2 * (i - (stack->numElems - 1 - k)));
+    }
+  }
+  assert(trims > 0 && trims < 10); // half the history goes at a time
+  int64_t bigLen = limit + 1;
+  char *big = dieIfNull(malloc(bigLen));
+  myMemset(big, 'b', bigLen);
+  command_t chain[2] = {{INSERT, 0, big, bigLen}, {DELETE, 9, big, 1}};
+  undoPushBatch(&doc, chain, 2);
+  assert(stack->numElems == 2 && undoChainStart(&doc, 1) == 0);
+  assert(memcmp(undoAt(&doc, 0)->start, big, bigLen) == 0);
+  free(big);
+  docFree(&doc);
+
+  // the commands count as well as their text, so many small ones go too
+  docInit(&doc, "", false, false);
+  limit = 64 << 10;
+  undoSetLimit(&doc, limit);
+  trims = 0;
+  for (int i = 0; i < 20000; ++i) {
+    int64_t before = stack->numElems;
+    undoPushAt(&doc, INSERT, 2 * i, "s", 1, t += UNDO_COALESCE_MS + 1);
+    trims += stack->numElems <= before;
+    assert(arenaSize(&doc.undoArena) + arrayMaxSize(stack) <= limit);
+  }
+  assert(stack->numElems * (int64_t)sizeof(command_t) <= limit);
+  assert(trims > 0 && trims < 100);
+
+  // a lower limit after undoing keeps what can be redone
+  int64_t numElems = stack->numElems;
+  stack->offset = numElems - 3;
+  undoSetLimit(&doc, limit / 2);
+  assert(stack->numElems < numElems && stack->offset == stack->numElems - 3);
+  assert(undoIs(undoAt(&doc, stack->numElems - 1), INSERT, 2 * 19999, "s"));
+  assert(undoIs(undoAt(&doc, stack->offset), INSERT, 2 * 19997, "s"));
+  // unless the commands before it would go, when it goes instead
+  stack->offset = 1;
+  undoSetLimit(&doc, limit / 4);
+  assert(stack->offset == stack->numElems && stack->numElems <= 1);
+  docFree(&doc);
+}
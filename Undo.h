@@ -0,0 +1,19 @@
+//
+//  Undo.h
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#ifndef Undo_h
+#define Undo_h
+
+#include "Util.h"
+
+void undoPush(doc_t *doc, commandTag_t tag, int64_t offset, char *s,
+              int64_t len);
+void undoPushBatch(doc_t *doc, command_t *cmds, int64_t n);
+int64_t undoChainStart(doc_t *doc, int64_t i);
+void undoSetLimit(doc_t *doc, int64_t limit);
+
+#endif /* Undo_h */
@@ -0,0 +1,166 @@
+//
+//  Utf8.c
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#include "Utf8.h"
+#include "Simd.h"
+
+// A column is one character: a valid UTF-8 sequence or, so that any file can
+// be edited, a single byte of one that isn't.  Wide glyphs still take one
+// cell.
+
+#define UTF8_BLOCK 4096
+
+static bool isCont(char c) { return ((uchar)c & 0xc0) == 0x80; }
+
+// length of the valid UTF-8 character at the start of s (looking at no more
+// than len bytes) or 0 if there isn't one.  Overlong forms, surrogates and
+// anything past U+10FFFF are invalid.
+int utf8Decode(char *s, int64_t len, uint32_t *cp) {
+  if (len <= 0)
+    return 0;
+  uchar c = s[0];
+  if (c < 0x80) {
+    *cp = c;
+    return 1;
+  }
+  int n;
+  uint32_t min;
+  if (c >= 0xc2 && c <= 0xdf) {
+    n = 2;
+    min = 0x80;
+    *cp = c & 0x1f;
+  } else if (c >= 0xe0 && c <= 0xef) {
+    n = 3;
+    min = 0x800;
+    *cp = c & 0x0f;
+  } else if (c >= 0xf0 && c <= 0xf4) {
+    n = 4;
+    min = 0x10000;
+    *cp = c & 0x07;
+  } else {
+    return 0;
+  }
+  if (len < n)
+    return 0;
+  for (int i = 1; i < n; ++i) {
+    if (!isCont(s[i]))
+      return 0;
+    *cp = (*cp << 6) | ((uchar)s[i] & 0x3f);
+  }
+  if (*cp < min || *cp > 0x10ffff || (*cp >= 0xd800 && *cp <= 0xdfff))
+    return 0;
+  return n;
+}
+
+// writes cp to buf (which has room for 4 bytes) and returns the length
+int utf8Encode(uint32_t cp, char *buf) {
+  if (cp < 0x80) {
+    buf[0] = cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    buf[0] = 0xc0 | (cp >> 6);
+    buf[1] = 0x80 | (cp & 0x3f);
+    return 2;
+  }
+  if (cp < 0x10000) {
+    buf[0] = 0xe0 | (cp >> 12);
+    buf[1] = 0x80 | ((cp >> 6) & 0x3f);
+    buf[2] = 0x80 | (cp & 0x3f);
+    return 3;
+  }
+  buf[0] = 0xf0 | (cp >> 18);
+  buf[1] = 0x80 | ((cp >> 12) & 0x3f);
+  buf[2] = 0x80 | ((cp >> 6) & 0x3f);
+  buf[3] = 0x80 | (cp & 0x3f);
+  return 4;
+}
+
+// length of s without a character that the end of s cuts short.  Used on
+// piece table spans, which can end in the middle of a character.
+int64_t utf8CompleteLen(char *s, int64_t len) {
+  int64_t i = len;
+  while (i > 0 && len - i < 3 && isCont(s[i - 1]))
+    i--;
+  if (i == 0)
+    return len;
+  uchar c = s[i - 1];
+  int want = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1;
+  return len - (i - 1) < want ? i - 1 : len;
+}
+
+// bytes of the character at s, counting a byte that doesn't start a valid one
+// as a character of its own
+int utf8CharLen(char *s, int64_t len) {
+  if ((uchar)*s < 0x80)
+    return 1;
+  uint32_t cp;
+  int n = utf8Decode(s, len, &cp);
+  return n ? n : 1;
+}
+
+// end of the next block to scan, moved back to a character boundary
+static int64_t blockEnd(char *s, int64_t i, int64_t len) {
+  int64_t end = min(i + UTF8_BLOCK, len);
+  int64_t e = end;
+  while (e < len && e > i && end - e < 3 && isCont(s[e]))
+    e--;
+  return e > i ? e : end;
+}
+
+static int64_t columnsScalar(char *s, int64_t i, int64_t end, int64_t *col) {
+  int64_t n = 0;
+  while (i < end && n < *col) {
+    i += utf8CharLen(s + i, end - i);
+    n++;
+  }
+  *col = n;
+  return i;
+}
+
+// Blocks of valid UTF-8 (nearly all of them) are counted with the vector
+// kernels, only the rest is decoded a character at a time.
+int64_t utf8Columns(char *s, int64_t len) {
+  int64_t cols = 0;
+  int64_t i = 0;
+  while (i < len) {
+    int64_t end = blockEnd(s, i, len);
+    if (simdUtf8Valid(s + i, end - i)) {
+      cols += simdCountCodepoints(s + i, end - i);
+      i = end;
+    } else {
+      int64_t n = INT64_MAX;
+      i = columnsScalar(s, i, end, &n);
+      cols += n;
+    }
+  }
+  return cols;
+}
+
+// offset in s of column *col, or len if s is shorter.  *col is set to the
+// number of columns skipped.
+int64_t utf8ColumnOffset(char *s, int64_t len, int64_t *col) {
+  int64_t want = *col;
+  int64_t cols = 0;
+  int64_t i = 0;
+  while (i < len && cols < want) {
+    int64_t end = blockEnd(s, i, len);
+    if (simdUtf8Valid(s + i, end - i)) {
+      int64_t n = simdCountCodepoints(s + i, end - i);
+      if (cols + n <= want) {
+        cols += n;
+        i = end;
+        continue;
+      }
+    }
+    int64_t n = want - cols;
+    i = columnsScalar(s, i, end, &n);
+    cols += n;
+  }
+  *col = cols;
+  return i;
+}
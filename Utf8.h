@@ -0,0 +1,20 @@
+//
+//  Utf8.h
+//  ceditor
+//
+//  Copyright (c) 2021 Brett Letner. All rights reserved.
+//
+
+#ifndef Utf8_h
+#define Utf8_h
+
+#include "Util.h"
+
+int utf8Decode(char *s, int64_t len, uint32_t *cp);
+int utf8Encode(uint32_t cp, char *buf);
+int utf8CharLen(char *s, int64_t len);
+int64_t utf8CompleteLen(char *s, int64_t len);
+int64_t utf8Columns(char *s, int64_t len);
+int64_t utf8ColumnOffset(char *s, int64_t len, int64_t *col);
+
+#endif /* Utf8_h */
@@ -7,6 +7,7 @@
 //
 
 #include "Util.h"
+#include "Simd.h"
 
 SDL_Renderer *renderer;
 
@@ -96,16 +97,8 @@ void fillRectAt(int x, int y, int w, int h) {
 
 void fillRect(int w, int h) { fillRectAt(0, 0, w, h); }
 
-int numLinesString(char *s, int len) {
-  int n = 0;
-  char *end = s + len;
-
-  while (s < end) {
-    if (*s == '\n')
-      n++;
-    s++;
-  }
-  return n;
+int64_t numLinesString(char *s, int64_t len) {
+  return simdCountChar(s, len, '\n');
 }
 
 char *getClipboardText(void) {
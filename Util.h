@@ -14,6 +14,7 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,7 +44,7 @@ void rendererInit(SDL_Window *win);
 void rendererPresent(void);
 char *getClipboardText(void);
 void setClipboardText(const char *text);
-int numLinesString(char *s, int len);
+int64_t numLinesString(char *s, int64_t len);
 void message(char *s);
 void myMemcpy(void *dst, const void *src, size_t n);
 void myMemset(void *b, int c, size_t len);
@@ -84,6 +85,7 @@ void setTextureColorMod(SDL_Texture *t, color_t c);
 #define CURSOR_COLOR 0xffff00ff
 #define CURSOR_BACKGROUND_COLOR (CURSOR_COLOR & 0xffffff30)
 #define SELECTION_COLOR CURSOR_BACKGROUND_COLOR
+#define SCROLL_THUMB_COLOR BRGREEN
 #define SEARCH_COLOR (BRRED & 0xffffff60)
 #define INIT_WINDOW_WIDTH 2488
 #define INIT_WINDOW_HEIGHT 1300
@@ -91,6 +93,19 @@ void setTextureColorMod(SDL_Texture *t, color_t c);
 #define INIT_FONT_FILE "/Library/Fonts/SourceCodePro-Semibold.ttf"
 #define SELECTION_RECT_GAP 8
 #define AUTO_SCROLL_HEIGHT 4
+#define UNDO_COALESCE_MS 1000        // edits closer together undo as one
+#define UNDO_MEMORY_LIMIT (16 << 20) // default per doc
+#define JOURNAL_COMMIT_MS 1000       // how often edits reach the disk
+#define MAX_SEARCH_EDITS 64          // more are searched again as one range
+#define SEARCH_CHUNK (1 << 20)       // bytes searched between checks to stop
+#define MAX_HIT_CONTEXT 160          // of a line listed by a search of all docs
+#define PARSE_CHECKPOINT 4096        // bytes at least between reparse points
+#define PARSE_SYNC_LENGTH (1 << 20)  // bigger docs are parsed on a thread
+
+// codes of the SDL_USEREVENTs we post
+#define JOURNAL_EVENT 0
+#define SEARCH_EVENT 1
+#define PARSE_EVENT 2
 
 #define CURSOR_WIDTH 3
 #define BORDER_WIDTH 4
@@ -120,10 +135,14 @@ extern uint16_t unicode[256];
 
 extern SDL_Renderer *renderer;
 
+#define GLYPH_PAGES (0x110000 >> 8)
+
 struct font_s {
   int lineSkip;
   int charSkip;
   SDL_Texture *charTexture[256]; // BAL: ['~' + 1];
+  SDL_Texture **glyphs[GLYPH_PAGES]; // non-ASCII code points, made on demand
+  TTF_Font *ttfFont;
   SDL_Rect charRect;             // BAL: remove
   SDL_Rect cursorRect;           // BAL: remove
   const char *filepath;
@@ -132,48 +151,385 @@ struct font_s {
 
 typedef struct font_s font_t;
 
+typedef enum {
+  GROW_GEOMETRIC, // double, but by no more than MAX_GROW_STEP bytes at a time
+  GROW_EXACT      // exactly what is asked for
+} growthPolicy_t;
+
 struct dynamicArray_s {
   void *start;
-  int numElems;
-  int maxElems;
+  int64_t numElems;
+  int64_t maxElems;
   int elemSize;
-  int offset;
+  int64_t offset;
+  growthPolicy_t growth;
 };
 
 typedef struct dynamicArray_s dynamicArray_t;
 
 typedef dynamicArray_t string_t; // contains characters
 
+struct arenaChunk_s {
+  char *start;
+  int64_t size;
+};
+
+typedef struct arenaChunk_s arenaChunk_t;
+
+struct arena_s {
+  dynamicArray_t chunks; // contains arenaChunk_t, never moved
+  int64_t used;          // bytes used in the last chunk
+  int64_t size;          // bytes in all chunks
+};
+
+typedef struct arena_s arena_t;
+
+struct textStats_s {
+  int64_t size;
+  int64_t numLines; // newlines
+  int64_t numChars; // UTF-8 code points
+  int64_t numWords; // runs of non-space characters
+  int64_t lead;     // bytes up to and including the first newline
+  int64_t trail;    // bytes after the last newline
+  int64_t longest;  // longest line between the first and last newline
+  bool startsInWord;
+  bool endsInWord;
+};
+
+typedef struct textStats_s textStats_t;
+
+struct piece_s {
+  struct piece_s *left;
+  struct piece_s *right;
+  unsigned int priority;
+  SDL_atomic_t refCount; // > 1 when shared with a snapshot
+  char *start;
+  int len;
+  textStats_t pieceStats; // of this piece
+  textStats_t stats;      // of this subtree
+};
+
+typedef struct piece_s piece_t;
+
+struct pieceStorage_s {
+  SDL_atomic_t refCount;
+  char *original; // file contents as loaded
+  arena_t add;    // add buffer
+};
+
+typedef struct pieceStorage_s pieceStorage_t;
+
+struct pieceTable_s {
+  piece_t *root;
+  pieceStorage_t *storage;
+  bool isOriginal;     // contents are exactly original
+  uint64_t generation; // changes with every edit
+};
+
+typedef struct pieceTable_s pieceTable_t;
+
+struct snapshot_s {
+  piece_t *root;
+  pieceStorage_t *storage;
+  uint64_t generation; // of the table when the snapshot was taken
+};
+
+typedef struct snapshot_s snapshot_t;
+
 typedef enum { DELETE, INSERT } commandTag_t;
 
 struct command_s {
   commandTag_t tag;
-  int offset;
-  string_t string;
+  int64_t offset;
+  char *start; // in the doc's undoArena
+  int64_t len;
+  uint32_t time; // SDL_GetTicks() of the last edit coalesced into it
+  bool chained;  // undone and redone along with the command before it
 };
 
 typedef struct command_s command_t;
 typedef dynamicArray_t undoStack_t;    // contains commands
-typedef dynamicArray_t searchBuffer_t; // contains result offsets
+typedef dynamicArray_t searchBuffer_t; // contains searchResult_t
+
+struct searcher_s {
+  char *needle;    // folded to lower case
+  int64_t len;
+  int64_t suffix;  // two-way critical factorization
+  int64_t period;
+  bool periodic;
+};
+
+typedef struct searcher_s searcher_t;
+
+struct dfa_s {
+  dynamicArray_t prog;   // contains reInst_t (see Search.c)
+  dynamicArray_t *sets;  // the byte sets the program tests
+  bool anchored;         // no implicit .*? in front of the pattern
+  bool longest;          // a match doesn't end the lower priority threads
+  dynamicArray_t states; // contains dfaState_t, 0 is the dead state
+  dynamicArray_t lists;  // contains the threads of every state
+  int *table;            // states by hash
+  int start[2];          // start state at the start of a line or not
+  int flushes;           // times the cache started over
+  int *seen;             // scratch for building states
+  int stamp;
+  int *stack;
+  int *list;
+  int *list2;
+};
+
+typedef struct dfa_s dfa_t;
+
+// where a search for the end of a match went after it found one, so later
+// searches that get there the same way can finish the same way (see
+// regexpEnd)
+struct reVisit_s {
+  int64_t search; // the reSearch_t that was there, or -1
+  int state;      // of the forward DFA, before the byte there
+};
+
+typedef struct reVisit_s reVisit_t;
+
+struct reSearch_s {
+  int64_t first; // where it started leaving reVisit_t
+  int64_t end;   // of the last match it found, or -1
+  int64_t stop;  // where it stopped looking, or -1 until it has
+};
+
+typedef struct reSearch_s reSearch_t;
+
+struct reMemo_s {
+  uint64_t generation;     // of the text searched, 0 if none
+  int64_t to;              // where the searches end
+  int flushes;             // of the forward DFA
+  int64_t search;          // the one going on, or -1 if it left no visits
+  int64_t firstSearch;     // the number of the first of searches
+  dynamicArray_t searches; // contains reSearch_t
+  reVisit_t *recent;       // by offset, near where each search started them
+  dynamicArray_t sparse;   // contains reVisit_t, at every RE_MEMO_STRIDE bytes
+  int64_t sparseBase;      // offset / RE_MEMO_STRIDE of the first of sparse
+};
+
+typedef struct reMemo_s reMemo_t;
+
+struct regexp_s {
+  dynamicArray_t sets; // contains 256 bit byte sets
+  int numGroups;       // not counting group 0, the whole match
+  bool multiline;      // a match can contain a newline
+  dfa_t forward;
+  dfa_t reverse;       // of the reversed pattern, to find where a match starts
+  reMemo_t memo;
+};
+
+typedef struct regexp_s regexp_t;
+
+struct searchResult_s {
+  int mark;
+  int64_t len;
+  int64_t reach; // past its start, how far the search had looked by then
+};
+
+typedef struct searchResult_s searchResult_t;
+
+struct searchEdit_s {
+  int64_t start; // of text edited since the search, in current offsets
+  int64_t end;
+};
+
+typedef struct searchEdit_s searchEdit_t;
+
+struct searchMatch_s {
+  int64_t offset;
+  int64_t len;
+  int64_t reach; // how far the search had looked when it found it
+};
+
+typedef struct searchMatch_s searchMatch_t;
+
+struct searchJob_s {
+  bool running;           // started and not yet taken to the end
+  bool async;             // on its own thread
+  SDL_Thread *thread;
+  SDL_atomic_t cancel;
+  snapshot_t snap;        // what it searches
+  searcher_t searcher;    // its own, so nothing is shared with the editor
+  regexp_t *regexp;       // or NULL
+  SDL_mutex *lock;        // guards found and done
+  dynamicArray_t found;   // contains searchMatch_t not yet taken
+  bool done;
+};
+
+typedef struct searchJob_s searchJob_t;
+
+struct searchHit_s {
+  int docRef;   // -1 if the file isn't loaded
+  int mark;
+  char *path;   // otherwise, where it is
+  int64_t row;
+};
+
+typedef struct searchHit_s searchHit_t;
+
+struct indexFile_s {
+  char *path;   // relative to the root of the index
+  int64_t mtime;
+  int64_t size;
+  bool alive;   // false once it changed or went away
+  bool indexed; // false if binary or too big
+  bool scan;    // too big but text, so it can match anything
+  bool seen;    // by the current walk
+};
+
+typedef struct indexFile_s indexFile_t;
+
+struct indexPosting_s {
+  uint32_t trigram;   // 0 if the slot is empty
+  dynamicArray_t ids; // contains uint32_t, ascending
+};
+
+typedef struct indexPosting_s indexPosting_t;
+
+struct index_s {
+  char *root;
+  dynamicArray_t files;  // contains indexFile_t, an id is its index
+  indexPosting_t *table; // by trigram
+  int64_t tableSize;     // a power of 2
+  int64_t numTrigrams;
+  int64_t numDead;       // files no longer alive
+  bool dirty;            // differs from the copy on disk
+  bool loaded;           // from disk, if there was a copy
+  bool complete;         // a refresh has seen every file
+  SDL_Thread *thread;    // loading and refreshing in the background
+  SDL_atomic_t busy;     // while the thread runs
+  SDL_atomic_t cancel;   // stops the thread early
+  SDL_mutex *lock;       // held by the thread while it changes the index
+};
+
+typedef struct index_s index_t;
+
+struct journal_s {
+  string_t path;    // empty if the doc isn't journaled
+  int fd;           // -1 until the first commit
+  bool started;     // header written (or found on disk)
+  string_t pending; // records not yet committed
+  int64_t mtime;    // of the file on disk the records apply to
+  int64_t size;
+};
+
+typedef struct journal_s journal_t;
+
+struct markNode_s {
+  int left; // also the next free node
+  int right;
+  int parent; // -1 if free
+  unsigned int priority;
+  int64_t delta; // offset relative to the parent's (absolute for the root)
+};
+
+typedef struct markNode_s markNode_t;
+
+struct marks_s {
+  dynamicArray_t nodes; // contains markNode_t, a mark is its index
+  int root;             // 0 is the null mark
+  int freeList;
+};
+
+typedef struct marks_s marks_t;
+
+typedef struct language_s language_t; // defined in Syntax.c
+
+struct syntaxCache_s {
+  language_t *language;  // NULL for plain text, which isn't lexed
+  dynamicArray_t states; // contains uchar, the tokSt_t at the start of a line
+  int64_t valid;         // lines whose states are right, the rest are stale
+  int64_t convergeFrom;  // first stale line whose state can be right again
+};
+
+typedef struct syntaxCache_s syntaxCache_t;
+
+struct parseSpan_s {
+  int64_t offset;
+  int64_t len;
+  color_t color; // drawn instead of the lexer's
+};
+
+typedef struct parseSpan_s parseSpan_t;
+
+struct block_s {
+  int64_t open;  // offset of its opening bracket
+  int64_t close; // of its closing one, -1 if there is none
+  int parent;    // the block it's in, -1 if none
+  int depth;
+  char kind;     // '(', '[' or '{'
+};
+
+typedef struct block_s block_t;
+
+struct parseCheckpoint_s {
+  int64_t offset; // of a line start
+  int top;        // the innermost block open there, -1 if none
+  uchar acc;      // the tokSt_t there
+};
+
+typedef struct parseCheckpoint_s parseCheckpoint_t;
+
+struct parseResult_s {
+  uint64_t generation;        // of the text it's of, 0 if none
+  dynamicArray_t spans;       // contains parseSpan_t, in order
+  dynamicArray_t blocks;      // contains block_t, the tree in preorder
+  dynamicArray_t checkpoints; // contains parseCheckpoint_t, in order
+};
+
+typedef struct parseResult_s parseResult_t;
+
+struct parser_s {
+  language_t *language;     // NULL if there's nothing to parse
+  parseResult_t results[2]; // the front one is drawn, the job makes the other
+  int front;
+  bool full;                // the front result is no use to the next job
+  int64_t editStart;        // text changed since the front result, in current
+  int64_t editEnd;          // offsets (-1 if none)
+  int64_t editDelta;        // current length less the front result's
+  bool running;             // the job, which takes in the edits so far
+  bool async;               // on its own thread
+  SDL_Thread *thread;
+  SDL_atomic_t cancel;
+  SDL_atomic_t done;
+  snapshot_t snap;
+  bool jobFull;
+  int64_t jobStart;
+  int64_t jobEnd;
+  int64_t jobDelta;
+};
+
+typedef struct parser_s parser_t;
 
 struct doc_s {
   string_t filepath;
   bool isUserDoc;
   bool isReadOnly;
   bool modified;
-  int numLines;
-  string_t contents;
+  pieceTable_t contents;
   undoStack_t undoStack;
+  arena_t undoArena;  // command text
+  int64_t undoLimit;  // bytes of undo history kept
+  journal_t journal;
+  marks_t marks;
   searchBuffer_t searchResults;
+  char *searchString;         // what searchResults were found for, or NULL
+  dynamicArray_t searchEdits; // contains searchEdit_t, to search again
+  syntaxCache_t syntax;
+  parser_t parser;
 };
 
 typedef struct doc_s doc_t;
 
 struct cursor_s {
-  int offset;
-  int row;
-  int column;
-  int preferredColumn;
+  int mark; // in the doc's marks so that edits move it, 0 if none
+  int64_t offset;
+  int64_t row;
+  int64_t column;
+  int64_t preferredColumn;
 };
 
 typedef struct cursor_s cursor_t;
@@ -189,10 +545,11 @@ struct view_s // BAL: this needs to be renamed
 {
   editorMode_t mode;
   int refDoc;
-  int scrollY;
+  int64_t scrollY;
   cursor_t cursor;
   cursor_t selection;
   selectMode_t selectMode;
+  dynamicArray_t cursors; // marks of any extra cursors
 };
 
 typedef struct view_s view_t;
@@ -229,8 +586,16 @@ typedef struct state_s {
   int searchLen;
   bool isReplace;
   string_t replace;
+  regexp_t *regexp;    // the search is a regular expression if not NULL
+  searcher_t searcher; // otherwise
+  char *searchString;  // what regexp or searcher were made from, or NULL
+  char *searchNeedle;  // the part of it that is searched for
+  searchJob_t searchJob;
+  dynamicArray_t hits; // contains searchHit_t, one per line listed
+  int hitsMark;        // in the search doc, at the first line listed, or 0
+  index_t index;       // of the files under the directory
   int downCxtX;
-  int downCxtY;
+  int64_t downCxtY;
   bool mouseSelectionInProgress;
 } state_t;
 
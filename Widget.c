@@ -122,7 +122,7 @@ void contextSetViewport() {
   setViewport(&rect);
 }
 
-void widgetAt(widget_t *widget, int x, int y) {
+void widgetAt(widget_t *widget, int x, int64_t y) {
   assert(context.w >= 0);
   assert(context.h >= 0);
 
@@ -192,7 +192,7 @@ void widgetAt(widget_t *widget, int x, int y) {
     widgetAt(widget->b.child, x, y);
     return;
   case SCROLL_Y: {
-    int dy = widget->a.scrollYFun(widget->c.ref);
+    int64_t dy = widget->a.scrollYFun(widget->c.ref);
     context.y += dy;
     widgetAt(widget->b.child, x, y + dy);
     return;
@@ -243,7 +243,7 @@ void widgetDraw(widget_t *widget) {
     return;
   }
   case VCAT: {
-    int y = context.y;
+    int64_t y = context.y;
     int h = context.h;
 
     context.h = widgetHeight(widget->a.child);
@@ -261,7 +261,7 @@ void widgetDraw(widget_t *widget) {
     return;
   }
   case VCATR: {
-    int y = context.y;
+    int64_t y = context.y;
     int h = context.h;
 
     context.h -= widgetHeight(widget->b.child);
@@ -284,7 +284,7 @@ void widgetDraw(widget_t *widget) {
     return;
   }
   case SCROLL_Y: {
-    int dy = context.dy;
+    int64_t dy = context.dy;
     context.dy += widget->a.scrollYFun(widget->c.ref);
     widgetDraw(widget->b.child);
     context.dy = dy;
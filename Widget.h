@@ -40,7 +40,7 @@ struct widget_s {
     font_t **font;
     widget_t *child;
     void (*drawFun)(int);
-    int (*scrollYFun)(int);
+    int64_t (*scrollYFun)(int);
     void *data;
   } a;
   union {
@@ -56,12 +56,12 @@ struct widget_s {
 
 typedef struct {
   int x;
-  int y;
+  int64_t y;
   int w;
   int h;
   int color;
   font_t *font;
-  int dy;
+  int64_t dy;
   int wid;
 } context_t;
 
@@ -72,7 +72,7 @@ widget_t *wid(int i, widget_t *a);
 widget_t *node(widgetTag_t tag, void *a, void *b);
 widget_t *singleton(widgetTag_t tag, void *a, widget_t *b);
   widget_t *singleton2(widgetTag_t tag, void *a, widget_t *b, void *c);
-void widgetAt(widget_t *widget, int x, int y);
+void widgetAt(widget_t *widget, int x, int64_t y);
 void widgetDraw(widget_t *widget);
 widget_t *leaf(widgetTag_t tag, void *a);
 void drawBox(void *_unused);
@@ -10,11 +10,18 @@
 #include "Doc.h"
 #include "DynamicArray.h"
 #include "Font.h"
+#include "Index.h"
+#include "Journal.h"
 #include "Keysym.h"
+#include "Marks.h"
+#include "Parse.h"
+#include "PieceTable.h"
 #include "Search.h"
 #include "Util.h"
 #include "Widget.h"
 #include "Syntax.h"
+#include "Undo.h"
+#include "Utf8.h"
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -32,12 +39,26 @@ void recomputeSearch();
 bool searchActive(); // BAL: remove?
 int searchFrameRef = 0;
 bool isSearchFocus();
+int64_t docHeight(doc_t *doc);
+void syncViews(doc_t *doc);
+void clearSearchResults(doc_t *doc);
+int64_t searchResultOffset(doc_t *doc, int64_t i);
+bool hasCursors(view_t *view);
+void moveCursors(view_t *view, int dir);
+void cursorsInsert(view_t *view, char *s, int64_t len);
+void cursorsDelete(view_t *view);
+void resetSearch();
+void searchEvent();
+void parseEvent();
+bool isHitList(view_t *view);
+void gotoHit();
+void cancelSelection();
 
 state_t st;
 widget_t *gui;
 
 int xToColumn(int x) { return x / st.font.charSkip; }
-int yToRow(int x) { return x / st.font.lineSkip; }
+int64_t yToRow(int64_t y) { return y / st.font.lineSkip; }
 
 int numFrames() { return st.frames.numElems; }
 
@@ -147,139 +168,154 @@ void viewInit(view_t *view, uint refDoc) {
   assert(view);
   myMemset(view, 0, sizeof(view_t));
   view->refDoc = refDoc;
+  doc_t *doc = docOf(view);
+  view->cursor.mark = markNew(&doc->marks, 0);
+  view->selection.mark = markNew(&doc->marks, 0);
+  arrayInit(&view->cursors, sizeof(int));
 }
 
-int maxLineLength(char *s) {
-  assert(s);
-  char c;
-  int rmax = 0;
-  int r = 0;
-  while ((c = *s) != '\0') {
-    switch (c) {
-    case '\n':
-      rmax = max(rmax, r + 1);
-      r = 0;
-      break;
-    default:
-      r++;
-    }
-    s++;
-  }
-  return max(rmax, r);
-}
-
-int numLinesCString(char *s) {
-  int n = 0;
-  char c;
-  while ((c = *s) != '\0') {
-    if (c == '\n')
-      n++;
-    s++;
-  }
-  return n;
+// only the parts of the selection that land on the screen are drawn
+void drawRectAt(int64_t x, int64_t y, int w, int h) {
+  if (x < -w || x > context.w || y < -h || y > context.h)
+    return;
+  fillRectAt((int)x, (int)y, w, h);
 }
 
-void drawStringSelection(int x, int y, char *s, int len) {
+void drawStringSelection(int64_t x, int64_t y, doc_t *doc, int64_t offset,
+                         int64_t len) {
   // BAL: would it look good to bold the characters in addition/instead?
-  assert(s);
   int w = context.font->charSkip;
   int h = context.font->lineSkip;
-  char *p = s + len;
-  while (s < p) {
-    fillRectAt(x, y, w, h);
-    switch (*s) {
-    case '\n':
-      x = 0;
-      y += h;
-      break;
-    default:
+  int64_t end = offset + len;
+  while (offset < end) {
+    int n;
+    char *s = docSpan(doc, offset, &n);
+    if (!s) { // selection includes the end of file
+      drawRectAt(x, y, w, h);
+      return;
+    }
+    int64_t m = utf8CompleteLen(s, min(n, end - offset));
+    if (m == 0) { // a character split between pieces
+      drawRectAt(x, y, w, h);
       x += w;
+      offset += docCharLen(doc, offset);
+      continue;
+    }
+    char *p = s + m;
+    offset += m;
+    while (s < p) {
+      drawRectAt(x, y, w, h);
+      switch (*s) {
+      case '\n':
+        x = 0;
+        y += h;
+        break;
+      default:
+        x += w;
+      }
+      s += utf8CharLen(s, p - s);
     }
-    s++;
   }
 }
 
-int columnToX(int column) { return column * st.font.charSkip; }
+int64_t columnToX(int64_t column) { return column * st.font.charSkip; }
 
-int rowToY(int row) { return row * st.font.lineSkip + context.dy; }
+int64_t rowToY(int64_t row) { return row * st.font.lineSkip + context.dy; }
 
-void drawCursor(view_t *view) {
-  int x = columnToX(view->cursor.column);
-  int y = rowToY(view->cursor.row);
+void drawCursorAt(view_t *view, cursor_t *cursor) {
+  int64_t x = columnToX(cursor->column);
+  int64_t y = rowToY(cursor->row);
 
   if (view->mode == NAVIGATE_MODE) {
     setDrawColor(CURSOR_BACKGROUND_COLOR);
-    fillRectAt(x, y, st.font.charSkip, st.font.lineSkip);
+    drawRectAt(x, y, st.font.charSkip, st.font.lineSkip);
   }
 
   setDrawColor(CURSOR_COLOR);
-  fillRectAt(x, y, CURSOR_WIDTH, st.font.lineSkip);
+  drawRectAt(x, y, CURSOR_WIDTH, st.font.lineSkip);
 
   setDrawColor(context.color);
 }
 
-int distanceToEOL(char *s) {
-  char *p = s;
-  char c = *p;
+void drawCursor(view_t *view) {
+  drawCursorAt(view, &view->cursor);
+  doc_t *doc = docOf(view);
+  for (int64_t i = 0; i < view->cursors.numElems; ++i) {
+    cursor_t c;
+    cursorInit(&c);
+    int mark = *(int *)arrayElemAt(&view->cursors, i);
+    cursorSetOffset(&c, markOffset(&doc->marks, mark), doc);
+    drawCursorAt(view, &c);
+  }
+}
 
-  while (c != '\n' && c != '\0') {
-    p++;
-    c = *p;
+int64_t distanceToEOL(doc_t *doc, int64_t offset) {
+  int64_t i = offset;
+  int n;
+  char *s;
+
+  while ((s = docSpan(doc, i, &n))) {
+    for (int j = 0; j < n; ++j) {
+      if (s[j] == '\n' || s[j] == '\0')
+        return i + j - offset;
+    }
+    i += n;
   }
-  return p - s;
+  return i - offset;
 }
 
-int distanceToNextSpace(char *s0, char *t) {
-  char *s = s0;
-  char c = *s;
+int64_t distanceToNextSpace(doc_t *doc, int64_t offset) {
+  int64_t t = docLength(doc);
+  int64_t i = offset;
+  char c;
 
-  while (s < t) {
-    s++;
-    c = *s;
+  while (i < t) {
+    i++;
+    c = docCharAt(doc, i);
     if (c == ' ' || c == '\n') {
-      while (s < t) {
-        s++;
-        c = *s;
+      while (i < t) {
+        i++;
+        c = docCharAt(doc, i);
         if (c != ' ' && c != '\n')
-          return s - s0;
+          return i - offset;
       }
-      return s - s0;
+      return i - offset;
     }
   }
 
-  return s - s0;
+  return i - offset;
 }
 
-int distanceToIndent(char *p0, char *q) {
-  char *p = p0;
-  while (p < q && *p == ' ') {
-    p++;
+int64_t distanceToIndent(doc_t *doc, int64_t offset) {
+  int64_t i = offset;
+  while (docCharAt(doc, i) == ' ') {
+    i++;
   }
-  return p - p0;
+  return i - offset;
 }
 
-int distanceToPrevSpace(char *t, char *s0) {
-  char *s = s0;
-  char c = *s;
+int64_t distanceToPrevSpace(doc_t *doc, int64_t offset) {
+  int64_t i = offset;
+  char c;
 
-  while (s > t) {
-    s--;
-    c = *s;
+  while (i > 0) {
+    i--;
+    c = docCharAt(doc, i);
     if (c == ' ' || c == '\n') {
-      while (s > t) {
-        s--;
-        c = *s;
+      while (i > 0) {
+        i--;
+        c = docCharAt(doc, i);
         if (c != ' ' && c != '\n')
-          return s - s0;
+          return i - offset;
       }
-      return s - s0;
+      return i - offset;
     }
   }
 
-  return s - s0;
+  return i - offset;
 }
 
-int distanceToStartOfElem(char *s, int offset) {
+int64_t distanceToStartOfElem(char *s, int64_t offset) {
   char *p0 = s + offset;
   char *p = p0;
   if (p > s && *p == '\n')
@@ -295,13 +331,13 @@ int distanceToStartOfElem(char *s, int offset) {
   return p - p0;
 }
 
-void getSelectionCoords(view_t *view, int *column, int *row, int *offset,
-                        int *len) {
+void getSelectionCoords(view_t *view, int64_t *column, int64_t *row,
+                        int64_t *offset, int64_t *len) {
   if (!selectionActive(view)) {
     *column = view->cursor.column;
     *row = view->cursor.row;
     *offset = view->cursor.offset;
-    *len = 1;
+    *len = max(1, docCharLen(docOf(view), *offset));
     return;
   }
 
@@ -317,33 +353,67 @@ void getSelectionCoords(view_t *view, int *column, int *row, int *offset,
   *row = a->row;
   *column = a->column;
 
-  char *s = docOf(view)->contents.start;
-
   if (view->selectMode == LINE_SELECT) {
-    *len += distanceToEOL(s + *offset + *len);
+    *len += distanceToEOL(docOf(view), *offset + *len);
     *offset -= *column;
     *len += *column;
     *column = 0;
   }
-  *len += 1;
+  // the selection includes the character under its end
+  *len += max(1, docCharLen(docOf(view), *offset + *len));
 }
 
+static int64_t searchResultIndex(doc_t *doc, int64_t offset);
+static bool isSearching(doc_t *doc);
+
+// only the matches on screen are drawn.  They are found by binary search and
+// placed by sweeping forward from the first visible line.
 void drawSearch(view_t *view) {
   doc_t *doc = docOf(view);
-  char *s = doc->contents.start;
+  searchBuffer_t *results = &doc->searchResults;
+  if (results->numElems == 0)
+    return;
 
-  setDrawColor(SEARCH_COLOR);
+  int h = st.font.lineSkip;
+  int64_t firstRow = clamp(0, -context.dy / h - 1, docNumLines(doc));
+  int64_t lastRow = (context.h - context.dy) / h;
+  int64_t sol = docLineStart(doc, firstRow);
+  int64_t eov = docLineEnd(doc, lastRow);
 
-  searchBuffer_t *results = &doc->searchResults;
+  setDrawColor(SEARCH_COLOR);
 
-  for (int i = 0; i < results->numElems; ++i) {
-    cursor_t c;
-    int *offset = arrayElemAt(results, i);
-    cursorSetOffset(
-        &c, *offset,
-        doc); // BAL: this is inefficient (it starts over every time)
-    drawStringSelection(columnToX(c.column), rowToY(c.row), s + *offset,
-                        st.searchLen);
+  // literal results overlap, but the ends of results still ascend, so those
+  // that reach into view are the ones before it that end past its start
+  int64_t i = searchResultIndex(doc, sol);
+  while (i > 0) {
+    searchResult_t *r = arrayElemAt(results, i - 1);
+    if (markOffset(&doc->marks, r->mark) + r->len <= sol)
+      break;
+    i--;
+  }
+  int64_t row = firstRow;
+  int64_t prev = sol;
+  for (; i < results->numElems; ++i) {
+    searchResult_t *r = arrayElemAt(results, i);
+    int64_t offset = markOffset(&doc->marks, r->mark);
+    if (offset > eov)
+      break;
+    if (offset < sol) {
+      cursor_t c;
+      cursorInit(&c);
+      cursorSetOffset(&c, offset, doc);
+      drawStringSelection(columnToX(c.column), rowToY(c.row), doc, offset,
+                          r->len);
+      continue;
+    }
+    int64_t n = docCountLines(doc, prev, offset - prev);
+    if (n > 0) {
+      row += n;
+      sol = docLineStart(doc, row);
+    }
+    prev = offset;
+    drawStringSelection(columnToX(docColumns(doc, sol, offset - sol)),
+                        rowToY(row), doc, offset, r->len);
   }
 
   setDrawColor(context.color);
@@ -351,17 +421,16 @@ void drawSearch(view_t *view) {
 
 void drawSelection(view_t *view) {
 
-  int offset;
-  int len;
-  int column;
-  int row;
-  char *s = docOf(view)->contents.start;
+  int64_t offset;
+  int64_t len;
+  int64_t column;
+  int64_t row;
 
   setDrawColor(SELECTION_COLOR);
 
   getSelectionCoords(view, &column, &row, &offset, &len);
 
-  drawStringSelection(columnToX(column), rowToY(row), s + offset, len);
+  drawStringSelection(columnToX(column), rowToY(row), docOf(view), offset, len);
 
   setDrawColor(context.color);
 }
@@ -433,10 +502,11 @@ void insertNewElem() {
 void drawFrameCursor(int frameRef) { drawCursorOrSelection(frameRef); }
 
 void drawFrameDoc(int frameRef) {
-  drawString(&docOf(viewOf(frameOf(frameRef)))->contents);
+  view_t *view = viewOf(frameOf(frameRef));
+  drawDoc(docOf(view), view->cursor.offset);
 }
 
-int frameScrollY(int frameRef) {
+int64_t frameScrollY(int frameRef) {
   view_t *view = viewOf(frameOf(frameRef));
   return view->scrollY;
 }
@@ -448,7 +518,20 @@ void drawFrameStatus(int frameRef) {
   char buf[1024];
   size_t n = sizeof(buf) - 1;
   buf[n] = '\0';
-  snprintf(buf, n, "<%s> %3d:%2d %s", editorModeDescr[view->mode], view->cursor.row + 1, view->cursor.column, cstringOf(&doc->filepath));
+  textStats_t *stats = docStats(doc);
+  snprintf(buf, n, "<%s> %3lld:%2lld %s  %lldL %lldW %lldC", editorModeDescr[view->mode], (long long)view->cursor.row + 1, (long long)view->cursor.column, cstringOf(&doc->filepath), (long long)stats->numLines, (long long)stats->numWords, (long long)stats->numChars);
+  // the match count needs no positions, so it is cheap for any number
+  int64_t numResults = doc->searchResults.numElems;
+  if (numResults > 0) {
+    size_t k = strlen(buf);
+    int64_t i = searchResultIndex(doc, view->cursor.offset);
+    if (i < numResults && searchResultOffset(doc, i) == view->cursor.offset)
+      snprintf(buf + k, n - k, "  %lld/%lld matches", (long long)i + 1,
+               (long long)numResults);
+    else
+      snprintf(buf + k, n - k, "  %lld matches%s", (long long)numResults,
+               isSearching(doc) ? " so far" : "");
+  }
   drawCString(buf, strlen(buf));
 }
 
@@ -456,6 +539,34 @@ int scrollBarColor = 0x000000ff;
 int scrollBarHeight = 5;
 int scrollBarWidth = 5;
 
+// the thumbs show how much of the doc is in view
+void drawScrollThumb(int x, int y, int w, int h) {
+  setDrawColor(SCROLL_THUMB_COLOR);
+  fillRectAt(x, y, w, h);
+  setDrawColor(context.color);
+}
+
+void drawFrameHScrollBar(int frameRef) {
+  doc_t *doc = docOf(viewOf(frameOf(frameRef)));
+  int64_t docWidth = docLongestLine(doc) * st.font.charSkip;
+  int w = context.w;
+  if (docWidth > context.w)
+    w = max(scrollBarWidth, (int)(context.w * (int64_t)context.w / docWidth));
+  drawScrollThumb(0, 0, w, context.h);
+}
+
+void drawFrameVScrollBar(int frameRef) {
+  view_t *view = viewOf(frameOf(frameRef));
+  int64_t total = docHeight(docOf(view)) + st.font.lineSkip;
+  if (total <= context.h) {
+    drawScrollThumb(0, 0, context.w, context.h);
+    return;
+  }
+  int h = max(scrollBarHeight, (int)(context.h * (int64_t)context.h / total));
+  int y = (int)(context.h * -view->scrollY / total);
+  drawScrollThumb(0, y, context.w, h);
+}
+
 widget_t *frameWidget(int frameRef) {
   frame_t *frame = frameOf(frameRef); // BAL: remove
   widget_t *textarea = scrollY(frameScrollY, frameRef,
@@ -465,8 +576,12 @@ widget_t *frameWidget(int frameRef) {
     over(draw(drawFrameStatus, frameRef), vspc(&st.font.lineSkip));
   widget_t *background = color(&frame->color, over(box(), hspc(&frame->width)));
 
-  widget_t *hScrollBar = color(&scrollBarColor, over(box(), vspc(&scrollBarHeight)));
-  widget_t *vScrollBar = color(&scrollBarColor, over(box(), hspc(&scrollBarWidth)));
+  widget_t *hScrollBar =
+      color(&scrollBarColor, over(draw(drawFrameHScrollBar, frameRef),
+                                  over(box(), vspc(&scrollBarHeight))));
+  widget_t *vScrollBar =
+      color(&scrollBarColor, over(draw(drawFrameVScrollBar, frameRef),
+                                  over(box(), hspc(&scrollBarWidth))));
   return wid(frameRef, over(vcatr(hcatr(vcatr(textarea, hScrollBar), vScrollBar), status), background));
 }
 
@@ -497,7 +612,7 @@ void builtinAppendCString(char *s) {
 void buffersBufInit() {
   setFocusBuiltinsView(BUFFERS_BUF);
   doc_t *doc = focusDoc();
-  arrayReinit(&doc->contents);
+  docReinit(doc);
   doc_t *buffer = arrayElemAt(&st.docs, 0);
   builtinAppendCString(cstringOf(&buffer->filepath));
   for(int i = 1; i < st.docs.numElems; ++i)
@@ -506,7 +621,6 @@ void buffersBufInit() {
       buffer = arrayElemAt(&st.docs, i);
       builtinAppendCString(cstringOf(&buffer->filepath));
     }
-  cstringOf(&focusDoc()->contents);
 }
 
 void docLoad(char *filepath)
@@ -531,6 +645,9 @@ void stInit(int argc, char **argv) {
   arrayInit(&st.docs, sizeof(doc_t));
   arrayInit(&st.frames, sizeof(frame_t));
   arrayInit(&st.replace, sizeof(char));
+  st.regexp = NULL;
+  searchJobInit(&st.searchJob);
+  arrayInit(&st.hits, sizeof(searchHit_t));
 
   for (int i = 0; i < NUM_FRAMES; ++i) {
     frame_t *frame = arrayPushUninit(&st.frames);
@@ -570,6 +687,11 @@ void stInit(int argc, char **argv) {
   buffersBufInit();
   directoryBufInit();
 
+  char dir[PATH_MAX + 1];
+  dieIfNull(getcwd(dir, sizeof(dir)));
+  indexInit(&st.index, dir);
+  indexStart(&st.index);
+
   setFocusBuiltinsView(HELP_BUF);
   setFocusFrame(MAIN_FRAME);
 
@@ -590,6 +712,40 @@ void saveAll() {
     system("make");
 }
 
+// commits the crash-recovery journals of all the user docs
+void journalEvent() {
+  for (int i = NUM_BUILTIN_BUFFERS; i < st.docs.numElems; ++i) {
+    doc_t *doc = arrayElemAt(&st.docs, i);
+    journalCommit(&doc->journal);
+  }
+}
+
+void userEvent() {
+  switch (st.event.user.code) {
+  case SEARCH_EVENT:
+    searchEvent();
+    break;
+  case PARSE_EVENT:
+    parseEvent();
+    break;
+  default:
+    journalEvent();
+    break;
+  }
+}
+
+// runs on SDL's timer thread, so it only posts an event
+Uint32 journalTimer(Uint32 interval, void *param) {
+  if (journalTakePending()) {
+    SDL_Event event;
+    myMemset(&event, 0, sizeof(event));
+    event.type = SDL_USEREVENT;
+    event.user.code = JOURNAL_EVENT;
+    SDL_PushEvent(&event);
+  }
+  return interval;
+}
+
 void quitEvent() {
   saveAll();
   TTF_Quit();
@@ -602,6 +758,9 @@ void windowEvent() {
   case SDL_WINDOWEVENT_SIZE_CHANGED:
     stResize();
     break;
+  case SDL_WINDOWEVENT_FOCUS_GAINED: // files may have changed meanwhile
+    indexStart(&st.index);
+    break;
   default:
     break;
   }
@@ -609,24 +768,149 @@ void windowEvent() {
 
 void selectChars() {
   view_t *view = focusView();
-  cursorCopy(&view->selection, &view->cursor);
+  cursorCopy(&view->selection, &view->cursor, docOf(view));
   view->selectMode = CHAR_SELECT;
 }
 
 void selectLines() {
   view_t *view = focusView();
-  cursorCopy(&view->selection, &view->cursor);
+  cursorCopy(&view->selection, &view->cursor, docOf(view));
   view->selectMode = LINE_SELECT;
 }
 
+// Extra cursors, for making the same edit in many places.  They are marks so
+// they follow the text; typing applies to all of them as one batch.
+
+bool hasCursors(view_t *view) { return view->cursors.numElems > 0; }
+
+void clearCursors(view_t *view) {
+  doc_t *doc = docOf(view);
+  for (int64_t i = 0; i < view->cursors.numElems; ++i) {
+    markFree(&doc->marks, *(int *)arrayElemAt(&view->cursors, i));
+  }
+  arrayReinit(&view->cursors);
+}
+
+void addCursor(view_t *view, int64_t offset) {
+  if (offset == view->cursor.offset)
+    return;
+  int *mark = arrayPushUninit(&view->cursors);
+  *mark = markNew(&docOf(view)->marks, offset);
+}
+
+// adds a cursor at each search result, or at the cursor's column on each
+// selected line
+void addCursors() {
+  view_t *view = focusView();
+  doc_t *doc = docOf(view);
+  searchBuffer_t *results = &doc->searchResults;
+  clearCursors(view);
+  if (results->numElems > 0) {
+    for (int64_t i = 0; i < results->numElems; ++i) {
+      searchResult_t *r = arrayElemAt(results, i);
+      addCursor(view, markOffset(&doc->marks, r->mark));
+    }
+    resetSearch();
+    return;
+  }
+  if (!selectionActive(view))
+    return;
+  int64_t a = min(view->cursor.row, view->selection.row);
+  int64_t b = max(view->cursor.row, view->selection.row);
+  cursor_t c;
+  cursorInit(&c);
+  for (int64_t row = a; row <= b; ++row) {
+    if (row == view->cursor.row)
+      continue;
+    cursorSetRowCol(&c, row, view->cursor.column, doc);
+    addCursor(view, c.offset);
+  }
+  cancelSelection();
+}
+
+// moves the extra cursors one character forward (dir > 0) or back
+void moveCursors(view_t *view, int dir) {
+  doc_t *doc = docOf(view);
+  for (int64_t i = 0; i < view->cursors.numElems; ++i) {
+    int mark = *(int *)arrayElemAt(&view->cursors, i);
+    int64_t offset = markOffset(&doc->marks, mark);
+    offset = dir > 0 ? docNextChar(doc, offset) : docPrevChar(doc, offset);
+    markSet(&doc->marks, mark, offset);
+  }
+}
+
+static int compareOffsets(const void *a, const void *b) {
+  int64_t x = *(int64_t *)a;
+  int64_t y = *(int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// offsets of all the cursors of view, sorted and without duplicates
+int64_t *cursorOffsets(view_t *view, int64_t *n) {
+  doc_t *doc = docOf(view);
+  int64_t m = view->cursors.numElems;
+  int64_t *offsets = dieIfNull(malloc((m + 1) * sizeof(int64_t)));
+  offsets[0] = view->cursor.offset;
+  for (int64_t i = 0; i < m; ++i) {
+    offsets[i + 1] =
+        markOffset(&doc->marks, *(int *)arrayElemAt(&view->cursors, i));
+  }
+  qsort(offsets, m + 1, sizeof(int64_t), compareOffsets);
+  *n = 0;
+  for (int64_t i = 0; i <= m; ++i) {
+    if (*n == 0 || offsets[*n - 1] != offsets[i])
+      offsets[(*n)++] = offsets[i];
+  }
+  return offsets;
+}
+
+void cursorsInsert(view_t *view, char *s, int64_t len) {
+  int64_t n;
+  int64_t *offsets = cursorOffsets(view, &n);
+  command_t *cmds = dieIfNull(malloc(n * sizeof(command_t)));
+  for (int64_t i = 0; i < n; ++i) {
+    cmds[i].tag = INSERT;
+    cmds[i].offset = offsets[i];
+    cmds[i].start = s;
+    cmds[i].len = len;
+  }
+  docPushBatch(docOf(view), cmds, n);
+  free(cmds);
+  free(offsets);
+}
+
+// deletes the character at each cursor
+void cursorsDelete(view_t *view) {
+  int64_t n;
+  int64_t *offsets = cursorOffsets(view, &n);
+  doc_t *doc = docOf(view);
+  command_t *cmds = dieIfNull(malloc(n * sizeof(command_t)));
+  int64_t m = 0;
+  int64_t end = 0;
+  for (int64_t i = 0; i < n; ++i) {
+    int len = docCharLen(doc, offsets[i]);
+    // a cursor inside the character deleted by the one before it
+    if (len == 0 || offsets[i] < end)
+      continue;
+    cmds[m].tag = DELETE;
+    cmds[m].offset = offsets[i];
+    cmds[m].len = len;
+    end = offsets[i] + len;
+    m++;
+  }
+  docPushBatch(doc, cmds, m);
+  free(cmds);
+  free(offsets);
+}
+
 void cancelSelection() {
   view_t *view = focusView();
   view->selectMode = NO_SELECT;
 }
 
-int docHeight(doc_t *doc) { return docNumLines(doc) * st.font.lineSkip; }
+int64_t docHeight(doc_t *doc) { return docNumLines(doc) * st.font.lineSkip; }
 
-void setFrameScrollY(frame_t *frame, int dR) {
+void setFrameScrollY(frame_t *frame, int64_t dR) {
   view_t *view = viewOf(frame);
   doc_t *doc = docOf(view);
 
@@ -637,13 +921,13 @@ void setFrameScrollY(frame_t *frame, int dR) {
 
 void setFocusScrollY(int dR) { setFrameScrollY(focusFrame(), dR); }
 
-void frameTrackRow(frame_t *frame, int row) {
+void frameTrackRow(frame_t *frame, int64_t row) {
   view_t *view = viewOf(frame);
   int height = AUTO_SCROLL_HEIGHT;
   assert(st.font.lineSkip > 0);
-  int scrollR = view->scrollY / st.font.lineSkip;
+  int64_t scrollR = view->scrollY / st.font.lineSkip;
 
-  int dR = scrollR + row;
+  int64_t dR = scrollR + row;
 
   if (dR < height) {
     setFrameScrollY(frame, height - dR);
@@ -655,7 +939,7 @@ void frameTrackRow(frame_t *frame, int row) {
   }
 }
 
-void focusTrackRow(int row) { frameTrackRow(focusFrame(), row); }
+void focusTrackRow(int64_t row) { frameTrackRow(focusFrame(), row); }
 
 // BAL: do this on mouse clicks...
 void focusTrackCursor() {
@@ -703,7 +987,7 @@ void mouseButtonDownEvent() {
   st.downCxtY = context.y;
 
   selectionSetRowCol();
-  cursorCopy(&view->cursor, &view->selection);
+  cursorCopy(&view->cursor, &view->selection, docOf(view));
 }
 
 void mouseMotionEvent() {
@@ -754,59 +1038,477 @@ void keyDownEvent() {
   }
 }
 
+int searchJobDocRef = 0; // the doc st.searchJob is searching
+
+static doc_t *searchJobDoc() { return arrayElemAt(&st.docs, searchJobDocRef); }
+
+// whether the results of doc are still coming in
+static bool isSearching(doc_t *doc) {
+  return st.searchJob.running && doc == searchJobDoc();
+}
+
+// frees the compiled search
+static void freeSearch() {
+  if (st.searchJob.running)
+    clearSearchResults(searchJobDoc());
+  if (st.searchString && !st.regexp)
+    searcherFree(&st.searcher);
+  regexpFree(st.regexp);
+  st.regexp = NULL;
+  free(st.searchString);
+  st.searchString = NULL;
+  free(st.searchNeedle);
+  st.searchNeedle = NULL;
+}
+
+// index of the first search result at or after offset
+static int64_t searchResultIndex(doc_t *doc, int64_t offset) {
+  int64_t lo = 0;
+  int64_t hi = doc->searchResults.numElems;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    if (searchResultOffset(doc, mid) < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void searchResultInsert(doc_t *doc, int64_t i, int64_t offset,
+                               int64_t len, int64_t reach) {
+  searchResult_t r = {markNew(&doc->marks, offset), len, reach - offset};
+  arrayInsert(&doc->searchResults, i, &r, 1);
+}
+
+// where the search had looked up to by the time it found result i
+static int64_t searchResultReach(doc_t *doc, int64_t i) {
+  searchResult_t *r = arrayElemAt(&doc->searchResults, i);
+  return markOffset(&doc->marks, r->mark) + r->reach;
+}
+
+static void searchResultsDelete(doc_t *doc, int64_t i, int64_t n) {
+  searchBuffer_t *results = &doc->searchResults;
+  if (n <= 0)
+    return;
+  for (int64_t k = i; k < i + n; ++k) {
+    markFree(&doc->marks, ((searchResult_t *)arrayElemAt(results, k))->mark);
+  }
+  arrayDelete(results, i, n);
+}
+
+// the literal matches that overlap the text from a to b are those that start
+// less than a needle's length before it.  Results that were inside deleted
+// text are left at b, so it is searched again too.
+static void searchAgainLiteral(doc_t *doc, int64_t a, int64_t b) {
+  int64_t m = st.searcher.len;
+  int64_t lo = max(0, a - (m - 1));
+  int64_t hi = min(docLength(doc), b + m);
+  int64_t i = searchResultIndex(doc, lo);
+  searchResultsDelete(doc, i, searchResultIndex(doc, b + 1) - i);
+
+  char *buf = dieIfNull(malloc(max(1, hi - lo)));
+  docCopy(doc, lo, hi - lo, buf);
+  int64_t j = 0;
+  int64_t k;
+  while ((k = searcherFind(&st.searcher, buf + j, hi - lo - j)) >= 0 &&
+         lo + j + k <= b) {
+    searchResultInsert(doc, i++, lo + j + k, m, lo + j + k + m);
+    j += k + 1;
+  }
+  free(buf);
+}
+
+// a match of a regexp that can't contain a newline depends only on its line,
+// so only the lines of the edit need searching again
+static void searchAgainLines(doc_t *doc, int64_t a, int64_t b) {
+  int64_t lo = docLineStart(doc, docRowOf(doc, a));
+  int64_t hi = docLineEnd(doc, docRowOf(doc, b));
+  int64_t i = searchResultIndex(doc, lo);
+  searchResultsDelete(doc, i, searchResultIndex(doc, hi + 1) - i);
+
+  int64_t from = lo;
+  int64_t start;
+  int64_t len;
+  int64_t stop;
+  while ((start = regexpFind(st.regexp, doc, from, hi, &len, &stop)) >= 0) {
+    searchResultInsert(doc, i++, start, len, start + len);
+    from = start + len;
+  }
+}
+
+// otherwise a match depends on the text from the end of the one before it to
+// wherever the search for it stopped looking, which can be anywhere.  So
+// search again from the first result whose search looked at the edit, until
+// the matches after the edit line up with the old ones.
+static void searchAgainRegexp(doc_t *doc, int64_t a, int64_t b) {
+  searchBuffer_t *results = &doc->searchResults;
+  // reaches only go up
+  int64_t lo = 0;
+  int64_t hi = results->numElems;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    if (searchResultReach(doc, mid) <= a)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  int64_t i = lo;
+  int64_t from = 0;
+  int64_t reach = 0;
+  if (i > 0) {
+    searchResult_t *r = arrayElemAt(results, i - 1);
+    from = markOffset(&doc->marks, r->mark) + r->len;
+    reach = searchResultReach(doc, i - 1);
+  }
+
+  for (;;) {
+    int64_t len;
+    int64_t stop;
+    int64_t start =
+        regexpFind(st.regexp, doc, from, docLength(doc), &len, &stop);
+    reach = max(reach, stop);
+    // the old results before the new match are gone, unless they agree
+    while (i < results->numElems) {
+      searchResult_t *r = arrayElemAt(results, i);
+      int64_t offset = markOffset(&doc->marks, r->mark);
+      if (offset == start && r->len == len)
+        break;
+      if (start >= 0 && offset >= start + len)
+        break;
+      searchResultsDelete(doc, i, 1);
+    }
+    if (start < 0)
+      return;
+    if (i == results->numElems || searchResultOffset(doc, i) != start) {
+      searchResultInsert(doc, i, start, len, reach);
+    } else if (start > b) {
+      // the rest are as they were, but may not have looked as far
+      while (i < results->numElems && searchResultReach(doc, i) < reach) {
+        searchResult_t *r = arrayElemAt(results, i);
+        r->reach = reach - markOffset(&doc->marks, r->mark);
+        i++;
+      }
+      return;
+    } else {
+      searchResult_t *r = arrayElemAt(results, i);
+      r->reach = reach - start;
+    }
+    i++;
+    from = start + len;
+  }
+}
+
+// finds the search results again where the text changed since they were
+// found.  The rest are marks, which have already moved with the text.
+static void searchAgain(doc_t *doc) {
+  dynamicArray_t *edits = &doc->searchEdits;
+  if (edits->numElems == 0)
+    return;
+  // by start
+  qsort(edits->start, edits->numElems, sizeof(searchEdit_t), compareOffsets);
+  for (int64_t i = 0; i < edits->numElems; ++i) {
+    searchEdit_t *e = arrayElemAt(edits, i);
+    if (!st.regexp)
+      searchAgainLiteral(doc, e->start, e->end);
+    else if (!st.regexp->multiline)
+      searchAgainLines(doc, e->start, e->end);
+    else
+      searchAgainRegexp(doc, e->start, e->end);
+  }
+  arrayReinit(edits);
+}
+
+// scrolls the search frame to the result closest to its cursor
+static void trackSearch(doc_t *doc) {
+  frame_t *frame = frameOf(searchFrameRef);
+  view_t *view = viewOf(frame);
+  searchBuffer_t *results = &doc->searchResults;
+  if (docOf(view) != doc || results->numElems == 0)
+    return;
+  int64_t offset = view->cursor.offset;
+  int64_t i = searchResultIndex(doc, offset);
+  if (i == results->numElems ||
+      (i > 0 && offset - searchResultOffset(doc, i - 1) <=
+                    searchResultOffset(doc, i) - offset))
+    i--;
+  cursor_t cur;
+  cursorInit(&cur);
+  cursorSetOffset(&cur, searchResultOffset(doc, i), doc);
+  frameTrackRow(frame, cur.row);
+}
+
+static void startSearchJob(doc_t *doc, int docRef);
+
+// adds the matches found since last time to the results.  If the doc changed
+// since the search started they no longer line up, so it starts over.
+static void takeSearchResults(bool wait) {
+  doc_t *doc = searchJobDoc();
+  uint64_t generation = st.searchJob.snap.generation;
+  dynamicArray_t found;
+  arrayInit(&found, sizeof(searchMatch_t));
+  bool done = searchJobTake(&st.searchJob, &found, wait);
+  if (docGeneration(doc) != generation) {
+    arrayFree(&found);
+    startSearchJob(doc, searchJobDocRef);
+    return;
+  }
+  for (int64_t i = 0; i < found.numElems; ++i) {
+    searchMatch_t *m = arrayElemAt(&found, i);
+    searchResult_t *r = arrayPushUninit(&doc->searchResults);
+    r->mark = markNew(&doc->marks, m->offset);
+    r->len = m->len;
+    r->reach = m->reach - m->offset;
+  }
+  arrayFree(&found);
+  if (done) {
+    arrayShrinkToFit(&doc->searchResults);
+    trackSearch(doc);
+  }
+}
+
+static void startSearchJob(doc_t *doc, int docRef) {
+  clearSearchResults(doc);
+  doc->searchString = dieIfNull(strdup(st.searchString));
+  searchJobDocRef = docRef;
+  searchJobStart(&st.searchJob, doc, st.searchNeedle, st.searchLen,
+                 st.regexp != NULL);
+  takeSearchResults(false);
+}
+
+// waits for the rest of the results of doc
+static void finishSearch(doc_t *doc) {
+  while (isSearching(doc))
+    takeSearchResults(true);
+}
+
+// the background search found more
+void searchEvent() {
+  if (st.searchJob.running)
+    takeSearchResults(false);
+}
+
+// a doc's parser finished, so it's drawn with the new result
+void parseEvent() {
+  for (int i = 0; i < st.docs.numElems; ++i) {
+    doc_t *doc = arrayElemAt(&st.docs, i);
+    parserTake(&doc->parser, false);
+  }
+}
+
+// a literal that starts with the last one only matches where that did, so
+// its results can be narrowed down instead of searching again
+static bool canNarrowSearch(doc_t *doc, char *needle, int64_t len) {
+  if (st.regexp || !st.searchString || !doc->searchString ||
+      strcmp(doc->searchString, st.searchString) != 0 || isSearching(doc) ||
+      len <= st.searcher.len ||
+      searcherFind(&st.searcher, needle, st.searcher.len) != 0)
+    return false;
+  searchAgain(doc);
+  return true;
+}
+
+static void narrowSearch(doc_t *doc) {
+  searchBuffer_t *results = &doc->searchResults;
+  int64_t m = st.searcher.len;
+  int64_t docLen = docLength(doc);
+  char *buf = dieIfNull(malloc(m));
+  int64_t n = 0;
+  for (int64_t i = 0; i < results->numElems; ++i) {
+    searchResult_t *r = arrayElemAt(results, i);
+    int64_t offset = markOffset(&doc->marks, r->mark);
+    if (offset + m <= docLen) {
+      docCopy(doc, offset, m, buf);
+      if (searcherFind(&st.searcher, buf, m) == 0) {
+        r->len = m;
+        r->reach = m;
+        myMemcpy(arrayElemAt(results, n++), r, sizeof(searchResult_t));
+        continue;
+      }
+    }
+    markFree(&doc->marks, r->mark);
+  }
+  free(buf);
+  results->numElems = n;
+  arrayShrinkToFit(results);
+  free(doc->searchString);
+  doc->searchString = dieIfNull(strdup(st.searchString));
+  trackSearch(doc);
+}
+
+// splits search into the needle (length 0 if none) and the replacement (NULL
+// if none).  Returns what they point into, for the caller to free.
+static char *parseSearch(char *search, bool *isRegexp, char **needle,
+                         char **replace) {
+  // /pattern/replace is a regular expression, in which \/ is a slash
+  *isRegexp = search[0] == '/';
+  char *temp = dieIfNull(strdup(search + *isRegexp));
+  char *p = temp;
+  *needle = temp;
+  if (*isRegexp) {
+    while (*p && *p != '/') {
+      p += p[0] == '\\' && p[1] ? 2 : 1;
+    }
+    if (*p)
+      *p++ = '\0';
+    else
+      p = NULL;
+  } else {
+    strsep(&p, "/");
+  }
+  *replace = p;
+  return temp;
+}
+
 void doSearch(char *search) {
   assert(search);
   frame_t *frame = frameOf(searchFrameRef);
   assert(frame);
   view_t *view = viewOf(frame);
   doc_t *doc = docOf(view);
-  cursor_t *cursor = &view->cursor;
-
-  char *haystack = cstringOf(&doc->contents);
-  char *replace = dieIfNull(strdup(search));
-  char *temp = replace;
-  char *needle = strsep(&replace, "/");
-  // needle is length 0 if no needle
-  // replace is NULL if no replace
+
+  if (doc->searchString && st.searchString &&
+      strcmp(doc->searchString, search) == 0 &&
+      strcmp(st.searchString, search) == 0) {
+    if (!isSearching(doc))
+      searchAgain(doc);
+    return;
+  }
+
+  bool isRegexp;
+  char *needle;
+  char *replace;
+  char *temp = parseSearch(search, &isRegexp, &needle, &replace);
   st.searchLen = strlen(needle);
   st.isReplace = replace != NULL;
   arrayReinit(&st.replace);
-  searchBuffer_t *results = &doc->searchResults;
-  arrayReinit(results);
+  bool narrow = !isRegexp && canNarrowSearch(doc, needle, st.searchLen);
+  freeSearch();
+  if (!narrow)
+    clearSearchResults(doc);
   if (st.isReplace) {
     arrayInsert(&st.replace, 0, replace, strlen(replace));
   }
   if (st.searchLen == 0)
     goto done;
 
-  char *p = haystack;
-  int *off;
-  int dist = INT_MAX;
+  if (isRegexp) {
+    // an unfinished pattern finds nothing
+    st.regexp = regexpNew(needle, st.searchLen, NULL);
+    st.isReplace = st.isReplace && st.regexp;
+    if (!st.regexp)
+      goto done;
+  } else {
+    searcherInit(&st.searcher, needle, st.searchLen);
+  }
+  st.searchString = dieIfNull(strdup(search));
+  st.searchNeedle = dieIfNull(strdup(needle));
+  if (narrow)
+    narrowSearch(doc);
+  else
+    startSearchJob(doc, view->refDoc);
+
+done:
+  free(temp);
+}
 
-  while ((p = strcasestr(p, needle))) {
-    off = arrayPushUninit(results);
-    *off = p - haystack;
-    p++;
+static void searchAgainTestFound(void *arg, int64_t offset, int64_t len) {
+  searchMatch_t m = {offset, len, 0};
+  arrayPush(arg, &m);
+}
 
-    // keep closest offset
-    int dist1 = *off - cursor->offset;
-    dist = abs(dist1) < abs(dist) ? dist1 : dist;
+// whether the results of doc are those of searching it afresh
+static bool searchAgainTestFresh(doc_t *doc, char *search) {
+  dynamicArray_t found;
+  arrayInit(&found, sizeof(searchMatch_t));
+  if (st.regexp) {
+    regexpSearchDoc(st.regexp, doc, searchAgainTestFound, &found);
+  } else {
+    searcher_t searcher;
+    searcherInit(&searcher, search, strlen(search));
+    searchDoc(&searcher, doc, searchAgainTestFound, &found);
+    searcherFree(&searcher);
   }
+  searchBuffer_t *results = &doc->searchResults;
+  bool ok = found.numElems == results->numElems;
+  for (int64_t i = 0; ok && i < found.numElems; ++i) {
+    searchMatch_t *m = arrayElemAt(&found, i);
+    searchResult_t *r = arrayElemAt(results, i);
+    ok = m->offset == searchResultOffset(doc, i) && m->len == r->len;
+  }
+  arrayFree(&found);
+  return ok;
+}
+
+// makes random edits, many of them at and inside the results, and checks
+// that the results kept up to date match a fresh search after each one
+void searchAgainTest() {
+  char *filepath = "/tmp/ceditor-searchAgainTest.txt";
+  char *alphabet = "aaAb\n";
+  FILE *fp = dieIfNull(fopen(filepath, "w"));
+  for (int i = 0; i < 2000; ++i) {
+    fputc(alphabet[rand() % 5], fp);
+  }
+  if (fclose(fp) != 0)
+    die("unable to close test file");
+  docLoad(filepath);
+  setFocusFrame(MAIN_FRAME);
+  setFocusView(focusFrame()->views.numElems - 1);
+  setupSearchFocus();
+  doc_t *doc = focusDoc();
 
-  // track search
-  cursor_t cur;
-  cursorInit(&cur);
-  cursorSetOffset(&cur, cursor->offset + dist, doc);
-  frameTrackRow(frame, cur.row);
+  // a literal whose matches overlap, a regexp that stays on one line and
+  // one that spans lines
+  char *searches[] = {"aa", "/a+b", "/b\\na|a\\nb"};
+  for (int k = 0; k < 3; ++k) {
+    doSearch(searches[k]);
+    finishSearch(doc);
+    assert(searchAgainTestFresh(doc, searches[k]));
+    int overlaps = 0;
+    for (int it = 0; it < 500; ++it) {
+      searchBuffer_t *results = &doc->searchResults;
+      int64_t len = docLength(doc);
+      int64_t offset = rand() % (len + 1);
+      if (results->numElems > 0 && rand() % 2) {
+        // from just before a result to its end
+        int64_t i = rand() % results->numElems;
+        searchResult_t *r = arrayElemAt(results, i);
+        offset = searchResultOffset(doc, i) - 1 + rand() % (r->len + 2);
+        offset = max(0, offset);
+      }
+      int64_t n = 1 + rand() % 3;
+      if (rand() % 2) {
+        char s[3];
+        for (int64_t j = 0; j < n; ++j) {
+          s[j] = alphabet[rand() % 5];
+        }
+        docPushInsert(doc, offset, s, n);
+      } else {
+        docPushDelete(doc, offset, n);
+      }
+      // one that spans lines is caught up with by the next search
+      doSearch(searches[k]);
+      assert(searchAgainTestFresh(doc, searches[k]));
+      for (int64_t i = 1; i < results->numElems; ++i) {
+        searchResult_t *r = arrayElemAt(results, i - 1);
+        overlaps += searchResultOffset(doc, i - 1) + r->len >
+                    searchResultOffset(doc, i);
+      }
+    }
+    assert(k > 0 || overlaps > 0);
+  }
 
-done:
-  free(temp);
+  freeSearch();
+  clearSearchResults(doc);
+  journalReset(&doc->journal, filepath);
+  doc->modified = false;
+  unlink(filepath);
 }
 
 char *viewElem(view_t *view) {
-  int offset = view->cursor.offset;
-  char *s = docOf(view)->contents.start;
-  int i = distanceToStartOfElem(s, offset);
+  int64_t offset = view->cursor.offset;
+  char *s = docCString(docOf(view));
+  int64_t i = distanceToStartOfElem(s, offset);
   char *p = s + offset + i;
   return p;
 }
@@ -817,8 +1519,27 @@ char *focusElem() {
   return viewElem(focusView());
 }
 
+int64_t searchResultOffset(doc_t *doc, int64_t i) {
+  searchResult_t *r = arrayElemAt(&doc->searchResults, i);
+  return markOffset(&doc->marks, r->mark);
+}
+
+// search results are marks so that they follow edits
+void clearSearchResults(doc_t *doc) {
+  if (isSearching(doc))
+    searchJobCancel(&st.searchJob);
+  searchBuffer_t *results = &doc->searchResults;
+  for (int64_t i = 0; i < results->numElems; ++i) {
+    markFree(&doc->marks, ((searchResult_t *)arrayElemAt(results, i))->mark);
+  }
+  arrayReinit(results);
+  free(doc->searchString);
+  doc->searchString = NULL;
+  arrayReinit(&doc->searchEdits);
+}
+
 void resetSearch() {
-  arrayReinit(&focusDoc()->searchResults);
+  clearSearchResults(focusDoc());
   st.searchLen = 0;
 }
 
@@ -831,9 +1552,10 @@ view_t *builtinsViewOf(int viewRef) {
 
 void recomputeSearch() {
   // get search elem
-  char *search = viewElem(builtinsViewOf(SEARCH_BUF));
+  view_t *view = builtinsViewOf(SEARCH_BUF);
+  char *search = viewElem(view);
 
-  if (!search)
+  if (!search || isHitList(view))
     return;
 
   doSearch(search);
@@ -841,7 +1563,16 @@ void recomputeSearch() {
 }
 
 void updateBuiltinsState(bool isModify) {
-  if (isModify) {
+  doc_t *doc = focusDoc();
+  if (isModify && isSearching(doc)) {
+    // the search starts over when it reports back
+  } else if (isModify && doc->searchString && st.searchString &&
+      strcmp(doc->searchString, st.searchString) == 0) {
+    // a regexp that spans lines can take a long search to catch up, so
+    // that waits for the next search and the results follow the text
+    if (!st.regexp || !st.regexp->multiline)
+      searchAgain(doc);
+  } else if (isModify) {
     resetSearch();
   }
 
@@ -851,21 +1582,27 @@ void updateBuiltinsState(bool isModify) {
   }
 }
 
-void stMoveCursorOffset(int offset) {
+void stMoveCursorOffset(int64_t offset) {
   cursorSetOffset(focusCursor(), offset, focusDoc());
   focusTrackCursor();
   updateBuiltinsState(false);
 }
 
-void stMoveCursorRowCol(int row, int col) {
+void stMoveCursorRowCol(int64_t row, int64_t col) {
   cursorSetRowCol(focusCursor(), row, col, focusDoc());
   focusTrackCursor();
   updateBuiltinsState(false);
 }
 
-void backwardChar() { stMoveCursorOffset(focusCursor()->offset - 1); }
+void backwardChar() {
+  moveCursors(focusView(), -1);
+  stMoveCursorOffset(docPrevChar(focusDoc(), focusCursor()->offset));
+}
 
-void forwardChar() { stMoveCursorOffset(focusCursor()->offset + 1); }
+void forwardChar() {
+  moveCursors(focusView(), 1);
+  stMoveCursorOffset(docNextChar(focusDoc(), focusCursor()->offset));
+}
 
 void setNavigateMode() { focusView()->mode = NAVIGATE_MODE; }
 
@@ -895,9 +1632,9 @@ void doKeyPressInNavigateMode(uchar c) {
   setMode(mode);
 }
 
-void moveLines(int dRow) {
+void moveLines(int64_t dRow) {
   cursor_t *cursor = focusCursor();
-  int col = cursor->preferredColumn;
+  int64_t col = cursor->preferredColumn;
 
   stMoveCursorRowCol(cursor->row + dRow, col);
   cursor->preferredColumn = col;
@@ -909,12 +1646,11 @@ void forwardLine() { moveLines(1); }
 
 char nextCharAfterSpaces() {
   doc_t *doc = focusDoc();
-  char *p = doc->contents.start + focusCursor()->offset;
-  char *end = arrayTop(&doc->contents);
+  int64_t i = focusCursor()->offset;
 
-  while (p < end && *p == ' ')
-    p++;
-  return p == end ? '\0' : *p;
+  while (docCharAt(doc, i) == ' ')
+    i++;
+  return docCharAt(doc, i);
 }
 
 void forwardBlankLine() {
@@ -946,17 +1682,15 @@ void backwardBlankLine() {
 }
 
 void forwardSpace() {
-  int i = focusCursor()->offset;
+  int64_t i = focusCursor()->offset;
   doc_t *doc = focusDoc();
-  stMoveCursorOffset(i + distanceToNextSpace(doc->contents.start + i,
-                                             arrayTop(&doc->contents)));
+  stMoveCursorOffset(i + distanceToNextSpace(doc, i));
 }
 
 void backwardSpace() {
-  int i = focusCursor()->offset;
+  int64_t i = focusCursor()->offset;
   doc_t *doc = focusDoc();
-  stMoveCursorOffset(
-      i + distanceToPrevSpace(doc->contents.start, doc->contents.start + i));
+  stMoveCursorOffset(i + distanceToPrevSpace(doc, i));
 }
 
 void backwardPage() {
@@ -970,18 +1704,22 @@ void forwardPage() {
 void backwardSOF() { stMoveCursorOffset(0); }
 
 void forwardEOF() {
-  stMoveCursorOffset(INT_MAX);
+  stMoveCursorOffset(INT64_MAX);
 }
 
 void backwardSOL() { stMoveCursorRowCol(focusCursor()->row, 0); }
 
-void forwardEOL() { stMoveCursorRowCol(focusCursor()->row, INT_MAX); }
+void forwardEOL() { stMoveCursorRowCol(focusCursor()->row, INT64_MAX); }
 
 void insertString(char *s, uint len) {
   assert(s);
   if (len <= 0)
     return;
 
+  if (hasCursors(focusView())) {
+    cursorsInsert(focusView(), s, len);
+    return;
+  }
   docPushInsert(focusDoc(), focusCursor()->offset, s, len);
 }
 
@@ -990,6 +1728,7 @@ void builtinInsertString(char *s, uint len) {
   if (len <= 0)
     return;
   docInsert(focusDoc(), focusCursor()->offset, s, len);
+  syncViews(focusDoc());
 }
 
 void insertCString(char *s) {
@@ -1008,9 +1747,15 @@ void insertChar(uchar c) {
 }
 
 void enter() {
+  if (focusFrameRef() == BUILTINS_FRAME && focusViewRef() == SEARCH_BUF &&
+      isHitList(focusView())) {
+    gotoHit();
+    return;
+  }
+
   if (focusFrameRef() == BUILTINS_FRAME && focusViewRef() == BUFFERS_BUF)
     {
-      int i = focusCursor()->row;
+      int i = (int)focusCursor()->row;
       if (i < NUM_BUILTIN_BUFFERS)
         {
           setFocusView(i);
@@ -1024,10 +1769,11 @@ void enter() {
   if (focusFrameRef() == BUILTINS_FRAME && focusViewRef() == DIRECTORY_BUF)
     {
       backwardSOL();
-      char *s = focusDoc()->contents.start + focusCursor()->offset;
-      int n = distanceToEOL(s);
+      doc_t *doc = focusDoc();
+      int64_t offset = focusCursor()->offset;
+      int64_t n = min(distanceToEOL(doc, offset), PATH_MAX);
       char filename[PATH_MAX + 1];
-      if (filename != strncpy(filename, s, n)) die("unrecognized filename");
+      docCopy(doc, offset, n, filename);
       filename[n] = '\0';
       if (isDirectory(filename))
         {
@@ -1118,7 +1864,7 @@ void directoryBufInit() {
 
   setFocusBuiltinsView(DIRECTORY_BUF);
   doc_t *doc = focusDoc();
-  arrayReinit(&doc->contents);
+  docReinit(doc);
   builtinAppendCString(dir);
 
   int i = 0;
@@ -1130,7 +1876,6 @@ void directoryBufInit() {
       i++;
     }
   free(namelist);
-  cstringOf(&focusDoc()->contents);
   backwardSOF();
 }
 
@@ -1155,14 +1900,14 @@ void helpBufInit() {
 
 void backwardStartOfElem() // BAL: remove(?)
 {
-  int offset = focusView()->cursor.offset;
-  int i = distanceToStartOfElem(focusDoc()->contents.start, offset);
+  int64_t offset = focusView()->cursor.offset;
+  int64_t i = distanceToStartOfElem(docCString(focusDoc()), offset);
   stMoveCursorOffset(offset + i);
 }
 
 void copyElemToClipboard() {
   backwardStartOfElem();
-  char *s = focusDoc()->contents.start + focusView()->cursor.offset;
+  char *s = docCString(focusDoc()) + focusView()->cursor.offset;
   setClipboardText(s);
 }
 
@@ -1172,73 +1917,225 @@ void pasteBefore() {
     insertCString(s);
 }
 
-void docPushCommand(commandTag_t tag, doc_t *doc, int offset, char *s,
-                    int len) {
-  command_t *cmd;
-  while (doc->undoStack.offset < doc->undoStack.numElems) {
-    cmd = arrayPop(&doc->undoStack);
-    arrayFree(&cmd->string);
+// moves the cursors and selections of every view of doc to follow an edit
+void syncViews(doc_t *doc) {
+  for (int i = 0; i < st.frames.numElems; ++i) {
+    frame_t *frame = arrayElemAt(&st.frames, i);
+    for (int j = 0; j < frame->views.numElems; ++j) {
+      view_t *view = arrayElemAt(&frame->views, j);
+      if (docOf(view) != doc)
+        continue;
+      cursorSync(&view->cursor, doc);
+      cursorSync(&view->selection, doc);
+    }
   }
-  cmd = arrayPushUninit(&doc->undoStack);
-  cmd->tag = tag;
-  cmd->offset = offset;
-  arrayInit(&cmd->string, sizeof(char));
-  arrayInsert(&cmd->string, 0, s, len);
-  doc->undoStack.offset++;
-  assert(doc->undoStack.offset == doc->undoStack.numElems);
 }
 
-int docPushDelete(doc_t *doc, int offset, int len) {
+int64_t docPushDelete(doc_t *doc, int64_t offset, int64_t len) {
   if (len <= 0)
     return 0;
   if (doc->isReadOnly)
     return 0;
-  int n = docDelete(doc, offset, len);
-  if (doc->isUserDoc && n > 0) {
-    docPushCommand(DELETE, doc, offset, doc->contents.start + offset, n);
+  int64_t n = min(len, docLength(doc) - offset);
+  if (n <= 0)
+    return 0;
+  if (doc->isUserDoc) {
+    // save the text before it is deleted
+    char *s = dieIfNull(malloc(n));
+    docCopy(doc, offset, n, s);
+    undoPush(doc, DELETE, offset, s, n);
+    free(s);
   }
+  n = docDelete(doc, offset, n);
+  syncViews(doc);
   updateBuiltinsState(true);
   return n;
 }
 
-void docPushInsert(doc_t *doc, int offset, char *s, int len) {
+// applies a batch of edits as one undo step.  The offsets are into the text
+// before the batch, in ascending order, and the edits don't overlap.
+void docPushBatch(doc_t *doc, command_t *cmds, int64_t n) {
+  if (n <= 0 || doc->isReadOnly)
+    return;
+  // save the text before it is deleted
+  int64_t size = 0;
+  for (int64_t i = 0; i < n; ++i) {
+    if (cmds[i].tag == DELETE)
+      size += cmds[i].len;
+  }
+  char *s = dieIfNull(malloc(max(1, size)));
+  char *p = s;
+  for (int64_t i = 0; i < n; ++i) {
+    if (cmds[i].tag == DELETE) {
+      docCopy(doc, cmds[i].offset, cmds[i].len, p);
+      cmds[i].start = p;
+      p += cmds[i].len;
+    }
+  }
+  undoPushBatch(doc, cmds, n);
+  docApply(doc, cmds, n);
+  free(s);
+  syncViews(doc);
+  updateBuiltinsState(true);
+}
+
+void docPushInsert(doc_t *doc, int64_t offset, char *s, int64_t len) {
   if (len <= 0 || doc->isReadOnly)
     return;
-  docPushCommand(INSERT, doc, offset, s, len);
+  undoPush(doc, INSERT, offset, s, len);
   docInsert(doc, offset, s, len);
+  syncViews(doc);
   updateBuiltinsState(true);
 }
 
-void docDoCommand(doc_t *doc, commandTag_t tag, int offset, string_t *string) {
+void docDoCommand(doc_t *doc, commandTag_t tag, command_t *cmd) {
   cancelSelection();
-  stMoveCursorOffset(offset);
+  stMoveCursorOffset(cmd->offset);
   switch (tag) {
   case DELETE:
-    docDelete(doc, offset, string->numElems);
-    return;
+    docDelete(doc, cmd->offset, cmd->len);
+    break;
   default:
     assert(tag == INSERT);
-    docInsert(doc, offset, string->start, string->numElems);
+    docInsert(doc, cmd->offset, cmd->start, cmd->len);
+    break;
+  }
+  syncViews(doc);
+  updateBuiltinsState(true);
+}
+
+// does (or undoes) the chain of commands [first, last) as one batch
+void docDoCommands(doc_t *doc, int64_t first, int64_t last, bool isUndo) {
+  undoStack_t *stack = &doc->undoStack;
+  int64_t n = last - first;
+  if (n == 1) {
+    command_t *cmd = arrayElemAt(stack, first);
+    docDoCommand(doc, isUndo ? !cmd->tag : cmd->tag, cmd);
     return;
   }
+  command_t *cmds = dieIfNull(malloc(n * sizeof(command_t)));
+  myMemcpy(cmds, arrayElemAt(stack, first), n * sizeof(command_t));
+  if (isUndo) {
+    // the offsets are relative to the text before the batch, so move each
+    // one past what the edits before it did
+    int64_t shift = 0;
+    for (int64_t i = 0; i < n; ++i) {
+      command_t *cmd = &cmds[i];
+      cmd->offset += shift;
+      shift += cmd->tag == INSERT ? cmd->len : -cmd->len;
+      cmd->tag = !cmd->tag;
+    }
+  }
+  cancelSelection();
+  docApply(doc, cmds, n);
+  syncViews(doc);
+  updateBuiltinsState(true);
+  // a cursor at each edit, as when the batch was made
+  view_t *view = focusView();
+  clearCursors(view);
+  stMoveCursorOffset(cmds[0].offset);
+  int64_t shift = 0;
+  for (int64_t i = 0; i < n; ++i) {
+    addCursor(view, cmds[i].offset + shift);
+    shift += cmds[i].tag == INSERT ? cmds[i].len : -cmds[i].len;
+  }
+  free(cmds);
 }
 
 void undo() {
   doc_t *doc = focusDoc();
-  if (doc->undoStack.offset == 0)
+  undoStack_t *stack = &doc->undoStack;
+  if (stack->offset == 0)
     return;
-  doc->undoStack.offset--;
-  command_t *cmd = arrayFocus(&doc->undoStack);
-  docDoCommand(doc, !cmd->tag, cmd->offset, &cmd->string);
+  int64_t first = undoChainStart(doc, stack->offset - 1);
+  docDoCommands(doc, first, stack->offset, true);
+  stack->offset = first;
 }
 
 void redo() {
   doc_t *doc = focusDoc();
-  if (doc->undoStack.offset == doc->undoStack.numElems)
+  undoStack_t *stack = &doc->undoStack;
+  if (stack->offset == stack->numElems)
     return;
-  command_t *cmd = arrayFocus(&doc->undoStack);
-  docDoCommand(doc, cmd->tag, cmd->offset, &cmd->string);
-  doc->undoStack.offset++;
+  int64_t last = stack->offset + 1;
+  while (last < stack->numElems &&
+         ((command_t *)arrayElemAt(stack, last))->chained)
+    last++;
+  docDoCommands(doc, stack->offset, last, false);
+  stack->offset = last;
+}
+
+static bool cursorsTestAt(view_t *view, char *text, int64_t *offsets,
+                          int64_t n) {
+  int64_t m;
+  int64_t *got = cursorOffsets(view, &m);
+  bool ok = strcmp(docCString(docOf(view)), text) == 0 && m == n &&
+            memcmp(got, offsets, n * sizeof(int64_t)) == 0;
+  free(got);
+  return ok;
+}
+
+// types and backspaces at several cursors, then undoes and redoes it all.
+// Undoing puts the text and every cursor back as they were before each
+// batch, and redoing puts a cursor where each of its edits was made.
+void cursorsTest() {
+  char *filepath = "/tmp/ceditor-cursorsTest.txt";
+  FILE *fp = dieIfNull(fopen(filepath, "w"));
+  fputs("abc\ndef\nghi\n", fp);
+  if (fclose(fp) != 0)
+    die("unable to close test file");
+  docLoad(filepath);
+  setFocusFrame(MAIN_FRAME);
+  setFocusView(focusFrame()->views.numElems - 1);
+  view_t *view = focusView();
+  doc_t *doc = focusDoc();
+  stMoveCursorOffset(1);
+  addCursor(view, 5);
+  addCursor(view, 9);
+
+  // the text and cursors before each batch, and after the last
+  char *texts[4];
+  int64_t *offsets[4];
+  int64_t n;
+  int64_t shifts[3] = {1, 1, -1}; // how far each edit moves the ones after
+  for (int k = 0; k < 4; ++k) {
+    texts[k] = dieIfNull(strdup(docCString(doc)));
+    offsets[k] = cursorOffsets(view, &n);
+    assert(n == 3);
+    if (k == 0) {
+      insertChar('<');
+    } else if (k == 1) {
+      insertChar('>');
+      backwardChar(); // and then delete, to backspace
+    } else if (k == 2) {
+      cut();
+    }
+  }
+  assert(strcmp(texts[3], "a<bc\nd<ef\ng<hi\n") == 0);
+
+  for (int k = 3; k > 0; --k) {
+    undo();
+    assert(cursorsTestAt(view, texts[k - 1], offsets[k - 1], n));
+  }
+  undo(); // nothing left to undo
+  assert(cursorsTestAt(view, texts[0], offsets[0], n));
+  for (int k = 1; k < 4; ++k) {
+    redo();
+    int64_t at[3];
+    for (int i = 0; i < n; ++i) {
+      at[i] = offsets[k - 1][i] + i * shifts[k - 1];
+    }
+    assert(cursorsTestAt(view, texts[k], at, n));
+  }
+
+  for (int k = 0; k < 4; ++k) {
+    free(texts[k]);
+    free(offsets[k]);
+  }
+  clearCursors(view);
+  journalReset(&doc->journal, filepath);
+  doc->modified = false;
+  unlink(filepath);
 }
 
 void copy(char *s, uint len) {
@@ -1246,30 +2143,39 @@ void copy(char *s, uint len) {
   setFocusBuiltinsView(COPY_BUF);
   insertNewElem();
   builtinInsertString(s, len);
-  setClipboardText(focusDoc()->contents.start);
+  setClipboardText(docCString(focusDoc()));
   setFocusFrame(frameRef);
 }
 
 void cut() {
-  int column;
-  int row;
-  int offset;
-  int length;
+  int64_t column;
+  int64_t row;
+  int64_t offset;
+  int64_t length;
 
   view_t *view = focusView();
   doc_t *doc = focusDoc();
 
+  if (hasCursors(view) && !selectionActive(view)) {
+    cursorsDelete(view);
+    return;
+  }
+
   getSelectionCoords(view, &column, &row, &offset, &length);
 
   cancelSelection();
 
-  length = min(length, doc->contents.numElems - offset);
+  length = min(length, docLength(doc) - offset);
 
   if (length <= 0)
     return;
 
-  if (length > 1)
-    copy(doc->contents.start + offset, length);
+  if (length > docCharLen(doc, offset)) { // more than one character
+    char *s = dieIfNull(malloc(length));
+    docCopy(doc, offset, length, s);
+    copy(s, length);
+    free(s);
+  }
   docPushDelete(doc, offset, length);
   cursorSetRowCol(&view->cursor, row, column, focusDoc());
 }
@@ -1332,14 +2238,436 @@ void stopRecordingOrPlayMacro() {
   doc_t *doc = focusDoc();
   view_t *view = focusView();
 
-  if (!doc->contents.start) {
+  if (docLength(doc) == 0) {
     message("no macros to play");
     setFocusFrame(frameRef);
     return;
   }
 
   setFocusFrame(frameRef);
-  playMacroCString(doc->contents.start + view->cursor.offset);
+  playMacroCString(docCString(doc) + view->cursor.offset);
+}
+
+// Searching all the user docs.  The lines with matches are listed in the
+// search doc, and enter on one goes there.
+
+static void clearHits() {
+  for (int64_t i = 0; i < st.hits.numElems; ++i) {
+    searchHit_t *hit = arrayElemAt(&st.hits, i);
+    if (hit->docRef < 0) {
+      free(hit->path);
+      continue;
+    }
+    doc_t *doc = arrayElemAt(&st.docs, hit->docRef);
+    markFree(&doc->marks, hit->mark);
+  }
+  arrayReinit(&st.hits);
+  if (st.hitsMark) {
+    markFree(&docOf(builtinsViewOf(SEARCH_BUF))->marks, st.hitsMark);
+    st.hitsMark = 0;
+  }
+}
+
+// whether the cursor of view (of the search doc) is in the list of hits
+bool isHitList(view_t *view) {
+  if (!st.hitsMark)
+    return false;
+  doc_t *doc = docOf(view);
+  int64_t h = markOffset(&doc->marks, st.hitsMark);
+  int64_t offset = view->cursor.offset;
+  char *s = docCString(doc);
+  int64_t start = offset + distanceToStartOfElem(s, offset);
+  return start <= h && !memchr(s + start, '\0', h - start);
+}
+
+// the matches (searchMatch_t) in each of st.docs of the current search, or
+// NULL if there is nothing to search for
+static dynamicArray_t *searchAllDocs(char *needle, bool isRegexp) {
+  int64_t len = strlen(needle);
+  if (len == 0)
+    return NULL;
+  if (isRegexp) {
+    regexp_t *re = regexpNew(needle, len, NULL);
+    if (!re)
+      return NULL;
+    regexpFree(re);
+  }
+  int n = st.docs.numElems - NUM_BUILTIN_BUFFERS;
+  snapshot_t *snaps = dieIfNull(malloc(max(1, n) * sizeof(snapshot_t)));
+  dynamicArray_t *found =
+      dieIfNull(malloc(st.docs.numElems * sizeof(dynamicArray_t)));
+  for (int i = 0; i < st.docs.numElems; ++i) {
+    arrayInit(&found[i], sizeof(searchMatch_t));
+  }
+  for (int i = 0; i < n; ++i) {
+    docSnapshot(arrayElemAt(&st.docs, NUM_BUILTIN_BUFFERS + i), &snaps[i]);
+  }
+  searchSnapshots(snaps, n, needle, len, isRegexp, found + NUM_BUILTIN_BUFFERS);
+  for (int i = 0; i < n; ++i) {
+    snapshotFree(&snaps[i]);
+  }
+  free(snaps);
+  return found;
+}
+
+static void freeFound(dynamicArray_t *found) {
+  for (int i = 0; i < st.docs.numElems; ++i) {
+    arrayFree(&found[i]);
+  }
+  free(found);
+}
+
+// appends "path:row: " and the line to list, cut short and with no NULs to
+// end the list early
+static void appendHit(dynamicArray_t *list, char *path, snapshot_t *snap,
+                      int64_t row) {
+  char buf[PATH_MAX + 64];
+  snprintf(buf, sizeof(buf), "%s:%lld: ", path, (long long)row + 1);
+  arrayInsert(list, list->numElems, buf, strlen(buf));
+  int64_t sol = snapshotLineStart(snap, row);
+  int64_t n = min(snapshotLength(snap) - sol, MAX_HIT_CONTEXT);
+  arrayGrow(list, list->numElems + n + 1);
+  char *context = (char *)list->start + list->numElems;
+  snapshotCopy(snap, sol, n, context);
+  char *eol = memchr(context, '\n', n);
+  if (eol)
+    n = eol - context;
+  for (int64_t k = 0; k < n; ++k) {
+    if (context[k] == '\0')
+      context[k] = ' ';
+  }
+  list->numElems += n;
+  arrayPush(list, "\n");
+}
+
+// shows the list of hits, under header, in the search doc
+static void showHits(dynamicArray_t *list, char *header) {
+  arrayInsert(list, 0, header, strlen(header));
+  setFocusBuiltinsView(SEARCH_BUF);
+  insertNewElem();
+  builtinInsertString(list->start, (uint)list->numElems);
+  st.hitsMark = markNew(&focusDoc()->marks, strlen(header));
+}
+
+// the search elem, unless the cursor is on the list of hits
+static char *allBuffersSearch() {
+  view_t *view = builtinsViewOf(SEARCH_BUF);
+  return isHitList(view) ? NULL : viewElem(view);
+}
+
+void searchAllBuffers() {
+  char *search = allBuffersSearch();
+  if (!search)
+    return;
+  bool isRegexp;
+  char *needle;
+  char *replace;
+  char *temp = parseSearch(search, &isRegexp, &needle, &replace);
+  dynamicArray_t *found = searchAllDocs(needle, isRegexp);
+  free(temp);
+  if (!found)
+    return;
+
+  clearHits();
+  dynamicArray_t list;
+  arrayInit(&list, sizeof(char));
+  int numDocs = 0;
+  for (int i = NUM_BUILTIN_BUFFERS; i < st.docs.numElems; ++i) {
+    doc_t *doc = arrayElemAt(&st.docs, i);
+    numDocs += found[i].numElems > 0;
+    snapshot_t snap;
+    docSnapshot(doc, &snap);
+    int64_t lastRow = -1;
+    for (int64_t j = 0; j < found[i].numElems; ++j) {
+      searchMatch_t *m = arrayElemAt(&found[i], j);
+      int64_t row = docRowOf(doc, m->offset);
+      if (row == lastRow) // one line for all the matches on it
+        continue;
+      lastRow = row;
+      searchHit_t hit = {i, markNew(&doc->marks, m->offset), NULL, row};
+      arrayPush(&st.hits, &hit);
+      appendHit(&list, cstringOf(&doc->filepath), &snap, row);
+    }
+    snapshotFree(&snap);
+  }
+  freeFound(found);
+
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%lld lines in %d buffers\n",
+           (long long)st.hits.numElems, numDocs);
+  showHits(&list, buf);
+  arrayFree(&list);
+}
+
+// the real paths of the n user docs (NULL where there is none)
+static char **docRealPaths(int n) {
+  char **reals = dieIfNull(calloc(max(1, n), sizeof(char *)));
+  for (int i = 0; i < n; ++i) {
+    doc_t *doc = arrayElemAt(&st.docs, NUM_BUILTIN_BUFFERS + i);
+    reals[i] = realpath(cstringOf(&doc->filepath), NULL);
+  }
+  return reals;
+}
+
+// the user doc of the file at the real path, or -1
+static int docRefOfPath(char *real, char **reals, int n) {
+  int docRef = -1;
+  for (int i = 0; i < n; ++i) {
+    if (reals[i] && strcmp(reals[i], real) == 0)
+      docRef = NUM_BUILTIN_BUFFERS + i;
+  }
+  return docRef;
+}
+
+static bool fileSnapshot(char *path, snapshot_t *snap) {
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return false;
+  struct stat stat;
+  if (fstat(fileno(fp), &stat) != 0) {
+    fclose(fp);
+    return false;
+  }
+  int64_t len = stat.st_size;
+  char *buf = dieIfNull(malloc(len + 1));
+  len = fread(buf, sizeof(char), len, fp);
+  fclose(fp);
+  pieceTable_t t;
+  pieceTableInit(&t);
+  pieceTableLoad(&t, buf, len);
+  pieceTableSnapshot(&t, snap);
+  pieceTableFree(&t);
+  return true;
+}
+
+// Searching the files under the directory, loaded or not.  The index (see
+// Index.c) rules out the files that can't match, and the rest are searched
+// like the docs: as they are in the editor if loaded, otherwise from disk.
+// Loaded docs under the directory with unsaved changes are searched too.
+void grepFiles() {
+  char *search = allBuffersSearch();
+  if (!search)
+    return;
+  bool isRegexp;
+  char *needle;
+  char *replace;
+  char *temp = parseSearch(search, &isRegexp, &needle, &replace);
+  int64_t len = strlen(needle);
+  dynamicArray_t query;
+  arrayInit(&query, sizeof(char));
+  if (len == 0 || !searchQuery(needle, len, isRegexp, &query)) {
+    arrayFree(&query);
+    free(temp);
+    return;
+  }
+
+  char dir[PATH_MAX + 1];
+  dieIfNull(getcwd(dir, sizeof(dir)));
+  if (strcmp(st.index.root, dir) != 0) { // moved to another directory
+    indexFree(&st.index);
+    indexInit(&st.index, dir);
+    indexLoad(&st.index);
+  }
+  indexStart(&st.index); // catches up with the files for next time
+  dynamicArray_t paths;
+  arrayInit(&paths, sizeof(char *));
+  bool complete =
+      indexQuery(&st.index, query.start, query.numElems, &paths);
+  arrayFree(&query);
+
+  int numUser = st.docs.numElems - NUM_BUILTIN_BUFFERS;
+  char **reals = docRealPaths(numUser);
+  bool *taken = dieIfNull(calloc(max(1, numUser), sizeof(bool)));
+  int64_t n = paths.numElems + numUser;
+  snapshot_t *snaps = dieIfNull(malloc(max(1, n) * sizeof(snapshot_t)));
+  int *docRefs = dieIfNull(malloc(max(1, n) * sizeof(int)));
+  char **files = dieIfNull(calloc(max(1, n), sizeof(char *)));
+  int m = 0;
+  for (int64_t i = 0; i < paths.numElems; ++i) {
+    char *path = *(char **)arrayElemAt(&paths, i);
+    char *file = dieIfNull(malloc(strlen(dir) + strlen(path) + 2));
+    sprintf(file, "%s/%s", dir, path);
+    free(path);
+    // real already: the working directory is, and the index skips links
+    int docRef = docRefOfPath(file, reals, numUser);
+    if (docRef >= 0) {
+      taken[docRef - NUM_BUILTIN_BUFFERS] = true;
+      docSnapshot(arrayElemAt(&st.docs, docRef), &snaps[m]);
+      free(file);
+      file = NULL;
+    } else if (!fileSnapshot(file, &snaps[m])) {
+      free(file);
+      continue;
+    }
+    docRefs[m] = docRef;
+    files[m] = file;
+    m++;
+  }
+  for (int i = 0; i < numUser; ++i) {
+    doc_t *doc = arrayElemAt(&st.docs, NUM_BUILTIN_BUFFERS + i);
+    char *real = reals[i];
+    int64_t k = strlen(dir);
+    if (!taken[i] && doc->modified && real && strncmp(real, dir, k) == 0 &&
+        real[k] == '/') {
+      docSnapshot(doc, &snaps[m]);
+      docRefs[m] = NUM_BUILTIN_BUFFERS + i;
+      m++;
+    }
+    free(real);
+  }
+  free(reals);
+  free(taken);
+  arrayFree(&paths);
+
+  dynamicArray_t *found = dieIfNull(malloc(max(1, m) * sizeof(dynamicArray_t)));
+  for (int i = 0; i < m; ++i) {
+    arrayInit(&found[i], sizeof(searchMatch_t));
+  }
+  searchSnapshots(snaps, m, needle, len, isRegexp, found);
+  free(temp);
+
+  clearHits();
+  dynamicArray_t list;
+  arrayInit(&list, sizeof(char));
+  int numFiles = 0;
+  for (int i = 0; i < m; ++i) {
+    doc_t *doc = docRefs[i] >= 0 ? arrayElemAt(&st.docs, docRefs[i]) : NULL;
+    char *path = doc ? cstringOf(&doc->filepath) : files[i] + strlen(dir) + 1;
+    numFiles += found[i].numElems > 0;
+    int64_t lastRow = -1;
+    for (int64_t j = 0; j < found[i].numElems; ++j) {
+      searchMatch_t *match = arrayElemAt(&found[i], j);
+      int64_t row = snapshotRowOf(&snaps[i], match->offset);
+      if (row == lastRow)
+        continue;
+      lastRow = row;
+      searchHit_t hit = {docRefs[i], 0, NULL, row};
+      if (doc)
+        hit.mark = markNew(&doc->marks, match->offset);
+      else
+        hit.path = dieIfNull(strdup(files[i]));
+      arrayPush(&st.hits, &hit);
+      appendHit(&list, path, &snaps[i], row);
+    }
+    arrayFree(&found[i]);
+    snapshotFree(&snaps[i]);
+    free(files[i]);
+  }
+  free(found);
+  free(snaps);
+  free(docRefs);
+  free(files);
+
+  char buf[96];
+  snprintf(buf, sizeof(buf), "%lld lines in %d files (%d searched%s)\n",
+           (long long)st.hits.numElems, numFiles, m,
+           complete ? "" : ", still indexing");
+  showHits(&list, buf);
+  arrayFree(&list);
+}
+
+// goes to the hit on the line of the cursor
+void gotoHit() {
+  doc_t *doc = focusDoc();
+  int64_t i =
+      focusCursor()->row - docRowOf(doc, markOffset(&doc->marks, st.hitsMark));
+  if (i < 0 || i >= st.hits.numElems)
+    return;
+  searchHit_t *hit = arrayElemAt(&st.hits, i);
+  if (hit->docRef < 0) { // a file that wasn't loaded
+    int numUser = st.docs.numElems - NUM_BUILTIN_BUFFERS;
+    char **reals = docRealPaths(numUser);
+    hit->docRef = docRefOfPath(hit->path, reals, numUser);
+    for (int j = 0; j < numUser; ++j) {
+      free(reals[j]);
+    }
+    free(reals);
+    if (hit->docRef < 0) {
+      hit->docRef = st.docs.numElems;
+      docLoad(hit->path);
+      buffersBufInit();
+      setFocusBuiltinsView(SEARCH_BUF);
+    }
+    doc_t *doc = arrayElemAt(&st.docs, hit->docRef);
+    hit->mark = markNew(&doc->marks, docLineStart(doc, hit->row));
+    free(hit->path);
+    hit->path = NULL;
+  }
+  setFocusFrame(MAIN_FRAME);
+  setFocusView(hit->docRef - NUM_BUILTIN_BUFFERS);
+  stMoveCursorOffset(markOffset(&focusDoc()->marks, hit->mark));
+}
+
+// replaces every match in every user doc, as one undo step per doc
+void replaceAllBuffers() {
+  char *search = allBuffersSearch();
+  if (!search)
+    return;
+  bool isRegexp;
+  char *needle;
+  char *replace;
+  char *temp = parseSearch(search, &isRegexp, &needle, &replace);
+  dynamicArray_t *found = replace ? searchAllDocs(needle, isRegexp) : NULL;
+  if (!found) {
+    free(temp);
+    return;
+  }
+  regexp_t *re = isRegexp ? regexpNew(needle, strlen(needle), NULL) : NULL;
+  int64_t replLen = strlen(replace);
+  int64_t numReplaced = 0;
+  int numDocs = 0;
+  dynamicArray_t text;
+  arrayInit(&text, sizeof(char));
+  for (int i = NUM_BUILTIN_BUFFERS; i < st.docs.numElems; ++i) {
+    doc_t *doc = arrayElemAt(&st.docs, i);
+    int64_t n = found[i].numElems;
+    if (n == 0 || doc->isReadOnly)
+      continue;
+    command_t *cmds = dieIfNull(malloc(2 * n * sizeof(command_t)));
+    int64_t m = 0;
+    int64_t end = 0;
+    arrayReinit(&text);
+    for (int64_t j = 0; j < n; ++j) {
+      searchMatch_t *match = arrayElemAt(&found[i], j);
+      if (match->offset < end) // overlaps the one before
+        continue;
+      end = match->offset + match->len;
+      int64_t k = text.numElems;
+      if (re)
+        regexpExpand(re, doc, match->offset, end, replace, replLen, &text);
+      else
+        arrayInsert(&text, k, replace, replLen);
+      cmds[m].tag = DELETE;
+      cmds[m].offset = match->offset;
+      cmds[m].len = match->len;
+      m++;
+      numReplaced++;
+      if (text.numElems == k)
+        continue;
+      // start is where the text will be, once it stops moving
+      cmds[m].tag = INSERT;
+      cmds[m].offset = end;
+      cmds[m].start = (char *)k;
+      cmds[m].len = text.numElems - k;
+      m++;
+    }
+    for (int64_t j = 0; j < m; ++j) {
+      if (cmds[j].tag == INSERT)
+        cmds[j].start = (char *)text.start + (intptr_t)cmds[j].start;
+    }
+    docPushBatch(doc, cmds, m);
+    free(cmds);
+    numDocs++;
+  }
+  arrayFree(&text);
+  regexpFree(re);
+  freeFound(found);
+  free(temp);
+
+  char buf[64];
+  snprintf(buf, sizeof(buf), "replaced %lld matches in %d buffers",
+           (long long)numReplaced, numDocs);
+  message(buf);
 }
 
 void forwardSearch() {
@@ -1353,21 +2681,16 @@ void forwardSearch() {
   doc_t *doc = focusDoc();
   searchBuffer_t *results = &doc->searchResults;
 
-  recomputeSearch(); // BAL: do only when necessary
+  recomputeSearch(); // only searches again if the search changed
+  finishSearch(doc);
 
   if (results->numElems == 0) return;
 
   cursor_t *cursor = focusCursor();
 
-  for (int i = 0; i < results->numElems; ++i) {
-    int *offset = arrayElemAt(results, i);
-    if (*offset > cursor->offset) {
-      stMoveCursorOffset(*offset);
-      return;
-    }
-  }
-  int *offset = arrayElemAt(results, 0);
-  stMoveCursorOffset(*offset);
+  // the first after the cursor, wrapping around
+  int64_t i = searchResultIndex(doc, cursor->offset + 1);
+  stMoveCursorOffset(searchResultOffset(doc, i < results->numElems ? i : 0));
 }
 
 void backwardSearch() {
@@ -1381,30 +2704,41 @@ void backwardSearch() {
   doc_t *doc = focusDoc();
   searchBuffer_t *results = &doc->searchResults;
 
-  recomputeSearch(); // BAL: do only when necessary
+  recomputeSearch(); // only searches again if the search changed
+  finishSearch(doc);
 
   if (results->numElems == 0) return;
 
   cursor_t *cursor = focusCursor();
 
-  int last = results->numElems - 1;
-  for (int i = last; i >= 0; --i) {
-    int *offset = arrayElemAt(results, i);
-    if (*offset < cursor->offset) {
-      stMoveCursorOffset(*offset);
-      return;
-    }
-  }
-  int *offset = arrayElemAt(results, last);
-  stMoveCursorOffset(*offset);
+  // the last before the cursor, wrapping around
+  int64_t i = searchResultIndex(doc, cursor->offset) - 1;
+  stMoveCursorOffset(
+      searchResultOffset(doc, i >= 0 ? i : results->numElems - 1));
 }
 
 void replace() {
   if (!st.isReplace) return;
-  int offset = focusCursor()->offset;
+  int64_t offset = focusCursor()->offset;
   doc_t *doc = focusDoc();
-  docPushDelete(doc, offset, st.searchLen);
-  docPushInsert(doc, offset, st.replace.start, st.replace.numElems);
+  if (!st.regexp) {
+    docPushDelete(doc, offset, st.searchLen);
+    docPushInsert(doc, offset, st.replace.start, st.replace.numElems);
+  } else {
+    // the match under the cursor, with its groups filled in
+    finishSearch(doc);
+    searchBuffer_t *results = &doc->searchResults;
+    int64_t i = searchResultIndex(doc, offset);
+    if (i == results->numElems || searchResultOffset(doc, i) != offset) return;
+    int64_t len = ((searchResult_t *)arrayElemAt(results, i))->len;
+    dynamicArray_t text;
+    arrayInit(&text, sizeof(char));
+    regexpExpand(st.regexp, doc, offset, offset + len, st.replace.start,
+                 st.replace.numElems, &text);
+    docPushDelete(doc, offset, len);
+    docPushInsert(doc, offset, text.start, text.numElems);
+    arrayFree(&text);
+  }
   forwardSearch(); // skip over where we are at
   forwardSearch();
 }
@@ -1438,20 +2772,19 @@ void backwardView() {
 
 #define INDENT_LENGTH 2
 
-int numLinesSelected(char *s, int len) {
+int64_t numLinesSelected(doc_t *doc, int64_t offset, int64_t len) {
   if (len <= 0)
     return 0;
-  int n = numLinesString(s, len);
-  if (*(s + len - 1) != '\n')
+  int64_t n = docCountLines(doc, offset, len);
+  if (docCharAt(doc, offset + len - 1) != '\n')
     n++;
   return n;
 }
 
 int indentLine() {
-  string_t *s = &focusDoc()->contents;
   backwardSOL();
-  int offset = focusCursor()->offset;
-  int x = distanceToIndent(s->start + offset, arrayTop(s));
+  int64_t offset = focusCursor()->offset;
+  int64_t x = distanceToIndent(focusDoc(), offset);
   int n = INDENT_LENGTH - x % INDENT_LENGTH;
   char buf[INDENT_LENGTH];
   myMemset(buf, ' ', n);
@@ -1461,31 +2794,30 @@ int indentLine() {
 
 int outdentLine() {
   doc_t *doc = focusDoc();
-  string_t *s = &doc->contents;
   backwardSOL();
-  int offset = focusCursor()->offset;
-  int x = distanceToIndent(s->start + offset, arrayTop(s));
+  int64_t offset = focusCursor()->offset;
+  int64_t x = distanceToIndent(doc, offset);
   int n = x == 0 ? 0 : (x - (((x - 1) / INDENT_LENGTH) * INDENT_LENGTH));
-  return docPushDelete(doc, offset, n);
+  return (int)docPushDelete(doc, offset, n);
 }
 
 void indent() {
-  int col;
-  int row;
-  int off;
-  int len;
+  int64_t col;
+  int64_t row;
+  int64_t off;
+  int64_t len;
 
   getSelectionCoords(focusView(), &col, &row, &off, &len);
 
-  int n = numLinesSelected(focusDoc()->contents.start + off, len);
+  int64_t n = numLinesSelected(focusDoc(), off, len);
 
-  int coff = focusCursor()->offset;
-  int soff = focusSelection()->offset;
-  int m = indentLine();
-  int m0 = m;
+  int64_t coff = focusCursor()->offset;
+  int64_t soff = focusSelection()->offset;
+  int64_t m = indentLine();
+  int64_t m0 = m;
 
   if (soff >= coff) { // left to right highlight order
-    for (int i = 1; i < n; ++i) {
+    for (int64_t i = 1; i < n; ++i) {
       forwardLine();
       m += indentLine();
     }
@@ -1495,7 +2827,7 @@ void indent() {
   }
 
   // coff > soff // right to left highlight order
-  for (int i = 1; i < n; ++i) {
+  for (int64_t i = 1; i < n; ++i) {
     backwardLine();
     m0 = indentLine();
     m += m0;
@@ -1505,22 +2837,22 @@ void indent() {
   cursorSetOffset(focusSelection(), soff + m0, focusDoc());
 }
 void outdent() {
-  int col;
-  int row;
-  int off;
-  int len;
+  int64_t col;
+  int64_t row;
+  int64_t off;
+  int64_t len;
 
   getSelectionCoords(focusView(), &col, &row, &off, &len);
 
-  int n = numLinesSelected(focusDoc()->contents.start + off, len);
+  int64_t n = numLinesSelected(focusDoc(), off, len);
 
-  int coff = focusCursor()->offset;
-  int soff = focusSelection()->offset;
-  int m = outdentLine();
-  int m0 = m;
+  int64_t coff = focusCursor()->offset;
+  int64_t soff = focusSelection()->offset;
+  int64_t m = outdentLine();
+  int64_t m0 = m;
 
   if (soff >= coff) { // left to right highlight order
-    for (int i = 1; i < n; ++i) {
+    for (int64_t i = 1; i < n; ++i) {
       forwardLine();
       m += outdentLine();
     }
@@ -1530,7 +2862,7 @@ void outdent() {
   }
 
   // coff > soff // right to left highlight order
-  for (int i = 1; i < n; ++i) {
+  for (int64_t i = 1; i < n; ++i) {
     backwardLine();
     m0 = outdentLine();
     m += m0;
@@ -1585,10 +2917,10 @@ uchar lookupCloseChar(uchar c) {
 void insertOpenCloseChars(uchar c) {
   uchar c1 = lookupCloseChar(c);
 
-  int col;
-  int row;
-  int off;
-  int len;
+  int64_t col;
+  int64_t row;
+  int64_t off;
+  int64_t len;
   view_t *view = focusView();
 
   if (selectionActive(view)) {
@@ -1639,6 +2971,7 @@ void doEscapeNavigate() {
   }
   resetSearch();
   cancelSelection();
+  clearCursors(focusView());
 }
 
 int main(int argc, char **argv) {
@@ -1649,8 +2982,7 @@ int main(int argc, char **argv) {
 
   stInit(argc, argv);
   stDraw();
-  // BAL: needed?
-  //    SDL_AddTimer(1000, timerInit, NULL);
+  SDL_AddTimer(JOURNAL_COMMIT_MS, journalTimer, NULL);
   while (SDL_WaitEvent(&st.event)) {
     switch (st.event.type) {
     case SDL_KEYDOWN:
@@ -1675,7 +3007,7 @@ int main(int argc, char **argv) {
       mouseMotionEvent();
       break;
     case SDL_USEREVENT:
-      //                timerEvent();
+      userEvent();
       break;
     default:
       break;
@@ -1721,15 +3053,12 @@ CORE:
 VIS:
     make font smaller in non-focused frames
     italics, underline and bold in syntax highlighting
-    reserved words syntax highlighting
-    context sensitive syntax highlighting (parser)
     Make the active frame the biggest (both in width and font size)
     Make builtin frame very thin when not in use
     Make frame widths resizeable
     slightly change color of status bar
     Display line number of every line(hmmm, takes up horiz space)
     Minimap
-    highlight matching paren
     resize nested parens
     display multiple characters as one (e.g. ->)
     buffer list screen